@@ -23,6 +23,7 @@ CFrmSocket::CFrmSocket(CParameter *pPara, QWidget *parent) :
     
     ui->cbEnableV4->setChecked(m_pPara->GetV4());
     ui->cbEnableV5->setChecked(m_pPara->GetV5());
+    ui->cbEnableHttp->setChecked(m_pPara->GetHttp());
     
     QVector<unsigned char> method = m_pPara->GetV5Method();
     ui->cbNoAuthentication->setChecked(method.contains(CParameterSocks::AUTHENTICATOR_NO));
@@ -83,6 +84,7 @@ void CFrmSocket::slotAccept()
 #endif
     m_pPara->SetV4(ui->cbEnableV4->isChecked());
     m_pPara->SetV5(ui->cbEnableV5->isChecked());
+    m_pPara->SetHttp(ui->cbEnableHttp->isChecked());
 
     QVector<unsigned char> method;
     if(ui->cbNoAuthentication->isChecked())
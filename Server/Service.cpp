@@ -1,5 +1,8 @@
 #include "Service.h"
 #include "ServerSocks.h"
+#include "RabbitCommonDir.h"
+#include <QSettings>
+#include <QStringList>
 #include <QLoggingCategory>
 Q_LOGGING_CATEGORY(logService, "Service")
 
@@ -14,15 +17,64 @@ CService::CService(int argc, char **argv)
 void CService::start()
 {
     qInfo(logService) << "Start server";
+    QSettings set(RabbitCommon::CDir::Instance()->GetFileUserConfigure(),
+                  QSettings::IniFormat);
     foreach(auto s, m_Server)
     {
+        s->Load(set);
+    }
+    
+    foreach(auto s, m_Server)
+    {
+        int nProcesses = s->Getparameter()->GetProcesses();
+        if(nProcesses > 1)
+        {
+            auto supervisor = QSharedPointer<CSupervisor>(
+                        new CSupervisor(s), &QObject::deleteLater);
+            if(0 == supervisor->Start(nProcesses))
+            {
+                m_Supervisor.push_back(supervisor);
+                continue;
+            }
+            qWarning(logService) << "Start worker processes fail."
+                                 << "Serve in the service process";
+        }
         s->Start();
     }
 }
 
+void CService::processCommand(int code)
+{
+    switch(code) {
+    case CONNECTORS:
+        foreach(auto s, m_Supervisor)
+        {
+            QStringList workers;
+            foreach(auto n, s->GetWorkerConnectors())
+                workers << QString::number(n);
+            qInfo(logService) << "Connectors:" << s->GetConnectors()
+                              << "workers:" << workers.join(", ");
+        }
+        foreach(auto s, m_Server)
+        {
+            if(CServer::STATUS::Start == s->GetStatus())
+                qInfo(logService) << "Connectors:" << s->GetConnectors();
+        }
+        break;
+    default:
+        qWarning(logService) << "Unknown command:" << code;
+        break;
+    }
+}
+
 void CService::stop()
 {
     qInfo(logService) << "Stop server";
+    foreach(auto s, m_Supervisor)
+    {
+        s->Stop();
+    }
+    m_Supervisor.clear();
     foreach(auto s, m_Server)
     {
         s->Stop();
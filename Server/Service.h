@@ -3,18 +3,27 @@
 
 #include "QtService/qtservice.h"
 #include "Server.h"
+#include "Supervisor.h"
 
 class CService : public QtService<QCoreApplication>
 {
 public:
     explicit CService(int argc, char **argv);
 
+    //! The commands of the service, eg: RabbitProxyServer -c 0
+    enum COMMAND {
+        //! Log the connection counts of the servers and the worker processes
+        CONNECTORS = 0
+    };
+
 protected:
     virtual void start() override;
     virtual void stop() override;
+    virtual void processCommand(int code) override;
     
 private:
     std::list<QSharedPointer<CServer> > m_Server;
+    std::list<QSharedPointer<CSupervisor> > m_Supervisor;
 };
 
 #endif // CSERVICE_H
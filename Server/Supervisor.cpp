@@ -0,0 +1,386 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "Supervisor.h"
+#include <new>
+
+#if defined(Q_OS_UNIX)
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <sys/mman.h>
+    #include <sys/resource.h>
+    #include <signal.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <cerrno>
+    #include <cstring>
+    #include <cstdlib>
+    #if defined(Q_OS_LINUX)
+        #include <sys/prctl.h>
+    #endif
+#endif
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QStringList>
+#include <QLoggingCategory>
+Q_LOGGING_CATEGORY(logSupervisor, "Supervisor")
+
+// The first argument of the worker process, it is followed by the id,
+// the number of the processes, the listening socket and the shared file
+#define WORKER_ARGUMENT "--supervisor-worker"
+// The most descriptors which are closed in the worker process before exec
+#define MAX_INHERITED_FD 65536
+// The interval (ms) of logging the connection counts when they change
+#define REPORT_INTERVAL 10000
+
+// The worker process which exits in it (ms) after it is forked is failure
+#define MIN_UPTIME 10000
+// The delay (ms) of restarting the failure worker process is doubled from it
+#define RESTART_DELAY 1000
+#define MAX_RESTART_DELAY 60000
+
+CSupervisor::CSupervisor(QSharedPointer<CServer> server, QObject *parent)
+    : QObject(parent),
+    m_Server(server),
+    m_ListenSocket(-1),
+    m_nShared(-1),
+    m_pConnectors(nullptr),
+    m_nProcesses(0),
+    m_nId(-1),
+    m_bStop(true),
+    m_nReported(0),
+    m_nReportTime(0)
+{
+    bool check = connect(&m_Timer, SIGNAL(timeout()), this, SLOT(slotCheck()));
+    Q_ASSERT(check);
+}
+
+CSupervisor::~CSupervisor()
+{
+    qDebug(logSupervisor) << "CSupervisor::~CSupervisor()";
+    Stop();
+}
+
+bool CSupervisor::IsWorker()
+{
+    return m_nId >= 0;
+}
+
+int CSupervisor::Start(int nProcesses)
+{
+#if defined(Q_OS_UNIX)
+    if(!m_Server || nProcesses <= 0) return -1;
+
+    m_nProcesses = nProcesses;
+    m_ListenSocket = CServer::CreateListenSocket(
+                m_Server->Getparameter()->GetPort(), false,
+                m_Server->Getparameter()->GetListenBacklog());
+    if(-1 == m_ListenSocket)
+        return -1;
+
+    // The anonymous mapping isn't kept by exec, so the counts are in an
+    // unlinked file which is inherited by the worker processes
+    QByteArray szFile = QDir::toNativeSeparators(
+                QDir::tempPath() + "/RabbitProxyServer.XXXXXX").toLocal8Bit();
+    int fd = ::mkstemp(szFile.data());
+    if(-1 != fd)
+        ::unlink(szFile.constData());
+    if(-1 == fd
+        || ::ftruncate(fd, sizeof(std::atomic<int>) * m_nProcesses)
+        || MapConnectors(fd))
+    {
+        qCritical(logSupervisor, "Create the shared counts fail: %s",
+                  strerror(errno));
+        if(-1 != fd)
+            ::close(fd);
+        ::close(m_ListenSocket);
+        m_ListenSocket = -1;
+        return -1;
+    }
+    m_nShared = fd;
+    for(int i = 0; i < m_nProcesses; i++)
+        new(m_pConnectors + i) std::atomic<int>(0);
+    // They are only inherited by the worker processes. \see Fork()
+    ::fcntl(m_ListenSocket, F_SETFD, FD_CLOEXEC);
+    ::fcntl(m_nShared, F_SETFD, FD_CLOEXEC);
+
+    m_bStop = false;
+    m_Pid.fill(-1, m_nProcesses);
+    m_Restart.fill(strRestart(), m_nProcesses);
+    m_Clock.start();
+    for(int i = 0; i < m_nProcesses; i++)
+        Fork(i);
+
+    qInfo(logSupervisor, "Supervisor listen at port %d with %d worker processes",
+          m_Server->Getparameter()->GetPort(), m_nProcesses);
+    m_Timer.start(1000);
+    return 0;
+#else
+    Q_UNUSED(nProcesses)
+    qCritical(logSupervisor) << "The worker processes isn't supported on the platform";
+    return -1;
+#endif
+}
+
+int CSupervisor::Stop()
+{
+#if defined(Q_OS_UNIX)
+    if(m_bStop) return 0;
+    m_bStop = true;
+    m_Timer.stop();
+
+    if(IsWorker())
+        m_Server->Stop();
+    else
+    {
+        foreach(auto pid, m_Pid)
+        {
+            if(pid > 0)
+                ::kill(pid, SIGTERM);
+        }
+        foreach(auto pid, m_Pid)
+        {
+            if(pid > 0)
+                ::waitpid(pid, nullptr, 0);
+        }
+        m_Pid.clear();
+
+        // The server of the worker process owns the listening socket
+        if(-1 != m_ListenSocket)
+            ::close(m_ListenSocket);
+    }
+    m_ListenSocket = -1;
+    if(-1 != m_nShared)
+    {
+        ::close(m_nShared);
+        m_nShared = -1;
+    }
+    if(m_pConnectors)
+    {
+        munmap(m_pConnectors, sizeof(std::atomic<int>) * m_nProcesses);
+        m_pConnectors = nullptr;
+    }
+#endif
+    return 0;
+}
+
+int CSupervisor::MapConnectors(int fd)
+{
+#if defined(Q_OS_UNIX)
+    void* p = mmap(nullptr, sizeof(std::atomic<int>) * m_nProcesses,
+                   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(MAP_FAILED == p)
+    {
+        qCritical(logSupervisor, "mmap fail: %s", strerror(errno));
+        return -1;
+    }
+    m_pConnectors = static_cast<std::atomic<int>*>(p);
+    return 0;
+#else
+    Q_UNUSED(fd)
+    return -1;
+#endif
+}
+
+int CSupervisor::GetConnectors()
+{
+    int nConnectors = 0;
+    foreach(auto n, GetWorkerConnectors())
+        nConnectors += n;
+    return nConnectors;
+}
+
+QVector<int> CSupervisor::GetWorkerConnectors()
+{
+    QVector<int> connectors;
+    if(!m_pConnectors) return connectors;
+    for(int i = 0; i < m_nProcesses; i++)
+        connectors.push_back(m_pConnectors[i].load(std::memory_order_relaxed));
+    return connectors;
+}
+
+int CSupervisor::Fork(int nId)
+{
+#if defined(Q_OS_UNIX)
+    // The child only calls the async-signal-safe functions before exec,
+    // so the arguments are prepared here
+    QByteArray szProgram = QCoreApplication::applicationFilePath().toLocal8Bit();
+    QList<QByteArray> args;
+    args << szProgram << WORKER_ARGUMENT << QByteArray::number(nId)
+         << QByteArray::number(m_nProcesses)
+         << QByteArray::number((qint64)m_ListenSocket)
+         << QByteArray::number(m_nShared);
+    QVector<char*> argv;
+    for(int i = 0; i < args.size(); i++)
+        argv.push_back(args[i].data());
+    argv.push_back(nullptr);
+    long nMaxFd = ::sysconf(_SC_OPEN_MAX);
+    if(nMaxFd <= 0 || nMaxFd > MAX_INHERITED_FD)
+        nMaxFd = MAX_INHERITED_FD;
+    int nListen = (int)m_ListenSocket;
+    int nShared = m_nShared;
+
+    pid_t pid = fork();
+    if(-1 == pid)
+    {
+        qCritical(logSupervisor, "Fork worker process %d fail: %s",
+                  nId, strerror(errno));
+        return -1;
+    }
+    if(0 == pid)
+    {
+#if defined(Q_OS_LINUX)
+        // Exit when the supervisor is gone. It is kept by exec.
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+        // The descriptors of the service (eg: the control socket of
+        // QtService, the wakeup of the event dispatcher) aren't inherited.
+        for(int fd = 3; fd < nMaxFd; fd++)
+        {
+            if(fd != nListen && fd != nShared)
+                ::close(fd);
+        }
+        ::fcntl(nListen, F_SETFD, 0);
+        ::fcntl(nShared, F_SETFD, 0);
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, nullptr);
+        ::execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    m_Pid[nId] = pid;
+    m_Restart[nId].nStart = m_Clock.elapsed();
+    qInfo(logSupervisor, "Start worker process %d: %d", nId, pid);
+#else
+    Q_UNUSED(nId)
+#endif
+    return 0;
+}
+
+bool CSupervisor::IsWorkerProcess(int argc, char *argv[])
+{
+    return argc >= 6 && 0 == strcmp(argv[1], WORKER_ARGUMENT);
+}
+
+int CSupervisor::StartWorker(int argc, char *argv[])
+{
+#if defined(Q_OS_UNIX)
+    if(!m_Server || !IsWorkerProcess(argc, argv))
+        return -1;
+    int nId = atoi(argv[2]);
+    m_nProcesses = atoi(argv[3]);
+    m_ListenSocket = atoi(argv[4]);
+    m_nShared = atoi(argv[5]);
+    if(nId < 0 || nId >= m_nProcesses || m_ListenSocket < 0 || m_nShared < 0)
+    {
+        qCritical(logSupervisor) << "The arguments of the worker process are error";
+        return -1;
+    }
+    if(MapConnectors(m_nShared))
+        return -1;
+    // The children of the worker process don't inherit them
+    ::fcntl(m_ListenSocket, F_SETFD, FD_CLOEXEC);
+    ::fcntl(m_nShared, F_SETFD, FD_CLOEXEC);
+
+    m_nId = nId;
+    m_bStop = false;
+    m_Timer.disconnect();
+    bool check = connect(&m_Timer, SIGNAL(timeout()), this, SLOT(slotReport()));
+    Q_ASSERT(check);
+    m_Timer.start(1000);
+
+    m_Server->SetListenSocket(m_ListenSocket);
+    int nRet = m_Server->Start();
+    if(nRet)
+    {
+        qCritical(logSupervisor, "Worker process %d start server fail", nId);
+        return nRet;
+    }
+    qInfo(logSupervisor, "Worker process %d is running", nId);
+    return 0;
+#else
+    Q_UNUSED(argc)
+    Q_UNUSED(argv)
+    return -1;
+#endif
+}
+
+void CSupervisor::slotReport()
+{
+    if(!IsWorker() || !m_pConnectors) return;
+    m_pConnectors[m_nId].store(m_Server->GetConnectors(),
+                               std::memory_order_relaxed);
+}
+
+void CSupervisor::slotCheck()
+{
+#if defined(Q_OS_UNIX)
+    // Only wait for the worker processes, the other children of the
+    // process aren't reaped here
+    for(int nId = 0; nId < m_Pid.size(); nId++)
+    {
+        pid_t pid = m_Pid[nId];
+        if(pid <= 0) continue;
+        int status = 0;
+        if(::waitpid(pid, &status, WNOHANG) != pid)
+            continue;
+        if(WIFSIGNALED(status))
+            qCritical(logSupervisor, "Worker process %d: %d is killed by signal %d",
+                      nId, pid, WTERMSIG(status));
+        else
+            qCritical(logSupervisor, "Worker process %d: %d exit: %d",
+                      nId, pid, WEXITSTATUS(status));
+        m_Pid[nId] = -1;
+        m_pConnectors[nId].store(0, std::memory_order_relaxed);
+        OnExit(nId);
+    }
+
+    if(m_bStop) return;
+    qint64 nNow = m_Clock.elapsed();
+    for(int nId = 0; nId < m_Pid.size(); nId++)
+    {
+        if(m_Pid[nId] > 0 || nNow < m_Restart[nId].nNext)
+            continue;
+        Fork(nId);
+    }
+    Report();
+#endif
+}
+
+void CSupervisor::Report()
+{
+    int nConnectors = GetConnectors();
+    qint64 nNow = m_Clock.elapsed();
+    if(nConnectors == m_nReported || nNow - m_nReportTime < REPORT_INTERVAL)
+        return;
+    m_nReported = nConnectors;
+    m_nReportTime = nNow;
+    QStringList workers;
+    foreach(auto n, GetWorkerConnectors())
+        workers << QString::number(n);
+    qInfo(logSupervisor) << "Connectors:" << nConnectors
+                         << "workers:" << workers.join(", ");
+}
+
+void CSupervisor::OnExit(int nId)
+{
+    strRestart& r = m_Restart[nId];
+    qint64 nNow = m_Clock.elapsed();
+    if(nNow - r.nStart >= MIN_UPTIME)
+    {
+        r.nFailures = 0;
+        r.nNext = nNow;
+        return;
+    }
+    r.nFailures++;
+    qint64 nDelay = MAX_RESTART_DELAY;
+    if(r.nFailures <= 16)
+        nDelay = qMin<qint64>(MAX_RESTART_DELAY,
+                              qint64(RESTART_DELAY) << (r.nFailures - 1));
+    r.nNext = nNow + nDelay;
+    qWarning(logSupervisor,
+             "Worker process %d exits %d times in a row soon after it starts."
+             " Restart it after %lld ms",
+             nId, r.nFailures, nDelay);
+}
@@ -0,0 +1,112 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CSUPERVISOR_H
+#define CSUPERVISOR_H
+
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QSharedPointer>
+#include <QElapsedTimer>
+#include <atomic>
+#include "Server.h"
+
+/*!
+ * \brief The supervisor of the pre-forked worker processes.
+ *        It creates one listening socket, then starts the worker processes.
+ *        Every worker process accepts from the shared listening socket.
+ *        The supervisor restarts the crashed worker processes,
+ *        and combines their connection counts.
+ *        A worker process which exits soon after it starts is restarted
+ *        after a delay, and the delay is doubled every time it exits again,
+ *        so a worker which can't start doesn't fork again and again.
+ *
+ *        The worker process is forked and executes the program again, so it
+ *        doesn't share the event loop and the control socket of the service.
+ *        Only the listening socket and the shared counts are inherited.
+ *        The program runs the worker before the service is created:
+ *        \code
+ *        if(CSupervisor::IsWorkerProcess(argc, argv))
+ *        {
+ *            QCoreApplication app(argc, argv);
+ *            CSupervisor worker(server);
+ *            if(worker.StartWorker(argc, argv))
+ *                return -1;
+ *            return app.exec();
+ *        }
+ *        \endcode
+ * \note Only is supported on unix
+ * \see CParameter::GetProcesses()
+ */
+class CSupervisor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CSupervisor(QSharedPointer<CServer> server,
+                         QObject *parent = nullptr);
+    virtual ~CSupervisor();
+
+    /*!
+     * \brief Start the worker processes.
+     * \return 0: success
+     */
+    int Start(int nProcesses);
+    int Stop();
+
+    //! Whether the arguments are of the worker process. \see Fork()
+    static bool IsWorkerProcess(int argc, char* argv[]);
+    /*!
+     * \brief Serve the server in the worker process
+     * \param argc, argv: the arguments of the worker process
+     * \return 0: success
+     */
+    int StartWorker(int argc, char* argv[]);
+
+    //! Whether this is in the worker process
+    bool IsWorker();
+    //! The sum of the connectors of all worker processes.
+    //! It is updated by the worker processes every second.
+    int GetConnectors();
+    QVector<int> GetWorkerConnectors();
+
+private Q_SLOTS:
+    void slotCheck();
+    void slotReport();
+
+private:
+    //! Fork and execute the worker process
+    int Fork(int nId);
+    //! The worker process exits. Schedule restarting it.
+    void OnExit(int nId);
+    //! Log the connection counts when they change
+    void Report();
+    //! Map the counts which are shared by the processes
+    int MapConnectors(int fd);
+
+private:
+    QSharedPointer<CServer> m_Server;
+    qintptr m_ListenSocket;
+    QVector<qint64> m_Pid;
+    struct strRestart {
+        qint64 nStart = 0; // The time which the process is forked
+        qint64 nNext = 0; // The time which the process is restarted
+        int nFailures = 0; // The times which it exits soon after it starts
+    };
+    QVector<strRestart> m_Restart;
+    QElapsedTimer m_Clock;
+    // The file of the counts, it is inherited by the worker processes
+    int m_nShared;
+    // Shared between the processes. It is written by the worker processes.
+    std::atomic<int>* m_pConnectors;
+    int m_nProcesses;
+    int m_nId; // -1: supervisor; >= 0: worker process
+    bool m_bStop;
+    QTimer m_Timer;
+    int m_nReported; // The connectors which are logged last
+    qint64 m_nReportTime;
+};
+
+#endif // CSUPERVISOR_H
@@ -14,6 +14,7 @@
 #include "RabbitCommonDir.h"
 
 #include "Service.h"
+#include "ServerSocks.h"
 
 int main(int argc, char *argv[])
 {
@@ -25,6 +26,24 @@ int main(int argc, char *argv[])
 //    QApplication::setDesktopFileName(QLatin1String("RabbitProxyServer.desktop"));
 //#endif
 
+#if defined(Q_OS_UNIX)
+    // The worker process of the supervisor isn't a service,
+    // it only serves the listening socket. \see CSupervisor
+    if(CSupervisor::IsWorkerProcess(argc, argv))
+    {
+        QCoreApplication app(argc, argv);
+        auto server = QSharedPointer<CServer>(new CServerSocks(),
+                                              &QObject::deleteLater);
+        QSettings set(RabbitCommon::CDir::Instance()->GetFileUserConfigure(),
+                      QSettings::IniFormat);
+        server->Load(set);
+        CSupervisor worker(server);
+        if(worker.StartWorker(argc, argv))
+            return -1;
+        return app.exec();
+    }
+#endif
+
 #if !defined(Q_OS_WIN)
     // QtService stores service settings in SystemScope, which normally require root privileges.
     // To allow testing this example as non-root, we change the directory of the SystemScope settings file.
@@ -0,0 +1,155 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "BufferPool.h"
+
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <cstdlib>
+#if defined(Q_OS_LINUX)
+    #include <sys/mman.h>
+#endif
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(logBufferPool, "BufferPool")
+
+// The size of a chunk. It is the size of a huge page on x86_64 and arm64
+#define CHUNK_SIZE (2 << 20)
+// The maximum of the slabs in the free list of a thread
+#define CACHE_SLABS 256
+// The number of the slabs moved between a free list and the depot at once
+#define BATCH_SLABS 64
+
+namespace {
+
+std::mutex g_Mutex;
+std::vector<char*> g_Depot;
+std::atomic<bool> g_bHugePages(false);
+std::atomic<quint64> g_nHit(0);
+std::atomic<quint64> g_nMiss(0);
+std::atomic<quint64> g_nBytes(0);
+
+//! Move n slabs from the back of src to dst
+void Move(std::vector<char*>& src, std::vector<char*>& dst, size_t n)
+{
+    n = std::min(n, src.size());
+    dst.insert(dst.end(), src.end() - n, src.end());
+    src.resize(src.size() - n);
+}
+
+struct strCache {
+    std::vector<char*> slabs;
+
+    strCache()
+    {
+        slabs.reserve(CACHE_SLABS);
+    }
+    // The slabs of the exited thread are given back to the depot
+    ~strCache()
+    {
+        std::lock_guard<std::mutex> lock(g_Mutex);
+        Move(slabs, g_Depot, slabs.size());
+    }
+};
+
+thread_local strCache g_Cache;
+
+char* AllocChunk()
+{
+    char* p = nullptr;
+#if defined(Q_OS_LINUX)
+    if(g_bHugePages)
+    {
+        void* m = ::mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(MAP_FAILED == m)
+        {
+            // The huge pages aren't reserved, use the transparent huge pages
+            m = ::mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(MAP_FAILED != m)
+                ::madvise(m, CHUNK_SIZE, MADV_HUGEPAGE);
+        }
+        if(MAP_FAILED != m)
+            p = static_cast<char*>(m);
+    }
+#endif
+    if(!p)
+        p = static_cast<char*>(::malloc(CHUNK_SIZE));
+    if(!p)
+    {
+        qCritical(logBufferPool) << "Allocate the chunk fail";
+        return nullptr;
+    }
+    g_nBytes += CHUNK_SIZE;
+    return p;
+}
+
+} // namespace
+
+char* CBufferPool::Alloc()
+{
+    std::vector<char*>& cache = g_Cache.slabs;
+    if(cache.empty())
+    {
+        std::lock_guard<std::mutex> lock(g_Mutex);
+        Move(g_Depot, cache, BATCH_SLABS);
+    }
+    if(!cache.empty())
+    {
+        g_nHit++;
+        char* p = cache.back();
+        cache.pop_back();
+        return p;
+    }
+
+    g_nMiss++;
+    char* pChunk = AllocChunk();
+    if(!pChunk)
+        return nullptr;
+    int nSlabs = CHUNK_SIZE / SLAB_SIZE;
+    // The slabs which don't fit in the free list are put into the depot
+    std::vector<char*> slabs;
+    slabs.reserve(nSlabs);
+    for(int i = 1; i < nSlabs; i++)
+        slabs.push_back(pChunk + i * SLAB_SIZE);
+    Move(slabs, cache, CACHE_SLABS - cache.size());
+    if(!slabs.empty())
+    {
+        std::lock_guard<std::mutex> lock(g_Mutex);
+        Move(slabs, g_Depot, slabs.size());
+    }
+    return pChunk;
+}
+
+void CBufferPool::Free(char *pSlab)
+{
+    if(!pSlab) return;
+    std::vector<char*>& cache = g_Cache.slabs;
+    cache.push_back(pSlab);
+    if(cache.size() > CACHE_SLABS)
+    {
+        std::lock_guard<std::mutex> lock(g_Mutex);
+        Move(cache, g_Depot, BATCH_SLABS);
+    }
+}
+
+void CBufferPool::SetHugePages(bool bHugePages)
+{
+#if !defined(Q_OS_LINUX)
+    if(bHugePages)
+        qWarning(logBufferPool) << "The huge pages are only supported on linux";
+#endif
+    g_bHugePages = bHugePages;
+}
+
+CBufferPool::strStatistics CBufferPool::GetStatistics()
+{
+    strStatistics st;
+    st.nHit = g_nHit;
+    st.nMiss = g_nMiss;
+    st.nBytes = g_nBytes;
+    return st;
+}
@@ -0,0 +1,83 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CBUFFERPOOL_H
+#define CBUFFERPOOL_H
+
+#pragma once
+
+#include <QtGlobal>
+#include "rabbitproxy_export.h"
+
+/*!
+ * \brief The pool of the fixed-size buffers (slabs) of the forwarding.
+ *        Every thread has itself free list, so it is nearly lock free.
+ *        When the free list of a thread is empty or full, a batch of slabs
+ *        is moved from or to a shared depot. The slabs are carved from
+ *        big chunks, which may be backed by huge pages.
+ *        The chunks aren't returned to the system, so the pool keeps the
+ *        peak of the slabs in use.
+ *
+ *        Example:
+ *        \code
+ *        CBufferPool::CSlab slab;
+ *        qint64 n = pSocket->read(slab.Data(), slab.Size());
+ *        \endcode
+ */
+class RABBITPROXY_EXPORT CBufferPool
+{
+public:
+    //! The size of a slab
+    static const int SLAB_SIZE = 16384;
+
+    /*!
+     * \brief Get a slab
+     * \return nullptr if the memory isn't enough
+     */
+    static char* Alloc();
+    //! Give back a slab, which is got by Alloc(). It may be nullptr.
+    static void Free(char* pSlab);
+
+    /*!
+     * \brief Whether the chunks are allocated in huge pages.
+     *        It is only supported on linux. If the huge pages aren't
+     *        reserved (vm.nr_hugepages), the transparent huge pages are used.
+     *        It only affects the chunks allocated after it is set.
+     */
+    static void SetHugePages(bool bHugePages);
+
+    struct strStatistics {
+        //! The slabs which are got from the free lists
+        quint64 nHit = 0;
+        //! The slabs which are got by allocating a new chunk
+        quint64 nMiss = 0;
+        //! The bytes of the chunks allocated by the pool
+        quint64 nBytes = 0;
+    };
+    static strStatistics GetStatistics();
+
+    //! The slab is got in the constructor, and given back in the destructor
+    class CSlab
+    {
+    public:
+        CSlab() : m_pData(CBufferPool::Alloc()) {}
+        ~CSlab() { CBufferPool::Free(m_pData); }
+        char* Data() { return m_pData; }
+        static int Size() { return SLAB_SIZE; }
+        /*!
+         * \brief Give the slab to the caller, and get a new one.
+         *        The caller gives it back with CBufferPool::Free().
+         */
+        char* Take()
+        {
+            char* p = m_pData;
+            m_pData = CBufferPool::Alloc();
+            return p;
+        }
+
+    private:
+        Q_DISABLE_COPY(CSlab)
+        char* m_pData;
+    };
+};
+
+#endif // CBUFFERPOOL_H
@@ -51,13 +51,17 @@ CLibDataChannelLogCallback g_LogCallback;
 ///////////////////////// End set libdatachannel log callback function ///////////////////////
 
 
-CDataChannelIce::CDataChannelIce(QObject* parent) : QIODevice(parent)
+CDataChannelIce::CDataChannelIce(QObject* parent) : QIODevice(parent),
+    m_bPause(false),
+    m_nLowWatermark(0)
 {
 }
 
 CDataChannelIce::CDataChannelIce(QSharedPointer<CIceSignal> signal, QObject *parent)
     : QIODevice(parent),
-      m_Signal(signal)
+      m_Signal(signal),
+      m_bPause(false),
+      m_nLowWatermark(0)
 {
     SetSignal(signal);
 }
@@ -171,24 +175,21 @@ int CDataChannelIce::SetDataChannel(std::shared_ptr<rtc::DataChannel> dc)
         emit sigError(-1, error.c_str());
     });
 
-    dc->onMessage([dc, this](std::variant<rtc::binary, std::string> data) {
-//        if (std::holds_alternative<std::string>(data))
-//            qDebug(logLibdatachannel, "From remote data: %s",
-//                            std::get<std::string>(data).c_str());
-//        else
-//            qDebug(logLibdatachannel, "From remote Received, size=%d",
-//                            std::get<rtc::binary>(data).size());
-        
-        rtc::binary d = std::get<rtc::binary>(data);
-        if(d.size() <= 0)
-        {
-            qDebug(logLibdatachannel, "onMessage size is zero");
-            return;
-        }
-        m_MutexData.lock();
-        m_data.append((char*)d.data(), d.size());
-        m_MutexData.unlock();
-        emit this->readyRead();
+    // Without it, onBufferedAmountLow is only called when the buffer is empty
+    if(m_nLowWatermark > 0)
+        dc->setBufferedAmountLowThreshold(m_nLowWatermark);
+    dc->onBufferedAmountLow([this]() {
+        // The bytes are written in writeData(), so it only notifies
+        // that the buffered data is sent.
+        emit this->bytesWritten(0);
+    });
+
+    // The messages aren't drained by onMessage, they are received in
+    // readData(), so the queue of libdatachannel applies the backpressure.
+    // It is called when the queue becomes non-empty.
+    dc->onAvailable([this]() {
+        if(!m_bPause)
+            emit this->readyRead();
     });
 
     return 0;
@@ -362,29 +363,73 @@ qint64 CDataChannelIce::readData(char *data, qint64 maxlen)
 
     QMutexLocker lock(&m_MutexData);
 
-    if(m_data.size() == 0)
-        return 0;
-
-    qint64 n = maxlen;
-    if(static_cast<int>(maxlen) > m_data.size())
-        n = m_data.size();
-    memcpy(data, m_data.data(), n);
-    if(m_data.size() == n)
-        m_data.clear();
-    else
+    // The rest of the last message is read first
+    qint64 n = qMin<qint64>(maxlen, m_data.size());
+    if(n > 0)
     {
+        memcpy(data, m_data.constData(), n);
         m_data.remove(0, n);
-        qWarning(logLibdatachannel, "maxlen: %d, Remain data:%d",
-                          maxlen, m_data.size());
-        //因为有 bytesAvailable，所以这里不要触发信号，由调用者自己判断是否继续读
-        //emit readyRead(); 
+    }
+    //因为有 bytesAvailable，所以这里不要触发信号，由调用者自己判断是否继续读
+    while(n < maxlen && m_data.isEmpty())
+    {
+        auto message = m_dataChannel->receive();
+        if(!message)
+            break;
+        const char* p = nullptr;
+        qint64 nLen = 0;
+        if(std::holds_alternative<rtc::binary>(*message))
+        {
+            const rtc::binary& d = std::get<rtc::binary>(*message);
+            p = reinterpret_cast<const char*>(d.data());
+            nLen = d.size();
+        } else {
+            const std::string& d = std::get<std::string>(*message);
+            p = d.data();
+            nLen = d.size();
+        }
+        qint64 nCopy = qMin(maxlen - n, nLen);
+        memcpy(data + n, p, nCopy);
+        n += nCopy;
+        // The rest is kept until the next read
+        if(nCopy < nLen)
+            m_data.append(p + nCopy, nLen - nCopy);
     }
     return n;
 }
 
+void CDataChannelIce::SetReadBufferSize(qint64 nSize)
+{
+    bool bPause = nSize > 0;
+    if(m_bPause == bPause)
+        return;
+    m_bPause = bPause;
+    // onAvailable isn't called again for the data which is queued already
+    if(!bPause && bytesAvailable() > 0)
+        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
+}
+
+void CDataChannelIce::SetLowWatermark(qint64 nBytes)
+{
+    m_nLowWatermark = nBytes;
+    if(m_dataChannel && nBytes > 0)
+        m_dataChannel->setBufferedAmountLowThreshold(nBytes);
+}
+
+qint64 CDataChannelIce::bytesToWrite() const
+{
+    if(!m_dataChannel) return 0;
+    return m_dataChannel->bufferedAmount();
+}
+
 qint64 CDataChannelIce::bytesAvailable() const
 {
-    return m_data.size();
+    // Include the messages in the queue of the data channel,
+    // and the data in the buffer of QIODevice
+    qint64 n = m_data.size() + QIODevice::bytesAvailable();
+    if(m_dataChannel)
+        n += m_dataChannel->availableAmount();
+    return n;
 }
 
 bool CDataChannelIce::isSequential() const
@@ -8,6 +8,7 @@
 #include "rtc/rtc.hpp"
 #include "IceSignal.h"
 #include <memory>
+#include <atomic>
 #include <QIODevice>
 #include <QMutex>
 #include <QSharedPointer>
@@ -15,6 +16,10 @@
 /*!
  * \brief The Ice data channel class.
  *        A PeerConnection corresponds to a datachannel
+ *
+ *        The messages are received on demand in read(). The messages which
+ *        aren't read stay in the bounded queue of libdatachannel, so the
+ *        SCTP flow control closes the receive window when the reader pauses.
  */
 class CDataChannelIce : public QIODevice
 {
@@ -36,6 +41,19 @@ public:
 
     virtual int SetDataChannel(std::shared_ptr<rtc::DataChannel>);
 
+    /*!
+     * \brief Pause or resume the notifications of the received data.
+     * \param nSize: 0: resume; others: pause. The data isn't read from the
+     *        data channel while it is paused, so the sender is slowed down.
+     *        readyRead() is emitted when it is resumed if there is data.
+     */
+    void SetReadBufferSize(qint64 nSize);
+    /*!
+     * \brief bytesWritten(0) is emitted when the bytes buffered by the data
+     *        channel drop to nBytes. \see bytesToWrite()
+     */
+    void SetLowWatermark(qint64 nBytes);
+
 Q_SIGNALS:
     void sigConnected();
     void sigDisconnected();
@@ -71,8 +89,11 @@ protected:
     std::shared_ptr<rtc::PeerConnection> m_peerConnection;
     std::shared_ptr<rtc::DataChannel> m_dataChannel;
 
+    //! The rest of a message which is more than the read
     QByteArray m_data;
     QMutex m_MutexData;
+    std::atomic<bool> m_bPause;
+    qint64 m_nLowWatermark;
 
     // QIODevice interface
 protected:
@@ -81,6 +102,11 @@ protected:
     qint64 readData(char *data, qint64 maxlen) override;
 public:
     virtual qint64 bytesAvailable() const override;
+    /*!
+     * \brief The bytes buffered by the data channel, which aren't sent.
+     *        bytesWritten(0) is emitted when they are sent.
+     */
+    virtual qint64 bytesToWrite() const override;
 };
 
 // NOTE: Don't use it!!!
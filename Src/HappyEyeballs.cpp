@@ -0,0 +1,246 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "HappyEyeballs.h"
+
+#include <QSocketNotifier>
+#include <QtEndian>
+#include <QLoggingCategory>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+Q_LOGGING_CATEGORY(logHappyEyeballs, "HappyEyeballs")
+
+namespace {
+
+int ToSockaddr(const QHostAddress& address, quint16 nPort,
+               sockaddr_storage& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    if(QAbstractSocket::IPv4Protocol == address.protocol())
+    {
+        sockaddr_in* p = reinterpret_cast<sockaddr_in*>(&addr);
+        p->sin_family = AF_INET;
+        p->sin_addr.s_addr = qToBigEndian(address.toIPv4Address());
+        p->sin_port = qToBigEndian(nPort);
+        return sizeof(sockaddr_in);
+    }
+    sockaddr_in6* p = reinterpret_cast<sockaddr_in6*>(&addr);
+    p->sin6_family = AF_INET6;
+    Q_IPV6ADDR ip = address.toIPv6Address();
+    memcpy(&p->sin6_addr, ip.c, sizeof(ip.c));
+    p->sin6_port = qToBigEndian(nPort);
+    return sizeof(sockaddr_in6);
+}
+
+} // namespace
+
+CHappyEyeballs::CHappyEyeballs(QObject *parent) : QObject(parent),
+    m_nNext(0),
+    m_nPort(0),
+    m_nDelay(0),
+    m_nTimeout(0),
+    m_nErrno(0),
+    m_bFail(false),
+    m_Delay([this]() { StartNext(); })
+{
+}
+
+CHappyEyeballs::~CHappyEyeballs()
+{
+    Stop();
+}
+
+QList<QHostAddress> CHappyEyeballs::Interleave(
+    const QList<QHostAddress> &addresses)
+{
+    if(addresses.isEmpty())
+        return addresses;
+    // The order of the resolver is kept in a family
+    QAbstractSocket::NetworkLayerProtocol first = addresses.first().protocol();
+    QList<QHostAddress> a, b;
+    foreach(const QHostAddress& add, addresses)
+    {
+        if(add.protocol() == first)
+            a.push_back(add);
+        else
+            b.push_back(add);
+    }
+    QList<QHostAddress> sorted;
+    for(int i = 0; i < a.size() || i < b.size(); i++)
+    {
+        if(i < a.size())
+            sorted.push_back(a.at(i));
+        if(i < b.size())
+            sorted.push_back(b.at(i));
+    }
+    return sorted;
+}
+
+int CHappyEyeballs::Start(const QList<QHostAddress> &addresses, quint16 nPort,
+                          int nDelay, int nTimeout)
+{
+    Stop();
+    m_Addresses = Interleave(addresses);
+    m_nPort = nPort;
+    m_nDelay = nDelay;
+    m_nTimeout = nTimeout;
+    m_nErrno = EHOSTUNREACH;
+    StartNext();
+    return 0;
+}
+
+void CHappyEyeballs::Stop()
+{
+    m_Delay.Stop();
+    m_bFail = false;
+    for(auto& a : m_Attempts)
+    {
+        if(-1 != a->fd)
+            ::close(a->fd);
+        a->fd = -1;
+        // It may be called in the signal of the notifier
+        a->pNotifier->setEnabled(false);
+        a->pNotifier->deleteLater();
+    }
+    m_Attempts.clear();
+    m_Addresses.clear();
+    m_nNext = 0;
+}
+
+void CHappyEyeballs::StartNext()
+{
+    m_Delay.Stop();
+    while(m_nNext < m_Addresses.size())
+    {
+        const QHostAddress& address = m_Addresses.at(m_nNext++);
+        sockaddr_storage addr;
+        int nLen = ToSockaddr(address, m_nPort, addr);
+        int fd = ::socket(addr.ss_family, SOCK_STREAM, 0);
+        if(-1 == fd)
+        {
+            m_nErrno = errno;
+            continue;
+        }
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        // A connection which is connected at once is also got by the notifier
+        if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), nLen)
+            && EINPROGRESS != errno)
+        {
+            // Eg: the network of the family is unreachable
+            m_nErrno = errno;
+            qDebug(logHappyEyeballs) << "Connect" << address << "fail:"
+                                     << strerror(m_nErrno);
+            ::close(fd);
+            continue;
+        }
+
+        qDebug(logHappyEyeballs) << "Attempt:" << address << m_nPort;
+        std::unique_ptr<strAttempt> a(new strAttempt());
+        strAttempt* pAttempt = a.get();
+        a->fd = fd;
+        a->pNotifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+        // The signal is overloaded in Qt 5.15
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+        bool check = connect(a->pNotifier, &QSocketNotifier::activated,
+                             this, &CHappyEyeballs::slotWritable);
+#else
+        bool check = connect(a->pNotifier, SIGNAL(activated(int)),
+                             this, SLOT(slotWritable()));
+#endif
+        Q_ASSERT(check);
+        if(m_nTimeout > 0)
+        {
+            a->timeout.reset(new CTimingWheel::CTimer([this, pAttempt]() {
+                OnFail(pAttempt, ETIMEDOUT);
+            }));
+            a->timeout->Start(m_nTimeout);
+        }
+        m_Attempts.push_back(std::move(a));
+        if(m_nNext < m_Addresses.size())
+            m_Delay.Start(m_nDelay);
+        return;
+    }
+    CheckFail();
+}
+
+void CHappyEyeballs::slotWritable()
+{
+    QObject* pNotifier = sender();
+    for(auto& a : m_Attempts)
+    {
+        if(a->pNotifier != pNotifier)
+            continue;
+        OnWritable(a.get());
+        return;
+    }
+}
+
+void CHappyEyeballs::OnWritable(strAttempt *pAttempt)
+{
+    int nErr = 0;
+    socklen_t nLen = sizeof(nErr);
+    if(::getsockopt(pAttempt->fd, SOL_SOCKET, SO_ERROR, &nErr, &nLen))
+        nErr = errno;
+    if(nErr)
+    {
+        OnFail(pAttempt, nErr);
+        return;
+    }
+
+    // The winner. The others are closed before the signal is emitted,
+    // because the receiver may stop or restart it.
+    int fd = pAttempt->fd;
+    pAttempt->fd = -1;
+    Stop();
+    qDebug(logHappyEyeballs) << "Connected:" << fd;
+    emit sigConnected(fd);
+}
+
+void CHappyEyeballs::OnFail(strAttempt *pAttempt, int nErrno)
+{
+    m_nErrno = nErrno;
+    qDebug(logHappyEyeballs) << "The attempt fail:" << strerror(nErrno);
+    Close(pAttempt);
+    // The next address isn't delayed
+    StartNext();
+}
+
+void CHappyEyeballs::Close(strAttempt *pAttempt)
+{
+    for(auto it = m_Attempts.begin(); it != m_Attempts.end(); ++it)
+    {
+        if(it->get() != pAttempt)
+            continue;
+        ::close(pAttempt->fd);
+        // It may be called in the signal of the notifier
+        pAttempt->pNotifier->setEnabled(false);
+        pAttempt->pNotifier->deleteLater();
+        m_Attempts.erase(it);
+        return;
+    }
+}
+
+void CHappyEyeballs::CheckFail()
+{
+    if(!m_Attempts.empty() || m_bFail)
+        return;
+    // The error isn't emitted in Start()
+    m_bFail = true;
+    QMetaObject::invokeMethod(this, "slotFail", Qt::QueuedConnection);
+}
+
+void CHappyEyeballs::slotFail()
+{
+    if(!m_bFail)
+        return;
+    m_bFail = false;
+    m_Addresses.clear();
+    m_nNext = 0;
+    emit sigError(m_nErrno);
+}
@@ -0,0 +1,93 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CHAPPYEYEBALLS_H
+#define CHAPPYEYEBALLS_H
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <QObject>
+#include <QList>
+#include <QHostAddress>
+#include "TimingWheel.h"
+
+class QSocketNotifier;
+
+/*!
+ * \brief Race the connections to the addresses of a host
+ *        (Happy Eyeballs, RFC 8305).
+ *        The addresses are interleaved by the family, the first family is
+ *        the family of the first address. The attempts are started one by
+ *        one with the attempt delay, and the next attempt is started at once
+ *        when an attempt fails or times out. The first connected socket wins,
+ *        and the others are closed.
+ *        The attempts are the native non-blocking sockets, so the loser
+ *        doesn't create a QTcpSocket. The socket of the winner is given to
+ *        the QTcpSocket of CPeerConnector.
+ *
+ * \note It is used in the thread which creates it.
+ * \see CPeerConnector::Connect()
+ */
+class CHappyEyeballs : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CHappyEyeballs(QObject* parent = nullptr);
+    virtual ~CHappyEyeballs();
+
+    /*!
+     * \brief Start the attempts
+     * \param nDelay: the time (ms) before the next attempt is started
+     * \param nTimeout: the time (ms) of an attempt. 0: no limit
+     * \return 0: success. sigConnected() or sigError() is emitted later.
+     */
+    int Start(const QList<QHostAddress>& addresses, quint16 nPort,
+              int nDelay, int nTimeout);
+    //! Close the attempts. The signals aren't emitted.
+    void Stop();
+
+    //! Sort the addresses by interleaving the families
+    static QList<QHostAddress> Interleave(const QList<QHostAddress>& addresses);
+
+Q_SIGNALS:
+    //! \param fd: the connected socket. The receiver owns it.
+    void sigConnected(qintptr fd);
+    //! \param nErrno: the error of the last attempt
+    void sigError(int nErrno);
+
+private Q_SLOTS:
+    //! The socket of an attempt is writable
+    void slotWritable();
+    void slotFail();
+
+private:
+    struct strAttempt {
+        int fd = -1;
+        QSocketNotifier* pNotifier = nullptr;
+        std::unique_ptr<CTimingWheel::CTimer> timeout;
+    };
+
+    //! Start the next address which can be connected
+    void StartNext();
+    //! The connection of the attempt is complete
+    void OnWritable(strAttempt* pAttempt);
+    //! The attempt fails, or it times out
+    void OnFail(strAttempt* pAttempt, int nErrno);
+    void Close(strAttempt* pAttempt);
+    //! Emit the error if there isn't an attempt or an address
+    void CheckFail();
+
+    QList<QHostAddress> m_Addresses;
+    int m_nNext;
+    quint16 m_nPort;
+    int m_nDelay;
+    int m_nTimeout;
+    int m_nErrno; // The error of the last attempt
+    bool m_bFail; // The error is emitted in the event loop
+    std::vector<std::unique_ptr<strAttempt> > m_Attempts;
+    CTimingWheel::CTimer m_Delay;
+};
+
+#endif // CHAPPYEYEBALLS_H
@@ -0,0 +1,279 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "HttpBody.h"
+#include "HttpParser.h"
+
+static int HexValue(char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool IsSpace(char c)
+{
+    return ' ' == c || '\t' == c;
+}
+
+CHttpBody::CHttpBody()
+{
+    Start(emFraming::None);
+}
+
+void CHttpBody::Start(emFraming framing, quint64 nLength)
+{
+    m_Framing = framing;
+    m_nRemain = emFraming::Length == framing ? nLength : 0;
+    m_Chunk = emChunk::Size;
+    m_nDigits = 0;
+}
+
+qint64 CHttpBody::ContentLength(const CHttpParser &message)
+{
+    qint64 nLength = -1;
+    for(int i = 0; i < message.HeaderCount(); i++)
+    {
+        if(!CHttpParser::IsEqual(message.Name(i), message.NameLength(i),
+                                 "Content-Length"))
+            continue;
+        const char* p = message.Value(i);
+        int nLen = message.ValueLength(i);
+        if(nLen <= 0 || nLen > 18)
+            return -2;
+        qint64 n = 0;
+        for(int k = 0; k < nLen; k++)
+        {
+            if(p[k] < '0' || p[k] > '9')
+                return -2;
+            n = n * 10 + (p[k] - '0');
+        }
+        // The different lengths are the request smuggling
+        if(-1 != nLength && n != nLength)
+            return -2;
+        nLength = n;
+    }
+    return nLength;
+}
+
+bool CHttpBody::IsChunked(const CHttpParser &message)
+{
+    // The codings of the fields are joined in order, so the last coding is
+    // the last one of the last field
+    const char* pLast = nullptr;
+    int nLast = 0;
+    for(int i = 0; i < message.HeaderCount(); i++)
+    {
+        if(!CHttpParser::IsEqual(message.Name(i), message.NameLength(i),
+                                 "Transfer-Encoding"))
+            continue;
+        const char* p = message.Value(i);
+        int nEnd = message.ValueLength(i);
+        while(nEnd > 0)
+        {
+            int nBegin = nEnd;
+            while(nBegin > 0 && ',' != p[nBegin - 1])
+                nBegin--;
+            int nTrim = nEnd;
+            while(nTrim > nBegin && IsSpace(p[nTrim - 1]))
+                nTrim--;
+            int nStart = nBegin;
+            while(nStart < nTrim && IsSpace(p[nStart]))
+                nStart++;
+            // The empty elements of the list are ignored. See RFC 7230 7
+            if(nTrim > nStart)
+            {
+                pLast = p + nStart;
+                nLast = nTrim - nStart;
+                break;
+            }
+            nEnd = nBegin - 1;
+        }
+    }
+    return pLast && CHttpParser::IsEqual(pLast, nLast, "chunked");
+}
+
+int CHttpBody::StartRequest(const CHttpParser &request)
+{
+    if(request.Find("Transfer-Encoding") >= 0)
+    {
+        // The length of the request can't be found if chunked isn't the
+        // last coding. See RFC 7230 3.3.3
+        if(!IsChunked(request))
+            return -1;
+        // Transfer-Encoding overrides Content-Length, but the upstream which
+        // uses Content-Length reads the other body (request smuggling)
+        if(request.Find("Content-Length") >= 0)
+            return -1;
+        Start(emFraming::Chunked);
+        return 0;
+    }
+    qint64 nLength = ContentLength(request);
+    if(-2 == nLength)
+        return -1;
+    if(nLength > 0)
+        Start(emFraming::Length, nLength);
+    else
+        Start(emFraming::None);
+    return 0;
+}
+
+int CHttpBody::StartResponse(const CHttpParser &response, bool bHead)
+{
+    int nCode = response.StatusCode();
+    if(bHead || (nCode >= 100 && nCode < 200) || 204 == nCode || 304 == nCode)
+    {
+        Start(emFraming::None);
+        return 0;
+    }
+    if(response.Find("Transfer-Encoding") >= 0)
+    {
+        // The body is ended by closing if chunked isn't the last coding
+        if(IsChunked(response))
+            Start(emFraming::Chunked);
+        else
+            Start(emFraming::Close);
+        return 0;
+    }
+    qint64 nLength = ContentLength(response);
+    if(-2 == nLength)
+        return -1;
+    if(-1 == nLength)
+        Start(emFraming::Close);
+    else if(nLength > 0)
+        Start(emFraming::Length, nLength);
+    else
+        Start(emFraming::None);
+    return 0;
+}
+
+CHttpBody::emFraming CHttpBody::GetFraming() const
+{
+    return m_Framing;
+}
+
+bool CHttpBody::IsComplete() const
+{
+    switch(m_Framing) {
+    case emFraming::None:
+        return true;
+    case emFraming::Length:
+        return 0 == m_nRemain;
+    case emFraming::Chunked:
+        return emChunk::Done == m_Chunk;
+    case emFraming::Close:
+        break;
+    }
+    return false;
+}
+
+qint64 CHttpBody::Scan(const char *pData, qint64 nLen)
+{
+    switch(m_Framing) {
+    case emFraming::None:
+        return 0;
+    case emFraming::Length:
+    {
+        qint64 n = qMin<quint64>(m_nRemain, nLen);
+        m_nRemain -= n;
+        return n;
+    }
+    case emFraming::Chunked:
+        return ScanChunked(pData, nLen);
+    case emFraming::Close:
+        break;
+    }
+    return nLen;
+}
+
+// chunk = chunk-size [ chunk-ext ] CRLF chunk-data CRLF
+// last-chunk = 1*("0") [ chunk-ext ] CRLF
+// chunked-body = *chunk last-chunk trailer-part CRLF
+qint64 CHttpBody::ScanChunked(const char *pData, qint64 nLen)
+{
+    qint64 i = 0;
+    while(i < nLen && emChunk::Done != m_Chunk)
+    {
+        char c = pData[i];
+        switch(m_Chunk) {
+        case emChunk::Size:
+        {
+            int v = HexValue(c);
+            if(v < 0)
+            {
+                if(0 == m_nDigits)
+                    return -1;
+                // The extension and the whitespace are skipped
+                m_Chunk = emChunk::Extension;
+                continue;
+            }
+            // The size is at most 60 bits
+            if(++m_nDigits > 15)
+                return -1;
+            m_nRemain = (m_nRemain << 4) | v;
+            break;
+        }
+        case emChunk::Extension:
+            if('\r' == c)
+                m_Chunk = emChunk::SizeLF;
+            else if('\n' == c)
+                m_Chunk = m_nRemain ? emChunk::Data : emChunk::Trailer;
+            break;
+        case emChunk::SizeLF:
+            if('\n' != c)
+                return -1;
+            m_Chunk = m_nRemain ? emChunk::Data : emChunk::Trailer;
+            break;
+        case emChunk::Data:
+        {
+            qint64 n = qMin<quint64>(m_nRemain, nLen - i);
+            m_nRemain -= n;
+            i += n;
+            if(0 == m_nRemain)
+                m_Chunk = emChunk::DataCR;
+            continue;
+        }
+        case emChunk::DataCR:
+            if('\r' == c)
+                m_Chunk = emChunk::DataLF;
+            else if('\n' == c)
+            {
+                m_Chunk = emChunk::Size;
+                m_nDigits = 0;
+            } else
+                return -1;
+            break;
+        case emChunk::DataLF:
+            if('\n' != c)
+                return -1;
+            m_Chunk = emChunk::Size;
+            m_nDigits = 0;
+            break;
+        case emChunk::Trailer:
+            // The beginning of a trailer field or the last empty line
+            if('\r' == c)
+                m_Chunk = emChunk::TrailerLF;
+            else if('\n' == c)
+                m_Chunk = emChunk::Done;
+            else
+                m_Chunk = emChunk::TrailerLine;
+            break;
+        case emChunk::TrailerLine:
+            if('\n' == c)
+                m_Chunk = emChunk::Trailer;
+            break;
+        case emChunk::TrailerLF:
+            if('\n' != c)
+                return -1;
+            m_Chunk = emChunk::Done;
+            break;
+        case emChunk::Done:
+            break;
+        }
+        i++;
+    }
+    return i;
+}
@@ -0,0 +1,95 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CHTTPBODY_H
+#define CHTTPBODY_H
+
+#pragma once
+
+#include <QtGlobal>
+#include "rabbitproxy_export.h"
+
+class CHttpParser;
+
+/*!
+ * \brief Find the end of the body of the HTTP/1.x message (RFC 7230 3.3.3).
+ *        The body is forwarded as it is, so the data isn't copied. It only
+ *        scans the chunked body to find the last chunk and the trailer.
+ *        The data after the body is the next message.
+ *
+ *        Example:
+ *        \code
+ *        body.StartResponse(response, bHead);
+ *        qint64 nBody = body.Scan(pData, nLen);
+ *        Write(pData, nBody);
+ *        if(body.IsComplete())
+ *            // The message is complete
+ *        \endcode
+ */
+class RABBITPROXY_EXPORT CHttpBody
+{
+public:
+    enum class emFraming {
+        //! There isn't the body
+        None,
+        //! Content-Length
+        Length,
+        //! Transfer-Encoding: chunked
+        Chunked,
+        //! The body is ended by closing the connection
+        Close
+    };
+
+    CHttpBody();
+
+    void Start(emFraming framing, quint64 nLength = 0);
+    /*!
+     * \brief Start the body of the complete request
+     * \return 0: success
+     *         -1: the length of the body is error. Eg: both Transfer-Encoding
+     *             and Content-Length, or chunked isn't the last coding
+     */
+    int StartRequest(const CHttpParser& request);
+    /*!
+     * \brief Start the body of the complete final response
+     * \param bHead: the request is HEAD
+     * \return 0: success
+     *         -1: the length of the body is error
+     */
+    int StartResponse(const CHttpParser& response, bool bHead);
+
+    emFraming GetFraming() const;
+    bool IsComplete() const;
+    /*!
+     * \brief Scan the bytes of the body
+     * \return the bytes which belong to the body, they are at the head of
+     *         the data. -1: the chunked body is error
+     */
+    qint64 Scan(const char* pData, qint64 nLen);
+
+private:
+    //! Parse Content-Length. -1: there isn't it; -2: it is error
+    static qint64 ContentLength(const CHttpParser& message);
+    //! The last coding of Transfer-Encoding is chunked
+    static bool IsChunked(const CHttpParser& message);
+    qint64 ScanChunked(const char* pData, qint64 nLen);
+
+    enum class emChunk {
+        Size,
+        Extension,
+        SizeLF,
+        Data,
+        DataCR,
+        DataLF,
+        Trailer,
+        TrailerLine,
+        TrailerLF,
+        Done
+    };
+
+    emFraming m_Framing;
+    quint64 m_nRemain; // The bytes of the body or the chunk which aren't scanned
+    emChunk m_Chunk;
+    int m_nDigits; // The digits of the chunk size
+};
+
+#endif // CHTTPBODY_H
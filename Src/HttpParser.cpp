@@ -0,0 +1,400 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "HttpParser.h"
+
+#include <cstring>
+
+static bool IsSpace(char c)
+{
+    return ' ' == c || '\t' == c;
+}
+
+static char ToLower(char c)
+{
+    if(c >= 'A' && c <= 'Z')
+        return c - 'A' + 'a';
+    return c;
+}
+
+CHttpParser::CHttpParser()
+{
+    Start();
+}
+
+void CHttpParser::Start(emMessage message)
+{
+    m_Message = message;
+    m_Result = Incomplete;
+    m_Error = emError::None;
+    m_nLen = 0;
+    m_nLine = 0;
+    m_nMethod = m_nMethodLen = 0;
+    m_nTarget = m_nTargetLen = 0;
+    m_nStatusCode = 0;
+    m_nMinorVersion = -1;
+    m_nHeaders = 0;
+}
+
+CHttpParser::emMessage CHttpParser::Message() const
+{
+    return m_Message;
+}
+
+int CHttpParser::Need() const
+{
+    if(Incomplete != m_Result)
+        return 0;
+    return BUFFER_SIZE - m_nLen;
+}
+
+char* CHttpParser::Tail()
+{
+    return m_Buffer + m_nLen;
+}
+
+int CHttpParser::Commit(int n)
+{
+    Q_ASSERT(n >= 0 && n <= Need());
+    if(n <= 0 || n > Need())
+        return 0;
+    int nEnd = m_nLen + n;
+    for(int i = m_nLen; i < nEnd; i++)
+    {
+        if('\n' != m_Buffer[i])
+            continue;
+        int nLineEnd = i;
+        if(nLineEnd > m_nLine && '\r' == m_Buffer[nLineEnd - 1])
+            nLineEnd--;
+        ParseLine(m_nLine, nLineEnd);
+        m_nLine = i + 1;
+        if(Incomplete != m_Result)
+        {
+            int nUsed = i + 1 - m_nLen;
+            m_nLen = i + 1;
+            return nUsed;
+        }
+    }
+    m_nLen = nEnd;
+    if(BUFFER_SIZE == m_nLen)
+        Fail(emError::Overflow);
+    return n;
+}
+
+CHttpParser::emResult CHttpParser::Result() const
+{
+    return m_Result;
+}
+
+CHttpParser::emError CHttpParser::GetError() const
+{
+    return m_Error;
+}
+
+int CHttpParser::Length() const
+{
+    return m_nLen;
+}
+
+const char* CHttpParser::Data() const
+{
+    return m_Buffer;
+}
+
+CHttpParser::emResult CHttpParser::Fail(emError e)
+{
+    m_Error = e;
+    m_Result = Error;
+    return m_Result;
+}
+
+CHttpParser::emResult CHttpParser::ParseLine(int nBegin, int nEnd)
+{
+    if(m_nMinorVersion < 0)
+    {
+        // The empty lines before the request line are ignored. See RFC 7230 3.5
+        if(nBegin == nEnd)
+            return m_Result;
+        if(emMessage::Response == m_Message)
+            return ParseStatusLine(nBegin, nEnd);
+        return ParseRequestLine(nBegin, nEnd);
+    }
+    // The empty line is the end of the header
+    if(nBegin == nEnd)
+    {
+        m_Result = Complete;
+        return m_Result;
+    }
+    return ParseHeader(nBegin, nEnd);
+}
+
+// method SP request-target SP HTTP-version
+CHttpParser::emResult CHttpParser::ParseRequestLine(int nBegin, int nEnd)
+{
+    const char* p = m_Buffer;
+    int i = nBegin;
+    while(i < nEnd && ' ' != p[i])
+        i++;
+    if(i == nBegin || i == nEnd)
+        return Fail(emError::Format);
+    m_nMethod = nBegin;
+    m_nMethodLen = i - nBegin;
+
+    m_nTarget = ++i;
+    while(i < nEnd && ' ' != p[i])
+        i++;
+    if(i == m_nTarget || i == nEnd)
+        return Fail(emError::Format);
+    m_nTargetLen = i - m_nTarget;
+
+    if(nEnd - i - 1 != 8 || !ParseVersion(i + 1, nEnd))
+        return Fail(emError::Format);
+    return m_Result;
+}
+
+// HTTP-version SP status-code SP reason-phrase
+CHttpParser::emResult CHttpParser::ParseStatusLine(int nBegin, int nEnd)
+{
+    const char* p = m_Buffer;
+    int i = nBegin + 8;
+    if(!ParseVersion(nBegin, nEnd) || i + 4 > nEnd || ' ' != p[i])
+        return Fail(emError::Format);
+    int nCode = 0;
+    for(int n = i + 1; n < i + 4; n++)
+    {
+        if(p[n] < '0' || p[n] > '9')
+            return Fail(emError::Format);
+        nCode = nCode * 10 + p[n] - '0';
+    }
+    // The reason phrase may be empty, and some servers omit the space
+    if(i + 4 < nEnd && ' ' != p[i + 4])
+        return Fail(emError::Format);
+    m_nStatusCode = nCode;
+    return m_Result;
+}
+
+bool CHttpParser::ParseVersion(int nBegin, int nEnd)
+{
+    const char* p = m_Buffer + nBegin;
+    if(nEnd - nBegin < 8 || memcmp(p, "HTTP/1.", 7) || p[7] < '0' || p[7] > '9')
+        return false;
+    m_nMinorVersion = p[7] - '0';
+    return true;
+}
+
+// field-name ":" OWS field-value OWS
+CHttpParser::emResult CHttpParser::ParseHeader(int nBegin, int nEnd)
+{
+    const char* p = m_Buffer;
+    // The obsolete line folding is rejected. See RFC 7230 3.2.4
+    if(IsSpace(p[nBegin]))
+        return Fail(emError::Format);
+    if(MAX_HEADERS == m_nHeaders)
+        return Fail(emError::Headers);
+
+    int i = nBegin;
+    while(i < nEnd && ':' != p[i])
+    {
+        // No whitespace is allowed between the name and the colon
+        if(IsSpace(p[i]))
+            return Fail(emError::Format);
+        i++;
+    }
+    if(i == nBegin || i == nEnd)
+        return Fail(emError::Format);
+
+    strField& f = m_Headers[m_nHeaders++];
+    f.nName = nBegin;
+    f.nNameLen = i - nBegin;
+    i++;
+    while(i < nEnd && IsSpace(p[i]))
+        i++;
+    while(nEnd > i && IsSpace(p[nEnd - 1]))
+        nEnd--;
+    f.nValue = i;
+    f.nValueLen = nEnd - i;
+    return m_Result;
+}
+
+const char* CHttpParser::Method() const
+{
+    return m_Buffer + m_nMethod;
+}
+
+int CHttpParser::MethodLength() const
+{
+    return m_nMethodLen;
+}
+
+bool CHttpParser::IsMethod(const char *pMethod) const
+{
+    int nLen = static_cast<int>(strlen(pMethod));
+    return nLen == m_nMethodLen && 0 == memcmp(Method(), pMethod, nLen);
+}
+
+const char* CHttpParser::Target() const
+{
+    return m_Buffer + m_nTarget;
+}
+
+int CHttpParser::TargetLength() const
+{
+    return m_nTargetLen;
+}
+
+int CHttpParser::StatusCode() const
+{
+    return m_nStatusCode;
+}
+
+int CHttpParser::MinorVersion() const
+{
+    return m_nMinorVersion;
+}
+
+int CHttpParser::HeaderCount() const
+{
+    return m_nHeaders;
+}
+
+const char* CHttpParser::Name(int i) const
+{
+    return m_Buffer + m_Headers[i].nName;
+}
+
+int CHttpParser::NameLength(int i) const
+{
+    return m_Headers[i].nNameLen;
+}
+
+const char* CHttpParser::Value(int i) const
+{
+    return m_Buffer + m_Headers[i].nValue;
+}
+
+int CHttpParser::ValueLength(int i) const
+{
+    return m_Headers[i].nValueLen;
+}
+
+int CHttpParser::Find(const char *pName) const
+{
+    for(int i = 0; i < m_nHeaders; i++)
+    {
+        if(IsEqual(Name(i), NameLength(i), pName))
+            return i;
+    }
+    return -1;
+}
+
+bool CHttpParser::HasToken(const char *pName, const char *pToken) const
+{
+    for(int i = 0; i < m_nHeaders; i++)
+    {
+        if(!IsEqual(Name(i), NameLength(i), pName))
+            continue;
+        const char* p = Value(i);
+        int nLen = ValueLength(i);
+        int nBegin = 0;
+        while(nBegin < nLen)
+        {
+            int nEnd = nBegin;
+            while(nEnd < nLen && ',' != p[nEnd])
+                nEnd++;
+            int nNext = nEnd + 1;
+            while(nBegin < nEnd && IsSpace(p[nBegin]))
+                nBegin++;
+            while(nEnd > nBegin && IsSpace(p[nEnd - 1]))
+                nEnd--;
+            if(IsEqual(p + nBegin, nEnd - nBegin, pToken))
+                return true;
+            nBegin = nNext;
+        }
+    }
+    return false;
+}
+
+bool CHttpParser::IsEqual(const char *pData, int nLen, const char *pString)
+{
+    int i = 0;
+    for(; i < nLen; i++)
+    {
+        if(!pString[i] || ToLower(pData[i]) != ToLower(pString[i]))
+            return false;
+    }
+    return 0 == pString[i];
+}
+
+bool CHttpParser::SplitAuthority(const char *pData, int nLen,
+                                 const char *&pHost, int &nHost,
+                                 quint16 &nPort)
+{
+    int nPortBegin = nLen;
+    if(nLen > 0 && '[' == pData[0])
+    {
+        // IP-literal
+        const char* pEnd = static_cast<const char*>(memchr(pData, ']', nLen));
+        if(!pEnd)
+            return false;
+        pHost = pData + 1;
+        nHost = static_cast<int>(pEnd - pHost);
+        int n = static_cast<int>(pEnd - pData) + 1;
+        if(n < nLen)
+        {
+            if(':' != pData[n])
+                return false;
+            nPortBegin = n + 1;
+        }
+    } else {
+        pHost = pData;
+        nHost = nLen;
+        for(int i = 0; i < nLen; i++)
+        {
+            if(':' != pData[i])
+                continue;
+            // The IPv6 address must be in the brackets
+            if(nHost != nLen)
+                return false;
+            nHost = i;
+            nPortBegin = i + 1;
+        }
+    }
+    if(nHost <= 0)
+        return false;
+
+    // The empty port is the default port
+    if(nPortBegin >= nLen)
+        return true;
+    if(nLen - nPortBegin > 5)
+        return false;
+    quint32 n = 0;
+    for(int i = nPortBegin; i < nLen; i++)
+    {
+        if(pData[i] < '0' || pData[i] > '9')
+            return false;
+        n = n * 10 + (pData[i] - '0');
+    }
+    if(0 == n || n > 65535)
+        return false;
+    nPort = static_cast<quint16>(n);
+    return true;
+}
+
+bool CHttpParser::SplitUri(const char *pData, int nLen,
+                           const char *&pAuthority, int &nAuthority,
+                           const char *&pPath, int &nPath)
+{
+    // The scheme is case-insensitive
+    const int nScheme = 7;
+    if(nLen <= nScheme || !IsEqual(pData, nScheme, "http://"))
+        return false;
+    pAuthority = pData + nScheme;
+    int i = nScheme;
+    while(i < nLen && '/' != pData[i] && '?' != pData[i] && '#' != pData[i])
+        i++;
+    nAuthority = i - nScheme;
+    if(nAuthority <= 0)
+        return false;
+    pPath = pData + i;
+    nPath = nLen - i;
+    return true;
+}
@@ -0,0 +1,180 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CHTTPPARSER_H
+#define CHTTPPARSER_H
+
+#pragma once
+
+#include <QtGlobal>
+#include "rabbitproxy_export.h"
+
+/*!
+ * \brief The incremental parser of the header of the HTTP/1.x request
+ *        and response (RFC 7230). It parses the request line or the status
+ *        line, and the header fields.
+ *
+ *        The header is gathered in a fixed inline buffer, and the lines are
+ *        parsed when the bytes arrive, so the bytes aren't scanned again.
+ *        The fields are kept as the offsets in the buffer.
+ *        Commit() uses the bytes until the end of the header, so the caller
+ *        can peek the data, and read no more than the header. The body or
+ *        the tunneled data which follows it is left in the socket.
+ *        It doesn't allocate memory.
+ *
+ *        Example:
+ *        \code
+ *        parser.Start();
+ *        while(parser.Need() > 0)
+ *        {
+ *            char* p = parser.Tail();
+ *            qint64 n = pSocket->peek(p, parser.Need());
+ *            if(n <= 0) break;
+ *            pSocket->read(p, parser.Commit(n));
+ *        }
+ *        if(CHttpParser::Complete == parser.Result())
+ *            // Use parser.Method(), parser.Target() and parser.Find()
+ *        \endcode
+ * \note The pointers of the fields are valid until the next Start().
+ */
+class RABBITPROXY_EXPORT CHttpParser
+{
+public:
+    //! The size of the inline buffer. A longer header is an error.
+    static const int BUFFER_SIZE = 8192;
+    //! The most header fields. More fields is an error.
+    static const int MAX_HEADERS = 64;
+
+    enum class emMessage {
+        //! method SP request-target SP HTTP-version
+        Request,
+        //! HTTP-version SP status-code SP reason-phrase
+        Response
+    };
+
+    enum emResult {
+        Error = -1,
+        Complete = 0,
+        Incomplete = 1
+    };
+
+    enum class emError {
+        None,
+        //! The start line or a header field is malformed
+        Format,
+        //! The header is longer than the buffer
+        Overflow,
+        //! The header has more than MAX_HEADERS fields
+        Headers
+    };
+
+    CHttpParser();
+
+    //! Start to parse a request or a response
+    void Start(emMessage message = emMessage::Request);
+    emMessage Message() const;
+    //! The free bytes of the buffer. 0: complete or error
+    int Need() const;
+    //! The place where the next bytes are put. There is Need() bytes at least.
+    char* Tail();
+    /*!
+     * \brief Parse the n bytes which are put into Tail(). n is at most Need().
+     * \return the bytes which belong to the header. The bytes after it
+     *         aren't used.
+     */
+    int Commit(int n);
+    emResult Result() const;
+    emError GetError() const;
+    //! The bytes of the header
+    int Length() const;
+    //! The header. It is forwarded as it is.
+    const char* Data() const;
+
+    //! \name The request line
+    //! @{
+    const char* Method() const;
+    int MethodLength() const;
+    //! Whether the method is the token. The method is case-sensitive.
+    bool IsMethod(const char* pMethod) const;
+    const char* Target() const;
+    int TargetLength() const;
+    //! @}
+
+    //! \name The status line
+    //! @{
+    int StatusCode() const;
+    //! @}
+
+    //! The minor version of HTTP/1.x
+    int MinorVersion() const;
+
+    //! \name The header fields. The values are trimmed.
+    //! @{
+    int HeaderCount() const;
+    const char* Name(int i) const;
+    int NameLength(int i) const;
+    const char* Value(int i) const;
+    int ValueLength(int i) const;
+    /*!
+     * \brief Find the field by the name. The name is case-insensitive.
+     * \return the index of the first field, or -1 if there isn't it
+     */
+    int Find(const char* pName) const;
+    /*!
+     * \brief Whether the comma-separated list of the fields of the name has
+     *        the token, eg: HasToken("Connection", "close").
+     *        The name and the token are case-insensitive.
+     */
+    bool HasToken(const char* pName, const char* pToken) const;
+    //! @}
+
+    //! Whether the bytes are the string, ignoring the case of ASCII
+    static bool IsEqual(const char* pData, int nLen, const char* pString);
+    /*!
+     * \brief Split the authority (RFC 3986) into the host and the port.
+     *        The brackets of the IPv6 address are removed.
+     * \param nPort: the port. It is unchanged if the authority hasn't it.
+     * \return false: the authority is malformed
+     */
+    static bool SplitAuthority(const char* pData, int nLen,
+                               const char*& pHost, int& nHost, quint16& nPort);
+    /*!
+     * \brief Split the absolute URI of the http scheme, eg:
+     *        "http://example.com:8080/index.html?a=b"
+     * \param pPath: the path and the query. It is empty if the URI hasn't them.
+     * \return false: it isn't the absolute URI of the http scheme
+     */
+    static bool SplitUri(const char* pData, int nLen,
+                         const char*& pAuthority, int& nAuthority,
+                         const char*& pPath, int& nPath);
+
+private:
+    //! Parse the line [nBegin, nEnd) without the line break
+    emResult ParseLine(int nBegin, int nEnd);
+    emResult ParseRequestLine(int nBegin, int nEnd);
+    emResult ParseStatusLine(int nBegin, int nEnd);
+    //! Parse "HTTP/1.x" at nBegin
+    bool ParseVersion(int nBegin, int nEnd);
+    emResult ParseHeader(int nBegin, int nEnd);
+    emResult Fail(emError e);
+
+    struct strField {
+        int nName, nNameLen;
+        int nValue, nValueLen;
+    };
+
+    char m_Buffer[BUFFER_SIZE];
+    emMessage m_Message;
+    emResult m_Result;
+    emError m_Error;
+    int m_nLen; // The bytes in the buffer
+    int m_nLine; // The beginning of the line which is parsed
+
+    int m_nMethod, m_nMethodLen;
+    int m_nTarget, m_nTargetLen;
+    int m_nStatusCode;
+    int m_nMinorVersion; // -1: the start line isn't parsed
+    strField m_Headers[MAX_HEADERS];
+    int m_nHeaders;
+};
+
+#endif // CHTTPPARSER_H
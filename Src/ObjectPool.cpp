@@ -0,0 +1,86 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "ObjectPool.h"
+
+#include <atomic>
+#include <QThread>
+#include <QThreadStorage>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(logObjectPool, "ObjectPool")
+
+namespace {
+
+std::atomic<int> g_nMaxSize(1024);
+std::atomic<quint64> g_nHit(0);
+std::atomic<quint64> g_nMiss(0);
+std::atomic<int> g_nSize(0);
+
+QThreadStorage<CObjectPool*> g_Pool;
+
+} // namespace
+
+CObjectPool::CObjectPool()
+{
+}
+
+CObjectPool::~CObjectPool()
+{
+    int nSize = 0;
+    for(QVector<QObject*>& objects : m_Objects)
+    {
+        nSize += objects.size();
+        qDeleteAll(objects);
+    }
+    g_nSize -= nSize;
+    qDebug(logObjectPool) << "CObjectPool::~CObjectPool(); objects:" << nSize;
+}
+
+CObjectPool* CObjectPool::Instance()
+{
+    // It is deleted when the thread exits
+    if(!g_Pool.hasLocalData())
+        g_Pool.setLocalData(new CObjectPool());
+    return g_Pool.localData();
+}
+
+QObject* CObjectPool::Get(const QMetaObject *pType)
+{
+    auto it = m_Objects.find(pType);
+    if(m_Objects.end() == it || it->isEmpty())
+    {
+        g_nMiss++;
+        return nullptr;
+    }
+    g_nHit++;
+    g_nSize--;
+    QObject* p = it->back();
+    it->pop_back();
+    return p;
+}
+
+bool CObjectPool::Put(QObject *pObject)
+{
+    if(!pObject) return false;
+    Q_ASSERT(pObject->thread() == QThread::currentThread());
+    QVector<QObject*>& objects = m_Objects[pObject->metaObject()];
+    if(objects.size() >= g_nMaxSize)
+        return false;
+    objects.push_back(pObject);
+    g_nSize++;
+    return true;
+}
+
+void CObjectPool::SetMaxSize(int nSize)
+{
+    g_nMaxSize = qMax(0, nSize);
+}
+
+CObjectPool::strStatistics CObjectPool::GetStatistics()
+{
+    strStatistics st;
+    st.nHit = g_nHit;
+    st.nMiss = g_nMiss;
+    st.nSize = g_nSize;
+    return st;
+}
@@ -0,0 +1,84 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef COBJECTPOOL_H
+#define COBJECTPOOL_H
+
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include "rabbitproxy_export.h"
+
+/*!
+ * \brief The pool of the closed session objects of a thread.
+ *        A session (eg: CProxySocks5, CPeerConnector) is reset and put into
+ *        the pool when it is closed, instead of being deleted. The next
+ *        session of the same type in the thread reuses it, so accepting a
+ *        connection doesn't allocate and construct the objects, the sockets
+ *        and the buffers again.
+ *        The objects are kept by the exact type (the QMetaObject), so a
+ *        CProxySocks5 isn't got as a CProxySocks4.
+ *        The objects of a pool live in its thread, and are deleted when
+ *        the thread exits.
+ *
+ *        Example:
+ *        \code
+ *        CProxySocks5* p = CObjectPool::Instance()->Get<CProxySocks5>();
+ *        if(p)
+ *            p->Reset(pSocket, server);
+ *        else
+ *            p = new CProxySocks5(pSocket, server);
+ *        \endcode
+ * \note It isn't thread safe. Use the pool of the current thread.
+ */
+class RABBITPROXY_EXPORT CObjectPool
+{
+public:
+    ~CObjectPool();
+
+    //! The pool of the current thread. It is created at the first call.
+    static CObjectPool* Instance();
+
+    /*!
+     * \brief Get a object of the type T from the pool
+     * \return nullptr if the pool hasn't it
+     */
+    template<class T>
+    T* Get()
+    {
+        return static_cast<T*>(Get(&T::staticMetaObject));
+    }
+    QObject* Get(const QMetaObject* pType);
+    /*!
+     * \brief Put the reset object into the pool
+     * \return true: the pool owns it
+     *         false: the pool is full or off, the caller deletes it
+     */
+    bool Put(QObject* pObject);
+
+    /*!
+     * \brief The maximum of the objects of a type in a pool.
+     *        0: off, the objects aren't kept.
+     */
+    static void SetMaxSize(int nSize);
+
+    //! The hit rate is nHit / (nHit + nMiss)
+    struct strStatistics {
+        //! The objects which are reused
+        quint64 nHit = 0;
+        //! The objects which are created because the pool is empty
+        quint64 nMiss = 0;
+        //! The objects in the pools of all threads
+        int nSize = 0;
+    };
+    static strStatistics GetStatistics();
+
+private:
+    CObjectPool();
+    Q_DISABLE_COPY(CObjectPool)
+
+    QHash<const QMetaObject*, QVector<QObject*> > m_Objects;
+};
+
+#endif // COBJECTPOOL_H
@@ -0,0 +1,710 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "OutputQueue.h"
+#include "TimingWheel.h"
+
+#include <atomic>
+#include <cstring>
+#if defined(Q_OS_UNIX)
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+#endif
+#if defined(Q_OS_LINUX)
+    #include <netinet/in.h>
+    #include <linux/errqueue.h>
+    #ifndef SO_ZEROCOPY
+        #define SO_ZEROCOPY 60
+    #endif
+    #ifndef MSG_ZEROCOPY
+        #define MSG_ZEROCOPY 0x4000000
+    #endif
+    #ifndef SO_EE_ORIGIN_ZEROCOPY
+        #define SO_EE_ORIGIN_ZEROCOPY 5
+    #endif
+    #ifndef SO_EE_CODE_ZEROCOPY_COPIED
+        #define SO_EE_CODE_ZEROCOPY_COPIED 1
+    #endif
+#endif
+
+#include <QCoreApplication>
+#include <QThreadStorage>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(logOutputQueue, "OutputQueue")
+
+// The queue is sent at once when it is more than it
+#define FLUSH_THRESHOLD (64 << 10)
+// The most segments sent by a call
+#define IOV_BATCH 64
+// The chunk of a slab which is less than it is copied into the tail slab
+#define COPY_THRESHOLD 4096
+// The interval (ms) of reaping the zerocopy completions
+#define REAP_INTERVAL 1
+// The interval (ms) of reaping the zerocopy completions of the closed sockets
+#define PINNED_INTERVAL 100
+// The closed socket whose zerocopy sends aren't completed in it (ms) is
+// reset, so the kernel purges its write queue and completes them.
+#define PINNED_TIMEOUT 60000
+
+namespace {
+
+std::atomic<quint64> g_nZeroCopy(0);
+std::atomic<quint64> g_nCopied(0);
+std::atomic<quint64> g_nSegments(0);
+std::atomic<quint64> g_nSends(0);
+std::atomic<quint64> g_nBytes(0);
+std::atomic<quint64> g_nFallback(0);
+
+} // namespace
+
+#if defined(Q_OS_LINUX)
+/*!
+ * \brief The reaper of the zerocopy completions of the closed queues of a
+ *        thread. It owns the duplicated sockets and the pinned slabs, and
+ *        gives back a slab only when the kernel completes its send, so a
+ *        slab which is reused is never read by the kernel.
+ */
+class CZeroCopyReaper
+{
+public:
+    //! The reaper of the current thread. It is created at the first call.
+    static CZeroCopyReaper* Instance();
+    ~CZeroCopyReaper();
+
+    //! It owns fd and the slabs
+    void Add(int fd, const QVector<COutputQueue::strPinned>& pinned);
+
+private:
+    CZeroCopyReaper();
+    //! \return true: all sends of the socket are completed
+    static bool Reap(int fd, QVector<COutputQueue::strPinned>& pinned);
+    //! Abort the connection, the kernel purges the write queue
+    static void Reset(int fd);
+    void OnTimer();
+
+    struct strClosed {
+        int fd;
+        QVector<COutputQueue::strPinned> pinned;
+        qint64 nTime; // The time when it is closed
+        bool bReset;
+    };
+    QVector<strClosed> m_Closed;
+    QElapsedTimer m_Clock;
+    CTimingWheel::CTimer m_Timer;
+};
+
+namespace {
+QThreadStorage<CZeroCopyReaper*> g_Reaper;
+} // namespace
+
+CZeroCopyReaper::CZeroCopyReaper() : m_Timer([this]() { OnTimer(); })
+{
+    m_Clock.start();
+}
+
+CZeroCopyReaper::~CZeroCopyReaper()
+{
+    // The thread exits. Reset the sockets, and wait for the kernel a while.
+    for(strClosed& c : m_Closed)
+        Reset(c.fd);
+    for(int i = 0; i < 100 && !m_Closed.isEmpty(); i++)
+    {
+        for(int j = m_Closed.size() - 1; j >= 0; j--)
+        {
+            if(!Reap(m_Closed[j].fd, m_Closed[j].pinned))
+                continue;
+            ::close(m_Closed[j].fd);
+            m_Closed.removeAt(j);
+        }
+        if(!m_Closed.isEmpty())
+            ::usleep(1000);
+    }
+    // The slabs which the kernel may still read aren't given back
+    for(strClosed& c : m_Closed)
+    {
+        qCritical(logOutputQueue) << "The zerocopy sends aren't completed,"
+                                  << "the slabs are leaked:" << c.pinned.size();
+        ::close(c.fd);
+    }
+}
+
+CZeroCopyReaper* CZeroCopyReaper::Instance()
+{
+    // It is deleted when the thread exits
+    if(!g_Reaper.hasLocalData())
+        g_Reaper.setLocalData(new CZeroCopyReaper());
+    return g_Reaper.localData();
+}
+
+void CZeroCopyReaper::Add(int fd, const QVector<COutputQueue::strPinned> &pinned)
+{
+    strClosed c;
+    c.fd = fd;
+    c.pinned = pinned;
+    c.nTime = m_Clock.elapsed();
+    c.bReset = false;
+    m_Closed.push_back(c);
+    if(!m_Timer.IsActive())
+        m_Timer.Start(PINNED_INTERVAL);
+}
+
+bool CZeroCopyReaper::Reap(int fd, QVector<COutputQueue::strPinned> &pinned)
+{
+    quint32 nFirst = 0, nLast = 0;
+    bool bCopied = false;
+    int nRet = 0;
+    while(!pinned.isEmpty()
+           && -1 != (nRet = COutputQueue::ReadCompletion(fd, nFirst, nLast, bCopied)))
+    {
+        if(0 == nRet)
+            COutputQueue::FreeCompleted(pinned, nFirst, nLast);
+    }
+    return pinned.isEmpty();
+}
+
+void CZeroCopyReaper::Reset(int fd)
+{
+    // connect(AF_UNSPEC) disconnects the socket (RST) and purges the write
+    // queue, the completions are still reported to the error queue.
+    struct sockaddr sa = {};
+    sa.sa_family = AF_UNSPEC;
+    ::connect(fd, &sa, sizeof(sa));
+}
+
+void CZeroCopyReaper::OnTimer()
+{
+    qint64 nNow = m_Clock.elapsed();
+    for(int i = m_Closed.size() - 1; i >= 0; i--)
+    {
+        strClosed& c = m_Closed[i];
+        if(Reap(c.fd, c.pinned))
+        {
+            ::close(c.fd);
+            m_Closed.removeAt(i);
+            continue;
+        }
+        if(!c.bReset && nNow - c.nTime >= PINNED_TIMEOUT)
+        {
+            qWarning(logOutputQueue) << "The zerocopy sends of the closed"
+                                     << "socket aren't completed. Reset it";
+            Reset(c.fd);
+            c.bReset = true;
+        }
+    }
+    if(!m_Closed.isEmpty())
+        m_Timer.Start(PINNED_INTERVAL);
+}
+#endif // Q_OS_LINUX
+
+COutputQueue::COutputQueue(QTcpSocket *pSocket, QObject *parent)
+    : QObject(parent),
+    m_pSocket(pSocket),
+    m_nOffset(0),
+    m_nBytes(0),
+    m_bScheduled(false),
+    m_nZeroCopyThreshold(0),
+    m_bZeroCopyEnabled(false),
+    m_nZeroCopyFd(-1),
+    m_nZeroCopySeq(0)
+{
+    m_ReapTimer.setInterval(REAP_INTERVAL);
+    m_ReapTimer.setTimerType(Qt::PreciseTimer);
+    bool check = connect(&m_ReapTimer, &QTimer::timeout,
+                         this, &COutputQueue::slotReap);
+    Q_ASSERT(check);
+}
+
+COutputQueue::~COutputQueue()
+{
+    qDebug(logOutputQueue) << "COutputQueue::~COutputQueue(); segments:"
+                           << m_Statistics.nSegments
+                           << "sends:" << m_Statistics.nSends
+                           << "zerocopy:" << m_Statistics.nZeroCopy
+                           << "copied:" << m_Statistics.nCopied;
+    Clear();
+}
+
+void COutputQueue::SetSocket(QTcpSocket *pSocket)
+{
+    Clear();
+    // The pass scheduled for the old socket is dropped
+    QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
+    m_bScheduled = false;
+    m_pSocket = pSocket;
+    m_Statistics = strStatistics();
+}
+
+void COutputQueue::Clear()
+{
+    for(int i = 0; i < m_Segments.size(); i++)
+        Release(m_Segments[i]);
+    m_Segments.clear();
+    m_nOffset = 0;
+    m_nBytes = 0;
+    Reap();
+#if defined(Q_OS_LINUX)
+    if(-1 != m_nZeroCopyFd)
+    {
+        // The kernel may still send from the slabs after the socket is
+        // closed (eg: FIN_WAIT1, zero window), so they are given back
+        // only when the kernel completes them.
+        if(m_Pinned.isEmpty())
+            ::close(m_nZeroCopyFd);
+        else
+            CZeroCopyReaper::Instance()->Add(m_nZeroCopyFd, m_Pinned);
+        m_nZeroCopyFd = -1;
+    }
+#endif
+    Q_ASSERT(m_Pinned.isEmpty());
+    m_Pinned.clear();
+    m_ReapTimer.stop();
+    m_bZeroCopyEnabled = false;
+    m_nZeroCopySeq = 0;
+}
+
+qint64 COutputQueue::Write(const char *buf, qint64 nLen)
+{
+    if(!m_pSocket || !m_pSocket->isOpen())
+        return -1;
+    if(nLen <= 0)
+        return 0;
+
+    // The data is copied into the slabs of the pool, so the small writes
+    // of a pass share a slab, and a write doesn't allocate memory
+    const char* p = buf;
+    qint64 nLeft = nLen;
+    while(nLeft > 0)
+    {
+        if(!m_Segments.isEmpty())
+        {
+            strSegment& t = m_Segments.last();
+            if(t.pSlab && !t.bPinned && t.nLen < CBufferPool::SLAB_SIZE)
+            {
+                int n = qMin<qint64>(nLeft, CBufferPool::SLAB_SIZE - t.nLen);
+                memcpy(t.pSlab + t.nLen, p, n);
+                t.nLen += n;
+                p += n;
+                nLeft -= n;
+                continue;
+            }
+        }
+        strSegment s;
+        s.pSlab = CBufferPool::Alloc();
+        if(!s.pSlab)
+        {
+            // The pool can't get the memory
+            s.data = QByteArray(p, nLeft);
+            s.nLen = nLeft;
+            nLeft = 0;
+        }
+        m_Segments.push_back(s);
+    }
+    m_nBytes += nLen;
+    m_Statistics.nSegments++;
+    g_nSegments++;
+    if(Schedule())
+        return -1;
+    return nLen;
+}
+
+qint64 COutputQueue::Write(const QByteArray &data)
+{
+    return Write(data.constData(), data.size());
+}
+
+qint64 COutputQueue::Write(CBufferPool::CSlab &slab, qint64 nLen)
+{
+    if(!m_pSocket || !m_pSocket->isOpen())
+        return -1;
+    if(nLen <= 0)
+        return 0;
+    bool bZeroCopy = m_nZeroCopyThreshold > 0 && nLen >= m_nZeroCopyThreshold;
+    // The small chunk is copied, so it doesn't hold a slab
+    if(!bZeroCopy && nLen < COPY_THRESHOLD)
+        return Write(slab.Data(), nLen);
+
+    strSegment s;
+    s.pSlab = slab.Take();
+    s.nLen = nLen;
+    m_Segments.push_back(s);
+    m_nBytes += nLen;
+    m_Statistics.nSegments++;
+    g_nSegments++;
+    // The zerocopy slab is full, so don't wait for the end of the pass
+    if(bZeroCopy)
+    {
+        if(Flush())
+            return -1;
+        return nLen;
+    }
+    if(Schedule())
+        return -1;
+    return nLen;
+}
+
+int COutputQueue::Schedule()
+{
+    if(m_nBytes >= FLUSH_THRESHOLD)
+        return Flush();
+    if(!m_bScheduled)
+    {
+        // It runs after the events which are pending now,
+        // so the writes of this pass are sent together.
+        m_bScheduled = true;
+        QMetaObject::invokeMethod(this, "slotFlush", Qt::QueuedConnection);
+    }
+    return 0;
+}
+
+void COutputQueue::slotFlush()
+{
+    m_bScheduled = false;
+    Flush();
+}
+
+int COutputQueue::Flush()
+{
+    if(m_Segments.isEmpty())
+        return 0;
+    if(!m_pSocket)
+    {
+        for(int i = 0; i < m_Segments.size(); i++)
+            Release(m_Segments[i]);
+        m_Segments.clear();
+        m_nOffset = 0;
+        m_nBytes = 0;
+        return -1;
+    }
+
+    qint64 nSent = 0;
+    // The data in the write buffer of Qt must be sent first
+    if(QAbstractSocket::ConnectedState == m_pSocket->state()
+        && 0 == m_pSocket->bytesToWrite())
+        nSent = Send();
+
+    int nRet = 0;
+    for(int i = 0; i < m_Segments.size(); i++)
+    {
+        strSegment& s = m_Segments[i];
+        int nOffset = 0 == i ? m_nOffset : 0;
+        if(0 == nRet)
+        {
+            m_Statistics.nFallback++;
+            g_nFallback++;
+            if(-1 == m_pSocket->write(s.Data() + nOffset, s.nLen - nOffset))
+            {
+                qCritical(logOutputQueue) << "Write fail:" << m_pSocket->errorString();
+                nRet = -1;
+            }
+        }
+        Release(s);
+    }
+    m_Segments.clear();
+    m_nOffset = 0;
+    m_nBytes = 0;
+
+    if(nSent > 0)
+        emit sigBytesWritten(nSent);
+    return nRet;
+}
+
+qint64 COutputQueue::Send()
+{
+    qint64 nSent = 0;
+#if defined(Q_OS_UNIX)
+    int fd = m_pSocket->socketDescriptor();
+    if(-1 == fd)
+        return 0;
+    if(!m_Pinned.isEmpty())
+        Reap();
+    while(!m_Segments.isEmpty())
+    {
+        // A call is either all zerocopy slabs or all copied segments
+        bool bZeroCopy = IsZeroCopy(m_Segments.front());
+        if(bZeroCopy && EnableZeroCopy(fd))
+            bZeroCopy = false;
+
+        struct iovec iov[IOV_BATCH];
+        int n = 0;
+        qint64 nLen = 0;
+        for(; n < m_Segments.size() && n < IOV_BATCH; n++)
+        {
+            const strSegment& s = m_Segments.at(n);
+            if(n > 0 && bZeroCopy != IsZeroCopy(s))
+                break;
+            int nOffset = 0 == n ? m_nOffset : 0;
+            iov[n].iov_base = const_cast<char*>(s.Data()) + nOffset;
+            iov[n].iov_len = s.nLen - nOffset;
+            nLen += iov[n].iov_len;
+        }
+
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        flags |= MSG_NOSIGNAL;
+#endif
+#ifdef MSG_MORE
+        // The next call continues the packet
+        if(n < m_Segments.size())
+            flags |= MSG_MORE;
+#endif
+#if defined(Q_OS_LINUX)
+        if(bZeroCopy)
+            flags |= MSG_ZEROCOPY;
+#endif
+        ssize_t r = ::sendmsg(fd, &msg, flags);
+        if(r < 0)
+        {
+            if(EINTR == errno)
+                continue;
+            // ENOBUFS: the pages can't be pinned (optmem_max)
+            if(bZeroCopy && ENOBUFS == errno)
+            {
+                qDebug(logOutputQueue) << "The zerocopy send fail. Switch it off";
+                m_nZeroCopyThreshold = 0;
+                continue;
+            }
+            // EAGAIN: the rest is sent by Qt.
+            // The other errors are reported by Qt when it writes the rest.
+            break;
+        }
+        m_Statistics.nSends++;
+        m_Statistics.nBytes += r;
+        g_nSends++;
+        g_nBytes += r;
+        nSent += r;
+        if(bZeroCopy)
+        {
+            // The kernel references the slabs which are sent at least partly
+            qint64 nLeft = r;
+            for(int i = 0; i < n && nLeft > 0; i++)
+            {
+                strSegment& s = m_Segments[i];
+                nLeft -= iov[i].iov_len;
+                if(s.bPinned)
+                {
+                    // The rest of the slab is sent. Keep it until this send
+                    for(int j = m_Pinned.size() - 1; j >= 0; j--)
+                    {
+                        if(m_Pinned.at(j).pSlab != s.pSlab) continue;
+                        m_Pinned[j].nSeq = m_nZeroCopySeq;
+                        break;
+                    }
+                    continue;
+                }
+                strPinned p = {m_nZeroCopySeq, s.pSlab};
+                m_Pinned.push_back(p);
+                s.bPinned = true;
+            }
+            m_nZeroCopySeq++;
+            if(!m_ReapTimer.isActive())
+                m_ReapTimer.start();
+        }
+        Consume(r);
+        if(r < nLen)
+            break;
+    }
+#endif
+    return nSent;
+}
+
+void COutputQueue::Consume(qint64 nBytes)
+{
+    m_nBytes -= nBytes;
+    while(nBytes > 0 && !m_Segments.isEmpty())
+    {
+        qint64 nLeft = m_Segments.front().nLen - m_nOffset;
+        if(nBytes < nLeft)
+        {
+            m_nOffset += nBytes;
+            return;
+        }
+        nBytes -= nLeft;
+        m_nOffset = 0;
+        Release(m_Segments.front());
+        m_Segments.pop_front();
+    }
+}
+
+void COutputQueue::Release(strSegment &s)
+{
+    // The pinned slab is given back when the zerocopy send is completed
+    if(s.pSlab && !s.bPinned)
+        CBufferPool::Free(s.pSlab);
+    s.pSlab = nullptr;
+}
+
+bool COutputQueue::IsZeroCopy(const strSegment &s)
+{
+    return s.pSlab && m_nZeroCopyThreshold > 0
+           && s.nLen >= m_nZeroCopyThreshold;
+}
+
+int COutputQueue::EnableZeroCopy(int fd)
+{
+#if defined(Q_OS_LINUX)
+    if(m_bZeroCopyEnabled)
+        return 0;
+    int one = 1;
+    if(0 == ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+    {
+        // The completions are reaped after the socket is closed by Qt
+        m_nZeroCopyFd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if(-1 != m_nZeroCopyFd)
+        {
+            m_bZeroCopyEnabled = true;
+            return 0;
+        }
+    }
+    qWarning(logOutputQueue) << "Enable the zerocopy fail:" << errno;
+#else
+    Q_UNUSED(fd)
+#endif
+    m_nZeroCopyThreshold = 0;
+    return -1;
+}
+
+void COutputQueue::slotReap()
+{
+    bool bPinned = !m_Pinned.isEmpty();
+    Reap();
+    // The owner may wait for the completions. \see IsPinned()
+    if(bPinned && m_Pinned.isEmpty())
+        emit sigBytesWritten(0);
+}
+
+void COutputQueue::Reap()
+{
+    quint32 nFirst = 0, nLast = 0;
+    bool bCopied = false;
+    int nRet = 0;
+    while(-1 != m_nZeroCopyFd && !m_Pinned.isEmpty()
+           && -1 != (nRet = ReadCompletion(m_nZeroCopyFd, nFirst, nLast, bCopied)))
+    {
+        if(0 == nRet)
+            OnCompleted(nFirst, nLast, bCopied);
+    }
+    if(m_Pinned.isEmpty())
+        m_ReapTimer.stop();
+}
+
+int COutputQueue::ReadCompletion(int fd, quint32 &nFirst, quint32 &nLast,
+                                 bool &bCopied)
+{
+#if defined(Q_OS_LINUX)
+    char control[128];
+    struct msghdr msg = {};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if(::recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+        return -1; // EAGAIN: no completion
+    for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm;
+         cm = CMSG_NXTHDR(&msg, cm))
+    {
+        if(!(SOL_IP == cm->cmsg_level && IP_RECVERR == cm->cmsg_type)
+            && !(SOL_IPV6 == cm->cmsg_level && IPV6_RECVERR == cm->cmsg_type))
+            continue;
+        struct sock_extended_err* ee
+            = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+        if(ee->ee_errno || SO_EE_ORIGIN_ZEROCOPY != ee->ee_origin)
+            continue;
+        // The sends [ee_info, ee_data] are completed
+        nFirst = ee->ee_info;
+        nLast = ee->ee_data;
+        bCopied = ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+        return 0;
+    }
+    return 1;
+#else
+    Q_UNUSED(fd)
+    Q_UNUSED(nFirst)
+    Q_UNUSED(nLast)
+    Q_UNUSED(bCopied)
+    return -1;
+#endif
+}
+
+void COutputQueue::FreeCompleted(QVector<strPinned> &pinned,
+                                 quint32 nFirst, quint32 nLast)
+{
+    for(int i = 0; i < pinned.size();)
+    {
+        const strPinned& p = pinned.at(i);
+        if((quint32)(p.nSeq - nFirst) <= (quint32)(nLast - nFirst))
+        {
+            CBufferPool::Free(p.pSlab);
+            pinned.removeAt(i);
+            continue;
+        }
+        i++;
+    }
+}
+
+void COutputQueue::OnCompleted(quint32 nFirst, quint32 nLast, bool bCopied)
+{
+    quint64 n = (quint32)(nLast - nFirst) + 1;
+    if(bCopied)
+    {
+        m_Statistics.nCopied += n;
+        g_nCopied += n;
+        if(m_nZeroCopyThreshold > 0)
+        {
+            qDebug(logOutputQueue) << "The kernel copies the zerocopy send. Switch it off";
+            m_nZeroCopyThreshold = 0;
+        }
+    } else {
+        m_Statistics.nZeroCopy += n;
+        g_nZeroCopy += n;
+    }
+
+    FreeCompleted(m_Pinned, nFirst, nLast);
+}
+
+void COutputQueue::SetZeroCopyThreshold(qint64 nBytes)
+{
+#if !defined(Q_OS_LINUX)
+    if(nBytes > 0)
+    {
+        qWarning(logOutputQueue) << "The zerocopy is only supported on linux";
+        nBytes = 0;
+    }
+#endif
+    m_nZeroCopyThreshold = nBytes;
+}
+
+bool COutputQueue::IsPinned()
+{
+    return !m_Pinned.isEmpty();
+}
+
+qint64 COutputQueue::BytesToWrite()
+{
+    qint64 n = m_nBytes;
+    if(m_pSocket)
+        n += m_pSocket->bytesToWrite();
+    return n;
+}
+
+COutputQueue::strStatistics COutputQueue::GetStatistics()
+{
+    return m_Statistics;
+}
+
+COutputQueue::strStatistics COutputQueue::GetTotalStatistics()
+{
+    strStatistics st;
+    st.nSegments = g_nSegments;
+    st.nSends = g_nSends;
+    st.nBytes = g_nBytes;
+    st.nFallback = g_nFallback;
+    st.nZeroCopy = g_nZeroCopy;
+    st.nCopied = g_nCopied;
+    return st;
+}
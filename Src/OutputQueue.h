@@ -0,0 +1,191 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef COUTPUTQUEUE_H
+#define COUTPUTQUEUE_H
+
+#pragma once
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QPointer>
+#include <QTimer>
+#include <QVector>
+#include <QByteArray>
+#include "rabbitproxy_export.h"
+#include "BufferPool.h"
+
+/*!
+ * \brief The output queue of a TCP connection.
+ *        The segments written in an event-loop pass are gathered, and are
+ *        sent with one writev-like call (sendmsg) when the pass ends.
+ *        So the handshake replies and the small forwarded chunks don't cost
+ *        a syscall and a packet each. When the segments need more than one
+ *        call, MSG_MORE is set on all but the last one, so the kernel
+ *        doesn't push a partial packet between them.
+ *
+ *        The data which can't be sent without blocking is given to the
+ *        QTcpSocket, so the order is kept and Qt sends it later.
+ *        On the systems without sendmsg, the segments are given to the
+ *        QTcpSocket in a pass.
+ *
+ *        The segments are the slabs of the buffer pool. The forwarded
+ *        slabs are taken by the queue, and the small writes are copied into
+ *        the tail slab, so the queue doesn't allocate memory.
+ *        On linux, the slabs may be sent with MSG_ZEROCOPY.
+ *        \see SetZeroCopyThreshold()
+ */
+class RABBITPROXY_EXPORT COutputQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit COutputQueue(QTcpSocket* pSocket, QObject *parent = nullptr);
+    virtual ~COutputQueue();
+
+    /*!
+     * \brief Append a segment. It is sent at the end of the event-loop pass,
+     *        or at once if the queue is more than the flush threshold.
+     *        It is copied into the slabs of the queue.
+     * \return the bytes of the segment, or -1 if the socket isn't open
+     */
+    qint64 Write(const char* buf, qint64 nLen);
+    qint64 Write(const QByteArray& data);
+    /*!
+     * \brief Append the first nLen bytes of the slab.
+     *        The queue takes the slab, and a new slab is put into slab.
+     *        The data of a small chunk is copied instead.
+     *        The slab is sent at once if it may be sent with zero copy.
+     * \note slab.Data() is nullptr if the pool can't get a new slab
+     * \see Write(const char*, qint64)
+     */
+    qint64 Write(CBufferPool::CSlab& slab, qint64 nLen);
+    /*!
+     * \brief Send the queued segments now.
+     * \return 0: success; -1: fail
+     */
+    int Flush();
+    //! The bytes in the queue and in the write buffer of the socket
+    qint64 BytesToWrite();
+    /*!
+     * \brief Drop the queued segments, and use the queue for the socket.
+     *        It is used when the owner is reused. \see CObjectPool
+     * \note Flush() before it if the segments should be sent
+     */
+    void SetSocket(QTcpSocket* pSocket);
+
+    /*!
+     * \brief The slabs which are written with at least nBytes are sent
+     *        with MSG_ZEROCOPY. The slab is kept until the kernel reports
+     *        the completion in the error queue of the socket.
+     *        It is switched off on the socket if it fails to be enabled,
+     *        or the kernel reports that it copied the data (eg: loopback),
+     *        because then it costs more than a copy.
+     * \param nBytes: 0 is off (default). It is only supported on linux 4.14
+     *        and later. It is recommended to be more than 10 KiB.
+     */
+    void SetZeroCopyThreshold(qint64 nBytes);
+    /*!
+     * \brief Whether the kernel still references the slabs sent with
+     *        MSG_ZEROCOPY. sigBytesWritten(0) is emitted when they are
+     *        completed.
+     */
+    bool IsPinned();
+
+    struct strStatistics {
+        //! The segments written to the queue
+        quint64 nSegments = 0;
+        //! The calls of sendmsg
+        quint64 nSends = 0;
+        //! The bytes sent by sendmsg
+        quint64 nBytes = 0;
+        //! The segments given to the QTcpSocket
+        quint64 nFallback = 0;
+        //! The zerocopy sends which the kernel completed without copy
+        quint64 nZeroCopy = 0;
+        //! The zerocopy sends which the kernel completed by copy
+        quint64 nCopied = 0;
+    };
+    strStatistics GetStatistics();
+    //! The sum of the statistics of all queues
+    static strStatistics GetTotalStatistics();
+
+Q_SIGNALS:
+    /*!
+     * \brief The bytes sent by the queue directly. \see QIODevice::bytesWritten()
+     *        It is 0 when the zerocopy sends are completed. \see IsPinned()
+     */
+    void sigBytesWritten(qint64 nBytes);
+
+private Q_SLOTS:
+    void slotFlush();
+    //! Reap the zerocopy completions
+    void slotReap();
+
+private:
+    struct strSegment {
+        //! It is only used when the pool can't get a slab
+        QByteArray data;
+        //! The slab owned by the queue
+        char* pSlab = nullptr;
+        int nLen = 0;
+        //! The slab has been given to m_Pinned
+        bool bPinned = false;
+        const char* Data() const { return pSlab ? pSlab : data.constData(); }
+    };
+    //! A slab which is referenced by the zerocopy send nSeq
+    struct strPinned {
+        quint32 nSeq;
+        char* pSlab;
+    };
+
+    friend class CZeroCopyReaper;
+
+    qint64 Send();
+    //! Flush at the end of the pass, or at once if the queue is full
+    int Schedule();
+    /*!
+     * \brief Drop the segments. The pinned slabs are handed to the reaper
+     *        of the thread with the duplicated socket, and are given back
+     *        when the kernel completes them.
+     */
+    void Clear();
+    //! Reap the zerocopy completions without the signal
+    void Reap();
+    void Consume(qint64 nBytes);
+    void Release(strSegment& s);
+    bool IsZeroCopy(const strSegment& s);
+    int EnableZeroCopy(int fd);
+    void OnCompleted(quint32 nFirst, quint32 nLast, bool bCopied);
+    /*!
+     * \brief Read a completion from the error queue of the socket
+     * \return 0: the zerocopy sends [nFirst, nLast] are completed
+     *         1: it isn't a zerocopy completion
+     *         -1: the error queue is empty
+     */
+    static int ReadCompletion(int fd, quint32& nFirst, quint32& nLast,
+                              bool& bCopied);
+    //! Give back the slabs of the completed sends [nFirst, nLast]
+    static void FreeCompleted(QVector<strPinned>& pinned,
+                              quint32 nFirst, quint32 nLast);
+
+    QPointer<QTcpSocket> m_pSocket;
+    QVector<strSegment> m_Segments;
+    int m_nOffset; // The bytes of the first segment which have been sent
+    qint64 m_nBytes; // The bytes in the queue
+    bool m_bScheduled; // slotFlush() is posted to the event queue
+    strStatistics m_Statistics;
+
+    qint64 m_nZeroCopyThreshold;
+    bool m_bZeroCopyEnabled; // SO_ZEROCOPY is set on the socket
+    /*!
+     * The duplicate of the socket when the zerocopy is enabled.
+     * The kernel reads the pinned slabs until they are completed, even if
+     * the socket is closed, so the completions are reaped through it.
+     */
+    int m_nZeroCopyFd;
+    quint32 m_nZeroCopySeq; // The sequence of the next zerocopy send
+    QVector<strPinned> m_Pinned;
+    QTimer m_ReapTimer;
+};
+
+#endif // COUTPUTQUEUE_H
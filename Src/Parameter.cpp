@@ -4,7 +4,30 @@
 #include <QDebug>
 
 CParameter::CParameter(QObject *parent) : QObject(parent),
-    m_nPort(0)
+    m_nPort(0),
+    m_nWorkers(0),
+    m_nProcesses(0),
+    m_nListenBacklog(0),
+    m_nMaxPendingConnections(128),
+    m_nAcceptBudget(64),
+    m_nMaxConnections(0),
+    m_nMaxHandshakes(0),
+    m_Relay(emRelay::Qt),
+    m_nHighWatermark(1 << 20),
+    m_nLowWatermark(256 << 10),
+    m_bHugePages(false),
+    m_nReadBudget(64 << 10),
+    m_nZeroCopyThreshold(0),
+    m_nHandshakeTimeout(30000),
+    m_nConnectTimeout(30000),
+    m_nIdleTimeout(0),
+    m_nConnectAttemptDelay(250),
+    m_nConnectAttemptTimeout(10000),
+    m_nPoolSize(1024),
+    m_nResolverTtl(60000),
+    m_nResolverNegativeTtl(5000),
+    m_nResolverCacheSize(4096),
+    m_nResolverPrefetch(0)
 {
 }
 
@@ -22,15 +45,291 @@ void CParameter::SetPort(quint16 port)
     m_nPort = port;
 }
 
+int CParameter::GetWorkers()
+{
+    return m_nWorkers;
+}
+
+void CParameter::SetWorkers(int nWorkers)
+{
+    m_nWorkers = nWorkers;
+}
+
+int CParameter::GetProcesses()
+{
+    return m_nProcesses;
+}
+
+void CParameter::SetProcesses(int nProcesses)
+{
+    m_nProcesses = nProcesses;
+}
+
+int CParameter::GetListenBacklog()
+{
+    return m_nListenBacklog;
+}
+
+void CParameter::SetListenBacklog(int nListenBacklog)
+{
+    m_nListenBacklog = nListenBacklog;
+}
+
+int CParameter::GetMaxPendingConnections()
+{
+    return m_nMaxPendingConnections;
+}
+
+void CParameter::SetMaxPendingConnections(int nMaxPendingConnections)
+{
+    m_nMaxPendingConnections = nMaxPendingConnections;
+}
+
+int CParameter::GetAcceptBudget()
+{
+    return m_nAcceptBudget;
+}
+
+void CParameter::SetAcceptBudget(int nAcceptBudget)
+{
+    m_nAcceptBudget = nAcceptBudget;
+}
+
+int CParameter::GetMaxConnections()
+{
+    return m_nMaxConnections;
+}
+
+void CParameter::SetMaxConnections(int nMaxConnections)
+{
+    m_nMaxConnections = nMaxConnections;
+}
+
+int CParameter::GetMaxHandshakes()
+{
+    return m_nMaxHandshakes;
+}
+
+void CParameter::SetMaxHandshakes(int nMaxHandshakes)
+{
+    m_nMaxHandshakes = nMaxHandshakes;
+}
+
+CParameter::emRelay CParameter::GetRelay()
+{
+    return m_Relay;
+}
+
+void CParameter::SetRelay(emRelay relay)
+{
+    m_Relay = relay;
+}
+
+qint64 CParameter::GetHighWatermark()
+{
+    return m_nHighWatermark;
+}
+
+void CParameter::SetHighWatermark(qint64 nBytes)
+{
+    m_nHighWatermark = nBytes;
+}
+
+qint64 CParameter::GetLowWatermark()
+{
+    return m_nLowWatermark;
+}
+
+void CParameter::SetLowWatermark(qint64 nBytes)
+{
+    m_nLowWatermark = nBytes;
+}
+
+bool CParameter::GetHugePages()
+{
+    return m_bHugePages;
+}
+
+void CParameter::SetHugePages(bool bHugePages)
+{
+    m_bHugePages = bHugePages;
+}
+
+qint64 CParameter::GetReadBudget()
+{
+    return m_nReadBudget;
+}
+
+void CParameter::SetReadBudget(qint64 nBytes)
+{
+    m_nReadBudget = nBytes;
+}
+
+qint64 CParameter::GetZeroCopyThreshold()
+{
+    return m_nZeroCopyThreshold;
+}
+
+void CParameter::SetZeroCopyThreshold(qint64 nBytes)
+{
+    m_nZeroCopyThreshold = nBytes;
+}
+
+int CParameter::GetHandshakeTimeout()
+{
+    return m_nHandshakeTimeout;
+}
+
+void CParameter::SetHandshakeTimeout(int nMs)
+{
+    m_nHandshakeTimeout = nMs;
+}
+
+int CParameter::GetConnectTimeout()
+{
+    return m_nConnectTimeout;
+}
+
+void CParameter::SetConnectTimeout(int nMs)
+{
+    m_nConnectTimeout = nMs;
+}
+
+int CParameter::GetIdleTimeout()
+{
+    return m_nIdleTimeout;
+}
+
+void CParameter::SetIdleTimeout(int nMs)
+{
+    m_nIdleTimeout = nMs;
+}
+
+int CParameter::GetConnectAttemptDelay()
+{
+    return m_nConnectAttemptDelay;
+}
+
+void CParameter::SetConnectAttemptDelay(int nMs)
+{
+    m_nConnectAttemptDelay = nMs;
+}
+
+int CParameter::GetConnectAttemptTimeout()
+{
+    return m_nConnectAttemptTimeout;
+}
+
+void CParameter::SetConnectAttemptTimeout(int nMs)
+{
+    m_nConnectAttemptTimeout = nMs;
+}
+
+int CParameter::GetPoolSize()
+{
+    return m_nPoolSize;
+}
+
+void CParameter::SetPoolSize(int nSize)
+{
+    m_nPoolSize = nSize;
+}
+
+int CParameter::GetResolverTtl()
+{
+    return m_nResolverTtl;
+}
+
+void CParameter::SetResolverTtl(int nMs)
+{
+    m_nResolverTtl = nMs;
+}
+
+int CParameter::GetResolverNegativeTtl()
+{
+    return m_nResolverNegativeTtl;
+}
+
+void CParameter::SetResolverNegativeTtl(int nMs)
+{
+    m_nResolverNegativeTtl = nMs;
+}
+
+int CParameter::GetResolverCacheSize()
+{
+    return m_nResolverCacheSize;
+}
+
+void CParameter::SetResolverCacheSize(int nSize)
+{
+    m_nResolverCacheSize = nSize;
+}
+
+int CParameter::GetResolverPrefetch()
+{
+    return m_nResolverPrefetch;
+}
+
+void CParameter::SetResolverPrefetch(int nHits)
+{
+    m_nResolverPrefetch = nHits;
+}
+
 int CParameter::Save(QSettings &set)
 {
     set.setValue(Name() + "Port", m_nPort);
+    set.setValue(Name() + "Workers", m_nWorkers);
+    set.setValue(Name() + "Processes", m_nProcesses);
+    set.setValue(Name() + "Accept/Backlog", m_nListenBacklog);
+    set.setValue(Name() + "Accept/MaxPendingConnections", m_nMaxPendingConnections);
+    set.setValue(Name() + "Accept/Budget", m_nAcceptBudget);
+    set.setValue(Name() + "Admission/MaxConnections", m_nMaxConnections);
+    set.setValue(Name() + "Admission/MaxHandshakes", m_nMaxHandshakes);
+    set.setValue(Name() + "Relay/Type", (int)m_Relay);
+    set.setValue(Name() + "Forward/HighWatermark", m_nHighWatermark);
+    set.setValue(Name() + "Forward/LowWatermark", m_nLowWatermark);
+    set.setValue(Name() + "Forward/HugePages", m_bHugePages);
+    set.setValue(Name() + "Forward/ReadBudget", m_nReadBudget);
+    set.setValue(Name() + "Forward/ZeroCopyThreshold", m_nZeroCopyThreshold);
+    set.setValue(Name() + "Timeout/Handshake", m_nHandshakeTimeout);
+    set.setValue(Name() + "Timeout/Connect", m_nConnectTimeout);
+    set.setValue(Name() + "Timeout/Idle", m_nIdleTimeout);
+    set.setValue(Name() + "Connect/AttemptDelay", m_nConnectAttemptDelay);
+    set.setValue(Name() + "Connect/AttemptTimeout", m_nConnectAttemptTimeout);
+    set.setValue(Name() + "Pool/Size", m_nPoolSize);
+    set.setValue(Name() + "Resolver/Ttl", m_nResolverTtl);
+    set.setValue(Name() + "Resolver/NegativeTtl", m_nResolverNegativeTtl);
+    set.setValue(Name() + "Resolver/CacheSize", m_nResolverCacheSize);
+    set.setValue(Name() + "Resolver/Prefetch", m_nResolverPrefetch);
     return 0;
 }
 
 int CParameter::Load(QSettings &set)
 {
     m_nPort = set.value(Name() + "Port", m_nPort).toUInt();
+    m_nWorkers = set.value(Name() + "Workers", m_nWorkers).toInt();
+    m_nProcesses = set.value(Name() + "Processes", m_nProcesses).toInt();
+    m_nListenBacklog = set.value(Name() + "Accept/Backlog", m_nListenBacklog).toInt();
+    m_nMaxPendingConnections = set.value(Name() + "Accept/MaxPendingConnections", m_nMaxPendingConnections).toInt();
+    m_nAcceptBudget = set.value(Name() + "Accept/Budget", m_nAcceptBudget).toInt();
+    m_nMaxConnections = set.value(Name() + "Admission/MaxConnections", m_nMaxConnections).toInt();
+    m_nMaxHandshakes = set.value(Name() + "Admission/MaxHandshakes", m_nMaxHandshakes).toInt();
+    m_Relay = (emRelay)set.value(Name() + "Relay/Type", (int)m_Relay).toInt();
+    m_nHighWatermark = set.value(Name() + "Forward/HighWatermark", m_nHighWatermark).toLongLong();
+    m_nLowWatermark = set.value(Name() + "Forward/LowWatermark", m_nLowWatermark).toLongLong();
+    m_bHugePages = set.value(Name() + "Forward/HugePages", m_bHugePages).toBool();
+    m_nReadBudget = set.value(Name() + "Forward/ReadBudget", m_nReadBudget).toLongLong();
+    m_nZeroCopyThreshold = set.value(Name() + "Forward/ZeroCopyThreshold", m_nZeroCopyThreshold).toLongLong();
+    m_nHandshakeTimeout = set.value(Name() + "Timeout/Handshake", m_nHandshakeTimeout).toInt();
+    m_nConnectTimeout = set.value(Name() + "Timeout/Connect", m_nConnectTimeout).toInt();
+    m_nIdleTimeout = set.value(Name() + "Timeout/Idle", m_nIdleTimeout).toInt();
+    m_nConnectAttemptDelay = set.value(Name() + "Connect/AttemptDelay", m_nConnectAttemptDelay).toInt();
+    m_nConnectAttemptTimeout = set.value(Name() + "Connect/AttemptTimeout", m_nConnectAttemptTimeout).toInt();
+    m_nPoolSize = set.value(Name() + "Pool/Size", m_nPoolSize).toInt();
+    m_nResolverTtl = set.value(Name() + "Resolver/Ttl", m_nResolverTtl).toInt();
+    m_nResolverNegativeTtl = set.value(Name() + "Resolver/NegativeTtl", m_nResolverNegativeTtl).toInt();
+    m_nResolverCacheSize = set.value(Name() + "Resolver/CacheSize", m_nResolverCacheSize).toInt();
+    m_nResolverPrefetch = set.value(Name() + "Resolver/Prefetch", m_nResolverPrefetch).toInt();
     return 0;
 }
 
@@ -16,6 +16,29 @@ class RABBITPROXY_EXPORT CParameter : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(quint16 Port READ GetPort WRITE SetPort)
+    Q_PROPERTY(int Workers READ GetWorkers WRITE SetWorkers)
+    Q_PROPERTY(int Processes READ GetProcesses WRITE SetProcesses)
+    Q_PROPERTY(int ListenBacklog READ GetListenBacklog WRITE SetListenBacklog)
+    Q_PROPERTY(int MaxPendingConnections READ GetMaxPendingConnections WRITE SetMaxPendingConnections)
+    Q_PROPERTY(int AcceptBudget READ GetAcceptBudget WRITE SetAcceptBudget)
+    Q_PROPERTY(int MaxConnections READ GetMaxConnections WRITE SetMaxConnections)
+    Q_PROPERTY(int MaxHandshakes READ GetMaxHandshakes WRITE SetMaxHandshakes)
+    Q_PROPERTY(emRelay Relay READ GetRelay WRITE SetRelay)
+    Q_PROPERTY(qint64 HighWatermark READ GetHighWatermark WRITE SetHighWatermark)
+    Q_PROPERTY(qint64 LowWatermark READ GetLowWatermark WRITE SetLowWatermark)
+    Q_PROPERTY(bool HugePages READ GetHugePages WRITE SetHugePages)
+    Q_PROPERTY(qint64 ReadBudget READ GetReadBudget WRITE SetReadBudget)
+    Q_PROPERTY(qint64 ZeroCopyThreshold READ GetZeroCopyThreshold WRITE SetZeroCopyThreshold)
+    Q_PROPERTY(int HandshakeTimeout READ GetHandshakeTimeout WRITE SetHandshakeTimeout)
+    Q_PROPERTY(int ConnectTimeout READ GetConnectTimeout WRITE SetConnectTimeout)
+    Q_PROPERTY(int IdleTimeout READ GetIdleTimeout WRITE SetIdleTimeout)
+    Q_PROPERTY(int ConnectAttemptDelay READ GetConnectAttemptDelay WRITE SetConnectAttemptDelay)
+    Q_PROPERTY(int ConnectAttemptTimeout READ GetConnectAttemptTimeout WRITE SetConnectAttemptTimeout)
+    Q_PROPERTY(int PoolSize READ GetPoolSize WRITE SetPoolSize)
+    Q_PROPERTY(int ResolverTtl READ GetResolverTtl WRITE SetResolverTtl)
+    Q_PROPERTY(int ResolverNegativeTtl READ GetResolverNegativeTtl WRITE SetResolverNegativeTtl)
+    Q_PROPERTY(int ResolverCacheSize READ GetResolverCacheSize WRITE SetResolverCacheSize)
+    Q_PROPERTY(int ResolverPrefetch READ GetResolverPrefetch WRITE SetResolverPrefetch)
 
 public:
     explicit CParameter(QObject *parent = nullptr);
@@ -27,6 +50,189 @@ public:
     quint16 GetPort();
     void SetPort(quint16 port);
     
+    /*!
+     * \brief The number of worker threads.
+     *        - 0: accept and forward in the thread of the server (default)
+     *        - > 0: every worker thread has itself event loop and
+     *               listening socket (SO_REUSEPORT) at GetPort(),
+     *               the kernel spreads connections across them.
+     */
+    int GetWorkers();
+    void SetWorkers(int nWorkers);
+    /*!
+     * \brief The number of worker processes of the service.
+     *        - 0 or 1: the service serves in itself process (default)
+     *        - > 1: the service forks the number of worker processes,
+     *               they share one listening socket. The service is the
+     *               supervisor, it restarts the crashed worker processes.
+     * \note Only is supported on unix
+     */
+    int GetProcesses();
+    void SetProcesses(int nProcesses);
+    /*!
+     * \brief The backlog of the listening socket.
+     *        0: the maximum of the system (SOMAXCONN)
+     * \note It is clamped by net.core.somaxconn on linux
+     */
+    int GetListenBacklog();
+    void SetListenBacklog(int nListenBacklog);
+    /*!
+     * \brief The maximum number of pending accepted connections
+     *        of QTcpServer. The default of Qt is 30.
+     * \see QTcpServer::setMaxPendingConnections
+     */
+    int GetMaxPendingConnections();
+    void SetMaxPendingConnections(int nMaxPendingConnections);
+    /*!
+     * \brief The maximum number of connections accepted
+     *        in one event loop iteration. 0: no limit
+     */
+    int GetAcceptBudget();
+    void SetAcceptBudget(int nAcceptBudget);
+    /*!
+     * \brief The maximum number of connections. 0: no limit.
+     *        When it is reached, the server pauses accepting,
+     *        the connections are queued in the listen backlog of the kernel.
+     */
+    int GetMaxConnections();
+    void SetMaxConnections(int nMaxConnections);
+    /*!
+     * \brief The maximum number of connections in handshake,
+     *        look up and connect. 0: no limit.
+     * \see GetMaxConnections()
+     */
+    int GetMaxHandshakes();
+    void SetMaxHandshakes(int nMaxHandshakes);
+    
+    //! The relay of the forwarding after the handshake
+    enum class emRelay {
+        Qt,     //!< Forward by the signals of Qt (default)
+        Epoll,  //!< Forward by the native epoll loop. Only is supported on linux
+        IoUring,//!< Forward by io_uring. It needs WITH_IO_URING and linux 6.0.
+                //!< Fall back to Epoll if the kernel doesn't support it.
+        Splice, //!< Forward by splice() through pipes with epoll.
+                //!< The data isn't copied to user space. Only is supported on linux
+        Sockmap //!< Redirect by the eBPF sockmap in the kernel.
+                //!< It needs CAP_BPF and CAP_NET_ADMIN.
+                //!< Fall back to Epoll if it isn't supported.
+    };
+    Q_ENUM(emRelay)
+    /*!
+     * \brief The relay of the direct TCP connections after the handshake.
+     *        The connections through ICE are always forwarded by Qt.
+     *        If the relay isn't supported, fall back to Qt.
+     * \see CRelay
+     */
+    emRelay GetRelay();
+    void SetRelay(emRelay relay);
+
+    /*!
+     * \brief The high watermark of the forwarding by Qt.
+     *        When the bytes waiting to be written to a side are more than it,
+     *        the proxy stops reading from the other side. 0: no limit
+     * \see GetLowWatermark()
+     */
+    qint64 GetHighWatermark();
+    void SetHighWatermark(qint64 nBytes);
+    /*!
+     * \brief The low watermark of the forwarding by Qt.
+     *        When the bytes waiting to be written to a side are less than or
+     *        equal to it, the proxy resumes reading from the other side.
+     *        It is also the size of the read buffer of the paused side.
+     * \see GetHighWatermark()
+     */
+    qint64 GetLowWatermark();
+    void SetLowWatermark(qint64 nBytes);
+    /*!
+     * \brief Whether the buffers of the forwarding are allocated in huge pages
+     * \see CBufferPool::SetHugePages()
+     */
+    bool GetHugePages();
+    void SetHugePages(bool bHugePages);
+    /*!
+     * \brief The most bytes read from a side of a connection in a wakeup.
+     *        When it is used up, the remaining data is forwarded in a later
+     *        pass of the event loop, so the connections are served in turn.
+     *        0: no limit
+     * \see CServer::GetForwardStatistics()
+     */
+    qint64 GetReadBudget();
+    void SetReadBudget(qint64 nBytes);
+    /*!
+     * \brief The forwarded chunks to the client which are at least it are
+     *        sent with MSG_ZEROCOPY. 0: off (default). Only on linux.
+     * \see COutputQueue::SetZeroCopyThreshold()
+     */
+    qint64 GetZeroCopyThreshold();
+    void SetZeroCopyThreshold(qint64 nBytes);
+    /*!
+     * \brief The time (ms) from accepting to the end of the request
+     *        of the client. 0: no limit
+     * \see CServer::GetTimeouts()
+     */
+    int GetHandshakeTimeout();
+    void SetHandshakeTimeout(int nMs);
+    /*!
+     * \brief The time (ms) of looking up and connecting to the peer.
+     *        0: no limit
+     */
+    int GetConnectTimeout();
+    void SetConnectTimeout(int nMs);
+    /*!
+     * \brief The connection which doesn't forward any data in it (ms)
+     *        is closed. 0: no limit (default)
+     * \note The sessions in the native relays aren't limited
+     */
+    int GetIdleTimeout();
+    void SetIdleTimeout(int nMs);
+    /*!
+     * \brief The time (ms) before the next address of the host name is
+     *        attempted when the last attempt doesn't complete.
+     *        The default is 250 (RFC 8305).
+     * \see CPeerConnector::SetConnectAttempt()
+     */
+    int GetConnectAttemptDelay();
+    void SetConnectAttemptDelay(int nMs);
+    /*!
+     * \brief The time (ms) of connecting to an address of the host name.
+     *        The next address is attempted at once when it times out.
+     *        0: no limit. The default is 10000.
+     * \see GetConnectTimeout()
+     */
+    int GetConnectAttemptTimeout();
+    void SetConnectAttemptTimeout(int nMs);
+    /*!
+     * \brief The maximum of the closed sessions of a type which a thread
+     *        keeps for reusing. 0: off. The default is 1024.
+     * \see CObjectPool
+     */
+    int GetPoolSize();
+    void SetPoolSize(int nSize);
+    /*!
+     * \brief The time (ms) which the addresses of a host name are cached.
+     *        0: off. The default is 60000.
+     * \note The system resolver doesn't give the TTL of the records,
+     *       so it shouldn't be longer than the TTL of the names.
+     * \see CResolver
+     */
+    int GetResolverTtl();
+    void SetResolverTtl(int nMs);
+    /*!
+     * \brief The time (ms) which a host name that isn't found is cached.
+     *        0: off. The default is 5000.
+     */
+    int GetResolverNegativeTtl();
+    void SetResolverNegativeTtl(int nMs);
+    //! The most host names in the cache of a thread. The default is 4096.
+    int GetResolverCacheSize();
+    void SetResolverCacheSize(int nSize);
+    /*!
+     * \brief A host name which is hit at least it in the TTL is looked up
+     *        again before it expires. 0: off (default)
+     */
+    int GetResolverPrefetch();
+    void SetResolverPrefetch(int nHits);
+
 Q_SIGNALS:
     void sigUpdate();
     
@@ -34,7 +240,30 @@ protected:
     virtual QString Name();
 
 private:
-    quint16 m_nPort;    
+    quint16 m_nPort;
+    int m_nWorkers;
+    int m_nProcesses;
+    int m_nListenBacklog;
+    int m_nMaxPendingConnections;
+    int m_nAcceptBudget;
+    int m_nMaxConnections;
+    int m_nMaxHandshakes;
+    emRelay m_Relay;
+    qint64 m_nHighWatermark;
+    qint64 m_nLowWatermark;
+    bool m_bHugePages;
+    qint64 m_nReadBudget;
+    qint64 m_nZeroCopyThreshold;
+    int m_nHandshakeTimeout;
+    int m_nConnectTimeout;
+    int m_nIdleTimeout;
+    int m_nConnectAttemptDelay;
+    int m_nConnectAttemptTimeout;
+    int m_nPoolSize;
+    int m_nResolverTtl;
+    int m_nResolverNegativeTtl;
+    int m_nResolverCacheSize;
+    int m_nResolverPrefetch;
 };
 
 #endif // CPARAMETER_H
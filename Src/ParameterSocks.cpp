@@ -6,7 +6,13 @@
 CParameterSocks::CParameterSocks(QObject *parent) : CParameterIce(parent),
     m_bIce(false),
     m_bV4(true),
-    m_bV5(true)
+    m_bV5(true),
+    m_bUdp(true),
+    m_nUdpTimeout(60000),
+    m_bHttp(true),
+    m_nHttpPoolMaxIdlePerHost(8),
+    m_nHttpPoolMaxIdle(256),
+    m_nHttpPoolIdleTimeout(60000)
 {
     SetPort(1080);
  
@@ -25,6 +31,8 @@ int CParameterSocks::Save(QSettings &set)
     set.setValue(Name() + "V4/Enable", m_bV4);
 
     set.setValue(Name() + "V5/Enable", m_bV5);
+    set.setValue(Name() + "V5/Udp/Enable", m_bUdp);
+    set.setValue(Name() + "V5/Udp/Timeout", m_nUdpTimeout);
     set.setValue(Name() + "V5/Autenticator/Method/count",
                  m_V5AuthenticatorMethod.size());
     for(int i = 0; i < m_V5AuthenticatorMethod.size(); i++)
@@ -37,6 +45,11 @@ int CParameterSocks::Save(QSettings &set)
                  + "V5/Autenticator/V5/Autenticator/UserAndPassword/Password",
                  m_szAuthentPassword);
 
+    set.setValue(Name() + "Http/Enable", m_bHttp);
+    set.setValue(Name() + "Http/Pool/MaxIdlePerHost", m_nHttpPoolMaxIdlePerHost);
+    set.setValue(Name() + "Http/Pool/MaxIdle", m_nHttpPoolMaxIdle);
+    set.setValue(Name() + "Http/Pool/IdleTimeout", m_nHttpPoolIdleTimeout);
+
     set.setValue(Name() + "Ice/Enable", m_bIce);
 
     return 0;
@@ -49,6 +62,8 @@ int CParameterSocks::Load(QSettings &set)
     m_bV4 = set.value(Name() + "V4/Enable", m_bV4).toBool();
 
     m_bV5 = set.value(Name() + "V5/Enable", m_bV5).toBool();
+    m_bUdp = set.value(Name() + "V5/Udp/Enable", m_bUdp).toBool();
+    m_nUdpTimeout = set.value(Name() + "V5/Udp/Timeout", m_nUdpTimeout).toInt();
     int v5MethodCount = set.value(Name() + "V5/Autenticator/Method/count").toUInt();
     if(v5MethodCount > 0) m_V5AuthenticatorMethod.clear();
     for(int i = 0; i < v5MethodCount; i++)
@@ -58,6 +73,14 @@ int CParameterSocks::Load(QSettings &set)
     }
     m_szAuthentUser = set.value(Name() + "V5/Autenticator/UserAndPassword/User").toString();
     m_szAuthentPassword = set.value(Name() + "V5/Autenticator/UserAndPassword/Password").toString();
+
+    m_bHttp = set.value(Name() + "Http/Enable", m_bHttp).toBool();
+    m_nHttpPoolMaxIdlePerHost = set.value(Name() + "Http/Pool/MaxIdlePerHost",
+                                          m_nHttpPoolMaxIdlePerHost).toInt();
+    m_nHttpPoolMaxIdle = set.value(Name() + "Http/Pool/MaxIdle",
+                                   m_nHttpPoolMaxIdle).toInt();
+    m_nHttpPoolIdleTimeout = set.value(Name() + "Http/Pool/IdleTimeout",
+                                       m_nHttpPoolIdleTimeout).toInt();
     
     m_bIce = set.value(Name() + "Ice/Enable", m_bIce).toBool();
 
@@ -99,6 +122,66 @@ void CParameterSocks::SetV5(bool v)
     m_bV5 = v;
 }
 
+bool CParameterSocks::GetUdp()
+{
+    return m_bUdp;
+}
+
+void CParameterSocks::SetUdp(bool v)
+{
+    m_bUdp = v;
+}
+
+int CParameterSocks::GetUdpTimeout()
+{
+    return m_nUdpTimeout;
+}
+
+void CParameterSocks::SetUdpTimeout(int nMs)
+{
+    m_nUdpTimeout = nMs;
+}
+
+bool CParameterSocks::GetHttp()
+{
+    return m_bHttp;
+}
+
+void CParameterSocks::SetHttp(bool v)
+{
+    m_bHttp = v;
+}
+
+int CParameterSocks::GetHttpPoolMaxIdlePerHost()
+{
+    return m_nHttpPoolMaxIdlePerHost;
+}
+
+void CParameterSocks::SetHttpPoolMaxIdlePerHost(int n)
+{
+    m_nHttpPoolMaxIdlePerHost = n;
+}
+
+int CParameterSocks::GetHttpPoolMaxIdle()
+{
+    return m_nHttpPoolMaxIdle;
+}
+
+void CParameterSocks::SetHttpPoolMaxIdle(int n)
+{
+    m_nHttpPoolMaxIdle = n;
+}
+
+int CParameterSocks::GetHttpPoolIdleTimeout()
+{
+    return m_nHttpPoolIdleTimeout;
+}
+
+void CParameterSocks::SetHttpPoolIdleTimeout(int nMs)
+{
+    m_nHttpPoolIdleTimeout = nMs;
+}
+
 QVector<unsigned char> CParameterSocks::GetV5Method()
 {
     return m_V5AuthenticatorMethod;
@@ -12,6 +12,12 @@ class RABBITPROXY_EXPORT CParameterSocks : public CParameterIce
     Q_PROPERTY(bool Ice READ GetIce WRITE SetIce)
     Q_PROPERTY(bool V4 READ GetV4 WRITE SetV4)
     Q_PROPERTY(bool V5 READ GetV5 WRITE SetV5)
+    Q_PROPERTY(bool Udp READ GetUdp WRITE SetUdp)
+    Q_PROPERTY(int UdpTimeout READ GetUdpTimeout WRITE SetUdpTimeout)
+    Q_PROPERTY(bool Http READ GetHttp WRITE SetHttp)
+    Q_PROPERTY(int HttpPoolMaxIdlePerHost READ GetHttpPoolMaxIdlePerHost WRITE SetHttpPoolMaxIdlePerHost)
+    Q_PROPERTY(int HttpPoolMaxIdle READ GetHttpPoolMaxIdle WRITE SetHttpPoolMaxIdle)
+    Q_PROPERTY(int HttpPoolIdleTimeout READ GetHttpPoolIdleTimeout WRITE SetHttpPoolIdleTimeout)
     Q_PROPERTY(QVector<unsigned char> V5Method READ GetV5Method WRITE SetV5Method)
     Q_PROPERTY(QString AuthentUser READ GetAuthentUser WRITE SetAuthentUser)
     Q_PROPERTY(QString AuthentPassword READ GetAuthentPassword WRITE SetAuthentPassword)
@@ -31,7 +37,26 @@ public:
     
     bool GetV5();
     void SetV5(bool v);
+    //! The UDP ASSOCIATE command of socks5. \see CUdpRelay
+    bool GetUdp();
+    void SetUdp(bool v);
+    //! The time (ms) which a destination of the UDP relay is kept idle
+    int GetUdpTimeout();
+    void SetUdpTimeout(int nMs);
     
+    //! The HTTP proxy on the same port. \see CProxyHttp
+    bool GetHttp();
+    void SetHttp(bool v);
+    //! The most idle upstream connections of a host:port in a thread. \see CUpstreamPool
+    int GetHttpPoolMaxIdlePerHost();
+    void SetHttpPoolMaxIdlePerHost(int n);
+    //! The most idle upstream connections in a thread. 0: don't reuse
+    int GetHttpPoolMaxIdle();
+    void SetHttpPoolMaxIdle(int n);
+    //! The time (ms) which an upstream connection is kept idle. 0: no limit
+    int GetHttpPoolIdleTimeout();
+    void SetHttpPoolIdleTimeout(int nMs);
+
     // Authenticator
     enum emAuthenticator {
         AUTHENTICATOR_NO = 0x00,           // 无需认证
@@ -57,9 +82,16 @@ private:
     
     // V5
     bool m_bV5;
+    bool m_bUdp;
+    int m_nUdpTimeout;
     QVector<unsigned char> m_V5AuthenticatorMethod;
     QString m_szAuthentUser;
     QString m_szAuthentPassword;
+
+    bool m_bHttp;
+    int m_nHttpPoolMaxIdlePerHost;
+    int m_nHttpPoolMaxIdle;
+    int m_nHttpPoolIdleTimeout;
 };
 
 #endif // CPARAMETERSOCKS_H
@@ -1,33 +1,109 @@
 //! @author Kang Lin <kl222@126.com>
 
 #include "PeerConnector.h"
+#include "ObjectPool.h"
+#include "Resolver.h"
 
+#include <atomic>
+#include <QCoreApplication>
 #include <QLoggingCategory>
 
+#ifdef HAVE_HAPPY_EYEBALLS
+#include "HappyEyeballs.h"
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
 Q_LOGGING_CATEGORY(logConnector, "Connector")
 
-CPeerConnector::CPeerConnector(QObject *parent) : QObject(parent)
+namespace {
+
+// RFC 8305 5: the recommended connection attempt delay is 250 ms
+std::atomic<int> g_nAttemptDelay(250);
+std::atomic<int> g_nAttemptTimeout(10000);
+
+} // namespace
+
+CPeerConnector::CPeerConnector(QObject *parent) : QObject(parent),
+    m_nLookup(0),
+    m_nPort(0),
+    m_pEyeballs(nullptr),
+    m_Output(&m_Socket)
 {
 }
 
 CPeerConnector::~CPeerConnector()
 {
+    CancelLookup();
     qDebug() << "CPeerConnector::~CPeerConnector()";
 }
 
+CPeerConnector* CPeerConnector::Create(QObject *parent)
+{
+    CPeerConnector* p = CObjectPool::Instance()->Get<CPeerConnector>();
+    if(!p)
+        return new CPeerConnector(parent);
+    p->setParent(parent);
+    return p;
+}
+
+void CPeerConnector::Recycle()
+{
+    QMetaObject::invokeMethod(this, "slotRecycle", Qt::QueuedConnection);
+}
+
+void CPeerConnector::slotRecycle()
+{
+    // The receivers of the closed session
+    disconnect();
+    Close();
+    // The socket which is still sending or is a derived connector isn't kept
+    if(&staticMetaObject != metaObject()
+        || QAbstractSocket::UnconnectedState != m_Socket.state())
+    {
+        deleteLater();
+        return;
+    }
+    m_Socket.setReadBufferSize(0);
+    m_Output.SetSocket(&m_Socket);
+    QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
+    setParent(nullptr);
+    if(!CObjectPool::Instance()->Put(this))
+        deleteLater();
+}
+
 int CPeerConnector::InitConnect()
 {
-    bool check = connect(&m_Socket, SIGNAL(connected()),
-            this, SIGNAL(sigConnected()));
+    // A reused connector may still have the connections of the last use
+    QObject::disconnect(&m_Socket, nullptr, this, nullptr);
+    QObject::disconnect(&m_Output, nullptr, this, nullptr);
+    bool check = connect(&m_Socket, &QTcpSocket::connected,
+                         this, &CPeerConnector::sigConnected);
+    Q_ASSERT(check);
+    check = connect(&m_Socket, &QTcpSocket::disconnected,
+                    this, &CPeerConnector::sigDisconnected);
     Q_ASSERT(check);
-    check = connect(&m_Socket, SIGNAL(disconnected()),
-                    this, SIGNAL(sigDisconnected()));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    check = connect(&m_Socket, &QTcpSocket::errorOccurred,
+                    this, &CPeerConnector::slotError);
+#else
+    check = connect(&m_Socket,
+                    QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
+                    this, &CPeerConnector::slotError);
+#endif
     Q_ASSERT(check);
-    check = connect(&m_Socket, SIGNAL(error(QAbstractSocket::SocketError)),
-                    this, SLOT(slotError(QAbstractSocket::SocketError)));
+    check = connect(&m_Socket, &QTcpSocket::readyRead,
+                    this, &CPeerConnector::sigReadyRead);
     Q_ASSERT(check);
-    check = connect(&m_Socket, SIGNAL(readyRead()),
-                    this, SIGNAL(sigReadyRead()));
+    check = connect(&m_Socket, &QTcpSocket::hostFound,
+                    this, &CPeerConnector::sigHostFound);
+    Q_ASSERT(check);
+    check = connect(&m_Socket, &QTcpSocket::bytesWritten,
+                    this, &CPeerConnector::sigBytesWritten);
+    Q_ASSERT(check);
+    check = connect(&m_Output, &COutputQueue::sigBytesWritten,
+                    this, &CPeerConnector::sigBytesWritten);
     Q_ASSERT(check);
     return 0;
 }
@@ -35,10 +111,128 @@ int CPeerConnector::InitConnect()
 int CPeerConnector::Connect(const QString &address, quint16 nPort)
 {
     InitConnect();
-    m_Socket.connectToHost(address, nPort);
+    CancelLookup();
+#ifdef HAVE_HAPPY_EYEBALLS
+    if(m_pEyeballs)
+        m_pEyeballs->Stop();
+#endif
+    QHostAddress add;
+    if(add.setAddress(address))
+    {
+        m_Socket.connectToHost(add, nPort);
+        return 0;
+    }
+
+    m_nPort = nPort;
+    QList<QHostAddress> addresses;
+    if(CResolver::Instance()->Lookup(address, addresses,
+            [this](const QList<QHostAddress>& addresses) {
+                m_nLookup = 0;
+                OnLookup(addresses);
+            }, m_nLookup))
+        OnLookup(addresses);
     return 0;
 }
 
+void CPeerConnector::OnLookup(const QList<QHostAddress> &addresses)
+{
+    if(addresses.isEmpty())
+    {
+        qCritical(logConnector) << "Not found host";
+        emit sigError(emERROR::HostNotFound, tr("Not found host"));
+        return;
+    }
+#ifdef HAVE_HAPPY_EYEBALLS
+    // The bound socket connects by itself
+    if(QAbstractSocket::UnconnectedState == m_Socket.state())
+    {
+        if(!m_pEyeballs)
+        {
+            m_pEyeballs = new CHappyEyeballs(this);
+            bool check = connect(m_pEyeballs, &CHappyEyeballs::sigConnected,
+                                 this, &CPeerConnector::slotAttemptConnected);
+            Q_ASSERT(check);
+            check = connect(m_pEyeballs, &CHappyEyeballs::sigError,
+                            this, &CPeerConnector::slotAttemptError);
+            Q_ASSERT(check);
+        }
+        emit sigHostFound();
+        m_pEyeballs->Start(addresses, m_nPort,
+                           g_nAttemptDelay, g_nAttemptTimeout);
+        return;
+    }
+#endif
+    // The socket emits hostFound before connecting
+    m_Socket.connectToHost(addresses.first(), m_nPort);
+}
+
+void CPeerConnector::slotAttemptConnected(qintptr fd)
+{
+#ifdef HAVE_HAPPY_EYEBALLS
+    if(!m_Socket.setSocketDescriptor(fd))
+    {
+        ::close(fd);
+        qCritical(logConnector) << "Set socket descriptor fail:"
+                                << ErrorString();
+        emit sigError(emERROR::Unkown, ErrorString());
+        return;
+    }
+    // The socket doesn't emit connected when it is set
+    emit sigConnected();
+#else
+    Q_UNUSED(fd)
+#endif
+}
+
+void CPeerConnector::slotAttemptError(int nErrno)
+{
+#ifdef HAVE_HAPPY_EYEBALLS
+    qCritical(logConnector) << "CPeerConnector::slotAttemptError:"
+                            << strerror(nErrno);
+    emERROR e = emERROR::Unkown;
+    QString szErr = strerror(nErrno);
+    switch(nErrno) {
+    case ECONNREFUSED:
+        e = emERROR::ConnectionRefused;
+        szErr = tr("Refused connection");
+        break;
+    case ENETUNREACH:
+    case EHOSTUNREACH:
+        e = emERROR::NetWorkUnreachable;
+        szErr = tr("Network unreachable");
+        break;
+    case EACCES:
+    case EPERM:
+        e = emERROR::NotAllowdConnection;
+        szErr = tr("Not allowd connection");
+        break;
+    case ETIMEDOUT:
+        e = emERROR::Timeout;
+        szErr = tr("Connection timeout");
+        break;
+    default:
+        break;
+    }
+    emit sigError(e, szErr);
+#else
+    Q_UNUSED(nErrno)
+#endif
+}
+
+void CPeerConnector::SetConnectAttempt(int nDelay, int nTimeout)
+{
+    g_nAttemptDelay = qMax(0, nDelay);
+    g_nAttemptTimeout = qMax(0, nTimeout);
+}
+
+void CPeerConnector::CancelLookup()
+{
+    if(0 == m_nLookup)
+        return;
+    CResolver::Instance()->Cancel(m_nLookup);
+    m_nLookup = 0;
+}
+
 int CPeerConnector::Bind(const QHostAddress &address, quint16 nPort)
 {
     InitConnect();
@@ -88,12 +282,30 @@ int CPeerConnector::Write(const char *buf, qint64 nLen)
         emit sigError(-1, "Socket isn't open");
         return -1;
     }
-    return m_Socket.write(buf, nLen);
+    return m_Output.Write(buf, nLen);
+}
+
+int CPeerConnector::Write(CBufferPool::CSlab &slab, qint64 nLen)
+{
+    if(!m_Socket.isOpen())
+    {
+        qCritical(logConnector) << "Socket isn't open";
+        emit sigError(-1, "Socket isn't open");
+        return -1;
+    }
+    return m_Output.Write(slab, nLen);
 }
 
 int CPeerConnector::Close()
 {
+    CancelLookup();
+#ifdef HAVE_HAPPY_EYEBALLS
+    if(m_pEyeballs)
+        m_pEyeballs->Stop();
+#endif
     m_Socket.disconnect();
+    // close() sends the data in the write buffer of the socket before closing
+    m_Output.Flush();
     m_Socket.close();
     return 0;
 }
@@ -118,6 +330,33 @@ quint16 CPeerConnector::LocalPort()
     return m_Socket.localPort();
 }
 
+qintptr CPeerConnector::SocketDescriptor()
+{
+    return m_Socket.socketDescriptor();
+}
+
+qint64 CPeerConnector::BytesToWrite()
+{
+    return m_Output.BytesToWrite();
+}
+
+qint64 CPeerConnector::BytesAvailable()
+{
+    return m_Socket.bytesAvailable();
+}
+
+bool CPeerConnector::Flush()
+{
+    if(m_Output.Flush())
+        return false;
+    return m_Socket.flush();
+}
+
+void CPeerConnector::SetReadBufferSize(qint64 nSize)
+{
+    m_Socket.setReadBufferSize(nSize);
+}
+
 void CPeerConnector::slotError(QAbstractSocket::SocketError error)
 {
     qCritical(logConnector) << "CPeerConnector::slotError:"
@@ -6,6 +6,9 @@
 #include <QObject>
 #include <QTcpSocket>
 #include <QHostAddress>
+#include "OutputQueue.h"
+
+class CHappyEyeballs;
 
 /*!
  * \brief The peer connector interface class
@@ -17,6 +20,20 @@ class CPeerConnector : public QObject
 public:
     explicit CPeerConnector(QObject *parent = nullptr);
     virtual ~CPeerConnector();
+
+    /*!
+     * \brief Get a connector from the pool of the thread, or create it
+     * \see CObjectPool Recycle()
+     */
+    static CPeerConnector* Create(QObject *parent = nullptr);
+    /*!
+     * \brief Give back the connector got by Create().
+     *        It is closed and put into the pool of the thread after the
+     *        signals which are being emitted return, like deleteLater().
+     *        It is the deleter of QSharedPointer.
+     *        The derived connectors aren't kept, they are deleted.
+     */
+    void Recycle();
     
     enum emERROR{
         Success = 0,
@@ -28,32 +45,93 @@ public:
         Unkown = -1
     };
 
+    /*!
+     * \brief Connect to the host.
+     *        The host name is looked up by CResolver, so the answers are
+     *        cached, and the connections to the same name share a lookup.
+     *        The connections to the addresses of the name are raced by
+     *        CHappyEyeballs on unix, the first connected one is used.
+     */
     virtual int Connect(const QString& address, quint16 nPort);
+    /*!
+     * \brief Set the attempts of connecting to the addresses of a host name
+     * \param nDelay: the time (ms) before the next address is attempted
+     * \param nTimeout: the time (ms) of an attempt. 0: no limit
+     * \see CHappyEyeballs
+     */
+    static void SetConnectAttempt(int nDelay, int nTimeout);
     virtual int Bind(const QHostAddress &address, quint16 nPort = 0);
     virtual int Bind(quint16 nPort = 0);
     virtual qint64 Read(char* buf, qint64 nLen);
     virtual QByteArray ReadAll();
     virtual int Write(const char* buf, qint64 nLen);
+    /*!
+     * \brief Write the first nLen bytes of the slab.
+     *        The connector may take the slab, and put a new one into slab.
+     * \see COutputQueue::Write(CBufferPool::CSlab&, qint64)
+     */
+    virtual int Write(CBufferPool::CSlab& slab, qint64 nLen);
     virtual int Close();
     virtual int Error();
     virtual QString ErrorString();
     virtual QHostAddress LocalAddress();
     virtual quint16 LocalPort();
+    /*!
+     * \brief The socket descriptor of the direct TCP connection
+     * \return -1: it isn't a direct TCP connection, eg: ICE
+     * \see CProxy::HandOffRelay()
+     */
+    virtual qintptr SocketDescriptor();
+    //! The number of bytes waiting to be written
+    virtual qint64 BytesToWrite();
+    //! The number of bytes which can be read
+    virtual qint64 BytesAvailable();
+    //! Write the queued and buffered data as much as possible without blocking
+    virtual bool Flush();
+    /*!
+     * \brief Set the size of the read buffer. 0: no limit (default).
+     *        When the buffer is full, it stops reading from the network,
+     *        so the flow control of the transport slows down the sender.
+     */
+    virtual void SetReadBufferSize(qint64 nSize);
     
 Q_SIGNALS:
     void sigConnected();
     void sigDisconnected();
     void sigError(int nErr, const QString& szError = QString());
     void sigReadyRead();
+    //! The host name is looked up. It isn't emitted by the ICE connectors.
+    void sigHostFound();
+    /*!
+     * \brief The data is written.
+     *        The ICE connectors emit it when the buffered data of the data
+     *        channel is sent, and nBytes is 0.
+     */
+    void sigBytesWritten(qint64 nBytes);
     
 private Q_SLOTS:
     virtual void slotError(QAbstractSocket::SocketError error);
+    void slotRecycle();
+    //! The attempt of an address wins. \see CHappyEyeballs
+    void slotAttemptConnected(qintptr fd);
+    void slotAttemptError(int nErrno);
     
 private:
     int InitConnect();
+    //! The lookup of the host name is complete
+    void OnLookup(const QList<QHostAddress>& addresses);
+    //! The callback of the lookup isn't called
+    void CancelLookup();
     
 private:
     QTcpSocket m_Socket;
+    //! The ticket of the lookup. 0: it doesn't look up. \see CResolver
+    quint64 m_nLookup;
+    quint16 m_nPort;
+    //! It is created at the first lookup which has the addresses
+    CHappyEyeballs* m_pEyeballs;
+    //! The writes to m_Socket are coalesced by it
+    COutputQueue m_Output;
 };
 
 #endif // CPEERCONNECTER_H
@@ -48,19 +48,24 @@ int CPeerConnectorIceClient::CreateDataChannel(const QString &peer,
     #endif
 
     if(!m_DataChannel) return -1;
+    m_DataChannel->SetLowWatermark(pPara->GetLowWatermark());
 
     bool check = false;
-    check = connect(m_DataChannel.data(), SIGNAL(sigConnected()),
-                    this, SLOT(slotDataChannelConnected()));
+    CDataChannelIce* pChannel = m_DataChannel.data();
+    check = connect(pChannel, &CDataChannelIce::sigConnected,
+                    this, &CPeerConnectorIceClient::slotDataChannelConnected);
     Q_ASSERT(check);
-    check = connect(m_DataChannel.data(), SIGNAL(sigDisconnected()),
-                    this, SLOT(slotDataChannelDisconnected()));
+    check = connect(pChannel, &CDataChannelIce::sigDisconnected,
+                    this, &CPeerConnectorIceClient::slotDataChannelDisconnected);
     Q_ASSERT(check);
-    check = connect(m_DataChannel.data(), SIGNAL(sigError(int, const QString&)),
-                    this, SLOT(slotDataChannelError(int, const QString&)));
+    check = connect(pChannel, &CDataChannelIce::sigError,
+                    this, &CPeerConnectorIceClient::slotDataChannelError);
     Q_ASSERT(check);
-    check = connect(m_DataChannel.data(), SIGNAL(readyRead()),
-                    this, SLOT(slotDataChannelReadyRead()));
+    check = connect(pChannel, &CDataChannelIce::readyRead,
+                    this, &CPeerConnectorIceClient::slotDataChannelReadyRead);
+    Q_ASSERT(check);
+    check = connect(pChannel, &CDataChannelIce::bytesWritten,
+                    this, &CPeerConnectorIceClient::slotDataChannelBytesWritten);
     Q_ASSERT(check);
     
     rtc::Configuration config;
@@ -146,6 +151,11 @@ void CPeerConnectorIceClient::slotDataChannelReadyRead()
     emit sigReadyRead();
 }
 
+void CPeerConnectorIceClient::slotDataChannelBytesWritten(qint64 nBytes)
+{
+    emit sigBytesWritten(nBytes);
+}
+
 int CPeerConnectorIceClient::OnConnectionReply()
 {
     int nRet = 0;
@@ -235,6 +245,11 @@ int CPeerConnectorIceClient::Write(const char *buf, qint64 nLen)
     return m_DataChannel->write(buf, nLen);
 }
 
+int CPeerConnectorIceClient::Write(CBufferPool::CSlab &slab, qint64 nLen)
+{
+    return Write(slab.Data(), nLen);
+}
+
 int CPeerConnectorIceClient::Close()
 {
     int nRet = 0;
@@ -266,6 +281,30 @@ QString CPeerConnectorIceClient::ErrorString()
     return m_szError;
 }
 
+qintptr CPeerConnectorIceClient::SocketDescriptor()
+{
+    // The data is forwarded by the data channel
+    return -1;
+}
+
+qint64 CPeerConnectorIceClient::BytesToWrite()
+{
+    if(!m_DataChannel) return 0;
+    return m_DataChannel->bytesToWrite();
+}
+
+qint64 CPeerConnectorIceClient::BytesAvailable()
+{
+    if(!m_DataChannel) return 0;
+    return m_DataChannel->bytesAvailable();
+}
+
+void CPeerConnectorIceClient::SetReadBufferSize(qint64 nSize)
+{
+    if(m_DataChannel)
+        m_DataChannel->SetReadBufferSize(nSize);
+}
+
 int CPeerConnectorIceClient::CheckBufferLength(int nLength)
 {
     int nRet = nLength - m_Buffer.size();
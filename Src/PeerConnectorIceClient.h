@@ -23,10 +23,17 @@ public:
     virtual qint64 Read(char *buf, qint64 nLen) override;
     virtual QByteArray ReadAll() override;
     virtual int Write(const char *buf, qint64 nLen) override;
+    //! The data channel copies the data
+    virtual int Write(CBufferPool::CSlab& slab, qint64 nLen) override;
     virtual int Close() override;
     virtual QHostAddress LocalAddress() override;
     virtual quint16 LocalPort() override;
     virtual QString ErrorString() override;
+    virtual qintptr SocketDescriptor() override;
+    virtual qint64 BytesToWrite() override;
+    virtual qint64 BytesAvailable() override;
+    //! \see CDataChannelIce::SetReadBufferSize()
+    virtual void SetReadBufferSize(qint64 nSize) override;
 
 protected:
     int CreateDataChannel(const QString& peer,
@@ -42,6 +49,7 @@ private Q_SLOTS:
     virtual void slotDataChannelDisconnected();
     virtual void slotDataChannelError(int nErr, const QString& szError);
     virtual void slotDataChannelReadyRead();
+    virtual void slotDataChannelBytesWritten(qint64 nBytes);
 
 protected:
     CServerSocks* m_pServer;
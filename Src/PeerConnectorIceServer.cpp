@@ -3,6 +3,7 @@
 #include "PeerConnectorIceServer.h"
 #include "ParameterSocks.h"
 #include "IceSignalWebSocket.h"
+#include "BufferPool.h"
 #include <QJsonDocument>
 #include <QtEndian>
 #include <QThread>
@@ -13,7 +14,11 @@ CPeerConnectorIceServer::CPeerConnectorIceServer(CServerSocks* pServer,
         const QString& fromUser,
         const QString& toUser,
         const QString& channelId, std::shared_ptr<rtc::DataChannel> dc)
-    : CPeerConnectorIceClient(pServer)
+    : CPeerConnectorIceClient(pServer),
+    m_bPausePeer(false),
+    m_bPauseDataChannel(false),
+    m_bWaitPeer(false),
+    m_bWaitDataChannel(false)
 {
     CreateDataChannel(fromUser, toUser, channelId, false);
     m_DataChannel->SetDataChannel(dc);
@@ -26,7 +31,11 @@ CPeerConnectorIceServer::CPeerConnectorIceServer(CServerSocks *pServer,
                                                  const QString &type,
                                                  const QString &sdp,
                                                  QObject *parent)
-    : CPeerConnectorIceClient(pServer, parent)
+    : CPeerConnectorIceClient(pServer, parent),
+    m_bPausePeer(false),
+    m_bPauseDataChannel(false),
+    m_bWaitPeer(false),
+    m_bWaitDataChannel(false)
 {
     CreateDataChannel(fromUser, toUser, channelId, false);
     m_DataChannel->slotSignalReceiverDescription(fromUser, toUser, channelId, type, sdp);
@@ -35,6 +44,9 @@ CPeerConnectorIceServer::CPeerConnectorIceServer(CServerSocks *pServer,
 CPeerConnectorIceServer::~CPeerConnectorIceServer()
 {
     qDebug(logPeerConnectorIceServer) << "CPeerConnectorIceServer::~CPeerConnectorIceServer()";
+    // The scheduled passes are discarded with the object
+    if(m_bWaitPeer) m_pServer->OnWaiting(-1);
+    if(m_bWaitDataChannel) m_pServer->OnWaiting(-1);
 }
 
 void CPeerConnectorIceServer::slotDataChannelConnected()
@@ -60,17 +72,74 @@ void CPeerConnectorIceServer::slotDataChannelReadyRead()
         return;
     }
 
-    if(m_Peer && m_DataChannel)
+    if(m_Peer && m_DataChannel && !m_bPauseDataChannel && !m_bWaitDataChannel)
     {
         /*
          LOG_MODEL_DEBUG("CPeerConnectorIceServer",
                         "Forword data to peer form data channel");//*/
-        QByteArray d = m_DataChannel->readAll();
-        if(!d.isEmpty())
-            m_Peer->Write(d.data(), d.size());        
+        CBufferPool::CSlab slab;
+        if(!slab.Data()) return;
+        qint64 nHigh = m_pServer->Getparameter()->GetHighWatermark();
+        qint64 nBudget = m_pServer->Getparameter()->GetReadBudget();
+        qint64 nBytes = 0;
+        qint64 n = 0;
+        while(true)
+        {
+            qint64 nLen = slab.Size();
+            if(nBudget > 0)
+            {
+                nLen = qMin(nLen, nBudget - nBytes);
+                if(nLen <= 0) break;
+            }
+            // The peer may take the slab
+            if(!slab.Data()) break;
+            n = m_DataChannel->read(slab.Data(), nLen);
+            if(n <= 0) break;
+            nBytes += n;
+            m_Peer->Write(slab, n);
+            if(nHigh > 0 && m_Peer->BytesToWrite() > nHigh)
+            {
+                // The data stays in the queue of the data channel until it
+                // is resumed, so the SCTP flow control slows down the sender
+                m_bPauseDataChannel = true;
+                m_DataChannel->SetReadBufferSize(
+                    m_pServer->Getparameter()->GetLowWatermark());
+                qDebug(logPeerConnectorIceServer) << "Pause reading the data channel";
+                break;
+            }
+        }
+        m_bWaitDataChannel = nBudget > 0 && nBytes >= nBudget
+                             && !m_bPauseDataChannel
+                             && m_DataChannel->bytesAvailable() > 0;
+        if(m_bWaitDataChannel)
+        {
+            m_pServer->OnWaiting(1);
+            QMetaObject::invokeMethod(this, "slotDataChannelReadDeferred",
+                                      Qt::QueuedConnection);
+        }
+        m_pServer->OnForward(nBytes, m_bWaitDataChannel);
     }
 }
 
+void CPeerConnectorIceServer::slotDataChannelReadDeferred()
+{
+    m_bWaitDataChannel = false;
+    m_pServer->OnWaiting(-1);
+    slotDataChannelReadyRead();
+}
+
+void CPeerConnectorIceServer::slotDataChannelBytesWritten(qint64 nBytes)
+{
+    Q_UNUSED(nBytes)
+    if(!m_bPausePeer || !m_Peer || !m_DataChannel) return;
+    if(m_DataChannel->bytesToWrite() > m_pServer->Getparameter()->GetLowWatermark())
+        return;
+    qDebug(logPeerConnectorIceServer) << "Resume reading the peer";
+    m_bPausePeer = false;
+    m_Peer->SetReadBufferSize(0);
+    slotPeerRead();
+}
+
 qint64 CPeerConnectorIceServer::Read(char *buf, qint64 nLen)
 {
     if(CONNECT == m_Status) return -1;
@@ -85,6 +154,13 @@ QByteArray CPeerConnectorIceServer::ReadAll()
     return m_Peer->ReadAll();
 }
 
+qint64 CPeerConnectorIceServer::BytesAvailable()
+{
+    if(CONNECT == m_Status) return 0;
+    if(!m_Peer) return 0;
+    return m_Peer->BytesAvailable();
+}
+
 int CPeerConnectorIceServer::Write(const char *buf, qint64 nLen)
 {
     if(CONNECT == m_Status) return -1;
@@ -93,6 +169,14 @@ int CPeerConnectorIceServer::Write(const char *buf, qint64 nLen)
     return m_Peer->Write(buf, nLen);
 }
 
+int CPeerConnectorIceServer::Write(CBufferPool::CSlab &slab, qint64 nLen)
+{
+    if(CONNECT == m_Status) return -1;
+    if(!m_Peer)
+        return -1;
+    return m_Peer->Write(slab, nLen);
+}
+
 int CPeerConnectorIceServer::Close()
 {
     qDebug(logPeerConnectorIceServer,
@@ -163,8 +247,8 @@ int CPeerConnectorIceServer::OnReciveConnectRequst()
     if(m_Peer)
         Q_ASSERT(false);
     else
-        m_Peer = QSharedPointer<CPeerConnector>(new CPeerConnector(this),
-                                                &QObject::deleteLater);
+        m_Peer = QSharedPointer<CPeerConnector>(CPeerConnector::Create(this),
+                                                &CPeerConnector::Recycle);
 
     if(!m_Peer)
     {
@@ -172,19 +256,24 @@ int CPeerConnectorIceServer::OnReciveConnectRequst()
         return -1;
     }
 
-    bool check = connect(m_Peer.data(), SIGNAL(sigConnected()),
-                         this, SLOT(slotPeerConnected()));
+    CPeerConnector* pPeer = m_Peer.data();
+    bool check = connect(pPeer, &CPeerConnector::sigConnected,
+                         this, &CPeerConnectorIceServer::slotPeerConnected);
+    Q_ASSERT(check);
+    check = connect(pPeer, &CPeerConnector::sigDisconnected,
+                    this, &CPeerConnectorIceServer::slotPeerDisconnectd);
     Q_ASSERT(check);
-    check = connect(m_Peer.data(), SIGNAL(sigDisconnected()),
-                    this, SLOT(slotPeerDisconnectd()));
+    check = connect(pPeer, &CPeerConnector::sigError,
+                    this, &CPeerConnectorIceServer::slotPeerError);
     Q_ASSERT(check);
-    check = connect(m_Peer.data(), SIGNAL(sigError(int, const QString&)),
-                    this, SLOT(slotPeerError(int, const QString&)));
+    check = connect(pPeer, &CPeerConnector::sigReadyRead,
+                    this, &CPeerConnectorIceServer::slotPeerRead);
     Q_ASSERT(check);
-    check = connect(m_Peer.data(), SIGNAL(sigReadyRead()),
-                    this, SLOT(slotPeerRead()));
+    check = connect(pPeer, &CPeerConnector::sigBytesWritten,
+                    this, &CPeerConnectorIceServer::slotPeerBytesWritten);
     Q_ASSERT(check);
 
+    // The domain is looked up by the cache of CResolver in the connector
     qDebug(logPeerConnectorIceServer, "Connect to peer: ip:%s; port:%d",
                     m_peerAddress.toStdString().c_str(),
                     m_nPeerPort);
@@ -258,15 +347,69 @@ void CPeerConnectorIceServer::slotPeerError(int nError, const QString &szErr)
 
 void CPeerConnectorIceServer::slotPeerRead()
 {
-    if(!m_Peer || !m_DataChannel) return;
+    if(!m_Peer || !m_DataChannel || m_bPausePeer || m_bWaitPeer) return;
+
+    CBufferPool::CSlab slab;
+    if(!slab.Data()) return;
+    CParameter* pPara = m_pServer->Getparameter();
+    qint64 nBudget = pPara->GetReadBudget();
+    qint64 nBytes = 0;
+    qint64 n = 0;
+    while(true)
+    {
+        qint64 nLen = slab.Size();
+        if(nBudget > 0)
+        {
+            nLen = qMin(nLen, nBudget - nBytes);
+            if(nLen <= 0) break;
+        }
+        n = m_Peer->Read(slab.Data(), nLen);
+        if(n <= 0) break;
+        nBytes += n;
+        /*
+        qDebug(logPeerConnectorIceServer,
+                        "CPeerConnectorIceServer::slotPeerRead(): size:%d;threadId:0x%X",
+                        n, QThread::currentThread());//*/
+        m_DataChannel->write(slab.Data(), n);
+        if(pPara->GetHighWatermark() > 0
+            && m_DataChannel->bytesToWrite() > pPara->GetHighWatermark())
+        {
+            // Stop reading from the network when the read buffer is full
+            m_bPausePeer = true;
+            m_Peer->SetReadBufferSize(pPara->GetLowWatermark());
+            qDebug(logPeerConnectorIceServer) << "Pause reading the peer";
+            break;
+        }
+    }
+    // Give the other connections of the event loop a turn
+    m_bWaitPeer = nBudget > 0 && nBytes >= nBudget && !m_bPausePeer
+                  && m_Peer->BytesAvailable() > 0;
+    if(m_bWaitPeer)
+    {
+        m_pServer->OnWaiting(1);
+        QMetaObject::invokeMethod(this, "slotPeerReadDeferred",
+                                  Qt::QueuedConnection);
+    }
+    m_pServer->OnForward(nBytes, m_bWaitPeer);
+}
+
+void CPeerConnectorIceServer::slotPeerReadDeferred()
+{
+    m_bWaitPeer = false;
+    m_pServer->OnWaiting(-1);
+    slotPeerRead();
+}
 
-    QByteArray d;
-    d = m_Peer->ReadAll();
-    /*
-    qDebug(logPeerConnectorIceServer,
-                    "CPeerConnectorIceServer::slotPeerRead(): size:%d;threadId:0x%X",
-                    d.size(), QThread::currentThread());//*/
-    m_DataChannel->write(d.data(), d.size());
+void CPeerConnectorIceServer::slotPeerBytesWritten(qint64 nBytes)
+{
+    Q_UNUSED(nBytes)
+    if(!m_bPauseDataChannel || !m_Peer) return;
+    if(m_Peer->BytesToWrite() > m_pServer->Getparameter()->GetLowWatermark())
+        return;
+    qDebug(logPeerConnectorIceServer) << "Resume reading the data channel";
+    m_bPauseDataChannel = false;
+    m_DataChannel->SetReadBufferSize(0);
+    slotDataChannelReadyRead();
 }
 
 QString CPeerConnectorIceServer::GetPeerUser()
@@ -34,6 +34,8 @@ public:
     virtual qint64 Read(char *buf, qint64 nLen) override;
     virtual QByteArray ReadAll() override;
     virtual int Write(const char *buf, qint64 nLen) override;
+    virtual int Write(CBufferPool::CSlab& slab, qint64 nLen) override;
+    virtual qint64 BytesAvailable() override;
     virtual int Close() override;
     virtual QHostAddress LocalAddress() override;
     virtual quint16 LocalPort() override;
@@ -49,14 +51,30 @@ private Q_SLOTS:
     virtual void slotDataChannelDisconnected() override;
     virtual void slotDataChannelError(int nErr, const QString& szError) override;
     virtual void slotDataChannelReadyRead() override;
+    //! Resume reading from the peer if the data channel is below the low watermark
+    virtual void slotDataChannelBytesWritten(qint64 nBytes) override;
 
     virtual void slotPeerConnected();
     virtual void slotPeerDisconnectd();
     virtual void slotPeerError(int nError, const QString &szErr);
     virtual void slotPeerRead();
+    //! Resume reading from the data channel if the peer is below the low watermark
+    virtual void slotPeerBytesWritten(qint64 nBytes);
+    //! The deferred pass of slotPeerRead()
+    void slotPeerReadDeferred();
+    //! The deferred pass of slotDataChannelReadyRead()
+    void slotDataChannelReadDeferred();
 
 private:
     QSharedPointer<CPeerConnector> m_Peer;
+    //! Stop reading from the peer, because the data channel is above the high watermark
+    bool m_bPausePeer;
+    //! Stop reading from the data channel, because the peer is above the high watermark
+    bool m_bPauseDataChannel;
+    //! A pass of reading from the peer is scheduled. \see CParameter::GetReadBudget()
+    bool m_bWaitPeer;
+    //! A pass of reading from the data channel is scheduled
+    bool m_bWaitDataChannel;
 };
 
 #endif // CPEERCONNECTERICESERVER_H
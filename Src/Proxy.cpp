@@ -1,33 +1,99 @@
 //! @author Kang Lin <kl222@126.com>
 
 #include "Proxy.h"
+#include "BufferPool.h"
+#include "ObjectPool.h"
+
+#include <QCoreApplication>
+
+// The most data which is kept before the peer is connected
+#define EARLY_DATA_SIZE (64 << 10)
 
 CProxy::CProxy(QTcpSocket* pSocket, CServer* server, QObject *parent)
     : QObject(parent),
     m_pServer(server),
-    m_pSocket(pSocket)
+    m_pSocket(pSocket),
+    m_pOutput(nullptr),
+    m_bPauseClient(false),
+    m_bPausePeer(false),
+    m_bWaitClient(false),
+    m_bWaitPeer(false),
+    m_Timeout([this]() { OnTimeout(); }),
+    m_TimeoutState(CServer::emState::Handshake),
+    m_bRecycle(false)
+{
+    Attach();
+}
+
+int CProxy::Reset(QTcpSocket *pSocket, CServer *server)
+{
+    m_pServer = server;
+    m_pSocket = pSocket;
+    m_bPauseClient = false;
+    m_bPausePeer = false;
+    m_bWaitClient = false;
+    m_bWaitPeer = false;
+    m_Statistics = CServer::strForwardStatistics();
+    m_TimeoutState = CServer::emState::Handshake;
+    m_bRecycle = false;
+    return Attach();
+}
+
+int CProxy::Attach()
 {
     bool check = false;
-    if(m_pSocket) {
-        check = connect(m_pSocket, SIGNAL(readyRead()), this, SLOT(slotRead()));
-        Q_ASSERT(check);
-        check = connect(m_pSocket, SIGNAL(disconnected()), 
-                        this, SLOT(slotClose()));
-        Q_ASSERT(check);
-//        check = connect(m_pSocket, SIGNAL(destroyed()),
-//                       this, SLOT(slotClose()));
-//        Q_ASSERT(check);
-        check = connect(m_pSocket, SIGNAL(error(QAbstractSocket::SocketError)),
-                this, SLOT(slotError(QAbstractSocket::SocketError)));
-        Q_ASSERT(check);
-        check = connect(server, SIGNAL(sigStop()), this, SLOT(slotClose()));
+    m_pCounter = CConnectionCounter::Get(m_pSocket);
+    if(!m_pSocket)
+        return -1;
+    // The connections of every session are typed, so they are resolved
+    // when compiling instead of looking up the signatures when connecting
+    check = connect(m_pSocket, &QTcpSocket::readyRead, this, &CProxy::slotRead);
+    Q_ASSERT(check);
+    check = connect(m_pSocket, &QTcpSocket::disconnected,
+                    this, &CProxy::slotClose);
+    Q_ASSERT(check);
+//    check = connect(m_pSocket, SIGNAL(destroyed()),
+//                   this, SLOT(slotClose()));
+//    Q_ASSERT(check);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    check = connect(m_pSocket, &QTcpSocket::errorOccurred,
+                    this, &CProxy::slotError);
+#else
+    check = connect(m_pSocket,
+                    QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
+                    this, &CProxy::slotError);
+#endif
+    Q_ASSERT(check);
+    check = connect(m_pServer, &CServer::sigStop, this, &CProxy::slotClose);
+    Q_ASSERT(check);
+    check = connect(m_pSocket, &QTcpSocket::bytesWritten,
+                    this, &CProxy::slotClientBytesWritten);
+    Q_ASSERT(check);
+    if(m_pOutput)
+        m_pOutput->SetSocket(m_pSocket);
+    else
+    {
+        m_pOutput = new COutputQueue(m_pSocket, this);
+        check = connect(m_pOutput, &COutputQueue::sigBytesWritten,
+                        this, &CProxy::slotClientBytesWritten);
         Q_ASSERT(check);
     }
+    m_pOutput->SetZeroCopyThreshold(
+        m_pServer->Getparameter()->GetZeroCopyThreshold());
+    // The handshake timeout is started when the socket is accepted
+    if(m_pCounter)
+        m_Timeout.Start(m_pCounter->StopHandshake());
+    else
+        m_Timeout.Start(m_pServer->Getparameter()->GetHandshakeTimeout());
+    return 0;
 }
 
 CProxy::~CProxy()
 {
     qDebug() << "CProxy::~CProxy()";
+    // The scheduled passes are discarded with the object
+    if(m_pServer && m_Statistics.nWaiting)
+        m_pServer->OnWaiting(-m_Statistics.nWaiting);
 }
 
 void CProxy::slotRead()
@@ -43,10 +109,15 @@ void CProxy::slotError(QAbstractSocket::SocketError socketError)
 
 void CProxy::slotClose()
 {
-    qDebug() << "CProxy::slotClose()";
+    qDebug() << "CProxy::slotClose(); passes:" << m_Statistics.nPasses
+             << "deferred:" << m_Statistics.nDeferred
+             << "bytes:" << m_Statistics.nBytes;
+    m_Timeout.Stop();
     if(m_pSocket)
     {
         m_pSocket->disconnect();
+        // The replies of the handshake may be still in the queue
+        m_pOutput->Flush();
         m_pSocket->close();
         m_pSocket->deleteLater();
         m_pSocket = nullptr;
@@ -59,45 +130,36 @@ void CProxy::slotClose()
         m_pPeer.clear();
     }
 
-    deleteLater();
-}
-
-int CProxy::CheckBufferLength(int nLength)
-{
-    int nRet = nLength - m_cmdBuf.size();
-    if(nRet > 0)
+    // It is reused after the signals which are being emitted return,
+    // like deleteLater()
+    if(!m_bRecycle)
     {
-        qDebug(
-            "Be continuing read [%d] bytes from socket: %s:%d",
-            nRet,
-            m_pSocket->peerAddress().toString().toStdString().c_str());
-        return nRet;
+        m_bRecycle = true;
+        QMetaObject::invokeMethod(this, "slotRecycle", Qt::QueuedConnection);
     }
-    return 0;
 }
 
-int CProxy::RemoveCommandBuffer(int nLength)
+void CProxy::slotRecycle()
 {
-    if(nLength < 0)
-    {
-        m_cmdBuf.clear();
-        return 0;
-    }
-
-    if(m_cmdBuf.size() > nLength)
+    if(m_pServer)
     {
-        m_cmdBuf = m_cmdBuf.right(m_cmdBuf.size() - nLength);
-        slotRead();
-    } else {
-        m_cmdBuf.clear();
+        QObject::disconnect(m_pServer, nullptr, this, nullptr);
+        if(m_Statistics.nWaiting)
+            m_pServer->OnWaiting(-m_Statistics.nWaiting);
     }
-    return 0;
+    // The scheduled passes of the closed connection are dropped
+    QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
+    m_Statistics.nWaiting = 0;
+    if(m_pOutput)
+        m_pOutput->SetSocket(nullptr);
+    if(!CObjectPool::Instance()->Put(this))
+        deleteLater();
 }
 
 int CProxy::CreatePeer()
 {
-    m_pPeer = QSharedPointer<CPeerConnector>(new CPeerConnector(this),
-                                             &QObject::deleteLater);
+    m_pPeer = QSharedPointer<CPeerConnector>(CPeerConnector::Create(this),
+                                             &CPeerConnector::Recycle);
     if(m_pPeer)
         return 0;
     qCritical() << "Make peer connect fail";
@@ -107,19 +169,337 @@ int CProxy::CreatePeer()
 int CProxy::SetPeerConnect()
 {
     if(!m_pPeer) return -1;
-    bool check = connect(m_pPeer.data(), SIGNAL(sigConnected()),
-                    this, SLOT(slotPeerConnected()));
+    CPeerConnector* pPeer = m_pPeer.data();
+    bool check = connect(pPeer, &CPeerConnector::sigConnected,
+                    this, &CProxy::slotPeerConnected);
+    Q_ASSERT(check);
+    check = connect(pPeer, &CPeerConnector::sigDisconnected,
+                    this, &CProxy::slotPeerDisconnectd);
     Q_ASSERT(check);
-    check = connect(m_pPeer.data(), SIGNAL(sigDisconnected()),
-                    this, SLOT(slotPeerDisconnectd()));
+    check = connect(pPeer, &CPeerConnector::sigError,
+                    this, &CProxy::slotPeerError);
     Q_ASSERT(check);
-    check = connect(m_pPeer.data(),
-           SIGNAL(sigError(int, const QString&)),
-           this,
-           SLOT(slotPeerError(int, const QString&)));
+    check = connect(pPeer, &CPeerConnector::sigReadyRead,
+                    this, &CProxy::slotPeerRead);
     Q_ASSERT(check);
-    check = connect(m_pPeer.data(), SIGNAL(sigReadyRead()),
-                    this, SLOT(slotPeerRead()));
+    check = connect(pPeer, &CPeerConnector::sigHostFound,
+                    this, &CProxy::slotPeerHostFound);
+    Q_ASSERT(check);
+    check = connect(pPeer, &CPeerConnector::sigBytesWritten,
+                    this, &CProxy::slotPeerBytesWritten);
     Q_ASSERT(check);
     return 0;
 }
+
+void CProxy::slotPeerHostFound()
+{
+    SetState(CServer::emState::Connect);
+}
+
+int CProxy::SetState(CServer::emState state)
+{
+    CParameter* pPara = m_pServer->Getparameter();
+    switch(state) {
+    case CServer::emState::LookUp:
+    case CServer::emState::Connect:
+        // Looking up and connecting share a deadline
+        if(CServer::emState::Handshake != m_TimeoutState)
+            break;
+        m_TimeoutState = state;
+        m_Timeout.Start(pPara->GetConnectTimeout());
+        // The data which the client sends before the reply is kept in the
+        // socket until the peer is connected. \see StartForward()
+        if(m_pSocket)
+            m_pSocket->setReadBufferSize(EARLY_DATA_SIZE);
+        break;
+    case CServer::emState::Forward:
+        m_TimeoutState = state;
+        m_Timeout.Start(pPara->GetIdleTimeout());
+        break;
+    default:
+        break;
+    }
+    if(!m_pCounter) return -1;
+    return m_pCounter->SetState(state);
+}
+
+int CProxy::StartForward()
+{
+    SetState(CServer::emState::Forward);
+    if(!m_pSocket)
+        return -1;
+    m_pSocket->setReadBufferSize(0);
+    // The client may send the payload without waiting for the reply,
+    // and it doesn't emit readyRead again
+    if(m_pSocket->bytesAvailable() > 0)
+        ForwardToPeer();
+    if(!m_pSocket)
+        return -1;
+    return HandOffRelay();
+}
+
+int CProxy::SetConnectState(const QString &szHost)
+{
+    QHostAddress add;
+    if(add.setAddress(szHost))
+        return SetState(CServer::emState::Connect);
+    return SetState(CServer::emState::LookUp);
+}
+
+int CProxy::HandOffRelay()
+{
+    if(!m_pSocket || !m_pPeer || !m_pServer)
+        return -1;
+    CRelay* pRelay = m_pServer->GetRelay();
+    if(!pRelay)
+        return -1;
+    qintptr peer = m_pPeer->SocketDescriptor();
+    if(-1 == peer || -1 == m_pSocket->socketDescriptor())
+        return -1;
+
+    // The data which has been written to Qt must be sent before the relay
+    m_pOutput->Flush();
+    m_pSocket->flush();
+    m_pPeer->Flush();
+    // The reaper resets the socket whose zerocopy sends aren't completed
+    // for long after it is closed, so the relay waits for them
+    if(m_pSocket->bytesToWrite() > 0 || m_pPeer->BytesToWrite() > 0
+        || m_pOutput->IsPinned())
+    {
+        bool check = connect(m_pSocket, &QTcpSocket::bytesWritten,
+                             this, &CProxy::slotHandOffRelay,
+                             Qt::UniqueConnection);
+        Q_ASSERT(check);
+        check = connect(m_pOutput, &COutputQueue::sigBytesWritten,
+                        this, &CProxy::slotHandOffRelay,
+                        Qt::UniqueConnection);
+        Q_ASSERT(check);
+        check = connect(m_pPeer.data(), &CPeerConnector::sigBytesWritten,
+                        this, &CProxy::slotHandOffRelay,
+                        Qt::UniqueConnection);
+        Q_ASSERT(check);
+        return 1;
+    }
+
+    QByteArray toPeer = m_pSocket->readAll();
+    QByteArray toClient = m_pPeer->ReadAll();
+    // The counter is owned by the relay, so the connection is counted
+    // until the relay closes it.
+    CConnectionCounter* pCounter = m_pCounter;
+    if(pCounter)
+        pCounter->setParent(nullptr);
+    if(pRelay->Add(m_pSocket->socketDescriptor(), peer,
+                   toPeer, toClient, pCounter))
+    {
+        qCritical() << "Hand off to the relay fail. Forward by Qt";
+        if(pCounter)
+            pCounter->setParent(m_pSocket);
+        if(!toPeer.isEmpty())
+            m_pPeer->Write(toPeer.data(), toPeer.size());
+        if(!toClient.isEmpty())
+            m_pOutput->Write(toClient);
+        return -1;
+    }
+
+    qDebug() << "Hand off to the relay";
+    // The relay duplicated the descriptors, so close the Qt sockets
+    disconnect(m_pOutput, &COutputQueue::sigBytesWritten,
+               this, &CProxy::slotHandOffRelay);
+    m_pSocket->disconnect();
+    m_pSocket->abort();
+    m_pSocket->deleteLater();
+    m_pSocket = nullptr;
+    slotClose();
+    return 0;
+}
+
+void CProxy::slotHandOffRelay()
+{
+    if(!m_pSocket)
+        return;
+    if(HandOffRelay() > 0 || !m_pSocket)
+        return;
+    // Fail, continue to forward by Qt
+    disconnect(m_pSocket, &QTcpSocket::bytesWritten,
+               this, &CProxy::slotHandOffRelay);
+    disconnect(m_pOutput, &COutputQueue::sigBytesWritten,
+               this, &CProxy::slotHandOffRelay);
+    if(m_pPeer)
+        disconnect(m_pPeer.data(), &CPeerConnector::sigBytesWritten,
+                   this, &CProxy::slotHandOffRelay);
+}
+
+int CProxy::ForwardToPeer()
+{
+    if(!m_pPeer || !m_pSocket) return -1;
+    // The scheduled pass forwards it, so the connections are served in turn
+    if(m_bPauseClient || m_bWaitClient) return 0;
+
+    CBufferPool::CSlab slab;
+    if(!slab.Data()) return -1;
+    CParameter* pPara = m_pServer->Getparameter();
+    qint64 nBudget = pPara->GetReadBudget();
+    qint64 nBytes = 0;
+    qint64 n = 0;
+    while(true)
+    {
+        qint64 nLen = slab.Size();
+        if(nBudget > 0)
+        {
+            nLen = qMin(nLen, nBudget - nBytes);
+            if(nLen <= 0) break;
+        }
+        if(!slab.Data()) break;
+        n = m_pSocket->read(slab.Data(), nLen);
+        if(n <= 0) break;
+        nBytes += n;
+        // It may take the slab, and put a new one into slab
+        int nWrite = m_pPeer->Write(slab, n);
+        if(-1 == nWrite)
+        {
+            qCritical() << "Forword client to peer fail:"
+                        << m_pPeer->Error() << m_pPeer->ErrorString();
+            OnForward(nBytes, m_bWaitClient, nullptr);
+            return -1;
+        }
+
+        if(pPara->GetHighWatermark() > 0
+            && m_pPeer->BytesToWrite() > pPara->GetHighWatermark())
+        {
+            // Qt stops reading from the network when the read buffer is full,
+            // so the client is slowed down by the TCP flow control.
+            m_bPauseClient = true;
+            m_pSocket->setReadBufferSize(pPara->GetLowWatermark());
+            qDebug() << "Pause reading the client";
+            break;
+        }
+    }
+    bool bDeferred = nBudget > 0 && nBytes >= nBudget && !m_bPauseClient
+                     && m_pSocket->bytesAvailable() > 0;
+    OnForward(nBytes, m_bWaitClient, bDeferred ? "slotForwardToPeer" : nullptr);
+    return 0;
+}
+
+int CProxy::ForwardToClient()
+{
+    if(!m_pPeer || !m_pSocket) return -1;
+    if(m_bPausePeer || m_bWaitPeer) return 0;
+
+    CBufferPool::CSlab slab;
+    if(!slab.Data()) return -1;
+    CParameter* pPara = m_pServer->Getparameter();
+    qint64 nBudget = pPara->GetReadBudget();
+    qint64 nBytes = 0;
+    qint64 n = 0;
+    while(true)
+    {
+        qint64 nLen = slab.Size();
+        if(nBudget > 0)
+        {
+            nLen = qMin(nLen, nBudget - nBytes);
+            if(nLen <= 0) break;
+        }
+        if(!slab.Data()) break;
+        n = m_pPeer->Read(slab.Data(), nLen);
+        if(n <= 0) break;
+        nBytes += n;
+        // It may take the slab, and put a new one into slab
+        int nWrite = m_pOutput->Write(slab, n);
+        if(-1 == nWrite)
+        {
+            qCritical() << "Forword peer to client fail:"
+                        << m_pSocket->error() << m_pSocket->errorString();
+            OnForward(nBytes, m_bWaitPeer, nullptr);
+            return -1;
+        }
+
+        if(pPara->GetHighWatermark() > 0
+            && m_pOutput->BytesToWrite() > pPara->GetHighWatermark())
+        {
+            m_bPausePeer = true;
+            m_pPeer->SetReadBufferSize(pPara->GetLowWatermark());
+            qDebug() << "Pause reading the peer";
+            break;
+        }
+    }
+    bool bDeferred = nBudget > 0 && nBytes >= nBudget && !m_bPausePeer
+                     && m_pPeer->BytesAvailable() > 0;
+    OnForward(nBytes, m_bWaitPeer, bDeferred ? "slotForwardToClient" : nullptr);
+    return 0;
+}
+
+void CProxy::OnForward(qint64 nBytes, bool &bWaiting, const char *pSlot)
+{
+    // Restart the idle timeout. It is O(1)
+    if(nBytes > 0 && m_Timeout.IsActive())
+        m_Timeout.Start(m_pServer->Getparameter()->GetIdleTimeout());
+    m_Statistics.nPasses++;
+    m_Statistics.nBytes += nBytes;
+    m_Statistics.nMaxPassBytes = qMax(m_Statistics.nMaxPassBytes, (quint64)nBytes);
+    if(pSlot)
+    {
+        // The queued call is posted to the end of the event queue,
+        // so the other connections are served before it.
+        m_Statistics.nDeferred++;
+        m_Statistics.nWaiting++;
+        m_pServer->OnWaiting(1);
+        bWaiting = true;
+        QMetaObject::invokeMethod(this, pSlot, Qt::QueuedConnection);
+    }
+    m_pServer->OnForward(nBytes, nullptr != pSlot);
+}
+
+void CProxy::slotForwardToPeer()
+{
+    m_bWaitClient = false;
+    m_Statistics.nWaiting--;
+    m_pServer->OnWaiting(-1);
+    ForwardToPeer();
+}
+
+void CProxy::slotForwardToClient()
+{
+    m_bWaitPeer = false;
+    m_Statistics.nWaiting--;
+    m_pServer->OnWaiting(-1);
+    ForwardToClient();
+}
+
+void CProxy::OnTimeout()
+{
+    qInfo() << "The connection is timeout in the state:" << (int)m_TimeoutState;
+    m_pServer->OnTimeout(m_TimeoutState);
+    slotClose();
+}
+
+CServer::strForwardStatistics CProxy::GetForwardStatistics()
+{
+    return m_Statistics;
+}
+
+void CProxy::slotClientBytesWritten(qint64 nBytes)
+{
+    Q_UNUSED(nBytes)
+    if(!m_bPausePeer || !m_pSocket || !m_pPeer)
+        return;
+    if(m_pOutput->BytesToWrite() > m_pServer->Getparameter()->GetLowWatermark())
+        return;
+    qDebug() << "Resume reading the peer";
+    m_bPausePeer = false;
+    m_pPeer->SetReadBufferSize(0);
+    // The data buffered when it is paused doesn't emit readyRead again
+    ForwardToClient();
+}
+
+void CProxy::slotPeerBytesWritten(qint64 nBytes)
+{
+    Q_UNUSED(nBytes)
+    if(!m_bPauseClient || !m_pSocket || !m_pPeer)
+        return;
+    if(m_pPeer->BytesToWrite() > m_pServer->Getparameter()->GetLowWatermark())
+        return;
+    qDebug() << "Resume reading the client";
+    m_bPauseClient = false;
+    m_pSocket->setReadBufferSize(0);
+    ForwardToPeer();
+}
@@ -8,8 +8,11 @@
 #include <QObject>
 #include <QTcpSocket>
 #include <QSharedPointer>
+#include <QPointer>
 #include "PeerConnector.h"
 #include "Server.h"
+#include "OutputQueue.h"
+#include "TimingWheel.h"
 
 /*!
  * \brief The proxy interface class
@@ -22,37 +25,119 @@ public:
     explicit CProxy(QTcpSocket* pSocket, CServer* server, QObject* parent = nullptr);
     virtual ~CProxy();
 
+    /*!
+     * \brief Reuse the closed proxy for a new connection of the server.
+     *        The derived classes reset their state, and call it.
+     * \return 0: success; -1: fail
+     * \see CObjectPool
+     */
+    virtual int Reset(QTcpSocket* pSocket, CServer* server);
+
 public Q_SLOTS:
     virtual void slotRead();
 
+public:
+    /*!
+     * \brief The statistics of the forwarding of the connection.
+     *        nWaiting is the directions which wait for a later pass.
+     * \see CServer::GetForwardStatistics()
+     */
+    CServer::strForwardStatistics GetForwardStatistics();
+
 protected Q_SLOTS:
+    //! Close the connection. The proxy is reused or deleted later.
     virtual void slotClose();
+    //! Put the closed proxy into the pool of the thread, or delete it
+    void slotRecycle();
     virtual void slotError(QAbstractSocket::SocketError socketError);
 
     virtual void slotPeerConnected() = 0;
     virtual void slotPeerDisconnectd() = 0;
     virtual void slotPeerError(int err, const QString &szErr) = 0;
     virtual void slotPeerRead() = 0;
+    virtual void slotPeerHostFound();
+    //! Retry to hand off when the written buffers are empty
+    void slotHandOffRelay();
+    //! Resume reading from the peer if the client is below the low watermark
+    void slotClientBytesWritten(qint64 nBytes);
+    //! Resume reading from the client if the peer is below the low watermark
+    void slotPeerBytesWritten(qint64 nBytes);
+    //! The deferred pass of ForwardToPeer()
+    void slotForwardToPeer();
+    //! The deferred pass of ForwardToClient()
+    void slotForwardToClient();
 
 protected:
-    /**
-     * @brief CheckBufferLength
-     * @param nLength
-     * @return:
-     *     0: If has nLength
-     *   > 0:
-     */
-    int CheckBufferLength(int nLength);
-    int RemoveCommandBuffer(int nLength = -1);
-
     virtual int CreatePeer();
     virtual int SetPeerConnect();
+    /*!
+     * \brief Set the state of the connection in the server.
+     *        It also starts the timeout of the state.
+     * \see CServer::GetConnectors(CServer::emState) CServer::GetTimeouts()
+     */
+    int SetState(CServer::emState state);
+    /*!
+     * \brief Set the state to look up or connect,
+     *        whether the host is an address or a name.
+     */
+    int SetConnectState(const QString& szHost);
+    /*!
+     * \brief Start forwarding when the peer is connected and the reply is
+     *        sent. The data which the client sent with the request
+     *        (pipelined) or before the reply is forwarded to the peer
+     *        first, then it hands off to the relay.
+     * \return \see HandOffRelay()
+     */
+    int StartForward();
+    /*!
+     * \brief Hand off the forwarding to the relay of the server.
+     *        It is called after the state is forward.
+     *        The data read by Qt is sent by the relay firstly.
+     *        The data written to Qt is sent before it hands off.
+     *        The connection is counted in forward until the relay closes it.
+     * \return 0: hand off, the proxy is closed.
+     *         > 0: wait for the written buffers are empty.
+     *         < 0: fail, it continues to forward by Qt.
+     * \see CServer::GetRelay()
+     */
+    int HandOffRelay();
 
-    QByteArray m_cmdBuf;
+    /*!
+     * \brief Forward the data from the client to the peer.
+     *        When the bytes waiting to be written to the peer are more than
+     *        the high watermark, it stops reading from the client until
+     *        they are less than or equal to the low watermark.
+     *        It reads the read budget at most in a pass. The remaining data
+     *        is forwarded in a pass scheduled to the end of the event queue.
+     * \see CParameter::GetHighWatermark() CParameter::GetReadBudget()
+     */
+    virtual int ForwardToPeer();
+    //! Forward the data from the peer to the client. \see ForwardToPeer()
+    virtual int ForwardToClient();
+    //! Count a pass, and schedule the next pass if it is deferred
+    void OnForward(qint64 nBytes, bool& bWaiting, const char* pSlot);
 
     CServer* m_pServer;
     QTcpSocket* m_pSocket;
     QSharedPointer<CPeerConnector> m_pPeer;
+    QPointer<CConnectionCounter> m_pCounter;
+    //! The writes to the client are coalesced by it. Write to the client with it.
+    COutputQueue* m_pOutput;
+    bool m_bPauseClient; // Stop reading from the client
+    bool m_bPausePeer; // Stop reading from the peer
+    bool m_bWaitClient; // A pass of reading from the client is scheduled
+    bool m_bWaitPeer; // A pass of reading from the peer is scheduled
+
+private:
+    //! Connect to the socket and the server, and start the handshake timeout
+    int Attach();
+    //! Close the connection when the timeout of the state expires
+    void OnTimeout();
+
+    CServer::strForwardStatistics m_Statistics;
+    CTimingWheel::CTimer m_Timeout;
+    CServer::emState m_TimeoutState; // The state which the timeout is started in
+    bool m_bRecycle; // slotRecycle() is scheduled
 };
 
 #endif // CPROXY_H
@@ -0,0 +1,716 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "ProxyHttp.h"
+#include "ServerSocks.h"
+#include "ParameterSocks.h"
+#include "UpstreamPool.h"
+#include "BufferPool.h"
+#ifdef HAVE_ICE
+    #include "PeerConnectorIceClient.h"
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(logHttp, "Http")
+
+CProxyHttp::CProxyHttp(QTcpSocket *pSocket, CServer *server, QObject *parent)
+    : CProxy(pSocket, server, parent),
+      m_Status(emStatus::Request),
+      m_nPort(0),
+      m_bHead(false),
+      m_bKeepAlive(false),
+      m_bReusePeer(false),
+      m_bPooledPeer(false),
+      m_bResponse(false)
+{
+    m_Response.Start(CHttpParser::emMessage::Response);
+}
+
+CProxyHttp::~CProxyHttp()
+{
+    qDebug(logHttp) << "CProxyHttp::~CProxyHttp()";
+}
+
+int CProxyHttp::Reset(QTcpSocket *pSocket, CServer *server)
+{
+    m_Status = emStatus::Request;
+    m_szHost.clear();
+    m_nPort = 0;
+    m_szKey.clear();
+    m_bHead = false;
+    m_bKeepAlive = false;
+    m_bReusePeer = false;
+    m_bPooledPeer = false;
+    m_bResponse = false;
+    m_Parser.Start();
+    m_Response.Start(CHttpParser::emMessage::Response);
+    m_RequestBody.Start(CHttpBody::emFraming::None);
+    m_ResponseBody.Start(CHttpBody::emFraming::None);
+    return CProxy::Reset(pSocket, server);
+}
+
+void CProxyHttp::slotRead()
+{
+    switch (m_Status) {
+    case emStatus::Request:
+        switch (ReadRequest()) {
+        case CHttpParser::Incomplete:
+            break;
+        case CHttpParser::Complete:
+            OnRequest();
+            break;
+        case CHttpParser::Error:
+            qCritical(logHttp) << "The request is error:"
+                               << (int)m_Parser.GetError();
+            if(CHttpParser::emError::Format == m_Parser.GetError())
+                ReplyError(400, "Bad Request");
+            else
+                ReplyError(431, "Request Header Fields Too Large");
+            break;
+        }
+        break;
+    case emStatus::Connect:
+        // The data is kept until the peer is connected. \see StartForward()
+        break;
+    case emStatus::Forward:
+    case emStatus::Exchange:
+        ForwardToPeer();
+        break;
+    }
+}
+
+CHttpParser::emResult CProxyHttp::ReadRequest()
+{
+    while(m_Parser.Need() > 0)
+    {
+        // Read no more than the header, the data after it is the payload
+        char* p = m_Parser.Tail();
+        qint64 n = m_pSocket->peek(p, m_Parser.Need());
+        if(n <= 0)
+            break;
+        m_pSocket->read(p, m_Parser.Commit(n));
+    }
+    return m_Parser.Result();
+}
+
+int CProxyHttp::OnRequest()
+{
+    qDebug(logHttp) << "Request:"
+                    << QLatin1String(m_Parser.Method(), m_Parser.MethodLength())
+                    << QLatin1String(m_Parser.Target(), m_Parser.TargetLength());
+    if(!IsAuthenticated())
+    {
+        qCritical(logHttp) << "Authenticate fail";
+        return ReplyError(407, "Proxy Authentication Required",
+                          "Proxy-Authenticate: Basic realm=\"RabbitProxy\"\r\n");
+    }
+
+    if(m_Parser.IsMethod("CONNECT"))
+        return processConnect();
+    return processForward();
+}
+
+bool CProxyHttp::IsAuthenticated()
+{
+    CParameterSocks* pPara = qobject_cast<CParameterSocks*>(m_pServer->Getparameter());
+    QVector<unsigned char> methods = pPara->GetV5Method();
+    if(methods.contains(CParameterSocks::AUTHENTICATOR_NO))
+        return true;
+    if(!methods.contains(CParameterSocks::AUTHENTICATOR_UserPassword))
+        return false;
+
+    // Proxy-Authorization: Basic base64(user:password)
+    int i = m_Parser.Find("Proxy-Authorization");
+    if(i < 0)
+        return false;
+    const char* pValue = m_Parser.Value(i);
+    int nValue = m_Parser.ValueLength(i);
+    if(nValue <= 6 || !CHttpParser::IsEqual(pValue, 6, "Basic "))
+        return false;
+    QByteArray credentials = QByteArray::fromBase64(
+        QByteArray::fromRawData(pValue + 6, nValue - 6));
+    return credentials == (pPara->GetAuthentUser() + ":"
+                           + pPara->GetAuthentPassword()).toUtf8();
+}
+
+int CProxyHttp::processConnect()
+{
+    // CONNECT host:port HTTP/1.1
+    const char* pHost = nullptr;
+    int nHost = 0;
+    quint16 nPort = 0;
+    if(!CHttpParser::SplitAuthority(m_Parser.Target(), m_Parser.TargetLength(),
+                                    pHost, nHost, nPort)
+        || 0 == nPort)
+    {
+        qCritical(logHttp) << "The target is error:"
+                           << QLatin1String(m_Parser.Target(),
+                                            m_Parser.TargetLength());
+        return ReplyError(400, "Bad Request");
+    }
+    m_szHost = QString::fromUtf8(pHost, nHost);
+    m_nPort = nPort;
+    return ConnectPeer();
+}
+
+int CProxyHttp::processForward()
+{
+    // GET http://host:port/path HTTP/1.1
+    const char* pAuthority = nullptr;
+    int nAuthority = 0;
+    const char* pPath = nullptr;
+    int nPath = 0;
+    const char* pHost = nullptr;
+    int nHost = 0;
+    quint16 nPort = 80;
+    if(!CHttpParser::SplitUri(m_Parser.Target(), m_Parser.TargetLength(),
+                              pAuthority, nAuthority, pPath, nPath)
+        || !CHttpParser::SplitAuthority(pAuthority, nAuthority,
+                                        pHost, nHost, nPort))
+    {
+        qCritical(logHttp) << "The target isn't the absolute URI of http:"
+                           << QLatin1String(m_Parser.Target(),
+                                            m_Parser.TargetLength());
+        return ReplyError(400, "Bad Request");
+    }
+    if(m_RequestBody.StartRequest(m_Parser))
+    {
+        qCritical(logHttp) << "The length of the body is error";
+        return ReplyError(400, "Bad Request");
+    }
+
+    m_szHost = QString::fromUtf8(pHost, nHost);
+    m_nPort = nPort;
+    m_szKey = m_szHost + ":" + QString::number(m_nPort);
+    m_bHead = m_Parser.IsMethod("HEAD");
+    // HTTP/1.1 keeps the connection alive by default
+    m_bKeepAlive = m_Parser.MinorVersion() >= 1
+                   && !m_Parser.HasToken("Connection", "close")
+                   && !m_Parser.HasToken("Proxy-Connection", "close");
+    m_bReusePeer = m_Parser.MinorVersion() >= 1;
+    m_bResponse = false;
+
+    if(m_pPeer)
+        Q_ASSERT(false);
+    m_pPeer = CUpstreamPool::Instance()->Get(m_szKey);
+    if(m_pPeer)
+    {
+        qDebug(logHttp) << "Reuse the connection:" << m_szKey;
+        m_bPooledPeer = true;
+        SetPeerConnect();
+        return StartExchange();
+    }
+    m_bPooledPeer = false;
+    return ConnectPeer();
+}
+
+int CProxyHttp::ConnectPeer()
+{
+    if(CreatePeer())
+        return ReplyError(502, "Bad Gateway");
+
+    SetPeerConnect();
+
+    m_Status = emStatus::Connect;
+    SetConnectState(m_szHost);
+    m_pPeer->Connect(m_szHost, m_nPort);
+    qDebug(logHttp) << "Connect to:" << m_szHost << ":" << m_nPort;
+    return 0;
+}
+
+int CProxyHttp::BuildRequest(char *pBuffer, int nSize)
+{
+    const char* pAuthority = nullptr;
+    int nAuthority = 0;
+    const char* pPath = nullptr;
+    int nPath = 0;
+    CHttpParser::SplitUri(m_Parser.Target(), m_Parser.TargetLength(),
+                          pAuthority, nAuthority, pPath, nPath);
+
+    char* p = pBuffer;
+    char* pEnd = pBuffer + nSize;
+    auto append = [&p, pEnd](const char* pData, int nLen) {
+        if(nLen > pEnd - p)
+            return false;
+        memcpy(p, pData, nLen);
+        p += nLen;
+        return true;
+    };
+
+    // The request line of the origin form
+    char version[] = " HTTP/1.x\r\n";
+    version[8] = '0' + m_Parser.MinorVersion();
+    bool bOk = append(m_Parser.Method(), m_Parser.MethodLength())
+               && append(" ", 1);
+    if(0 == nPath || '/' != pPath[0])
+        bOk = bOk && append("/", 1);
+    bOk = bOk && append(pPath, nPath) && append(version, sizeof(version) - 1);
+
+    // The hop-by-hop fields. See RFC 7230 6.1
+    static const char* hop[] = {"Connection", "Proxy-Connection", "Keep-Alive",
+                                "Proxy-Authorization", "TE", "Trailer",
+                                "Upgrade"};
+    for(int i = 0; bOk && i < m_Parser.HeaderCount(); i++)
+    {
+        bool bHop = false;
+        for(const char* pName : hop)
+        {
+            if(CHttpParser::IsEqual(m_Parser.Name(i), m_Parser.NameLength(i),
+                                    pName))
+            {
+                bHop = true;
+                break;
+            }
+        }
+        if(bHop)
+            continue;
+        bOk = append(m_Parser.Name(i), m_Parser.NameLength(i))
+              && append(": ", 2)
+              && append(m_Parser.Value(i), m_Parser.ValueLength(i))
+              && append("\r\n", 2);
+    }
+    if(m_Parser.Find("Host") < 0)
+        bOk = bOk && append("Host: ", 6) && append(pAuthority, nAuthority)
+              && append("\r\n", 2);
+    bOk = bOk && append("\r\n", 2);
+    if(!bOk)
+        return -1;
+    return static_cast<int>(p - pBuffer);
+}
+
+int CProxyHttp::StartExchange()
+{
+    CBufferPool::CSlab slab;
+    int nLen = -1;
+    if(slab.Data())
+        nLen = BuildRequest(slab.Data(), slab.Size());
+    if(nLen < 0)
+    {
+        qCritical(logHttp) << "The request is too long to rewrite";
+        return ReplyError(431, "Request Header Fields Too Large");
+    }
+
+    m_Status = emStatus::Exchange;
+    m_Response.Start(CHttpParser::emMessage::Response);
+    m_ResponseBody.Start(CHttpBody::emFraming::None);
+    SetState(CServer::emState::Forward);
+    m_pSocket->setReadBufferSize(0);
+    if(-1 == m_pPeer->Write(slab, nLen))
+    {
+        qCritical(logHttp) << "Send the request fail:" << m_pPeer->ErrorString();
+        OnPeerClosed();
+        return -1;
+    }
+    // The body which the client sent with the header
+    if(m_pSocket->bytesAvailable() > 0)
+        ForwardToPeer();
+    return 0;
+}
+
+int CProxyHttp::ForwardToPeer()
+{
+    if(emStatus::Exchange != m_Status)
+        return CProxy::ForwardToPeer();
+    if(!m_pPeer || !m_pSocket) return -1;
+    if(m_bPauseClient || m_bWaitClient || m_RequestBody.IsComplete())
+        return 0;
+
+    CBufferPool::CSlab slab;
+    if(!slab.Data()) return -1;
+    CParameter* pPara = m_pServer->Getparameter();
+    qint64 nBudget = pPara->GetReadBudget();
+    qint64 nBytes = 0;
+    while(!m_RequestBody.IsComplete())
+    {
+        qint64 nLen = slab.Size();
+        if(nBudget > 0)
+        {
+            nLen = qMin(nLen, nBudget - nBytes);
+            if(nLen <= 0) break;
+        }
+        if(!slab.Data()) break;
+        // Read no more than the body, the data after it is the next request
+        qint64 n = m_pSocket->peek(slab.Data(), nLen);
+        if(n <= 0) break;
+        n = m_RequestBody.Scan(slab.Data(), n);
+        if(n < 0)
+        {
+            qCritical(logHttp) << "The chunked body of the request is error";
+            OnForward(nBytes, m_bWaitClient, nullptr);
+            slotClose();
+            return -1;
+        }
+        m_pSocket->read(slab.Data(), n);
+        nBytes += n;
+        // It may take the slab, and put a new one into slab
+        if(-1 == m_pPeer->Write(slab, n))
+        {
+            qCritical(logHttp) << "Forword the request to peer fail:"
+                               << m_pPeer->Error() << m_pPeer->ErrorString();
+            OnForward(nBytes, m_bWaitClient, nullptr);
+            slotClose();
+            return -1;
+        }
+
+        if(pPara->GetHighWatermark() > 0
+            && m_pPeer->BytesToWrite() > pPara->GetHighWatermark())
+        {
+            m_bPauseClient = true;
+            m_pSocket->setReadBufferSize(pPara->GetLowWatermark());
+            qDebug(logHttp) << "Pause reading the client";
+            break;
+        }
+    }
+    bool bDeferred = nBudget > 0 && nBytes >= nBudget && !m_bPauseClient
+                     && !m_RequestBody.IsComplete()
+                     && m_pSocket->bytesAvailable() > 0;
+    OnForward(nBytes, m_bWaitClient, bDeferred ? "slotForwardToPeer" : nullptr);
+    return 0;
+}
+
+int CProxyHttp::ForwardToClient()
+{
+    if(emStatus::Exchange != m_Status)
+        return CProxy::ForwardToClient();
+    if(!m_pPeer || !m_pSocket) return -1;
+    if(m_bPausePeer || m_bWaitPeer) return 0;
+
+    CBufferPool::CSlab slab;
+    if(!slab.Data()) return -1;
+    CParameter* pPara = m_pServer->Getparameter();
+    qint64 nBudget = pPara->GetReadBudget();
+    qint64 nBytes = 0;
+    while(emStatus::Exchange == m_Status && m_pPeer)
+    {
+        qint64 nLen = slab.Size();
+        if(nBudget > 0)
+        {
+            nLen = qMin(nLen, nBudget - nBytes);
+            if(nLen <= 0) break;
+        }
+        qint64 n = m_pPeer->Read(slab.Data(), nLen);
+        if(n <= 0) break;
+        nBytes += n;
+        if(OnResponseData(slab.Data(), n))
+        {
+            OnForward(nBytes, m_bWaitPeer, nullptr);
+            return -1;
+        }
+
+        if(emStatus::Exchange == m_Status && pPara->GetHighWatermark() > 0
+            && m_pOutput->BytesToWrite() > pPara->GetHighWatermark())
+        {
+            m_bPausePeer = true;
+            m_pPeer->SetReadBufferSize(pPara->GetLowWatermark());
+            qDebug(logHttp) << "Pause reading the peer";
+            break;
+        }
+    }
+    bool bDeferred = nBudget > 0 && nBytes >= nBudget && !m_bPausePeer
+                     && emStatus::Exchange == m_Status && m_pPeer
+                     && m_pPeer->BytesAvailable() > 0;
+    OnForward(nBytes, m_bWaitPeer, bDeferred ? "slotForwardToClient" : nullptr);
+    return 0;
+}
+
+int CProxyHttp::OnResponseData(const char *pData, qint64 nLen)
+{
+    while(nLen > 0 && emStatus::Exchange == m_Status)
+    {
+        if(CHttpParser::Complete != m_Response.Result())
+        {
+            // The header is gathered by the parser
+            int n = static_cast<int>(qMin<qint64>(nLen, m_Response.Need()));
+            memcpy(m_Response.Tail(), pData, n);
+            n = m_Response.Commit(n);
+            pData += n;
+            nLen -= n;
+            if(CHttpParser::Error == m_Response.Result())
+            {
+                qCritical(logHttp) << "The response is error:"
+                                   << (int)m_Response.GetError();
+                FailExchange();
+                return -1;
+            }
+            if(CHttpParser::Incomplete == m_Response.Result())
+                continue;
+            if(OnResponse())
+                return -1;
+        } else {
+            qint64 n = m_ResponseBody.Scan(pData, nLen);
+            if(n < 0)
+            {
+                qCritical(logHttp) << "The chunked body of the response is error";
+                slotClose();
+                return -1;
+            }
+            if(n > 0 && -1 == m_pOutput->Write(pData, n))
+            {
+                qCritical(logHttp) << "Forword the response to client fail:"
+                                   << m_pSocket->errorString();
+                slotClose();
+                return -1;
+            }
+            pData += n;
+            nLen -= n;
+        }
+
+        // The interim response restarts the parser, so it isn't complete
+        if(CHttpParser::Complete == m_Response.Result()
+            && m_ResponseBody.IsComplete())
+        {
+            // The server doesn't send more than the response
+            if(nLen > 0)
+                m_bReusePeer = false;
+            return FinishExchange();
+        }
+    }
+    return 0;
+}
+
+int CProxyHttp::OnResponse()
+{
+    int nCode = m_Response.StatusCode();
+    qDebug(logHttp) << "Response:" << nCode << m_szKey;
+    if(101 == nCode)
+    {
+        // The upgrade field isn't forwarded, so the server shouldn't switch
+        qCritical(logHttp) << "Don't support switching protocols";
+        FailExchange();
+        return -1;
+    }
+
+    // The header is forwarded as it is
+    if(-1 == m_pOutput->Write(m_Response.Data(), m_Response.Length()))
+    {
+        slotClose();
+        return -1;
+    }
+    m_bResponse = true;
+
+    if(nCode >= 100 && nCode < 200)
+    {
+        // The interim response, eg: 100 Continue, is followed by the final response
+        m_Response.Start(CHttpParser::emMessage::Response);
+        return 0;
+    }
+
+    if(m_ResponseBody.StartResponse(m_Response, m_bHead))
+    {
+        qCritical(logHttp) << "The length of the body of the response is error";
+        slotClose();
+        return -1;
+    }
+    bool bClose = m_Response.HasToken("Connection", "close")
+                  || CHttpBody::emFraming::Close == m_ResponseBody.GetFraming();
+    if(bClose || m_Response.MinorVersion() < 1)
+    {
+        m_bReusePeer = false;
+        m_bKeepAlive = false;
+    }
+    return 0;
+}
+
+int CProxyHttp::FinishExchange()
+{
+    qDebug(logHttp) << "The exchange is complete:" << m_szKey
+                    << "reuse:" << m_bReusePeer << "keep alive:" << m_bKeepAlive;
+    bool bRequest = m_RequestBody.IsComplete();
+    m_pPeer->disconnect(this);
+    if(m_bPausePeer)
+    {
+        m_bPausePeer = false;
+        m_pPeer->SetReadBufferSize(0);
+    }
+    if(m_bReusePeer && bRequest)
+        CUpstreamPool::Instance()->Put(m_szKey, m_pPeer);
+    else
+        m_pPeer->Close();
+    m_pPeer.clear();
+
+    if(!m_bKeepAlive || !bRequest || !m_pSocket)
+    {
+        slotClose();
+        return 0;
+    }
+    if(m_bPauseClient)
+    {
+        m_bPauseClient = false;
+        m_pSocket->setReadBufferSize(0);
+    }
+    m_Status = emStatus::Request;
+    m_Parser.Start();
+    // The next request which is pipelined is handled after the signals of
+    // the peer return
+    if(m_pSocket->bytesAvailable() > 0)
+        QMetaObject::invokeMethod(this, "slotRead", Qt::QueuedConnection);
+    return 0;
+}
+
+void CProxyHttp::OnPeerClosed()
+{
+    m_bReusePeer = false;
+    // The data which the peer sent before closing is forwarded at once
+    m_bPausePeer = false;
+    do {
+        m_bWaitPeer = false;
+        if(ForwardToClient())
+            return;
+    } while(emStatus::Exchange == m_Status && m_pPeer
+             && m_pPeer->BytesAvailable() > 0);
+    if(emStatus::Exchange != m_Status)
+        return;
+    if(RetryExchange())
+        return;
+    // The body which is ended by closing the connection
+    if(CHttpParser::Complete == m_Response.Result()
+        && CHttpBody::emFraming::Close == m_ResponseBody.GetFraming())
+    {
+        FinishExchange();
+        return;
+    }
+    FailExchange();
+}
+
+int CProxyHttp::FailExchange()
+{
+    if(m_bResponse)
+    {
+        slotClose();
+        return -1;
+    }
+    return ReplyError(502, "Bad Gateway");
+}
+
+bool CProxyHttp::RetryExchange()
+{
+    // The request is resent only if nothing of it is lost
+    if(!m_bPooledPeer || m_bResponse || m_Response.Length() > 0
+        || CHttpBody::emFraming::None != m_RequestBody.GetFraming())
+        return false;
+    qDebug(logHttp) << "The pooled connection is closed, retry:" << m_szKey;
+    m_pPeer->disconnect(this);
+    m_pPeer->Close();
+    m_pPeer.clear();
+    m_bPooledPeer = false;
+    m_bReusePeer = m_Parser.MinorVersion() >= 1;
+    ConnectPeer();
+    return true;
+}
+
+int CProxyHttp::Reply(int nCode, const char *pReason, const char *pHeaders)
+{
+    if(!m_pSocket)
+        return -1;
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\n%s\r\n",
+                     nCode, pReason, pHeaders);
+    if(n <= 0 || n >= (int)sizeof(buf))
+        return -1;
+    if(-1 == m_pOutput->Write(buf, n))
+    {
+        qCritical(logHttp) << "Reply fail:" << m_pSocket->errorString();
+        return -1;
+    }
+    return 0;
+}
+
+int CProxyHttp::ReplyError(int nCode, const char *pReason, const char *pHeaders)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%sContent-Length: 0\r\nConnection: close\r\n",
+             pHeaders);
+    Reply(nCode, pReason, buf);
+    slotClose();
+    return -1;
+}
+
+void CProxyHttp::slotPeerConnected()
+{
+    if(emStatus::Connect != m_Status)
+        return;
+
+    qInfo(logHttp) << "Peer connected to:" << m_szHost << ":" << m_nPort;
+    if(m_Parser.IsMethod("CONNECT"))
+    {
+        Reply(200, "Connection Established");
+        m_Status = emStatus::Forward;
+        StartForward();
+        return;
+    }
+    StartExchange();
+}
+
+void CProxyHttp::slotPeerDisconnectd()
+{
+    qInfo(logHttp) << "Peer disconnected to:" << m_szHost << ":" << m_nPort;
+    switch (m_Status) {
+    case emStatus::Connect:
+        ReplyError(502, "Bad Gateway");
+        break;
+    case emStatus::Exchange:
+        OnPeerClosed();
+        break;
+    default:
+        slotClose();
+        break;
+    }
+}
+
+void CProxyHttp::slotPeerError(int err, const QString &szErr)
+{
+    qCritical(logHttp, "Peer: %s:%d. Error:%d %s",
+              m_szHost.toStdString().c_str(),
+              m_nPort,
+              err,
+              szErr.toStdString().c_str());
+    switch (m_Status) {
+    case emStatus::Connect:
+        break;
+    case emStatus::Exchange:
+        OnPeerClosed();
+        return;
+    default:
+        slotClose();
+        return;
+    }
+
+    switch (err) {
+    case CPeerConnector::emERROR::NotAllowdConnection:
+        ReplyError(403, "Forbidden");
+        break;
+    case CPeerConnector::emERROR::Timeout:
+        ReplyError(504, "Gateway Timeout");
+        break;
+    default:
+        ReplyError(502, "Bad Gateway");
+        break;
+    }
+}
+
+void CProxyHttp::slotPeerRead()
+{
+    ForwardToClient();
+}
+
+int CProxyHttp::CreatePeer()
+{
+#ifdef HAVE_ICE
+    CParameterSocks* pPara = dynamic_cast<CParameterSocks*>(m_pServer->Getparameter());
+    if(pPara->GetIce())
+    {
+        CServerSocks* pServer = qobject_cast<CServerSocks*>(m_pServer);
+        m_pPeer = QSharedPointer<CPeerConnectorIceClient>(
+                    new CPeerConnectorIceClient(pServer, this),
+                    &QObject::deleteLater);
+    } else
+#endif
+        m_pPeer = QSharedPointer<CPeerConnector>(CPeerConnector::Create(this),
+                                                 &CPeerConnector::Recycle);
+    if(m_pPeer)
+        return 0;
+    qCritical(logHttp, "Make peer connect fail");
+    return -1;
+}
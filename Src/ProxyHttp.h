@@ -0,0 +1,134 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CPROXYHTTP_H
+#define CPROXYHTTP_H
+
+#pragma once
+
+#include "Proxy.h"
+#include "HttpParser.h"
+#include "HttpBody.h"
+
+/**
+ * @brief The HTTP proxy class.
+ *        It implements the tunnel of the CONNECT method (RFC 7231 4.3.6),
+ *        and the forward proxy of the requests with the absolute URI of
+ *        the http scheme (RFC 7230 5.3.2).
+ *        The forward proxy keeps the connection of the client alive, and
+ *        the idle upstream connections are kept in CUpstreamPool, so the
+ *        next request to the same host:port reuses it.
+ *        When the socks5 server requires the user/password authentication,
+ *        the request is authenticated by the basic authentication
+ *        (RFC 7617) with the same user and password.
+ * @note  The protocol is detected in CServerSocks::OnRead()
+ */
+class CProxyHttp : public CProxy
+{
+    Q_OBJECT
+
+public:
+    explicit CProxyHttp(QTcpSocket* pSocket, CServer* server, QObject* parent = nullptr);
+    virtual ~CProxyHttp();
+
+    virtual int Reset(QTcpSocket* pSocket, CServer* server) override;
+
+public Q_SLOTS:
+    virtual void slotRead() override;
+
+protected Q_SLOTS:
+    virtual void slotPeerConnected() override;
+    virtual void slotPeerDisconnectd() override;
+    virtual void slotPeerError(int err, const QString &szErr) override;
+    virtual void slotPeerRead() override;
+
+protected:
+    virtual int CreatePeer() override;
+    //! Forward the body of the request in the exchange, or the tunnel
+    virtual int ForwardToPeer() override;
+    //! Forward the response in the exchange, or the tunnel
+    virtual int ForwardToClient() override;
+    /*!
+     * \brief Read the header of the request. The data after it is left in
+     *        the socket.
+     * \return Complete: the header is complete
+     *         Incomplete: wait for more data
+     *         Error: the header is error. \see CHttpParser::GetError()
+     */
+    CHttpParser::emResult ReadRequest();
+    /*!
+     * \brief Handle the complete request
+     * \return 0: success
+     *         -1: fail, the error is replied and the proxy is closed
+     */
+    virtual int OnRequest();
+    //! Whether the request has the credentials which the server requires
+    bool IsAuthenticated();
+    /*!
+     * \brief Reply the status line and the header fields
+     * \param pHeaders: the header fields, every one is ended with "\r\n"
+     */
+    int Reply(int nCode, const char* pReason, const char* pHeaders = "");
+    //! Reply the error, and close the connection
+    int ReplyError(int nCode, const char* pReason, const char* pHeaders = "");
+
+    //! The parser of the request
+    CHttpParser m_Parser;
+
+private:
+    int processConnect();
+    int processForward();
+    /*!
+     * \brief Rewrite the request to the origin server: the request target
+     *        is the path, and the hop-by-hop fields are removed.
+     * \return the length. -1: the buffer isn't enough
+     */
+    int BuildRequest(char* pBuffer, int nSize);
+    //! Send the request to the connected peer, and forward the exchange
+    int StartExchange();
+    //! Handle the bytes of the response from the peer
+    int OnResponseData(const char* pData, qint64 nLen);
+    //! Handle the complete header of the response
+    int OnResponse();
+    /*!
+     * \brief The response is complete. Put the peer into the pool if it is
+     *        kept alive, and wait for the next request of the client.
+     */
+    int FinishExchange();
+    //! The peer is closed in the exchange
+    void OnPeerClosed();
+    //! Reply the error if the response isn't sent, or close the connection
+    int FailExchange();
+    /*!
+     * \brief Resend the request with a new connection when the pooled
+     *        connection is closed by the server before the response.
+     * \return true: it is resent
+     */
+    bool RetryExchange();
+    int ConnectPeer();
+
+    enum class emStatus {
+        Request,
+        Connect,
+        //! The tunnel of CONNECT
+        Forward,
+        //! The request and the response of the forward proxy
+        Exchange
+    };
+    emStatus m_Status;
+    QString m_szHost;
+    quint16 m_nPort;
+
+    //! host:port of the pool. \see CUpstreamPool
+    QString m_szKey;
+    //! The parser of the response
+    CHttpParser m_Response;
+    CHttpBody m_RequestBody;
+    CHttpBody m_ResponseBody;
+    bool m_bHead; // The request is HEAD, so the response hasn't body
+    bool m_bKeepAlive; // The connection of the client is kept alive
+    bool m_bReusePeer; // The peer can be put into the pool
+    bool m_bPooledPeer; // The peer is got from the pool
+    bool m_bResponse; // The response is sent to the client partly
+};
+
+#endif // CPROXYHTTP_H
@@ -17,6 +17,7 @@ CProxySocks4::CProxySocks4(QTcpSocket *pSocket, CServer *server, QObject *parent
       m_Status(emStatus::ClientRequest),
       m_nPort(0)
 {
+    m_Parser.Start(CSocksParser::emMessage::Request4);
 }
 
 CProxySocks4::~CProxySocks4()
@@ -24,29 +25,25 @@ CProxySocks4::~CProxySocks4()
     qDebug(logSocks4) << "CProxySocks4::~CProxySocks4()";
 }
 
+int CProxySocks4::Reset(QTcpSocket *pSocket, CServer *server)
+{
+    m_Status = emStatus::ClientRequest;
+    m_HostAddress.clear();
+    m_nPort = 0;
+    m_Parser.Start(CSocksParser::emMessage::Request4);
+    return CProxy::Reset(pSocket, server);
+}
+
 void CProxySocks4::slotRead()
 {
     //LOG_MODEL_DEBUG("Socks4", "slotRead() command:0x%X", m_Status);
     
     switch (m_Status) {
     case emStatus::ClientRequest:
-        processClientRequest();
+        RunHandshake();
         break;
     case emStatus::Forward:
-        if(m_pPeer && m_pSocket)
-        {
-            QByteArray d = m_pSocket->readAll();
-            if(!d.isEmpty())
-            {
-                int nWrite = m_pPeer->Write(d.data(), d.length());
-                if(-1 == nWrite)
-                    qCritical(logSocks4) << "Forword client to peer fail:"
-                                         << m_pPeer->Error()
-                                         << m_pPeer->ErrorString();
-            }
-            else
-                qDebug(logSocks4) << "From client readAll is empty";
-        }
+        ForwardToPeer();
         break;
     }
 }
@@ -62,61 +59,81 @@ int CProxySocks4::reply(emErrorCode code)
     }
     
     if(m_pSocket)
-        m_pSocket->write(reinterpret_cast<char*>(&r), sizeof(strReply));
+        m_pOutput->Write(reinterpret_cast<char*>(&r), sizeof(strReply));
     return nRet;
 }
 
+int CProxySocks4::ReadMessage()
+{
+    while(m_Parser.Need() > 0)
+    {
+        // Read no more than the message, the data after it is the payload
+        qint64 n = m_pSocket->read(m_Parser.Tail(), m_Parser.Need());
+        if(n <= 0)
+            return ERROR_CONTINUE_READ;
+        m_Parser.Commit(n);
+    }
+    switch(m_Parser.Result()) {
+    case CSocksParser::Complete:
+        return 0;
+    case CSocksParser::Incomplete:
+        return ERROR_CONTINUE_READ;
+    default:
+        return -1;
+    }
+}
+
+void CProxySocks4::RunHandshake()
+{
+    while(m_pSocket && CSocksParser::Incomplete == m_Parser.Result())
+    {
+        if(ERROR_CONTINUE_READ == ReadMessage())
+        {
+            qDebug(logSocks4) << "Be continuing read from socket:"
+                              << m_pSocket->peerAddress();
+            return;
+        }
+        if(OnMessage())
+            return;
+    }
+}
+
+int CProxySocks4::OnMessage()
+{
+    return processClientRequest();
+}
+
 int CProxySocks4::processClientRequest()
 {
     qDebug(logSocks4) << "processClientRequest()";
     //NOTE: Removed version
     //See   CProxyServerSocket::slotRead()
-    m_cmdBuf += m_pSocket->readAll();
-    if(CheckBufferLength(7))
+    if(CSocksParser::Complete != m_Parser.Result())
     {
-        qDebug(logSocks4) << "Be continuing read from socket:"
-                          << m_pSocket->peerAddress();
-        return ERROR_CONTINUE_READ;
+        qCritical(logSocks4) << "The format is error";
+        reply(emErrorCode::Rejected);
+        slotClose();
+        return -1;
     }
 
-    strRequest *pReq = reinterpret_cast<strRequest*>(m_cmdBuf.data());
-    quint32 add = qFromBigEndian<quint32>(pReq->dstIp);
-    m_nPort = qFromBigEndian<quint16>(pReq->dstPort);
-    m_szUser = pReq->user;
-
+    m_nPort = m_Parser.Port();
     qDebug(logSocks4,
-                    "Client request: command:%d; ip:%s; port:%d; user: %s",
-                    pReq->cmd,
-                    QHostAddress(add).toString().toStdString().c_str(),
+                    "Client request: command:%d; ip:%s; port:%d; user: %.*s",
+                    m_Parser.Command(),
+                    QHostAddress(m_Parser.Ipv4()).toString().toStdString().c_str(),
                     m_nPort,
-                    m_szUser.toStdString().c_str());
+                    m_Parser.UserLength(), m_Parser.User());
     // Is v4a
-    if( (add & 0xFFFFFF00) == 0 && (add & 0x000000FF) )
+    if(CSocksParser::AddressTypeDomain == m_Parser.AddressType())
     {
-        std::string szUser(pReq->user);
-        int nLen = 8 + szUser.size() + 1;
-        if(m_cmdBuf.size() <= nLen)
-        {
-            qCritical(logSocks4) << "The format is error";
-            return reply(emErrorCode::Rejected);
-        }
-        if(m_cmdBuf.at(m_cmdBuf.size() - 1) != 0)
-        {
-            qCritical(logSocks4) << "The domain format is error";
-            return reply(emErrorCode::Rejected);
-        }
-        char *pDomain = m_cmdBuf.data() + nLen;
-        m_HostAddress = pDomain;
-        
-//        std::string szAddress(pDomain);
-//        LOG_MODEL_DEBUG("Socks4", "Look up domain: %s", szAddress.c_str());
-//        QHostInfo::lookupHost(szAddress.c_str(), this, SLOT(slotLookup(QHostInfo)));
-        return 0;
+        m_HostAddress = QString::fromUtf8(m_Parser.Domain(),
+                                          m_Parser.DomainLength());
+        // The domain is looked up by CResolver in CPeerConnector::Connect()
+    } else {
+        // Is v4
+        m_HostAddress = QHostAddress(m_Parser.Ipv4()).toString();
     }
 
-    // Is v4
-    m_HostAddress = QHostAddress(add).toString();
-
     return onExecClientRequest();
 }
 
@@ -124,8 +141,7 @@ int CProxySocks4::onExecClientRequest()
 {
     int nRet = 0;
 
-    strRequest *pReq = reinterpret_cast<strRequest*>(m_cmdBuf.data());
-    switch (pReq->cmd) {
+    switch (m_Parser.Command()) {
     case 1: // Connect
     {
         nRet = processConnect();
@@ -135,7 +151,7 @@ int CProxySocks4::onExecClientRequest()
         nRet = processBind();
         break;
     default:
-        qCritical(logSocks4) << "Don't support the command:" << pReq->cmd;
+        qCritical(logSocks4) << "Don't support the command:" << m_Parser.Command();
     }
     return nRet;
 }
@@ -176,6 +192,7 @@ int CProxySocks4::processConnect()
     
     SetPeerConnect();
     
+    SetConnectState(m_HostAddress);
     m_pPeer->Connect(m_HostAddress, m_nPort);
     qDebug(logSocks4) << "Connect to:" << m_HostAddress << ":" << m_nPort;
     
@@ -214,8 +231,8 @@ int CProxySocks4::processBind()
     reply(emErrorCode::Ok);
 
     m_Status = emStatus::Forward;
+    SetState(CServer::emState::Forward);
 
-    RemoveCommandBuffer();
     return nRet;
 }
 
@@ -228,7 +245,7 @@ void CProxySocks4::slotPeerConnected()
     qInfo(logSocks4) << "Peer connected to:" << m_HostAddress << ":" << m_nPort;
     reply(emErrorCode::Ok);
     m_Status = emStatus::Forward;
-    RemoveCommandBuffer();
+    StartForward();
     return;
 }
 
@@ -276,20 +293,7 @@ void CProxySocks4::slotPeerError(int err, const QString &szErr)
 void CProxySocks4::slotPeerRead()
 {
     //LOG_MODEL_DEBUG("Socks4", "slotPeerRead()");
-    if(!m_pPeer || !m_pSocket) return;
-
-    QByteArray d = m_pPeer->ReadAll();
-    if(d.isEmpty())
-    {
-        //LOG_MODEL_DEBUG("Socks4", "Peer read all is empty");
-        return;
-    }
-
-    int nRet = m_pSocket->write(d.data(), d.length());
-    if(-1 == nRet)
-        qCritical(logSocks4, "Forword peer to client fail[%d]: %s",
-                        m_pSocket->error(),
-                        m_pSocket->errorString().toStdString().c_str());
+    ForwardToClient();
 }
 
 int CProxySocks4::CreatePeer()
@@ -304,8 +308,8 @@ int CProxySocks4::CreatePeer()
                     &QObject::deleteLater);
     } else
 #endif
-        m_pPeer = QSharedPointer<CPeerConnector>(new CPeerConnector(this),
-                                                 &QObject::deleteLater);
+        m_pPeer = QSharedPointer<CPeerConnector>(CPeerConnector::Create(this),
+                                                 &CPeerConnector::Recycle);
     if(m_pPeer)
         return 0;
     qCritical(logSocks4, "Make peer connect fail");
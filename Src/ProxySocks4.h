@@ -5,6 +5,7 @@
 
 #include "Proxy.h"
 #include "PeerConnector.h"
+#include "SocksParser.h"
 #include <memory>
 #include <QTcpSocket>
 #include <QHostInfo>
@@ -23,6 +24,8 @@ public:
     CProxySocks4(QTcpSocket* pSocket, CServer *server, QObject* parent = nullptr);
     virtual ~CProxySocks4();
 
+    virtual int Reset(QTcpSocket* pSocket, CServer* server) override;
+
 public Q_SLOTS:
     virtual void slotRead() override;
 
@@ -38,6 +41,32 @@ protected Q_SLOTS:
 
 protected:
     virtual int CreatePeer() override;
+    /*!
+     * \brief Read the message which the parser is started for
+     * \return 0: the message is complete
+     *         ERROR_CONTINUE_READ: wait for more data
+     *         -1: the message is error. \see CSocksParser::GetError()
+     */
+    int ReadMessage();
+    /*!
+     * \brief Run the handshake. The message which the parser is started for
+     *        is read, and is handled by OnMessage(). The messages which the
+     *        client sends without waiting for the replies are handled in
+     *        the loop, until a message is incomplete, or the handshake waits
+     *        for the peer, or it fails.
+     */
+    void RunHandshake();
+    /*!
+     * \brief Handle the complete or error message of the parser.
+     *        It starts the parser for the next message of the handshake,
+     *        or leaves it to wait for the peer.
+     * \return 0: success
+     *         -1: fail, the proxy is closed or rejected
+     */
+    virtual int OnMessage();
+
+    //! The parser of the handshake messages
+    CSocksParser m_Parser;
 
 private:
     enum class emStatus {
@@ -61,13 +90,6 @@ private:
     
 #pragma pack(push) 
 #pragma pack(1)
-    struct strRequest {
-        char cmd;
-        quint16 dstPort;
-        quint32 dstIp;
-        char user[1];
-    };
-    
     struct strReply {
         char version;
         unsigned char err;
@@ -78,7 +100,6 @@ private:
     
     QString m_HostAddress;
     quint16 m_nPort;
-    QString m_szUser;
 
     int processClientRequest();
     virtual int onExecClientRequest();
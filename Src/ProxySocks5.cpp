@@ -7,9 +7,11 @@
 #ifdef HAVE_ICE
     #include "PeerConnectorIceClient.h"
 #endif
+#ifdef HAVE_UDP_RELAY
+    #include "UdpRelay.h"
+#endif
 
 #include <QtEndian>
-#include <memory>
 
 #include <QLoggingCategory>
 Q_LOGGING_CATEGORY(logSocks5, "Socks5")
@@ -17,8 +19,10 @@ Q_LOGGING_CATEGORY(logSocks5, "Socks5")
 CProxySocks5::CProxySocks5(QTcpSocket *pSocket, CServer *server, QObject *parent)
     : CProxySocks4(pSocket, server, parent),
       m_Status(emStatus::Negotiate),
-      m_currentVersion(VERSION_SOCK5)
+      m_currentVersion(VERSION_SOCK5),
+      m_currentAuthenticator(CParameterSocks::AUTHENTICATOR_NoAcceptable)
 {
+    m_Parser.Start(CSocksParser::emMessage::Greeting);
 }
 
 CProxySocks5::~CProxySocks5()
@@ -26,98 +30,119 @@ CProxySocks5::~CProxySocks5()
     qDebug(logSocks5) << "CProxySocks5::~CProxySocks5()";
 }
 
+int CProxySocks5::Reset(QTcpSocket *pSocket, CServer *server)
+{
+    m_Status = emStatus::Negotiate;
+    m_currentVersion = VERSION_SOCK5;
+    m_currentAuthenticator = CParameterSocks::AUTHENTICATOR_NoAcceptable;
+    m_Client = strClientRequst();
+    m_pUdp.clear();
+    int nRet = CProxySocks4::Reset(pSocket, server);
+    m_Parser.Start(CSocksParser::emMessage::Greeting);
+    return nRet;
+}
+
 void CProxySocks5::slotRead()
 {
     //LOG_MODEL_DEBUG("Socks5", "CProxySocks::slotRead() command:0x%X", m_Command);
-    int nRet = 0;
     switch (m_Status) {
-    case emStatus::Negotiate:
-        nRet = processNegotiate();
-        break;
-    case emStatus::Authentication:
-        nRet = processAuthenticator();
+    case emStatus::Forward:
+        ForwardToPeer();
         break;
-    case emStatus::ClientRequest:
-        nRet = processClientRequest();
+    case emStatus::Udp:
+    {
+        // The connection only keeps the association. See RFC 1928 7
+        char buf[256];
+        while(m_pSocket && m_pSocket->read(buf, sizeof(buf)) > 0);
         break;
-    case emStatus::LookUp:
+    }
+    default:
+        RunHandshake();
         break;
-    case emStatus::Forward:
-        if(m_pPeer && m_pSocket)
-        {
-            QByteArray d = m_pSocket->readAll();
-            if(!d.isEmpty())
-            {
-                //LOG_MODEL_DEBUG("Socks5", "Write %d length to peer", d.length());
-                int nWrite = m_pPeer->Write(d.data(), d.length());
-                if(-1 == nWrite)
-                    qCritical(logSocks5,
-                                    "Forword client to peer fail[%d]: %s",
-                                    m_pPeer->Error(),
-                                    m_pPeer->ErrorString().toStdString().c_str());
-            }
-            else
-                qCritical(logSocks5, "From client readAll is empty");
-        }
+    }
+}
+
+void CProxySocks5::slotClose()
+{
+#ifdef HAVE_UDP_RELAY
+    if(m_pUdp)
+    {
+        m_pUdp->disconnect(this);
+        m_pUdp->Close();
+        m_pUdp.clear();
+    }
+#endif
+    CProxySocks4::slotClose();
+}
+
+int CProxySocks5::OnMessage()
+{
+    switch (m_Status) {
+    case emStatus::Negotiate:
+        return processNegotiate();
+    case emStatus::Authentication:
+        return processAuthenticator();
+    case emStatus::ClientRequest:
+        return processClientRequest();
+    default:
         break;
     }
+    return -1;
 }
 
 int CProxySocks5::processNegotiate()
 {
-    int nRet = 0;
-    int nLen = 0;
-    m_cmdBuf += m_pSocket->readAll();
     qDebug(logSocks5) << "CProxySocks::processNegotiate()";
-    if(m_cmdBuf.isEmpty())
+    //NOTE: Removed version
+    //See   CProxyServerSocket::slotRead()
+    if(CSocksParser::Complete != m_Parser.Result())
     {
-        qCritical(logSocks5) << "m_pSocket->readAll() fail";
+        slotClose();
         return -1;
     }
+    qDebug(logSocks5) << "support" << m_Parser.MethodCount() << "methos";
 
-    //NOTE: Removed version
-    //See   CProxyServerSocket::slotRead()
-    if(m_cmdBuf.size() >= 1)
+    int nRet = processNegotiateReply();
+    if(nRet)
+        return nRet;
+
+    switch(m_currentAuthenticator)
     {
-        nLen = 1 + m_cmdBuf.at(0);
-        qDebug(logSocks5) << "support" << nLen - 1 << "methos";
-        if(CheckBufferLength(nLen))
-        {
-            qDebug(logSocks5, "Be continuing read from socket: %s:%d",
-                     m_pSocket->peerAddress().toString().toStdString().c_str());
-            return ERROR_CONTINUE_READ;
-        }
+    case CParameterSocks::AUTHENTICATOR_NO:
+        m_Status = emStatus::ClientRequest;
+        m_Parser.Start(CSocksParser::emMessage::Request5);
+        break;
+    case CParameterSocks::AUTHENTICATOR_UserPassword:
+        m_Status = emStatus::Authentication;
+        m_Parser.Start(CSocksParser::emMessage::Authentication);
+        break;
+    default:
+        slotClose();
+        return -1;
     }
-    
-    nRet = processNegotiateReply(m_cmdBuf);
-    
-    m_Status = emStatus::Authentication;
-    
-    RemoveCommandBuffer(nLen);
-    
-    return nRet;
+    return 0;
 }
 
-int CProxySocks5::processNegotiateReply(const QByteArray& data)
+int CProxySocks5::processNegotiateReply()
 {
     int nRet = 0;
     unsigned char method = CParameterSocks::AUTHENTICATOR_NoAcceptable;
-    for(unsigned char i = 0; i < data.at(0); i++)
+    CParameterSocks* pPara = qobject_cast<CParameterSocks*>(m_pServer->Getparameter());
+    const unsigned char* pMethods = m_Parser.Methods();
+    for(int i = 0; i < m_Parser.MethodCount(); i++)
     {
-        char c = data.at(i + 1);
-        CParameterSocks* pPara = qobject_cast<CParameterSocks*>(m_pServer->Getparameter());
+        unsigned char c = pMethods[i];
         if(pPara->GetV5Method().contains(c))
         {
             method = c;
             qInfo(logSocks5, tr("Select authenticator: 0x%x").toStdString().c_str(), c);
             break;
         }
-        continue;
     }
     
     m_currentAuthenticator = method;
     strNegotiate buf = {m_currentVersion, method};
-    if(-1 == m_pSocket->write((char*)&buf, sizeof(strNegotiate)))
+    if(-1 == m_pOutput->Write((char*)&buf, sizeof(strNegotiate)))
     {
         qCritical(logSocks5) << "Reply authennticator fail:"
                              << m_pSocket->errorString();
@@ -129,72 +154,34 @@ int CProxySocks5::processNegotiateReply(const QByteArray& data)
 
 int CProxySocks5::processAuthenticator()
 {
-    int nRet = 0;
-    
-    m_cmdBuf += m_pSocket->readAll();
-    
-    qDebug(logSocks5) << "m_currentAuthenticator:" << m_currentAuthenticator;
-    switch(m_currentAuthenticator)
-    {
-    case CParameterSocks::AUTHENTICATOR_NO:
-        m_Status = emStatus::ClientRequest;
-        slotRead();
-        return nRet;
-    case CParameterSocks::AUTHENTICATOR_UserPassword:
+    /*
+       +----+------+----------+------+----------+
+       |VER | ULEN |  UNAME   | PLEN |  PASSWD  |
+       +----+------+----------+------+----------+
+       | 1  |  1   | 1 to 255 |  1   | 1 to 255 |
+       +----+------+----------+------+----------+
+    */
+    if(CSocksParser::Complete != m_Parser.Result())
     {
-        if(CheckBufferLength(2))
-            return ERROR_CONTINUE_READ;
-        if(m_cmdBuf.at(0) != 0x01)
-        {
-            qCritical(logSocks5,
-                            "Authenticator user/password, the version isn't supported: 0x%X",
-                            m_cmdBuf.at(0));
-            replyAuthenticatorUserPassword(1);
-            return -1;
-        }
-        /*
-           +----+------+----------+------+----------+
-           |VER | ULEN |  UNAME   | PLEN |  PASSWD  |
-           +----+------+----------+------+----------+
-           | 1  |  1   | 1 to 255 |  1   | 1 to 255 |
-           +----+------+----------+------+----------+
-        */
-        unsigned char nUser = m_cmdBuf.at(1);
-        if(CheckBufferLength(nUser + 2))
-            return ERROR_CONTINUE_READ;
-        unsigned char nPassword = m_cmdBuf.at(nUser + 2);
-        if(CheckBufferLength(nUser + 3 + nPassword))
-            return ERROR_CONTINUE_READ;
-        std::string szUser(m_cmdBuf.data() + 2, nUser);
-        std::string szPassword(m_cmdBuf.data() + nUser + 3, nPassword);
-        /*
-        qDebug() << m_cmdBuf;
-        LOG_MODEL_DEBUG("Socks5", "User[%d]: %s; Password[%d]: %s",
-                        nUser, szUser.c_str(), nPassword, szPassword.c_str());//*/
-        nRet = processAuthenticatorUserPassword(QString(szUser.c_str()),
-                                                QString(szPassword.c_str()));
-        replyAuthenticatorUserPassword(nRet);
-        if(!nRet)
-        {
-            //TODO: test it!
-            qCritical(logSocks5) << "Authenticator User Password fail";
-            slotClose();
-            return nRet;
-        }
-        
-        int nLen = 3 + nUser + nPassword;
-
-        m_Status = emStatus::ClientRequest;
-
-        RemoveCommandBuffer(nLen);
-        break;
+        qCritical(logSocks5,
+                  "Authenticator user/password, the version isn't supported");
+        replyAuthenticatorUserPassword(1);
+        return -1;
     }
-    default:
-        slotClose();
-        break;
+
+    int nRet = processAuthenticatorUserPassword(
+        m_Parser.User(), m_Parser.UserLength(),
+        m_Parser.Password(), m_Parser.PasswordLength());
+    replyAuthenticatorUserPassword(nRet);
+    if(nRet)
+    {
+        qCritical(logSocks5) << "Authenticator User Password fail";
+        return -1;
     }
 
-    return nRet;
+    m_Status = emStatus::ClientRequest;
+    m_Parser.Start(CSocksParser::emMessage::Request5);
+    return 0;
 }
 
 int CProxySocks5::replyAuthenticatorUserPassword(char nRet)
@@ -202,25 +189,39 @@ int CProxySocks5::replyAuthenticatorUserPassword(char nRet)
     int n = 0;
     strReplyAuthenticationUserPassword repy{0x01, nRet};
     if(m_pSocket)
-        m_pSocket->write((char*)&repy,
+        m_pOutput->Write((char*)&repy,
                          sizeof(strReplyAuthenticationUserPassword));
     if(0 != nRet)
         slotClose();
     return n;
 }
 
+/*!
+ * \brief Whether the string is the bytes in UTF-8.
+ *        The ASCII bytes are compared without converting.
+ */
+static bool IsEqual(const QString& szString, const char* pData, int nLen)
+{
+    for(int i = 0; i < nLen; i++)
+    {
+        if(pData[i] & 0x80)
+            return szString == QString::fromUtf8(pData, nLen);
+    }
+    return szString == QLatin1String(pData, nLen);
+}
+
 /**
  * @brief CProxySocks::processAuthenticatorUserPassword
- * @param szUser
- * @param szPassword
  * @return 0: success
  *     other: fail
  * @see https://www.ietf.org/rfc/rfc1929.txt
  */
-int CProxySocks5::processAuthenticatorUserPassword(QString szUser, QString szPassword)
+int CProxySocks5::processAuthenticatorUserPassword(
+    const char* pUser, int nUser, const char* pPassword, int nPassword)
 {
     CParameterSocks* pPara = qobject_cast<CParameterSocks*>(m_pServer->Getparameter());
-    if(pPara->GetAuthentUser() == szUser && pPara->GetAuthentPassword() == szPassword)
+    if(IsEqual(pPara->GetAuthentUser(), pUser, nUser)
+        && IsEqual(pPara->GetAuthentPassword(), pPassword, nPassword))
         return 0;
     
     return -1;
@@ -229,68 +230,44 @@ int CProxySocks5::processAuthenticatorUserPassword(QString szUser, QString szPas
 // @see https://www.ietf.org/rfc/rfc1928.txt
 int CProxySocks5::processClientRequest()
 {
-    int nRet = 0;
     qDebug(logSocks5) << "CProxySocks::processClientRequest()";
-    m_cmdBuf += m_pSocket->readAll();
-    if(CheckBufferLength(4))
+    if(CSocksParser::Complete != m_Parser.Result())
     {
-        qDebug(logSocks5) << "Be continuing read from socket:"
-                          << m_pSocket->peerAddress();
-        return ERROR_CONTINUE_READ;
-    }
-    
-    strClientRequstHead* pHead = (strClientRequstHead*)(m_cmdBuf.data());
-    if(pHead->version != m_currentVersion)
-    {
-        qCritical(logSocks5) << "The version is not same";
+        if(CSocksParser::emError::AddressType == m_Parser.GetError())
+            processClientReply(REPLY_AddressTypeNotSupported);
+        else
+        {
+            qCritical(logSocks5) << "The version is not same";
+            slotClose();
+        }
         return -1;
     }
-    
-    m_Client.pHead = pHead;
-    switch (pHead->addressType) {
+
+    switch (m_Parser.AddressType()) {
     case AddressTypeIpv4: //IPV4
     {
-        m_Client.nLen = sizeof(strClientRequstHead) + 6;
-        if(CheckBufferLength(m_Client.nLen))
-            return ERROR_CONTINUE_READ;
-        QHostAddress add(qFromBigEndian<quint32>(m_cmdBuf.data() + 4));
+        QHostAddress add(m_Parser.Ipv4());
         m_Client.szHost = add.toString();
-        m_Client.nPort = qFromBigEndian<quint16>(m_cmdBuf.data() + 8);
-        qDebug(logSocks5) << "IPV4:" << add << m_Client.nPort;
+        qDebug(logSocks5) << "IPV4:" << add << m_Parser.Port();
         break;
     }
     case AddressTypeDomain: //Domain
     {
-        m_Client.nLen = sizeof(strClientRequstHead);
-        if(CheckBufferLength(m_Client.nLen + 2))
-            return ERROR_CONTINUE_READ;
-        unsigned char nLen = m_cmdBuf.data()[m_Client.nLen];
-        m_Client.nLen += 3 + nLen;
-        if(CheckBufferLength(m_Client.nLen))
-            return ERROR_CONTINUE_READ;
-        m_Client.nPort = qFromBigEndian<quint16>(m_cmdBuf.data() + 5 + nLen);
-        char* pAdd = m_cmdBuf.data() + sizeof(strClientRequstHead) + 1;
-        std::string szAddress(pAdd, nLen);
-        m_Client.szHost = szAddress.c_str();
-        
-        qDebug(logSocks5) << "Domain:" << szAddress.c_str();
-//        QHostInfo::lookupHost(szAddress.c_str(), this, SLOT(slotLookup(QHostInfo)));
-//        m_Status = emStatus::LookUp;
+        m_Client.szHost = QString::fromUtf8(m_Parser.Domain(),
+                                            m_Parser.DomainLength());
+        qDebug(logSocks5) << "Domain:" << m_Client.szHost;
+        // The domain is looked up by CResolver in CPeerConnector::Connect()
         break;
     }
     case AddressTypeIpv6: //IPV6
     {
-        //TODO: Test it!
-        if(CheckBufferLength(sizeof(strClientRequstHead) + 18)) //16 + 2 
-            return ERROR_CONTINUE_READ;
-        QHostAddress add((quint8*)(m_cmdBuf.data() + 4));
+        QHostAddress add(m_Parser.Ipv6());
         m_Client.szHost = add.toString();
-        m_Client.nPort = qFromBigEndian<quint16>(m_cmdBuf.data() + 20);
-        qDebug(logSocks5) << "IPV6:" << add << m_Client.nPort;
+        qDebug(logSocks5) << "IPV6:" << add << m_Parser.Port();
+        break;
     }
-    default:
-        return processClientReply(REPLY_AddressTypeNotSupported);
     }
+    m_Client.nPort = m_Parser.Port();
 
     return processExecClientRequest();
 }
@@ -315,22 +292,27 @@ void CProxySocks5::slotLookup(QHostInfo info)
 }
 
 int CProxySocks5::processClientReply(char rep)
+{
+    QHostAddress add;
+    quint16 nPort = 0;
+    if(m_pPeer)
+    {
+        add = m_pPeer->LocalAddress();
+        nPort = m_pPeer->LocalPort();
+    }
+    return processClientReply(rep, add, nPort);
+}
+
+int CProxySocks5::processClientReply(char rep, QHostAddress add, quint16 nPort)
 {
     strClientRequstReplyHead reply;
-    reply.version = m_cmdBuf.at(0);
+    reply.version = m_currentVersion;
     reply.reply = rep;
     reply.reserved = 0;
     reply.addressType = 0x01;
 
-    quint16 nPort = 0;
     int nLen = sizeof(strClientRequstReplyHead);
     
-    QHostAddress add;
-    if(m_pPeer)
-    {
-        add = m_pPeer->LocalAddress();
-        nPort = m_pPeer->LocalPort();
-    }
     if(add != QHostAddress::Null)
     {
         bool ok = false;
@@ -349,30 +331,31 @@ int CProxySocks5::processClientReply(char rep)
         add.setAddress((quint32)0);
     }
 
-    std::unique_ptr<char> buf(new char[nLen]);
-    if(m_pSocket && buf)
+    // The longest reply is the IPv6 address
+    char buf[sizeof(strClientRequstReplyHead) + 18];
+    if(m_pSocket)
     {
-        memcpy(buf.get(), &reply, sizeof(strClientRequstReplyHead));
+        memcpy(buf, &reply, sizeof(strClientRequstReplyHead));
         switch (reply.addressType) {
         case AddressTypeIpv4:
         {
             qDebug(logSocks5) << "Reply IP:" << add.toString() << nPort;
             quint32 d = qToBigEndian(add.toIPv4Address());
-            memcpy(buf.get() + sizeof(strClientRequstReplyHead), &d, 4);
+            memcpy(buf + sizeof(strClientRequstReplyHead), &d, 4);
             quint16 port = qToBigEndian(nPort);
-            memcpy(buf.get() + sizeof(strClientRequstReplyHead) + 4, &port, 2);
+            memcpy(buf + sizeof(strClientRequstReplyHead) + 4, &port, 2);
             break;
         }
         case AddressTypeIpv6:
         {
             Q_IPV6ADDR d = add.toIPv6Address();
-            memcpy(buf.get() + sizeof(strClientRequstReplyHead), d.c, 16);
+            memcpy(buf + sizeof(strClientRequstReplyHead), d.c, 16);
             quint16 port = qToBigEndian(nPort);
-            memcpy(buf.get() + sizeof(strClientRequstReplyHead) + 16, &port, 2);
+            memcpy(buf + sizeof(strClientRequstReplyHead) + 16, &port, 2);
             break;
         }
         }
-        m_pSocket->write(buf.get(), nLen);
+        m_pOutput->Write(buf, nLen);
     }
 
     if(REPLY_Succeeded != rep)
@@ -383,8 +366,8 @@ int CProxySocks5::processClientReply(char rep)
 int CProxySocks5::processExecClientRequest()
 {
     int nRet = 0;
-    qDebug(logSocks5) << "processExecClientRequest:" << m_Client.pHead->command;
-    switch (m_Client.pHead->command) {
+    qDebug(logSocks5) << "processExecClientRequest:" << m_Parser.Command();
+    switch (m_Parser.Command()) {
     case ClientRequstCommandConnect:
     {
         nRet = processConnect();
@@ -394,7 +377,7 @@ int CProxySocks5::processExecClientRequest()
         nRet = processBind();
         break;
     case ClientRequstCommandUdp:
-        //TODO: process udp
+        nRet = processUdpAssociate();
         break;
     default:
         processClientReply(REPLY_CommandNotSupported);
@@ -420,18 +403,53 @@ int CProxySocks5::processConnect()
 
     SetPeerConnect();
 
+    SetConnectState(m_Client.szHost);
     m_pPeer->Connect(m_Client.szHost, m_Client.nPort);
 
     return 0;
 }
 
+int CProxySocks5::processUdpAssociate()
+{
+    CParameterSocks* pPara = qobject_cast<CParameterSocks*>(m_pServer->Getparameter());
+    if(!pPara->GetUdp())
+        return processClientReply(REPLY_CommandNotSupported);
+#ifdef HAVE_UDP_RELAY
+    // DST.ADDR and DST.PORT are the address which the client sends from.
+    // The client behind a NAT sends zeros, so only the port is used, and
+    // the address is the address of the connection.
+    m_pUdp = QSharedPointer<CUdpRelay>(new CUdpRelay(), &QObject::deleteLater);
+    if(m_pUdp->Open(m_pSocket->localAddress(), m_pSocket->peerAddress(),
+                    m_Client.nPort, pPara->GetUdpTimeout()))
+    {
+        m_pUdp.clear();
+        return processClientReply(REPLY_GeneralServerFailure);
+    }
+    bool check = connect(m_pUdp.data(), &CUdpRelay::sigForward, this,
+                         [this](qint64 nBytes) {
+                             OnForward(nBytes, m_bWaitPeer, nullptr);
+                         });
+    Q_ASSERT(check);
+
+    qInfo(logSocks5) << "Udp associate:" << m_pUdp->LocalAddress()
+                     << m_pUdp->LocalPort();
+    m_Status = emStatus::Udp;
+    processClientReply(REPLY_Succeeded, m_pUdp->LocalAddress(),
+                       m_pUdp->LocalPort());
+    SetState(CServer::emState::Forward);
+    return 0;
+#else
+    return processClientReply(REPLY_CommandNotSupported);
+#endif
+}
+
 void CProxySocks5::slotPeerConnected()
 {
     qInfo(logSocks5) << "Peer connected:"
                      << m_Client.szHost << ":" << m_Client.nPort;
     processClientReply(REPLY_Succeeded);
     m_Status = emStatus::Forward;
-    RemoveCommandBuffer(m_Client.nLen);
+    StartForward();
     return;
 }
 
@@ -503,6 +521,7 @@ int CProxySocks5::processBind()
     SetPeerConnect();
 
     processClientReply(REPLY_Succeeded);
+    SetState(CServer::emState::Forward);
 
     return nRet;
 }
@@ -13,6 +13,8 @@
 #include <QList>
 #include <QUdpSocket>
 
+class CUdpRelay;
+
 /**
  * @brief The socks proxy class
  *        Implement SOCKET5(RFC1928)：http://www.ietf.org/rfc/rfc1928.txt
@@ -26,23 +28,34 @@ public:
     explicit CProxySocks5(QTcpSocket* pSocket, CServer *server, QObject *parent = nullptr);
     virtual ~CProxySocks5();
 
+    virtual int Reset(QTcpSocket* pSocket, CServer* server) override;
+
 public Q_SLOTS:
     virtual void slotRead() override;
+protected Q_SLOTS:
+    virtual void slotClose() override;
 private Q_SLOTS:
     virtual void slotLookup(QHostInfo info) override;
     virtual void slotPeerConnected() override;
     virtual void slotPeerDisconnectd() override;
     virtual void slotPeerError(int err, const QString &szErr) override;
-    
+
+protected:
+    virtual int OnMessage() override;
+
 private:
     int processNegotiate();
-    int processNegotiateReply(const QByteArray &data);
+    int processNegotiateReply();
     int processAuthenticator();
-    int processAuthenticatorUserPassword(QString szUser, QString szPassword);
+    int processAuthenticatorUserPassword(const char* pUser, int nUser,
+                                         const char* pPassword, int nPassword);
     int replyAuthenticatorUserPassword(char nRet);
     int processClientRequest();
     int processClientReply(char rep);
+    //! Reply with the bound address and port
+    int processClientReply(char rep, QHostAddress add, quint16 nPort);
     int processExecClientRequest();
+    int processUdpAssociate();
     virtual int processConnect() override;
     virtual int processBind() override;
     
@@ -80,7 +93,9 @@ private:
         Authentication,
         ClientRequest,
         LookUp,
-        Forward
+        Forward,
+        //! The datagrams are relayed until the connection is closed
+        Udp
     };
     
 #pragma pack(push) 
@@ -98,18 +113,9 @@ private:
         char status; //0: success, other: failure
     };
 
-    struct strClientRequstHead {
-        char version;
-        char command;     // enum emCommand
-        char reserved;
-        char addressType; // enum emAddressType
-    };
-
     struct strClientRequst {
-        strClientRequstHead* pHead;
         QString szHost;
-        quint16 nPort;
-        int nLen; //整个请求的长度
+        quint16 nPort = 0;
     };
 
     struct strClientRequstReplyHead {
@@ -124,7 +130,8 @@ private:
     char m_currentVersion;
     char m_currentAuthenticator;
     strClientRequst m_Client;
-
+    //! The relay of UDP ASSOCIATE
+    QSharedPointer<CUdpRelay> m_pUdp;
 };
 
 #endif // CPROXYSOCKS5_H
@@ -0,0 +1,74 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "Relay.h"
+
+#ifdef HAVE_RELAY_EPOLL
+    #include "RelayEpoll.h"
+#endif
+#ifdef HAVE_IO_URING
+    #include "RelayIoUring.h"
+#endif
+#ifdef HAVE_RELAY_SOCKMAP
+    #include "RelaySockmap.h"
+#endif
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(logRelay, "Relay")
+
+CRelay::CRelay()
+{
+}
+
+CRelay::~CRelay()
+{
+    qDebug(logRelay) << "CRelay::~CRelay()";
+}
+
+QSharedPointer<CRelay> CRelay::Create(CParameter::emRelay relay)
+{
+    QSharedPointer<CRelay> r;
+    switch(relay)
+    {
+    case CParameter::emRelay::Sockmap:
+#ifdef HAVE_RELAY_SOCKMAP
+        if(CRelaySockmap::IsSupported())
+        {
+            r = QSharedPointer<CRelay>(new CRelaySockmap());
+            break;
+        }
+#endif
+#ifdef HAVE_RELAY_EPOLL
+        qWarning(logRelay) << "The sockmap isn't supported. Fall back to epoll";
+        r = QSharedPointer<CRelay>(new CRelayEpoll());
+#endif
+        break;
+    case CParameter::emRelay::IoUring:
+#ifdef HAVE_IO_URING
+        if(CRelayIoUring::IsSupported())
+        {
+            r = QSharedPointer<CRelay>(new CRelayIoUring());
+            break;
+        }
+#endif
+        qWarning(logRelay) << "io_uring isn't supported. Fall back to epoll";
+        Q_FALLTHROUGH();
+    case CParameter::emRelay::Epoll:
+#ifdef HAVE_RELAY_EPOLL
+        r = QSharedPointer<CRelay>(new CRelayEpoll());
+#endif
+        break;
+    case CParameter::emRelay::Splice:
+#ifdef HAVE_RELAY_EPOLL
+        // The capacity of a pipe is 64K by default
+        r = QSharedPointer<CRelay>(new CRelayEpoll(true, 65536));
+#endif
+        break;
+    default:
+        break;
+    }
+    if(!r && CParameter::emRelay::Qt != relay)
+        qWarning(logRelay) << "The relay isn't supported:" << relay
+                           << ". Fall back to Qt";
+    return r;
+}
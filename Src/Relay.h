@@ -0,0 +1,67 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CRELAY_H
+#define CRELAY_H
+
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QSharedPointer>
+#include "Parameter.h"
+
+/*!
+ * \brief The native relay interface class.
+ *        After the handshake, the proxy hands off the socket descriptors of
+ *        the client and the peer to the relay. The relay forwards data
+ *        between them in itself loop until they are closed.
+ *        Qt keeps the control plane.
+ * \see CProxy::HandOffRelay()
+ */
+class RABBITPROXY_EXPORT CRelay
+{
+public:
+    CRelay();
+    virtual ~CRelay();
+
+    /*!
+     * \brief Create the relay
+     * \return nullptr if the relay isn't supported on the platform
+     */
+    static QSharedPointer<CRelay> Create(CParameter::emRelay relay);
+
+    virtual int Start() = 0;
+    //! Stop the relay, and close all the sessions
+    virtual int Stop() = 0;
+
+    /*!
+     * \brief Relay between the client and the peer
+     * \param client: the socket descriptor of the client
+     * \param peer: the socket descriptor of the peer
+     * \param toPeer: the data is sent to the peer firstly
+     * \param toClient: the data is sent to the client firstly
+     * \param pOwner: It is deleted by deleteLater() when the session is closed.
+     *                It may be nullptr.
+     * \return 0: success
+     * \note The descriptors are duplicated by the relay,
+     *       so the caller can close itself descriptors.
+     *       It is thread safe.
+     */
+    virtual int Add(qintptr client, qintptr peer,
+                    const QByteArray& toPeer, const QByteArray& toClient,
+                    QObject* pOwner) = 0;
+
+    struct strStatistics {
+        //! The number of the active sessions
+        int nSessions = 0;
+        //! The total of the sessions
+        quint64 nTotalSessions = 0;
+        //! The total of the forwarded bytes
+        quint64 nBytes = 0;
+        //! The directions of the sessions which hold a buffer now
+        int nBuffers = 0;
+    };
+    virtual strStatistics GetStatistics() = 0;
+};
+
+#endif // CRELAY_H
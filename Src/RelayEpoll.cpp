@@ -0,0 +1,481 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "RelayEpoll.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(logRelay)
+
+// The epoll data of the event fd. The session is (index << 1) | side
+#define EVENT_ID ((quint64)-1)
+
+CRelayEpoll::CRelayEpoll(bool bSplice, int nBufferSize)
+    : CRelay(),
+    m_bSplice(bSplice),
+    m_nBufferSize(nBufferSize),
+    m_Epoll(-1),
+    m_Event(-1),
+    m_bStop(true),
+    m_nSessions(0),
+    m_nTotalSessions(0),
+    m_nBytes(0),
+    m_nBuffers(0)
+{
+}
+
+CRelayEpoll::~CRelayEpoll()
+{
+    Stop();
+}
+
+int CRelayEpoll::Start()
+{
+    if(!m_bStop) return 0;
+
+    m_Epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    if(-1 == m_Epoll)
+    {
+        qCritical(logRelay, "epoll_create1 fail: %s", strerror(errno));
+        return -1;
+    }
+    m_Event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(-1 == m_Event)
+    {
+        qCritical(logRelay, "eventfd fail: %s", strerror(errno));
+        ::close(m_Epoll);
+        m_Epoll = -1;
+        return -1;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_ID;
+    ::epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Event, &ev);
+
+    if(!m_bSplice && !m_pScratch)
+        m_pScratch.reset(new char[m_nBufferSize]);
+
+    m_bStop = false;
+    m_Thread = std::thread(&CRelayEpoll::Run, this);
+    return 0;
+}
+
+int CRelayEpoll::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(m_bStop) return 0;
+        m_bStop = true;
+        quint64 v = 1;
+        if(::write(m_Event, &v, sizeof(v)) < 0)
+            qCritical(logRelay, "Write event fail: %s", strerror(errno));
+    }
+    if(m_Thread.joinable())
+        m_Thread.join();
+
+    // Close the sessions which aren't added
+    for(auto& p: m_Pending)
+    {
+        ::close(p.client);
+        ::close(p.peer);
+        if(p.pOwner)
+            p.pOwner->deleteLater();
+    }
+    m_Pending.clear();
+
+    ::close(m_Event);
+    m_Event = -1;
+    ::close(m_Epoll);
+    m_Epoll = -1;
+    return 0;
+}
+
+int CRelayEpoll::Add(qintptr client, qintptr peer,
+                     const QByteArray &toPeer, const QByteArray &toClient,
+                     QObject *pOwner)
+{
+    strPending p;
+    p.client = ::fcntl(client, F_DUPFD_CLOEXEC, 0);
+    p.peer = ::fcntl(peer, F_DUPFD_CLOEXEC, 0);
+    if(-1 == p.client || -1 == p.peer)
+    {
+        qCritical(logRelay, "Duplicate the socket fail: %s", strerror(errno));
+        if(-1 != p.client) ::close(p.client);
+        if(-1 != p.peer) ::close(p.peer);
+        return -1;
+    }
+    p.toPeer = toPeer;
+    p.toClient = toClient;
+    p.pOwner = pOwner;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(m_bStop)
+    {
+        ::close(p.client);
+        ::close(p.peer);
+        return -1;
+    }
+    m_Pending.push_back(p);
+    quint64 v = 1;
+    if(::write(m_Event, &v, sizeof(v)) < 0)
+        qCritical(logRelay, "Write event fail: %s", strerror(errno));
+    return 0;
+}
+
+CRelay::strStatistics CRelayEpoll::GetStatistics()
+{
+    strStatistics st;
+    st.nSessions = m_nSessions;
+    st.nTotalSessions = m_nTotalSessions;
+    st.nBytes = m_nBytes;
+    st.nBuffers = m_nBuffers;
+    return st;
+}
+
+void CRelayEpoll::Run()
+{
+    struct epoll_event events[64];
+    qInfo(logRelay) << "The epoll relay is running. splice:" << m_bSplice;
+    while(!m_bStop)
+    {
+        int n = ::epoll_wait(m_Epoll, events, 64, -1);
+        if(n < 0)
+        {
+            if(EINTR == errno) continue;
+            qCritical(logRelay, "epoll_wait fail: %s", strerror(errno));
+            break;
+        }
+        bool bPending = false;
+        for(int i = 0; i < n; i++)
+        {
+            quint64 id = events[i].data.u64;
+            if(EVENT_ID == id)
+            {
+                bPending = true;
+                continue;
+            }
+            OnEvent(id >> 1, id & 1, events[i].events);
+        }
+        // Add the sessions after the events, so the index of a session
+        // closed in this round isn't reused by the stale events.
+        if(bPending)
+            AddPending();
+    }
+
+    for(quint32 i = 0; i < m_Sessions.size(); i++)
+    {
+        if(m_Sessions[i].bUsed)
+            Close(i);
+    }
+    qInfo(logRelay) << "The epoll relay is stopped";
+}
+
+int CRelayEpoll::AddPending()
+{
+    quint64 v = 0;
+    if(::read(m_Event, &v, sizeof(v)) < 0 && EAGAIN != errno)
+        qCritical(logRelay, "Read event fail: %s", strerror(errno));
+
+    std::vector<strPending> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        pending.swap(m_Pending);
+    }
+    for(auto& p: pending)
+        AddSession(p);
+    return 0;
+}
+
+int CRelayEpoll::AddSession(strPending &p)
+{
+    quint32 nIndex = 0;
+    if(m_Free.empty())
+    {
+        nIndex = m_Sessions.size();
+        m_Sessions.emplace_back();
+    } else {
+        nIndex = m_Free.back();
+        m_Free.pop_back();
+    }
+
+    strSession& s = m_Sessions[nIndex];
+    s = strSession();
+    s.bUsed = true;
+    m_nSessions++;
+    m_nTotalSessions++;
+    s.fd[0] = p.client;
+    s.fd[1] = p.peer;
+    s.pOwner = p.pOwner;
+    const QByteArray* pData[2] = {&p.toPeer, &p.toClient};
+    for(int i = 0; i < 2; i++)
+    {
+        ::fcntl(s.fd[i], F_SETFL, ::fcntl(s.fd[i], F_GETFL) | O_NONBLOCK);
+        if(m_bSplice && ::pipe2(s.pipe[i], O_NONBLOCK | O_CLOEXEC))
+        {
+            qCritical(logRelay, "pipe2 fail: %s", strerror(errno));
+            s.events[i] = (quint32)-1;
+            Close(nIndex);
+            return -1;
+        }
+        // The buffer only holds the data read by Qt
+        SetBuffer(s.buf[i], pData[i]->data(), pData[i]->size());
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.data.u64 = ((quint64)nIndex << 1) | i;
+        if(::epoll_ctl(m_Epoll, EPOLL_CTL_ADD, s.fd[i], &ev))
+        {
+            qCritical(logRelay, "epoll_ctl add fail: %s", strerror(errno));
+            s.events[i] = (quint32)-1;
+            Close(nIndex);
+            return -1;
+        }
+    }
+
+    // Send the data which is read by Qt
+    if(Transfer(s, 0, false) || Transfer(s, 1, false))
+    {
+        Close(nIndex);
+        return -1;
+    }
+    return Update(nIndex);
+}
+
+void CRelayEpoll::OnEvent(quint32 nIndex, int i, quint32 events)
+{
+    if(nIndex >= m_Sessions.size() || !m_Sessions[nIndex].bUsed)
+        return;
+    strSession& s = m_Sessions[nIndex];
+    if(events & EPOLLERR)
+    {
+        Close(nIndex);
+        return;
+    }
+    if(events & EPOLLHUP)
+    {
+        // The data to fd[i] can't be sent, so stop reading the other side
+        s.bHup[i] = true;
+        s.bShutdown[i] = true;
+        s.bEof[1 - i] = true;
+        FreeBuffer(s.buf[1 - i]);
+        // The data left in the pipe is dropped when the pipe is closed
+        s.nPipe[1 - i] = 0;
+    }
+    int nRet = 0;
+    if(events & (EPOLLIN | EPOLLHUP))
+        nRet = Transfer(s, i, true);
+    if(!nRet && (events & EPOLLOUT))
+        nRet = Transfer(s, 1 - i, false);
+    if(nRet)
+    {
+        Close(nIndex);
+        return;
+    }
+    Update(nIndex);
+}
+
+/*!
+ * \brief Send buf[d] and pipe[d] to fd[1 - d], and read from fd[d] if bRead.
+ *        Read a buffer at most once, so the sessions are fair.
+ * \return -1: the session is error
+ */
+int CRelayEpoll::Transfer(strSession &s, int d, bool bRead)
+{
+    strBuffer& b = s.buf[d];
+    int dst = s.fd[1 - d];
+    while(true)
+    {
+        while(!b.IsEmpty())
+        {
+            ssize_t n = ::send(dst, b.pData.get() + b.nBegin,
+                               b.nEnd - b.nBegin, MSG_NOSIGNAL);
+            if(n < 0)
+            {
+                if(EINTR == errno) continue;
+                if(EAGAIN == errno || EWOULDBLOCK == errno) return 0;
+                return -1;
+            }
+            b.nBegin += n;
+            m_nBytes += n;
+        }
+        FreeBuffer(b);
+
+        while(s.nPipe[d] > 0)
+        {
+            ssize_t n = ::splice(s.pipe[d][0], nullptr, dst, nullptr,
+                                 s.nPipe[d], SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n < 0)
+            {
+                if(EINTR == errno) continue;
+                if(EAGAIN == errno || EWOULDBLOCK == errno) return 0;
+                return -1;
+            }
+            s.nPipe[d] -= n;
+            m_nBytes += n;
+        }
+
+        if(s.bEof[d])
+        {
+            // Half close
+            if(!s.bShutdown[1 - d])
+            {
+                ::shutdown(dst, SHUT_WR);
+                s.bShutdown[1 - d] = true;
+            }
+            return 0;
+        }
+
+        // The hung up fd is removed from epoll, so drain it here
+        if(!bRead && !s.bHup[d]) return 0;
+        bRead = false;
+
+        ssize_t n = 0;
+        if(m_bSplice)
+            n = ::splice(s.fd[d], nullptr, s.pipe[d][1], nullptr,
+                         m_nBufferSize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        else
+            n = ::recv(s.fd[d], m_pScratch.get(), m_nBufferSize, 0);
+        if(n > 0)
+        {
+            if(m_bSplice)
+                s.nPipe[d] = n;
+            else if(Forward(s, d, n))
+                return -1;
+            // The rest is sent when the destination is writable
+            if(!b.IsEmpty())
+                return 0;
+        }
+        else if(0 == n)
+            s.bEof[d] = true;
+        else if(EINTR == errno)
+            bRead = true;
+        else if(EAGAIN == errno || EWOULDBLOCK == errno)
+            return 0;
+        else
+            return -1;
+    }
+}
+
+/*!
+ * \brief Send the data in the scratch buffer to fd[1 - d].
+ *        The data which isn't sent is copied to buf[d].
+ * \return -1: the session is error
+ */
+int CRelayEpoll::Forward(strSession &s, int d, quint32 nLen)
+{
+    quint32 nSent = 0;
+    while(nSent < nLen)
+    {
+        ssize_t n = ::send(s.fd[1 - d], m_pScratch.get() + nSent,
+                           nLen - nSent, MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            if(EINTR == errno) continue;
+            if(EAGAIN == errno || EWOULDBLOCK == errno) break;
+            return -1;
+        }
+        nSent += n;
+        m_nBytes += n;
+    }
+    if(nSent < nLen)
+        SetBuffer(s.buf[d], m_pScratch.get() + nSent, nLen - nSent);
+    return 0;
+}
+
+void CRelayEpoll::SetBuffer(strBuffer &b, const char *pData, quint32 nLen)
+{
+    if(0 == nLen) return;
+    b.pData.reset(new char[nLen]);
+    memcpy(b.pData.get(), pData, nLen);
+    b.nSize = nLen;
+    b.nBegin = 0;
+    b.nEnd = nLen;
+    m_nBuffers++;
+}
+
+void CRelayEpoll::FreeBuffer(strBuffer &b)
+{
+    if(b.pData)
+        m_nBuffers--;
+    b.pData.reset();
+    b.nSize = b.nBegin = b.nEnd = 0;
+}
+
+int CRelayEpoll::Update(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    if(s.bEof[0] && s.bEof[1] && s.IsEmpty(0) && s.IsEmpty(1))
+        return Close(nIndex);
+
+    for(int i = 0; i < 2; i++)
+    {
+        if(s.bHup[i])
+        {
+            // EPOLLHUP can't be masked, remove it from epoll
+            if(s.events[i] != (quint32)-1)
+            {
+                ::epoll_ctl(m_Epoll, EPOLL_CTL_DEL, s.fd[i], nullptr);
+                s.events[i] = (quint32)-1;
+            }
+            continue;
+        }
+        quint32 events = 0;
+        if(!s.bEof[i] && s.IsEmpty(i))
+            events |= EPOLLIN;
+        if(!s.IsEmpty(1 - i))
+            events |= EPOLLOUT;
+        if(events == s.events[i])
+            continue;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.u64 = ((quint64)nIndex << 1) | i;
+        if(::epoll_ctl(m_Epoll, EPOLL_CTL_MOD, s.fd[i], &ev))
+        {
+            qCritical(logRelay, "epoll_ctl mod fail: %s", strerror(errno));
+            return Close(nIndex);
+        }
+        s.events[i] = events;
+    }
+    return 0;
+}
+
+int CRelayEpoll::Close(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    if(!s.bUsed) return 0;
+    for(int i = 0; i < 2; i++)
+    {
+        if(-1 == s.fd[i]) continue;
+        // Remove it explicitly, because close() doesn't remove it
+        // if the file description is still referred by other descriptors
+        if(s.events[i] != (quint32)-1)
+            ::epoll_ctl(m_Epoll, EPOLL_CTL_DEL, s.fd[i], nullptr);
+        ::close(s.fd[i]);
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        for(int j = 0; j < 2; j++)
+        {
+            if(-1 != s.pipe[i][j])
+                ::close(s.pipe[i][j]);
+        }
+    }
+    FreeBuffer(s.buf[0]);
+    FreeBuffer(s.buf[1]);
+    // It is thread safe, the owner is deleted in itself thread
+    if(s.pOwner)
+        s.pOwner->deleteLater();
+    s = strSession();
+    m_Free.push_back(nIndex);
+    m_nSessions--;
+    return 0;
+}
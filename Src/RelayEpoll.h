@@ -0,0 +1,110 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CRELAYEPOLL_H
+#define CRELAYEPOLL_H
+
+#pragma once
+
+#include "Relay.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <memory>
+
+/*!
+ * \brief The relay with epoll on linux.
+ *        It forwards data in itself thread with a compact session table.
+ *        The data is read into a scratch buffer shared by all sessions, and
+ *        is sent to the other side at once. A session only holds a buffer
+ *        while a partial write leaves data pending, so an idle session
+ *        holds no heap buffer.
+ *        In splice mode, the data is moved from a socket to the other
+ *        through a pipe in the kernel, it isn't copied to user space.
+ */
+class CRelayEpoll : public CRelay
+{
+public:
+    /*!
+     * \param bSplice: use splice() through a pipe of every direction
+     * \param nBufferSize: the maximum bytes read by a recv().
+     *        In splice mode, it is the maximum bytes moved by a splice().
+     */
+    explicit CRelayEpoll(bool bSplice = false, int nBufferSize = 16384);
+    virtual ~CRelayEpoll();
+
+    virtual int Start() override;
+    virtual int Stop() override;
+    virtual int Add(qintptr client, qintptr peer,
+                    const QByteArray& toPeer, const QByteArray& toClient,
+                    QObject* pOwner) override;
+    virtual strStatistics GetStatistics() override;
+
+private:
+    void Run();
+
+    struct strBuffer {
+        std::unique_ptr<char[]> pData;
+        quint32 nSize = 0;
+        quint32 nBegin = 0;
+        quint32 nEnd = 0;
+        bool IsEmpty() { return nBegin == nEnd; }
+    };
+    /*!
+     * The index 0 is the client, and 1 is the peer.
+     * buf[i] and pipe[i] are read from fd[i], and are written to fd[1 - i].
+     * buf[i] only has the data which isn't sent. It is freed when it is empty.
+     */
+    struct strSession {
+        int fd[2] = {-1, -1};
+        strBuffer buf[2];
+        int pipe[2][2] = {{-1, -1}, {-1, -1}};
+        quint32 nPipe[2] = {0, 0}; // The bytes in pipe[i]
+        quint32 events[2] = {0, 0}; // The registered events
+        bool bEof[2] = {false, false}; // fd[i] is read EOF, or it is useless
+        bool bShutdown[2] = {false, false}; // fd[i] is shutdown write
+        bool bHup[2] = {false, false}; // fd[i] is hung up
+        bool bUsed = false;
+        QObject* pOwner = nullptr;
+        bool IsEmpty(int i) { return buf[i].IsEmpty() && 0 == nPipe[i]; }
+    };
+    struct strPending {
+        int client;
+        int peer;
+        QByteArray toPeer;
+        QByteArray toClient;
+        QObject* pOwner;
+    };
+
+    int AddPending();
+    int AddSession(strPending& p);
+    void OnEvent(quint32 nIndex, int i, quint32 events);
+    int Transfer(strSession& s, int d, bool bRead);
+    int Forward(strSession& s, int d, quint32 nLen);
+    void SetBuffer(strBuffer& b, const char* pData, quint32 nLen);
+    void FreeBuffer(strBuffer& b);
+    int Update(quint32 nIndex);
+    int Close(quint32 nIndex);
+
+    bool m_bSplice;
+    int m_nBufferSize;
+    int m_Epoll;
+    int m_Event;
+    //! The data read from a socket. It is only used in the thread of the relay.
+    std::unique_ptr<char[]> m_pScratch;
+    std::thread m_Thread;
+    std::atomic<bool> m_bStop;
+
+    std::vector<strSession> m_Sessions;
+    std::vector<quint32> m_Free;
+
+    std::mutex m_Mutex;
+    std::vector<strPending> m_Pending;
+
+    std::atomic<int> m_nSessions;
+    std::atomic<quint64> m_nTotalSessions;
+    std::atomic<quint64> m_nBytes;
+    std::atomic<int> m_nBuffers;
+};
+
+#endif // CRELAYEPOLL_H
@@ -0,0 +1,614 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "RelayIoUring.h"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(logRelay)
+
+// The user data of the event fd.
+// The session is (index << 3) | (operation << 1) | direction
+#define EVENT_ID ((quint64)-1)
+// The buffer group id of the ring
+#define BUFFER_GROUP 0
+// The maximum of the ring buffers queued in a direction.
+// The receive is canceled when it is reached, so a slow receiver
+// doesn't exhaust the ring.
+#define MAX_DIRECTION_BUFFERS 8
+
+CRelayIoUring::CRelayIoUring(int nBufferSize, int nBuffers)
+    : CRelay(),
+    m_nBufferSize(nBufferSize),
+    m_nBuffers(1),
+    m_pBufRing(nullptr),
+    m_Event(-1),
+    m_nEventValue(0),
+    m_bStop(true),
+    m_nUsed(0),
+    m_nSessions(0),
+    m_nTotalSessions(0),
+    m_nBytes(0)
+{
+    // The number of the buffers in the ring must be power of 2
+    while(m_nBuffers < nBuffers && m_nBuffers < 32768)
+        m_nBuffers <<= 1;
+    memset(&m_Ring, 0, sizeof(m_Ring));
+}
+
+CRelayIoUring::~CRelayIoUring()
+{
+    Stop();
+}
+
+bool CRelayIoUring::IsSupported()
+{
+    // The multishot receive needs linux 6.0
+    struct utsname u;
+    int nMajor = 0;
+    if(uname(&u) || sscanf(u.release, "%d", &nMajor) != 1 || nMajor < 6)
+        return false;
+    // It may be disabled by kernel.io_uring_disabled or seccomp
+    struct io_uring ring;
+    if(io_uring_queue_init(8, &ring, 0) < 0)
+        return false;
+    io_uring_queue_exit(&ring);
+    return true;
+}
+
+int CRelayIoUring::Start()
+{
+    if(!m_bStop) return 0;
+
+    int nRet = io_uring_queue_init(1024, &m_Ring, 0);
+    if(nRet < 0)
+    {
+        qCritical(logRelay, "io_uring_queue_init fail: %s", strerror(-nRet));
+        return -1;
+    }
+
+    m_pBuffers.reset(new char[(size_t)m_nBufferSize * m_nBuffers]);
+    m_pBufRing = io_uring_setup_buf_ring(&m_Ring, m_nBuffers, BUFFER_GROUP,
+                                         0, &nRet);
+    if(!m_pBufRing)
+    {
+        qCritical(logRelay, "io_uring_setup_buf_ring fail: %s", strerror(-nRet));
+        io_uring_queue_exit(&m_Ring);
+        return -1;
+    }
+    for(int i = 0; i < m_nBuffers; i++)
+        io_uring_buf_ring_add(m_pBufRing,
+                              m_pBuffers.get() + (size_t)i * m_nBufferSize,
+                              m_nBufferSize, i,
+                              io_uring_buf_ring_mask(m_nBuffers), i);
+    io_uring_buf_ring_advance(m_pBufRing, m_nBuffers);
+
+    // It is blocking, so the read of io_uring waits for it
+    m_Event = ::eventfd(0, EFD_CLOEXEC);
+    if(-1 == m_Event)
+    {
+        qCritical(logRelay, "eventfd fail: %s", strerror(errno));
+        io_uring_free_buf_ring(&m_Ring, m_pBufRing, m_nBuffers, BUFFER_GROUP);
+        m_pBufRing = nullptr;
+        io_uring_queue_exit(&m_Ring);
+        return -1;
+    }
+
+    m_bStop = false;
+    m_Thread = std::thread(&CRelayIoUring::Run, this);
+    return 0;
+}
+
+int CRelayIoUring::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(m_bStop) return 0;
+        m_bStop = true;
+        quint64 v = 1;
+        if(::write(m_Event, &v, sizeof(v)) < 0)
+            qCritical(logRelay, "Write event fail: %s", strerror(errno));
+    }
+    if(m_Thread.joinable())
+        m_Thread.join();
+
+    // Close the sessions which aren't added
+    for(auto& p: m_Pending)
+    {
+        ::close(p.client);
+        ::close(p.peer);
+        if(p.pOwner)
+            p.pOwner->deleteLater();
+    }
+    m_Pending.clear();
+
+    io_uring_free_buf_ring(&m_Ring, m_pBufRing, m_nBuffers, BUFFER_GROUP);
+    m_pBufRing = nullptr;
+    io_uring_queue_exit(&m_Ring);
+    m_pBuffers.reset();
+    ::close(m_Event);
+    m_Event = -1;
+    return 0;
+}
+
+int CRelayIoUring::Add(qintptr client, qintptr peer,
+                       const QByteArray &toPeer, const QByteArray &toClient,
+                       QObject *pOwner)
+{
+    strPending p;
+    p.client = ::fcntl(client, F_DUPFD_CLOEXEC, 0);
+    p.peer = ::fcntl(peer, F_DUPFD_CLOEXEC, 0);
+    if(-1 == p.client || -1 == p.peer)
+    {
+        qCritical(logRelay, "Duplicate the socket fail: %s", strerror(errno));
+        if(-1 != p.client) ::close(p.client);
+        if(-1 != p.peer) ::close(p.peer);
+        return -1;
+    }
+    p.toPeer = toPeer;
+    p.toClient = toClient;
+    p.pOwner = pOwner;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(m_bStop)
+    {
+        ::close(p.client);
+        ::close(p.peer);
+        return -1;
+    }
+    m_Pending.push_back(p);
+    quint64 v = 1;
+    if(::write(m_Event, &v, sizeof(v)) < 0)
+        qCritical(logRelay, "Write event fail: %s", strerror(errno));
+    return 0;
+}
+
+CRelay::strStatistics CRelayIoUring::GetStatistics()
+{
+    strStatistics st;
+    st.nSessions = m_nSessions;
+    st.nTotalSessions = m_nTotalSessions;
+    st.nBytes = m_nBytes;
+    return st;
+}
+
+void CRelayIoUring::Run()
+{
+    qInfo(logRelay) << "The io_uring relay is running";
+    ArmEvent();
+    while(!m_bStop)
+    {
+        if(Wait())
+            break;
+    }
+
+    // Wait for the operations of the sessions are completed
+    for(quint32 i = 0; i < m_Sessions.size(); i++)
+    {
+        if(m_Sessions[i].bUsed)
+            Close(i);
+    }
+    while(m_nUsed > 0)
+    {
+        if(Wait())
+            break;
+    }
+    qInfo(logRelay) << "The io_uring relay is stopped";
+}
+
+int CRelayIoUring::Wait()
+{
+    int nRet = io_uring_submit_and_wait(&m_Ring, 1);
+    if(nRet < 0 && -EINTR != nRet)
+    {
+        qCritical(logRelay, "io_uring_submit_and_wait fail: %s",
+                  strerror(-nRet));
+        return -1;
+    }
+    unsigned int head = 0;
+    unsigned int n = 0;
+    struct io_uring_cqe* cqe = nullptr;
+    io_uring_for_each_cqe(&m_Ring, head, cqe)
+    {
+        OnCompletion(cqe);
+        n++;
+    }
+    io_uring_cq_advance(&m_Ring, n);
+    return 0;
+}
+
+struct io_uring_sqe* CRelayIoUring::GetSqe()
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_Ring);
+    if(!sqe)
+    {
+        // The submission queue is full
+        io_uring_submit(&m_Ring);
+        sqe = io_uring_get_sqe(&m_Ring);
+    }
+    if(!sqe)
+        qCritical(logRelay) << "Get the submission queue entry fail";
+    return sqe;
+}
+
+void CRelayIoUring::SetData(io_uring_sqe *sqe, quint32 nIndex, emOp op, int d)
+{
+    io_uring_sqe_set_data64(sqe, ((quint64)nIndex << 3) | ((int)op << 1) | d);
+    m_Sessions[nIndex].nOps++;
+}
+
+int CRelayIoUring::ArmEvent()
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if(!sqe) return -1;
+    io_uring_prep_read(sqe, m_Event, &m_nEventValue, sizeof(m_nEventValue), 0);
+    io_uring_sqe_set_data64(sqe, EVENT_ID);
+    return 0;
+}
+
+int CRelayIoUring::AddPending()
+{
+    std::vector<strPending> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        pending.swap(m_Pending);
+    }
+    for(auto& p: pending)
+        AddSession(p);
+    return 0;
+}
+
+int CRelayIoUring::AddSession(strPending &p)
+{
+    quint32 nIndex = 0;
+    if(m_Free.empty())
+    {
+        nIndex = m_Sessions.size();
+        m_Sessions.emplace_back();
+    } else {
+        nIndex = m_Free.back();
+        m_Free.pop_back();
+    }
+
+    strSession& s = m_Sessions[nIndex];
+    s = strSession();
+    s.bUsed = true;
+    m_nUsed++;
+    m_nSessions++;
+    m_nTotalSessions++;
+    s.fd[0] = p.client;
+    s.fd[1] = p.peer;
+    s.pOwner = p.pOwner;
+    const QByteArray* pData[2] = {&p.toPeer, &p.toClient};
+    for(int i = 0; i < 2; i++)
+    {
+        // io_uring waits in the kernel for a blocking socket,
+        // but it returns -EAGAIN for a nonblocking socket.
+        ::fcntl(s.fd[i], F_SETFL, ::fcntl(s.fd[i], F_GETFL) & ~O_NONBLOCK);
+        if(pData[i]->isEmpty())
+            continue;
+        // Send the data which is read by Qt firstly
+        strSend item;
+        item.nBid = -1;
+        item.data = *pData[i];
+        item.pData = item.data.constData();
+        item.nLen = item.data.size();
+        item.nOffset = 0;
+        s.dir[i].queue.push_back(item);
+    }
+
+    for(int i = 0; i < 2; i++)
+    {
+        if(ArmRecv(nIndex, i) || StartSend(nIndex, i))
+        {
+            Close(nIndex);
+            break;
+        }
+    }
+    return Check(nIndex);
+}
+
+void CRelayIoUring::OnCompletion(io_uring_cqe *cqe)
+{
+    quint64 data = io_uring_cqe_get_data64(cqe);
+    if(EVENT_ID == data)
+    {
+        if(!m_bStop)
+        {
+            AddPending();
+            ArmEvent();
+        }
+        return;
+    }
+
+    quint32 nIndex = data >> 3;
+    emOp op = (emOp)((data >> 1) & 3);
+    int d = data & 1;
+    if(nIndex >= m_Sessions.size() || !m_Sessions[nIndex].bUsed)
+        return;
+    switch(op)
+    {
+    case emOp::Recv:
+        OnRecv(nIndex, d, cqe);
+        break;
+    case emOp::Send:
+        OnSend(nIndex, d, cqe->res);
+        break;
+    case emOp::Cancel:
+        m_Sessions[nIndex].nOps--;
+        break;
+    }
+    Check(nIndex);
+}
+
+void CRelayIoUring::OnRecv(quint32 nIndex, int d, io_uring_cqe *cqe)
+{
+    strSession& s = m_Sessions[nIndex];
+    strDirection& dir = s.dir[d];
+    int res = cqe->res;
+    // The multishot receive is terminated
+    if(!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        dir.bRecv = false;
+        dir.bCancel = false;
+        s.nOps--;
+    }
+
+    if(res > 0)
+    {
+        int nBid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if(s.bClosing)
+        {
+            GiveBack(nBid);
+            return;
+        }
+        strSend item;
+        item.nBid = nBid;
+        item.pData = m_pBuffers.get() + (size_t)nBid * m_nBufferSize;
+        item.nLen = res;
+        item.nOffset = 0;
+        dir.queue.push_back(item);
+        dir.nBuffers++;
+        if(StartSend(nIndex, d))
+        {
+            Close(nIndex);
+            return;
+        }
+        CheckRecv(nIndex, d);
+        return;
+    }
+
+    if(s.bClosing)
+        return;
+    if(0 == res)
+    {
+        dir.bEof = true;
+        if(dir.queue.empty())
+            ShutdownWrite(nIndex, d);
+        return;
+    }
+    switch(-res)
+    {
+    case ENOBUFS:
+        // The ring is empty. Receive again when a buffer is given back
+        if(!dir.bWaitBuffer)
+        {
+            dir.bWaitBuffer = true;
+            m_WaitBuffer.push_back(std::make_pair(nIndex, d));
+        }
+        break;
+    case ECANCELED:
+        // Canceled by CheckRecv(). The sent buffers may be given back
+        CheckRecv(nIndex, d);
+        break;
+    default:
+        qDebug(logRelay, "Receive fail: %s", strerror(-res));
+        Close(nIndex);
+        break;
+    }
+}
+
+void CRelayIoUring::OnSend(quint32 nIndex, int d, int res)
+{
+    strSession& s = m_Sessions[nIndex];
+    strDirection& dir = s.dir[d];
+    s.nOps--;
+    dir.bSending = false;
+    if(s.bClosing)
+        return;
+    if(res < 0)
+    {
+        if(-EINTR != res && -EAGAIN != res)
+        {
+            qDebug(logRelay, "Send fail: %s", strerror(-res));
+            Close(nIndex);
+            return;
+        }
+        res = 0;
+    }
+
+    strSend& item = dir.queue.front();
+    item.nOffset += res;
+    m_nBytes += res;
+    if(item.nOffset >= item.nLen)
+    {
+        int nBid = item.nBid;
+        dir.queue.pop_front();
+        if(nBid >= 0)
+        {
+            dir.nBuffers--;
+            GiveBack(nBid);
+        }
+    }
+
+    if(StartSend(nIndex, d))
+    {
+        Close(nIndex);
+        return;
+    }
+    if(dir.queue.empty() && dir.bEof)
+        ShutdownWrite(nIndex, d);
+    CheckRecv(nIndex, d);
+}
+
+int CRelayIoUring::ArmRecv(quint32 nIndex, int d)
+{
+    strSession& s = m_Sessions[nIndex];
+    struct io_uring_sqe* sqe = GetSqe();
+    if(!sqe) return -1;
+    io_uring_prep_recv_multishot(sqe, s.fd[d], nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    SetData(sqe, nIndex, emOp::Recv, d);
+    s.dir[d].bRecv = true;
+    return 0;
+}
+
+int CRelayIoUring::CancelRecv(quint32 nIndex, int d)
+{
+    strDirection& dir = m_Sessions[nIndex].dir[d];
+    if(!dir.bRecv || dir.bCancel)
+        return 0;
+    struct io_uring_sqe* sqe = GetSqe();
+    if(!sqe) return -1;
+    io_uring_prep_cancel64(sqe, ((quint64)nIndex << 3)
+                                    | ((int)emOp::Recv << 1) | d, 0);
+    SetData(sqe, nIndex, emOp::Cancel, d);
+    dir.bCancel = true;
+    return 0;
+}
+
+int CRelayIoUring::StartSend(quint32 nIndex, int d)
+{
+    strSession& s = m_Sessions[nIndex];
+    strDirection& dir = s.dir[d];
+    if(s.bClosing || dir.bSending || dir.queue.empty())
+        return 0;
+    strSend& item = dir.queue.front();
+    struct io_uring_sqe* sqe = GetSqe();
+    if(!sqe) return -1;
+    io_uring_prep_send(sqe, s.fd[1 - d], item.pData + item.nOffset,
+                       item.nLen - item.nOffset, MSG_NOSIGNAL);
+    SetData(sqe, nIndex, emOp::Send, d);
+    dir.bSending = true;
+    return 0;
+}
+
+/*!
+ * \brief Cancel the receive if the direction has too many buffers,
+ *        and arm it again when the half of them are sent.
+ */
+int CRelayIoUring::CheckRecv(quint32 nIndex, int d)
+{
+    strSession& s = m_Sessions[nIndex];
+    strDirection& dir = s.dir[d];
+    if(s.bClosing || dir.bEof || dir.bWaitBuffer)
+        return 0;
+    if(dir.nBuffers >= MAX_DIRECTION_BUFFERS)
+        return CancelRecv(nIndex, d);
+    if(!dir.bRecv && dir.nBuffers <= MAX_DIRECTION_BUFFERS / 2)
+    {
+        if(ArmRecv(nIndex, d))
+            return Close(nIndex);
+    }
+    return 0;
+}
+
+int CRelayIoUring::ShutdownWrite(quint32 nIndex, int d)
+{
+    strSession& s = m_Sessions[nIndex];
+    strDirection& dir = s.dir[d];
+    if(dir.bShutdown)
+        return 0;
+    // Half close
+    ::shutdown(s.fd[1 - d], SHUT_WR);
+    dir.bShutdown = true;
+    return 0;
+}
+
+int CRelayIoUring::GiveBack(int nBid)
+{
+    io_uring_buf_ring_add(m_pBufRing,
+                          m_pBuffers.get() + (size_t)nBid * m_nBufferSize,
+                          m_nBufferSize, nBid,
+                          io_uring_buf_ring_mask(m_nBuffers), 0);
+    io_uring_buf_ring_advance(m_pBufRing, 1);
+
+    if(m_WaitBuffer.empty())
+        return 0;
+    std::vector<std::pair<quint32, int> > wait;
+    wait.swap(m_WaitBuffer);
+    for(auto& w: wait)
+    {
+        strSession& s = m_Sessions[w.first];
+        if(!s.bUsed || !s.dir[w.second].bWaitBuffer)
+            continue;
+        s.dir[w.second].bWaitBuffer = false;
+        CheckRecv(w.first, w.second);
+    }
+    return 0;
+}
+
+int CRelayIoUring::Close(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    if(!s.bUsed || s.bClosing)
+        return 0;
+    s.bClosing = true;
+    for(int i = 0; i < 2; i++)
+    {
+        CancelRecv(nIndex, i);
+        // Complete the operations in the kernel
+        ::shutdown(s.fd[i], SHUT_RDWR);
+    }
+    return Release(nIndex);
+}
+
+//! Close the session when both directions are finished
+int CRelayIoUring::Check(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    if(!s.bUsed)
+        return 0;
+    if(!s.bClosing && s.dir[0].bEof && s.dir[1].bEof
+            && s.dir[0].queue.empty() && s.dir[1].queue.empty())
+        return Close(nIndex);
+    return Release(nIndex);
+}
+
+//! Release the closing session when all of its operations are completed
+int CRelayIoUring::Release(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    if(!s.bUsed || !s.bClosing || s.nOps > 0)
+        return 0;
+
+    for(int i = 0; i < 2; i++)
+    {
+        s.dir[i].bWaitBuffer = false;
+        for(auto& item: s.dir[i].queue)
+        {
+            if(item.nBid >= 0)
+                GiveBack(item.nBid);
+        }
+        s.dir[i].queue.clear();
+        if(-1 != s.fd[i])
+            ::close(s.fd[i]);
+    }
+    // It is thread safe, the owner is deleted in itself thread
+    if(s.pOwner)
+        s.pOwner->deleteLater();
+    s = strSession();
+    m_Free.push_back(nIndex);
+    m_nUsed--;
+    m_nSessions--;
+    return 0;
+}
@@ -0,0 +1,129 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CRELAYIOURING_H
+#define CRELAYIOURING_H
+
+#pragma once
+
+#include "Relay.h"
+#include <liburing.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
+
+/*!
+ * \brief The relay with io_uring on linux.
+ *        Every socket has a multishot receive, which selects the buffers
+ *        from a buffer ring registered in the kernel. The received buffer
+ *        is sent to the other socket, then it is given back to the ring.
+ *        So it needs nearly no system calls per chunk in steady state.
+ * \note It needs linux 6.0 and liburing 2.4 or later
+ */
+class CRelayIoUring : public CRelay
+{
+public:
+    /*!
+     * \param nBufferSize: the size of a buffer in the ring
+     * \param nBuffers: the number of buffers in the ring. It is power of 2.
+     */
+    explicit CRelayIoUring(int nBufferSize = 16384, int nBuffers = 1024);
+    virtual ~CRelayIoUring();
+
+    //! Whether the kernel supports it
+    static bool IsSupported();
+
+    virtual int Start() override;
+    virtual int Stop() override;
+    virtual int Add(qintptr client, qintptr peer,
+                    const QByteArray& toPeer, const QByteArray& toClient,
+                    QObject* pOwner) override;
+    virtual strStatistics GetStatistics() override;
+
+private:
+    void Run();
+
+    enum class emOp {
+        Recv,
+        Send,
+        Cancel
+    };
+    struct strSend {
+        int nBid; // The buffer id in the ring. -1: data
+        const char* pData;
+        quint32 nLen;
+        quint32 nOffset;
+        QByteArray data; // The data read by Qt
+    };
+    //! Read from fd[d], and write to fd[1 - d]
+    struct strDirection {
+        std::deque<strSend> queue; // The front is sending if bSending
+        int nBuffers = 0; // The number of ring buffers in queue
+        bool bRecv = false; // The multishot receive is armed
+        bool bCancel = false; // The receive is being canceled
+        bool bSending = false;
+        bool bEof = false;
+        bool bShutdown = false; // fd[1 - d] is shutdown write
+        bool bWaitBuffer = false; // Wait for the buffers of the ring
+    };
+    struct strSession {
+        int fd[2] = {-1, -1}; // 0: client; 1: peer
+        strDirection dir[2];
+        int nOps = 0; // The operations in the kernel
+        bool bUsed = false;
+        bool bClosing = false;
+        QObject* pOwner = nullptr;
+    };
+    struct strPending {
+        int client;
+        int peer;
+        QByteArray toPeer;
+        QByteArray toClient;
+        QObject* pOwner;
+    };
+
+    struct io_uring_sqe* GetSqe();
+    void SetData(struct io_uring_sqe* sqe, quint32 nIndex, emOp op, int d);
+    int Wait();
+    int ArmEvent();
+    int AddPending();
+    int AddSession(strPending& p);
+    void OnCompletion(struct io_uring_cqe* cqe);
+    void OnRecv(quint32 nIndex, int d, struct io_uring_cqe* cqe);
+    void OnSend(quint32 nIndex, int d, int res);
+    int ArmRecv(quint32 nIndex, int d);
+    int CancelRecv(quint32 nIndex, int d);
+    int StartSend(quint32 nIndex, int d);
+    int CheckRecv(quint32 nIndex, int d);
+    int ShutdownWrite(quint32 nIndex, int d);
+    int GiveBack(int nBid);
+    int Close(quint32 nIndex);
+    int Check(quint32 nIndex);
+    int Release(quint32 nIndex);
+
+    int m_nBufferSize;
+    int m_nBuffers;
+    struct io_uring m_Ring;
+    struct io_uring_buf_ring* m_pBufRing;
+    std::unique_ptr<char[]> m_pBuffers;
+    std::vector<std::pair<quint32, int> > m_WaitBuffer;
+    int m_Event;
+    quint64 m_nEventValue;
+    std::thread m_Thread;
+    std::atomic<bool> m_bStop;
+
+    std::vector<strSession> m_Sessions;
+    std::vector<quint32> m_Free;
+    int m_nUsed;
+
+    std::mutex m_Mutex;
+    std::vector<strPending> m_Pending;
+
+    std::atomic<int> m_nSessions;
+    std::atomic<quint64> m_nTotalSessions;
+    std::atomic<quint64> m_nBytes;
+};
+
+#endif // CRELAYIOURING_H
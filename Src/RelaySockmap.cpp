@@ -0,0 +1,791 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "RelaySockmap.h"
+#include "RelayEpoll.h"
+
+#include <linux/bpf.h>
+#include <linux/tcp.h>
+#include <linux/sockios.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(logRelay)
+
+// The epoll data of the event fd. The session is (index << 1) | side
+#define EVENT_ID ((quint64)-1)
+// The interval of polling the sessions which are draining, in milliseconds
+#define DRAIN_INTERVAL 10
+// The interval of reading the counters of the sessions, in milliseconds
+#define STATISTICS_INTERVAL 1000
+
+/*!
+ * The value of the hash map.
+ * It is same as the layout which is accessed by the verdict program.
+ */
+struct strValue {
+    quint32 nPeer; // The key of the redirect target in the target sockmap
+    quint32 nPad;
+    quint64 nBytes; // The bytes are redirected. It is added by the program.
+};
+
+static long Bpf(int cmd, union bpf_attr* attr)
+{
+    return ::syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int CreateMap(bpf_map_type type, int nKey, int nValue, int nMax)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = nKey;
+    attr.value_size = nValue;
+    attr.max_entries = nMax;
+    return Bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int UpdateElem(int map, const void* key, const void* value)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map;
+    attr.key = (quint64)key;
+    attr.value = (quint64)value;
+    attr.flags = BPF_ANY;
+    return Bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int LookupElem(int map, const void* key, void* value)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map;
+    attr.key = (quint64)key;
+    attr.value = (quint64)value;
+    return Bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+static int DeleteElem(int map, const void* key)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map;
+    attr.key = (quint64)key;
+    return Bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+static bpf_insn Insn(quint8 code, quint8 dst, quint8 src, qint16 off, qint32 imm)
+{
+    bpf_insn insn;
+    memset(&insn, 0, sizeof(insn));
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+
+//! The total of the bytes received, include the FIN
+static quint64 GetReceived(int fd)
+{
+    struct tcp_info ti;
+    memset(&ti, 0, sizeof(ti));
+    socklen_t len = sizeof(ti);
+    ::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len);
+    return ti.tcpi_bytes_received;
+}
+
+//! The total of the bytes written to the socket
+static quint64 GetWritten(int fd)
+{
+    struct tcp_info ti;
+    memset(&ti, 0, sizeof(ti));
+    socklen_t len = sizeof(ti);
+    ::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len);
+    int nQueue = 0;
+    ::ioctl(fd, SIOCOUTQ, &nQueue);
+    return ti.tcpi_bytes_acked + nQueue;
+}
+
+/*!
+ * \brief The bytes read by the application.
+ * \note Call it before the socket is inserted into a sockmap,
+ *       because SIOCINQ returns the bytes in the psock after it is inserted.
+ */
+static quint64 GetRead(int fd)
+{
+    // The data may be received between the calls, so read until it is stable
+    while(true)
+    {
+        quint64 nReceived = GetReceived(fd);
+        int nQueue = 0;
+        ::ioctl(fd, SIOCINQ, &nQueue);
+        if(GetReceived(fd) == nReceived)
+            return nReceived - nQueue;
+    }
+}
+
+static int Send(int fd, const QByteArray& data, int& nSent)
+{
+    nSent = 0;
+    while(nSent < data.size())
+    {
+        ssize_t n = ::send(fd, data.constData() + nSent, data.size() - nSent,
+                           MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            if(EINTR == errno) continue;
+            if(EAGAIN == errno || EWOULDBLOCK == errno) return 1;
+            return -1;
+        }
+        nSent += n;
+    }
+    return 0;
+}
+
+CRelaySockmap::CRelaySockmap(int nMaxSessions)
+    : CRelay(),
+    m_nMaxSessions(nMaxSessions),
+    m_Target(-1),
+    m_Sockmap(-1),
+    m_Hash(-1),
+    m_Parser(-1),
+    m_Verdict(-1),
+    m_Epoll(-1),
+    m_Event(-1),
+    m_bStop(true),
+    m_nSessions(0),
+    m_nTotalSessions(0),
+    m_nBytes(0)
+{
+}
+
+CRelaySockmap::~CRelaySockmap()
+{
+    Stop();
+    CloseMaps();
+}
+
+bool CRelaySockmap::IsSupported()
+{
+    CRelaySockmap relay(1);
+    return 0 == relay.CreateMaps() && 0 == relay.LoadPrograms();
+}
+
+int CRelaySockmap::CreateMaps()
+{
+    m_Target = CreateMap(BPF_MAP_TYPE_SOCKMAP, sizeof(quint32), sizeof(quint32),
+                         m_nMaxSessions << 1);
+    m_Sockmap = CreateMap(BPF_MAP_TYPE_SOCKMAP, sizeof(quint32), sizeof(quint32),
+                          m_nMaxSessions << 1);
+    m_Hash = CreateMap(BPF_MAP_TYPE_HASH, sizeof(quint64), sizeof(strValue),
+                       m_nMaxSessions << 1);
+    if(-1 == m_Target || -1 == m_Sockmap || -1 == m_Hash)
+    {
+        qCritical(logRelay, "Create the bpf map fail: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * \brief Load the programs, and attach them to m_Sockmap.
+ *        The parser takes the whole skb as a message.
+ *        The verdict is same as:
+ *        \code
+ *        int verdict(struct __sk_buff* skb) {
+ *            __u64 cookie = bpf_get_socket_cookie(skb);
+ *            struct strValue* v = bpf_map_lookup_elem(&hash, &cookie);
+ *            if(!v) return SK_PASS;
+ *            __sync_fetch_and_add(&v->nBytes, skb->len);
+ *            return bpf_sk_redirect_map(skb, &target, v->nPeer, 0);
+ *        }
+ *        \endcode
+ */
+int CRelaySockmap::LoadPrograms()
+{
+    const bpf_insn parser[] = {
+        // r0 = skb->len
+        Insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_0, BPF_REG_1,
+             offsetof(struct __sk_buff, len), 0),
+        Insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+    };
+    const bpf_insn verdict[] = {
+        // r6 = skb
+        Insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+        // *(u64*)(r10 - 8) = bpf_get_socket_cookie(skb)
+        Insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_get_socket_cookie),
+        Insn(BPF_STX | BPF_DW | BPF_MEM, BPF_REG_10, BPF_REG_0, -8, 0),
+        // r0 = bpf_map_lookup_elem(hash, r10 - 8)
+        Insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+        Insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -8),
+        Insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, m_Hash),
+        Insn(0, 0, 0, 0, 0),
+        Insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+        // if(!r0) goto pass
+        Insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 10, 0),
+        // r7 = r0->nPeer
+        Insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_7, BPF_REG_0,
+             offsetof(strValue, nPeer), 0),
+        // lock r0->nBytes += skb->len
+        Insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_8, BPF_REG_6,
+             offsetof(struct __sk_buff, len), 0),
+        Insn(BPF_STX | BPF_DW | BPF_ATOMIC, BPF_REG_0, BPF_REG_8,
+             offsetof(strValue, nBytes), BPF_ADD),
+        // return bpf_sk_redirect_map(skb, target, r7, 0)
+        Insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0),
+        Insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_2, BPF_PSEUDO_MAP_FD, 0, m_Target),
+        Insn(0, 0, 0, 0, 0),
+        Insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_3, BPF_REG_7, 0, 0),
+        Insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, 0),
+        Insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_sk_redirect_map),
+        Insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        // pass: return SK_PASS
+        Insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, SK_PASS),
+        Insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+    };
+
+    struct {
+        const bpf_insn* pInsn;
+        int nInsn;
+        int* pFd;
+        bpf_attach_type type;
+    } progs[] = {
+        {parser, sizeof(parser) / sizeof(bpf_insn), &m_Parser,
+         BPF_SK_SKB_STREAM_PARSER},
+        {verdict, sizeof(verdict) / sizeof(bpf_insn), &m_Verdict,
+         BPF_SK_SKB_STREAM_VERDICT}
+    };
+    for(auto& prog: progs)
+    {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+        attr.insns = (quint64)prog.pInsn;
+        attr.insn_cnt = prog.nInsn;
+        attr.license = (quint64)"GPL";
+        *prog.pFd = Bpf(BPF_PROG_LOAD, &attr);
+        if(-1 == *prog.pFd)
+        {
+            qCritical(logRelay, "Load the bpf program fail: %s", strerror(errno));
+            return -1;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.target_fd = m_Sockmap;
+        attr.attach_bpf_fd = *prog.pFd;
+        attr.attach_type = prog.type;
+        if(Bpf(BPF_PROG_ATTACH, &attr))
+        {
+            qCritical(logRelay, "Attach the bpf program fail: %s", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void CRelaySockmap::CloseMaps()
+{
+    // The programs are detached when the sockmap is freed
+    int* fds[] = {&m_Parser, &m_Verdict, &m_Sockmap, &m_Target, &m_Hash};
+    for(auto fd: fds)
+    {
+        if(-1 == *fd) continue;
+        ::close(*fd);
+        *fd = -1;
+    }
+}
+
+int CRelaySockmap::Start()
+{
+    if(!m_bStop) return 0;
+
+    if(-1 == m_Sockmap && (CreateMaps() || LoadPrograms()))
+    {
+        CloseMaps();
+        return -1;
+    }
+
+    m_Fallback = QSharedPointer<CRelay>(new CRelayEpoll());
+    if(m_Fallback->Start())
+        return -1;
+
+    m_Epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    if(-1 == m_Epoll)
+    {
+        qCritical(logRelay, "epoll_create1 fail: %s", strerror(errno));
+        return -1;
+    }
+    m_Event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(-1 == m_Event)
+    {
+        qCritical(logRelay, "eventfd fail: %s", strerror(errno));
+        ::close(m_Epoll);
+        m_Epoll = -1;
+        return -1;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_ID;
+    ::epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Event, &ev);
+
+    m_bStop = false;
+    m_Thread = std::thread(&CRelaySockmap::Run, this);
+    return 0;
+}
+
+int CRelaySockmap::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(m_bStop) return 0;
+        m_bStop = true;
+        quint64 v = 1;
+        if(::write(m_Event, &v, sizeof(v)) < 0)
+            qCritical(logRelay, "Write event fail: %s", strerror(errno));
+    }
+    if(m_Thread.joinable())
+        m_Thread.join();
+
+    // Close the sessions which aren't added
+    for(auto& p: m_Pending)
+    {
+        ::close(p.client);
+        ::close(p.peer);
+        if(p.pOwner)
+            p.pOwner->deleteLater();
+    }
+    m_Pending.clear();
+
+    if(m_Fallback)
+        m_Fallback->Stop();
+
+    ::close(m_Event);
+    m_Event = -1;
+    ::close(m_Epoll);
+    m_Epoll = -1;
+    return 0;
+}
+
+int CRelaySockmap::Add(qintptr client, qintptr peer,
+                       const QByteArray &toPeer, const QByteArray &toClient,
+                       QObject *pOwner)
+{
+    strPending p;
+    p.client = ::fcntl(client, F_DUPFD_CLOEXEC, 0);
+    p.peer = ::fcntl(peer, F_DUPFD_CLOEXEC, 0);
+    if(-1 == p.client || -1 == p.peer)
+    {
+        qCritical(logRelay, "Duplicate the socket fail: %s", strerror(errno));
+        if(-1 != p.client) ::close(p.client);
+        if(-1 != p.peer) ::close(p.peer);
+        return -1;
+    }
+    p.toPeer = toPeer;
+    p.toClient = toClient;
+    p.pOwner = pOwner;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(m_bStop)
+    {
+        ::close(p.client);
+        ::close(p.peer);
+        return -1;
+    }
+    m_Pending.push_back(p);
+    quint64 v = 1;
+    if(::write(m_Event, &v, sizeof(v)) < 0)
+        qCritical(logRelay, "Write event fail: %s", strerror(errno));
+    return 0;
+}
+
+CRelay::strStatistics CRelaySockmap::GetStatistics()
+{
+    strStatistics st;
+    if(m_Fallback)
+        st = m_Fallback->GetStatistics();
+    st.nSessions += m_nSessions;
+    st.nTotalSessions += m_nTotalSessions;
+    st.nBytes += m_nBytes;
+    return st;
+}
+
+void CRelaySockmap::Run()
+{
+    struct epoll_event events[64];
+    auto tmStatistics = std::chrono::steady_clock::now();
+    qInfo(logRelay) << "The sockmap relay is running";
+    while(!m_bStop)
+    {
+        int n = ::epoll_wait(m_Epoll, events, 64,
+                             m_Drain.empty() ? STATISTICS_INTERVAL : DRAIN_INTERVAL);
+        if(n < 0)
+        {
+            if(EINTR == errno) continue;
+            qCritical(logRelay, "epoll_wait fail: %s", strerror(errno));
+            break;
+        }
+        bool bPending = false;
+        for(int i = 0; i < n; i++)
+        {
+            quint64 id = events[i].data.u64;
+            if(EVENT_ID == id)
+            {
+                bPending = true;
+                continue;
+            }
+            OnEvent(id >> 1, id & 1, events[i].events);
+        }
+
+        // The kernel doesn't notify when the redirected data is sent,
+        // so poll the sessions which are half closed.
+        std::vector<quint32> drain;
+        drain.swap(m_Drain);
+        for(auto nIndex: drain)
+        {
+            m_Sessions[nIndex].bDrain = false;
+            CheckDrain(nIndex);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(now - tmStatistics >= std::chrono::milliseconds(STATISTICS_INTERVAL))
+        {
+            tmStatistics = now;
+            for(quint32 i = 0; i < m_Sessions.size(); i++)
+            {
+                if(m_Sessions[i].bUsed)
+                    UpdateStatistics(i);
+            }
+        }
+
+        // Add the sessions after the events, so the index of a session
+        // closed in this round isn't reused by the stale events.
+        if(bPending)
+            AddPending();
+    }
+
+    for(quint32 i = 0; i < m_Sessions.size(); i++)
+    {
+        if(m_Sessions[i].bUsed)
+            Close(i);
+    }
+    m_Drain.clear();
+    qInfo(logRelay) << "The sockmap relay is stopped";
+}
+
+int CRelaySockmap::AddPending()
+{
+    quint64 v = 0;
+    if(::read(m_Event, &v, sizeof(v)) < 0 && EAGAIN != errno)
+        qCritical(logRelay, "Read event fail: %s", strerror(errno));
+
+    std::vector<strPending> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        pending.swap(m_Pending);
+    }
+    for(auto& p: pending)
+        AddSession(p);
+    return 0;
+}
+
+int CRelaySockmap::AddSession(strPending &p)
+{
+    // Send the data which is read by Qt before the sockets are inserted,
+    // so it is in front of the redirected data.
+    int nSent[2] = {0, 0};
+    int nRet = Send(p.peer, p.toPeer, nSent[1]);
+    if(0 == nRet)
+        nRet = Send(p.client, p.toClient, nSent[0]);
+    m_nBytes += nSent[0] + nSent[1];
+    if(nRet < 0)
+    {
+        ::close(p.client);
+        ::close(p.peer);
+        if(p.pOwner)
+            p.pOwner->deleteLater();
+        return -1;
+    }
+
+    if(0 == nRet && (!m_Free.empty() || (int)m_Sessions.size() < m_nMaxSessions))
+    {
+        quint32 nIndex = 0;
+        if(m_Free.empty())
+        {
+            nIndex = m_Sessions.size();
+            m_Sessions.emplace_back();
+        } else {
+            nIndex = m_Free.back();
+            m_Free.pop_back();
+        }
+
+        strSession& s = m_Sessions[nIndex];
+        s = strSession();
+        s.bUsed = true;
+        m_nSessions++;
+        m_nTotalSessions++;
+        s.fd[0] = p.client;
+        s.fd[1] = p.peer;
+        s.pOwner = p.pOwner;
+        nRet = Insert(nIndex);
+        if(nRet <= 0)
+        {
+            if(nRet < 0)
+                Close(nIndex);
+            return nRet;
+        }
+
+        // Isn't inserted, give it to the fallback
+        m_nSessions--;
+        m_nTotalSessions--;
+        s = strSession();
+        m_Free.push_back(nIndex);
+    }
+
+    qDebug(logRelay) << "The session is forwarded by the epoll relay";
+    nRet = m_Fallback->Add(p.client, p.peer, p.toPeer.mid(nSent[1]),
+                           p.toClient.mid(nSent[0]), p.pOwner);
+    ::close(p.client);
+    ::close(p.peer);
+    if(nRet && p.pOwner)
+        p.pOwner->deleteLater();
+    return nRet;
+}
+
+/*!
+ * \brief Insert the sockets into the maps.
+ *        At first, they are inserted into the target sockmap, which has no
+ *        program, so the redirect target exists before any data is redirected.
+ *        Then they are inserted into the sockmap with the programs.
+ * \return 0: success
+ *         > 0: isn't inserted, the session can be forwarded by other relay
+ *         < 0: the session is error
+ */
+int CRelaySockmap::Insert(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    for(int i = 0; i < 2; i++)
+    {
+        socklen_t len = sizeof(s.cookie[i]);
+        if(::getsockopt(s.fd[i], SOL_SOCKET, SO_COOKIE, &s.cookie[i], &len))
+        {
+            qCritical(logRelay, "Get the socket cookie fail: %s", strerror(errno));
+            return 1;
+        }
+        // The data which arrives after it is inserted is redirected.
+        // The data before it stays in the receive queue until the data ready
+        // callback is called. So it isn't read by the application any more.
+        s.nRead[i] = GetRead(s.fd[i]);
+        s.nWritten[i] = GetWritten(s.fd[i]);
+    }
+
+    s.bInsert = true;
+    for(int i = 0; i < 2; i++)
+    {
+        quint32 nKey = (nIndex << 1) | i;
+        quint32 fd = s.fd[i];
+        if(UpdateElem(m_Target, &nKey, &fd))
+        {
+            // The socket isn't established, etc.
+            qDebug(logRelay, "Insert the target sockmap fail: %s", strerror(errno));
+            Remove(nIndex);
+            return 1;
+        }
+        strValue v;
+        memset(&v, 0, sizeof(v));
+        v.nPeer = (nIndex << 1) | (1 - i);
+        if(UpdateElem(m_Hash, &s.cookie[i], &v))
+        {
+            qCritical(logRelay, "Update the bpf hash fail: %s", strerror(errno));
+            Remove(nIndex);
+            return 1;
+        }
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        quint32 nKey = (nIndex << 1) | i;
+        quint32 fd = s.fd[i];
+        if(UpdateElem(m_Sockmap, &nKey, &fd))
+        {
+            // The socket must be established, so the FIN isn't received
+            // before it is inserted.
+            qDebug(logRelay, "Insert the sockmap fail: %s", strerror(errno));
+            if(0 == i)
+            {
+                Remove(nIndex);
+                return 1;
+            }
+            // The data of the client may be redirected
+            return -1;
+        }
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        // Setting SO_RCVLOWAT calls the data ready callback,
+        // so the data in the receive queue before it is inserted is redirected.
+        int nLowat = 1;
+        ::setsockopt(s.fd[i], SOL_SOCKET, SO_RCVLOWAT, &nLowat, sizeof(nLowat));
+
+        // Only the half close and the errors are monitored
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLRDHUP;
+        ev.data.u64 = ((quint64)nIndex << 1) | i;
+        if(::epoll_ctl(m_Epoll, EPOLL_CTL_ADD, s.fd[i], &ev))
+        {
+            qCritical(logRelay, "epoll_ctl add fail: %s", strerror(errno));
+            return -1;
+        }
+        s.bEvent[i] = true;
+    }
+    return 0;
+}
+
+//! Remove the sockets from the maps
+int CRelaySockmap::Remove(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    if(!s.bInsert) return 0;
+    // Remove the redirect sources before the targets
+    for(int i = 0; i < 2; i++)
+    {
+        quint32 nKey = (nIndex << 1) | i;
+        DeleteElem(m_Sockmap, &nKey);
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        quint32 nKey = (nIndex << 1) | i;
+        DeleteElem(m_Target, &nKey);
+        if(s.cookie[i])
+            DeleteElem(m_Hash, &s.cookie[i]);
+    }
+    s.bInsert = false;
+    return 0;
+}
+
+void CRelaySockmap::OnEvent(quint32 nIndex, int i, quint32 events)
+{
+    if(nIndex >= m_Sessions.size() || !m_Sessions[nIndex].bUsed)
+        return;
+    strSession& s = m_Sessions[nIndex];
+    if(events & EPOLLERR)
+    {
+        Close(nIndex);
+        return;
+    }
+    if((events & EPOLLHUP) && !s.bShutdown[i])
+    {
+        // The connection is closed
+        Close(nIndex);
+        return;
+    }
+
+    s.bEof[i] = true;
+    // The events are level triggered. EPOLLHUP can't be masked,
+    // so remove it from epoll. Otherwise only monitor the errors.
+    if(events & EPOLLHUP)
+    {
+        ::epoll_ctl(m_Epoll, EPOLL_CTL_DEL, s.fd[i], nullptr);
+        s.bEvent[i] = false;
+    } else {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.data.u64 = ((quint64)nIndex << 1) | i;
+        ::epoll_ctl(m_Epoll, EPOLL_CTL_MOD, s.fd[i], &ev);
+    }
+    CheckDrain(nIndex);
+}
+
+/*!
+ * \brief If fd[i] is read EOF, and all the data received from it is sent to
+ *        fd[1 - i], then shutdown write fd[1 - i].
+ *        Shutdown before it is drained loses the redirected data,
+ *        because the kernel can't send it to fd[1 - i] any more.
+ */
+int CRelaySockmap::CheckDrain(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    if(!s.bUsed) return 0;
+    for(int i = 0; i < 2; i++)
+    {
+        if(!s.bEof[i] || s.bShutdown[1 - i])
+            continue;
+        quint64 nRedirected = GetRedirected(nIndex, i);
+        // The FIN is counted in the bytes received
+        if(GetReceived(s.fd[i]) != s.nRead[i] + nRedirected + 1
+            || GetWritten(s.fd[1 - i]) != s.nWritten[1 - i] + nRedirected)
+        {
+            if(!s.bDrain)
+            {
+                s.bDrain = true;
+                m_Drain.push_back(nIndex);
+            }
+            continue;
+        }
+        ::shutdown(s.fd[1 - i], SHUT_WR);
+        s.bShutdown[1 - i] = true;
+    }
+    if(s.bShutdown[0] && s.bShutdown[1])
+        return Close(nIndex);
+    return 0;
+}
+
+quint64 CRelaySockmap::GetRedirected(quint32 nIndex, int i)
+{
+    strSession& s = m_Sessions[nIndex];
+    strValue v;
+    memset(&v, 0, sizeof(v));
+    if(!s.bInsert || LookupElem(m_Hash, &s.cookie[i], &v))
+        return s.nCounted[i];
+    return v.nBytes;
+}
+
+void CRelaySockmap::UpdateStatistics(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    for(int i = 0; i < 2; i++)
+    {
+        quint64 n = GetRedirected(nIndex, i);
+        if(n <= s.nCounted[i]) continue;
+        m_nBytes += n - s.nCounted[i];
+        s.nCounted[i] = n;
+    }
+}
+
+int CRelaySockmap::Close(quint32 nIndex)
+{
+    strSession& s = m_Sessions[nIndex];
+    if(!s.bUsed) return 0;
+    UpdateStatistics(nIndex);
+    Remove(nIndex);
+    for(int i = 0; i < 2; i++)
+    {
+        if(-1 == s.fd[i]) continue;
+        // Remove it explicitly, because close() doesn't remove it
+        // if the file description is still referred by other descriptors
+        if(s.bEvent[i])
+            ::epoll_ctl(m_Epoll, EPOLL_CTL_DEL, s.fd[i], nullptr);
+        ::close(s.fd[i]);
+    }
+    // It is thread safe, the owner is deleted in itself thread
+    if(s.pOwner)
+        s.pOwner->deleteLater();
+    // If the index is in the drain list, it is checked without effect
+    s = strSession();
+    m_Free.push_back(nIndex);
+    m_nSessions--;
+    return 0;
+}
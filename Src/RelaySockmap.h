@@ -0,0 +1,114 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CRELAYSOCKMAP_H
+#define CRELAYSOCKMAP_H
+
+#pragma once
+
+#include "Relay.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+/*!
+ * \brief The relay with the eBPF sockmap on linux.
+ *        The client socket and the peer socket are inserted into a sockmap.
+ *        A sk_skb verdict program redirects the data received from a socket
+ *        to the other socket in the kernel. So the data isn't forwarded by
+ *        the proxy at all. The forwarded bytes are counted by the program
+ *        in a hash map keyed by the socket cookie.
+ *        The thread of the relay only monitors the half close and the errors.
+ *
+ *        If the data read by Qt can't be sent at once, or the sockmap is full,
+ *        the session is forwarded by the epoll relay.
+ * \note It needs linux 5.15 and CAP_BPF (or CAP_SYS_ADMIN) and CAP_NET_ADMIN
+ */
+class CRelaySockmap : public CRelay
+{
+public:
+    //! \param nMaxSessions: the maximum of the sessions in the sockmap
+    explicit CRelaySockmap(int nMaxSessions = 32768);
+    virtual ~CRelaySockmap();
+
+    //! Whether the kernel supports it, and the process has the permission
+    static bool IsSupported();
+
+    virtual int Start() override;
+    virtual int Stop() override;
+    virtual int Add(qintptr client, qintptr peer,
+                    const QByteArray& toPeer, const QByteArray& toClient,
+                    QObject* pOwner) override;
+    virtual strStatistics GetStatistics() override;
+
+private:
+    void Run();
+
+    /*!
+     * The index 0 is the client, and 1 is the peer.
+     * The data received from fd[i] is redirected to fd[1 - i].
+     * The key of fd[i] in the sockmap is (index << 1) | i
+     */
+    struct strSession {
+        int fd[2] = {-1, -1};
+        quint64 cookie[2] = {0, 0};
+        //! The bytes read by Qt from fd[i] before it is inserted
+        quint64 nRead[2] = {0, 0};
+        //! The bytes written to fd[i] before it is inserted
+        quint64 nWritten[2] = {0, 0};
+        //! The bytes redirected from fd[i], which are added to the statistics
+        quint64 nCounted[2] = {0, 0};
+        bool bEvent[2] = {false, false}; // fd[i] is in epoll
+        bool bEof[2] = {false, false}; // fd[i] is read EOF
+        bool bShutdown[2] = {false, false}; // fd[i] is shutdown write
+        bool bInsert = false; // The sockets are in the maps
+        bool bDrain = false; // It is in the drain list
+        bool bUsed = false;
+        QObject* pOwner = nullptr;
+    };
+    struct strPending {
+        int client;
+        int peer;
+        QByteArray toPeer;
+        QByteArray toClient;
+        QObject* pOwner;
+    };
+
+    int CreateMaps();
+    int LoadPrograms();
+    void CloseMaps();
+    int AddPending();
+    int AddSession(strPending& p);
+    int Insert(quint32 nIndex);
+    int Remove(quint32 nIndex);
+    void OnEvent(quint32 nIndex, int i, quint32 events);
+    int CheckDrain(quint32 nIndex);
+    quint64 GetRedirected(quint32 nIndex, int i);
+    void UpdateStatistics(quint32 nIndex);
+    int Close(quint32 nIndex);
+
+    int m_nMaxSessions;
+    int m_Target; // The sockmap of the redirect targets
+    int m_Sockmap; // The sockmap with the programs
+    int m_Hash; // The socket cookie -> strValue
+    int m_Parser;
+    int m_Verdict;
+    int m_Epoll;
+    int m_Event;
+    std::thread m_Thread;
+    std::atomic<bool> m_bStop;
+    QSharedPointer<CRelay> m_Fallback;
+
+    std::vector<strSession> m_Sessions;
+    std::vector<quint32> m_Free;
+    std::vector<quint32> m_Drain;
+
+    std::mutex m_Mutex;
+    std::vector<strPending> m_Pending;
+
+    std::atomic<int> m_nSessions;
+    std::atomic<quint64> m_nTotalSessions;
+    std::atomic<quint64> m_nBytes;
+};
+
+#endif // CRELAYSOCKMAP_H
@@ -0,0 +1,300 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "Resolver.h"
+
+#include <atomic>
+#include <QThreadStorage>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(logResolver, "Resolver")
+
+namespace {
+
+std::atomic<int> g_nTtl(60000);
+std::atomic<int> g_nNegativeTtl(5000);
+std::atomic<int> g_nMaxEntries(4096);
+std::atomic<int> g_nPrefetchHits(0);
+std::atomic<quint64> g_nHit(0);
+std::atomic<quint64> g_nNegativeHit(0);
+std::atomic<quint64> g_nMiss(0);
+std::atomic<quint64> g_nShared(0);
+std::atomic<quint64> g_nPrefetch(0);
+std::atomic<quint64> g_nNotFound(0);
+std::atomic<quint64> g_nFail(0);
+std::atomic<int> g_nEntries(0);
+std::atomic<quint64> g_nLatency[CResolver::strStatistics::LATENCY_BUCKETS];
+
+QThreadStorage<CResolver*> g_Resolver;
+
+void AddLatency(qint64 nMs)
+{
+    int i = 0;
+    while(i < CResolver::strStatistics::LATENCY_BUCKETS - 1
+          && nMs >= (qint64(1) << i))
+        i++;
+    g_nLatency[i]++;
+}
+
+} // namespace
+
+CResolver::CResolver() : QObject(),
+    m_nTicket(0),
+    m_Timer([this]() { OnExpire(); })
+{
+    m_Clock.start();
+}
+
+CResolver::~CResolver()
+{
+    qDebug(logResolver) << "CResolver::~CResolver(); entries:" << m_Cache.size();
+    for(auto it = m_Id.begin(); it != m_Id.end(); ++it)
+        QHostInfo::abortHostLookup(it.key());
+    g_nEntries -= m_Cache.size();
+}
+
+CResolver* CResolver::Instance()
+{
+    // It is deleted when the thread exits
+    if(!g_Resolver.hasLocalData())
+        g_Resolver.setLocalData(new CResolver());
+    return g_Resolver.localData();
+}
+
+bool CResolver::Lookup(const QString &szHost, QList<QHostAddress> &addresses,
+                       const Callback &cb, quint64 &nTicket)
+{
+    // The host names are case insensitive
+    QString szKey = szHost.toLower();
+    auto it = m_Cache.find(szKey);
+    if(m_Cache.end() != it)
+    {
+        if(m_Clock.elapsed() < it->nExpire)
+        {
+            if(!it->addresses.isEmpty())
+            {
+                g_nHit++;
+                it->nHits++;
+                addresses = it->addresses;
+                Prefetch(szKey, *it);
+                return true;
+            }
+            // The answer is delivered in the event loop like a lookup
+            g_nNegativeHit++;
+            nTicket = AddWaiter(cb);
+            if(m_NotFound.isEmpty())
+                QMetaObject::invokeMethod(this, "slotNotFound",
+                                          Qt::QueuedConnection);
+            m_NotFound.push_back(nTicket);
+            return false;
+        }
+        m_Cache.erase(it);
+        g_nEntries--;
+    }
+
+    nTicket = AddWaiter(cb);
+    auto f = m_Flight.find(szKey);
+    if(m_Flight.end() != f)
+    {
+        g_nShared++;
+        f->tickets.push_back(nTicket);
+        return false;
+    }
+    g_nMiss++;
+    StartLookup(szKey).tickets.push_back(nTicket);
+    return false;
+}
+
+void CResolver::Cancel(quint64 nTicket)
+{
+    m_Waiter.remove(nTicket);
+}
+
+quint64 CResolver::AddWaiter(const Callback &cb)
+{
+    m_Waiter.insert(++m_nTicket, cb);
+    return m_nTicket;
+}
+
+CResolver::strFlight& CResolver::StartLookup(const QString &szKey)
+{
+    strFlight& f = m_Flight[szKey];
+    f.nStart = m_Clock.elapsed();
+    f.nId = QHostInfo::lookupHost(szKey, this, SLOT(slotLookup(QHostInfo)));
+    m_Id.insert(f.nId, szKey);
+    qDebug(logResolver) << "Look up:" << szKey << "id:" << f.nId;
+    return f;
+}
+
+void CResolver::Prefetch(const QString &szKey, const strEntry &entry)
+{
+    int nPrefetch = g_nPrefetchHits;
+    if(nPrefetch <= 0 || entry.nHits < nPrefetch)
+        return;
+    if(entry.nExpire - m_Clock.elapsed() > entry.nTtl / 10)
+        return;
+    if(m_Flight.contains(szKey))
+        return;
+    // The entry is kept until the lookup is complete or it expires
+    g_nPrefetch++;
+    StartLookup(szKey);
+}
+
+void CResolver::slotLookup(const QHostInfo &info)
+{
+    auto id = m_Id.find(info.lookupId());
+    if(m_Id.end() == id)
+        return;
+    QString szKey = id.value();
+    m_Id.erase(id);
+    auto f = m_Flight.find(szKey);
+    if(m_Flight.end() == f)
+        return;
+    strFlight flight = f.value();
+    m_Flight.erase(f);
+
+    AddLatency(m_Clock.elapsed() - flight.nStart);
+    QList<QHostAddress> addresses;
+    switch(info.error()) {
+    case QHostInfo::NoError:
+        addresses = info.addresses();
+        if(!addresses.isEmpty())
+        {
+            Store(szKey, addresses, g_nTtl);
+            break;
+        }
+        // The name hasn't an address
+        Q_FALLTHROUGH();
+    case QHostInfo::HostNotFound:
+        g_nNotFound++;
+        Store(szKey, addresses, g_nNegativeTtl);
+        break;
+    default:
+        // A temporary failure of the name server isn't cached
+        g_nFail++;
+        qWarning(logResolver) << "Look up" << szKey << "fail:"
+                              << info.errorString();
+        break;
+    }
+
+    // The callbacks may look up again
+    foreach(quint64 nTicket, flight.tickets)
+        Finish(nTicket, addresses);
+}
+
+void CResolver::slotNotFound()
+{
+    QVector<quint64> tickets;
+    tickets.swap(m_NotFound);
+    foreach(quint64 nTicket, tickets)
+        Finish(nTicket, QList<QHostAddress>());
+}
+
+void CResolver::Finish(quint64 nTicket, const QList<QHostAddress> &addresses)
+{
+    auto it = m_Waiter.find(nTicket);
+    if(m_Waiter.end() == it)
+        return;
+    Callback cb = it.value();
+    m_Waiter.erase(it);
+    if(cb)
+        cb(addresses);
+}
+
+void CResolver::Store(const QString &szKey,
+                      const QList<QHostAddress> &addresses, int nTtl)
+{
+    auto it = m_Cache.find(szKey);
+    if(nTtl <= 0)
+    {
+        if(m_Cache.end() != it)
+        {
+            m_Cache.erase(it);
+            g_nEntries--;
+        }
+        return;
+    }
+    if(m_Cache.end() == it)
+    {
+        if(m_Cache.size() >= g_nMaxEntries)
+        {
+            OnExpire();
+            // Replace a name when all names are alive
+            if(!m_Cache.isEmpty() && m_Cache.size() >= g_nMaxEntries)
+            {
+                m_Cache.erase(m_Cache.begin());
+                g_nEntries--;
+            }
+            if(m_Cache.size() >= g_nMaxEntries)
+                return;
+        }
+        it = m_Cache.insert(szKey, strEntry());
+        g_nEntries++;
+    }
+    it->addresses = addresses;
+    it->nTtl = nTtl;
+    it->nExpire = m_Clock.elapsed() + nTtl;
+    it->nHits = 0;
+    if(!m_Timer.IsActive())
+        m_Timer.Start(nTtl);
+}
+
+void CResolver::OnExpire()
+{
+    qint64 nNow = m_Clock.elapsed();
+    qint64 nNext = 0;
+    for(auto it = m_Cache.begin(); it != m_Cache.end();)
+    {
+        if(nNow >= it->nExpire)
+        {
+            it = m_Cache.erase(it);
+            g_nEntries--;
+            continue;
+        }
+        if(0 == nNext || it->nExpire < nNext)
+            nNext = it->nExpire;
+        ++it;
+    }
+    // The next expiry is the nearest name
+    if(nNext > 0)
+        m_Timer.Start(nNext - nNow);
+    else
+        m_Timer.Stop();
+}
+
+void CResolver::SetLimits(int nTtl, int nNegativeTtl, int nMaxEntries,
+                          int nPrefetch)
+{
+    g_nTtl = qMax(0, nTtl);
+    g_nNegativeTtl = qMax(0, nNegativeTtl);
+    g_nMaxEntries = qMax(0, nMaxEntries);
+    g_nPrefetchHits = qMax(0, nPrefetch);
+}
+
+quint64 CResolver::strStatistics::Requests() const
+{
+    return nHit + nNegativeHit + nMiss + nShared;
+}
+
+double CResolver::strStatistics::HitRatio() const
+{
+    quint64 nRequests = Requests();
+    if(0 == nRequests)
+        return 0;
+    return double(nHit + nNegativeHit) / nRequests;
+}
+
+CResolver::strStatistics CResolver::GetStatistics()
+{
+    strStatistics st;
+    st.nHit = g_nHit;
+    st.nNegativeHit = g_nNegativeHit;
+    st.nMiss = g_nMiss;
+    st.nShared = g_nShared;
+    st.nPrefetch = g_nPrefetch;
+    st.nNotFound = g_nNotFound;
+    st.nFail = g_nFail;
+    st.nEntries = g_nEntries;
+    for(int i = 0; i < strStatistics::LATENCY_BUCKETS; i++)
+        st.nLatency[i] = g_nLatency[i];
+    return st;
+}
@@ -0,0 +1,161 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CRESOLVER_H
+#define CRESOLVER_H
+
+#pragma once
+
+#include <functional>
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QList>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QElapsedTimer>
+#include "TimingWheel.h"
+#include "rabbitproxy_export.h"
+
+/*!
+ * \brief The asynchronous resolver of the host names of a thread.
+ *        The host names are looked up by QHostInfo, and the answers are
+ *        kept in the cache of the thread:
+ *        - The addresses are kept for the TTL.
+ *        - The names which aren't found are kept for the negative TTL,
+ *          so a bad name doesn't look up again and again.
+ *        - The concurrent lookups of the same name share one lookup
+ *          (single-flight).
+ *        - A hot name is looked up again before it expires (prefetch),
+ *          so its requests don't wait for the lookup.
+ *
+ *        Example:
+ *        \code
+ *        QList<QHostAddress> addresses;
+ *        quint64 nTicket = 0;
+ *        if(CResolver::Instance()->Lookup("example.com", addresses,
+ *              [this](const QList<QHostAddress>& addresses) {
+ *                  // The addresses are empty if the name isn't found
+ *              }, nTicket))
+ *            // The addresses are in the cache
+ *        // ... The callback isn't called after it
+ *        CResolver::Instance()->Cancel(nTicket);
+ *        \endcode
+ * \note It isn't thread safe. Use the resolver of the current thread.
+ * \see CPeerConnector::Connect()
+ */
+class RABBITPROXY_EXPORT CResolver : public QObject
+{
+    Q_OBJECT
+
+public:
+    virtual ~CResolver();
+
+    //! The resolver of the current thread. It is created at the first call.
+    static CResolver* Instance();
+
+    //! \param addresses: they are empty if the name isn't found
+    typedef std::function<void(const QList<QHostAddress>& addresses)> Callback;
+    /*!
+     * \brief Look up the host name
+     * \param addresses: the addresses of the name if they are in the cache
+     * \param cb: it is called in the event loop when the name isn't in the
+     *        cache and the lookup is complete
+     * \param nTicket: the ticket of the callback. \see Cancel()
+     * \return true: the addresses are in the cache, cb isn't called
+     *         false: cb is called later
+     */
+    bool Lookup(const QString& szHost, QList<QHostAddress>& addresses,
+                const Callback& cb, quint64& nTicket);
+    //! The callback of the ticket isn't called. The lookup isn't aborted.
+    void Cancel(quint64 nTicket);
+
+    /*!
+     * \brief Set the limits of the resolvers of all threads
+     * \param nTtl: the time (ms) which the addresses are kept. 0: no cache
+     * \param nNegativeTtl: the time (ms) which a name that isn't found is kept.
+     *        0: no negative cache
+     * \param nMaxEntries: the most names in the cache of a thread
+     * \param nPrefetch: a name which is hit at least it in the TTL is looked
+     *        up again in the last tenth of the TTL. 0: off
+     */
+    static void SetLimits(int nTtl, int nNegativeTtl, int nMaxEntries,
+                          int nPrefetch);
+
+    //! The hit ratio is (nHit + nNegativeHit) / nRequests
+    struct strStatistics {
+        //! The names which are found in the cache
+        quint64 nHit = 0;
+        //! The names which are found in the negative cache
+        quint64 nNegativeHit = 0;
+        //! The lookups which are started because the cache hasn't the name
+        quint64 nMiss = 0;
+        //! The requests which wait for the lookup of the same name
+        quint64 nShared = 0;
+        //! The lookups of the hot names before they expire
+        quint64 nPrefetch = 0;
+        //! The lookups which don't find the name
+        quint64 nNotFound = 0;
+        //! The lookups which fail by other errors. They aren't cached.
+        quint64 nFail = 0;
+        //! The names in the caches of all threads
+        int nEntries = 0;
+
+        static const int LATENCY_BUCKETS = 13;
+        /*!
+         * \brief The histogram of the time of the lookups.
+         *        nLatency[i] is the lookups which take less than 2^i ms,
+         *        and not less than 2^(i-1) ms. The last is the rest.
+         */
+        quint64 nLatency[LATENCY_BUCKETS] = {0};
+
+        quint64 Requests() const;
+        double HitRatio() const;
+    };
+    static strStatistics GetStatistics();
+
+private Q_SLOTS:
+    void slotLookup(const QHostInfo& info);
+    void slotNotFound();
+
+private:
+    CResolver();
+    Q_DISABLE_COPY(CResolver)
+
+    struct strEntry {
+        //! It is empty if the name isn't found
+        QList<QHostAddress> addresses;
+        qint64 nExpire = 0;
+        qint64 nTtl = 0;
+        //! The hits since it is stored
+        int nHits = 0;
+    };
+    struct strFlight {
+        int nId = -1; // The id of QHostInfo::lookupHost()
+        qint64 nStart = 0;
+        QVector<quint64> tickets;
+    };
+
+    quint64 AddWaiter(const Callback& cb);
+    //! Start the lookup of the name
+    strFlight& StartLookup(const QString& szKey);
+    //! Look up the hot name again when it is about to expire
+    void Prefetch(const QString& szKey, const strEntry& entry);
+    void Store(const QString& szKey, const QList<QHostAddress>& addresses,
+               int nTtl);
+    //! Call the callback of the ticket once
+    void Finish(quint64 nTicket, const QList<QHostAddress>& addresses);
+    //! Remove the expired names
+    void OnExpire();
+
+    QHash<QString, strEntry> m_Cache;
+    QHash<QString, strFlight> m_Flight;
+    QHash<int, QString> m_Id;
+    QHash<quint64, Callback> m_Waiter;
+    //! The tickets of the negative hits, they are answered in the event loop
+    QVector<quint64> m_NotFound;
+    quint64 m_nTicket;
+    QElapsedTimer m_Clock;
+    CTimingWheel::CTimer m_Timer;
+};
+
+#endif // CRESOLVER_H
@@ -1,9 +1,25 @@
 //! @author Kang Lin <kl222@126.com>
 
 #include "Server.h"
+#include "ServerWorker.h"
+#include "BufferPool.h"
+#include "ObjectPool.h"
+#include "Resolver.h"
+#include "PeerConnector.h"
 
 #include <QHostAddress>
 #include <QTcpSocket>
+#include <QTimer>
+#include <QFile>
+
+#if defined(Q_OS_UNIX)
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <unistd.h>
+    #include <cerrno>
+    #include <cstring>
+#endif
 
 #include <QLoggingCategory>
 
@@ -12,14 +28,26 @@ Q_LOGGING_CATEGORY(logServer, "Server")
 CServer::CServer(QObject *parent) : QObject(parent),
     m_pParameter(nullptr),
     m_Status(STATUS::Stop),
-    m_nConnectors(0)
+    m_bPaused(false),
+    m_ListenSocket(-1),
+    m_nAccepted(0),
+    m_nLastAccepted(0),
+    m_nRelay(0),
+    m_nPasses(0),
+    m_nDeferred(0),
+    m_nBytes(0),
+    m_nMaxPassBytes(0),
+    m_nWaiting(0)
 {
     m_pParameter = QSharedPointer<CParameter>(new CParameter(this));
+    m_RateTimer.start();
 }
 
 CServer::~CServer()
 {
     qDebug() << "CProxyServer::~CProxyServer()";
+    StopRelay();
+    StopWorkers();
 }
 
 CServer::STATUS CServer::GetStatus()
@@ -29,7 +57,30 @@ CServer::STATUS CServer::GetStatus()
 
 int CServer::GetConnectors()
 {
-    return m_nConnectors;
+    int nConnectors = 0;
+    for(int i = 0; i < (int)emState::Max; i++)
+        nConnectors += m_nState[i].loadAcquire();
+    return nConnectors;
+}
+
+int CServer::GetConnectors(emState state)
+{
+    if(emState::Max == state) return 0;
+    return m_nState[(int)state].loadAcquire();
+}
+
+QVector<int> CServer::GetWorkerConnectors()
+{
+    QVector<int> connectors;
+    foreach(auto w, m_Workers)
+        connectors.push_back(w->GetConnectors());
+    return connectors;
+}
+
+int CServer::GetWorkers()
+{
+    if(!m_pParameter) return 0;
+    return m_pParameter->GetWorkers();
 }
 
 CParameter* CServer::Getparameter()
@@ -64,11 +115,66 @@ int CServer::Start()
         return -1;
     }
     
-    if(m_Acceptor.isListening())
+    if(m_Acceptor.isListening() || !m_Workers.isEmpty())
         Stop();
     
+    CBufferPool::SetHugePages(m_pParameter->GetHugePages());
+    CObjectPool::SetMaxSize(m_pParameter->GetPoolSize());
+    CResolver::SetLimits(m_pParameter->GetResolverTtl(),
+                         m_pParameter->GetResolverNegativeTtl(),
+                         m_pParameter->GetResolverCacheSize(),
+                         m_pParameter->GetResolverPrefetch());
+    CPeerConnector::SetConnectAttempt(m_pParameter->GetConnectAttemptDelay(),
+                                      m_pParameter->GetConnectAttemptTimeout());
+
+    int nWorkers = GetWorkers();
+    // A relay thread for every worker thread
+    StartRelay(qMax(1, nWorkers));
+    if(-1 != m_ListenSocket)
+    {
+        // The listening socket is set by SetListenSocket()
+        if(nWorkers > 0)
+            qWarning(logServer) << "The workers is ignored,"
+                                << "because the listening socket is set";
+        if(!m_Acceptor.setSocketDescriptor(m_ListenSocket))
+        {
+            qCritical(logServer, "Server set listen socket fail: %s",
+                      m_Acceptor.errorString().toStdString().c_str());
+            return -1;
+        }
+        qInfo(logServer, "Server accept from the listening socket: %d",
+              (int)m_ListenSocket);
+    } else if(nWorkers > 0)
+    {
+        if(0 == StartWorkers(nWorkers))
+        {
+            m_Status = STATUS::Start;
+            return 0;
+        }
+        qWarning(logServer) << "Start workers fail."
+                            << "Accept in the thread of the server";
+    }
+    
     QHostAddress address = QHostAddress::Any;
-    bool bCheck = m_Acceptor.listen(address, m_pParameter->GetPort());
+    bool bCheck = true;
+    if(-1 == m_ListenSocket)
+    {
+#if defined(Q_OS_UNIX)
+        // QTcpServer::listen() uses a fixed backlog,
+        // so create the listening socket with the backlog of the parameter.
+        qintptr fd = CreateListenSocket(m_pParameter->GetPort(), false,
+                                        m_pParameter->GetListenBacklog());
+        bCheck = (-1 != fd) && m_Acceptor.setSocketDescriptor(fd);
+        if(-1 != fd && !bCheck)
+            ::close(fd);
+#else
+    #if QT_VERSION >= QT_VERSION_CHECK(6, 3, 0)
+        if(m_pParameter->GetListenBacklog() > 0)
+            m_Acceptor.setListenBacklogSize(m_pParameter->GetListenBacklog());
+    #endif
+        bCheck = m_Acceptor.listen(address, m_pParameter->GetPort());
+#endif
+    }
     if(!bCheck)
     {
         qCritical(logServer,
@@ -78,13 +184,16 @@ int CServer::Start()
                        m_Acceptor.errorString().toStdString().c_str());
         return -1;
     }
-    else
+    else if(-1 == m_ListenSocket)
         qInfo(logServer,
                        tr("Server listen at: %s:%d").toStdString().c_str(),
                        address.toString().toStdString().c_str(),
                        m_pParameter->GetPort());
+    if(m_pParameter->GetMaxPendingConnections() > 0)
+        m_Acceptor.setMaxPendingConnections(
+                    m_pParameter->GetMaxPendingConnections());
     bCheck = connect(&m_Acceptor, SIGNAL(newConnection()),
-                     this, SLOT(slotAccept()));
+                     this, SLOT(slotAccept()), Qt::UniqueConnection);
     Q_ASSERT(bCheck);
     
     m_Status = STATUS::Start;
@@ -98,40 +207,448 @@ int CServer::Stop()
     
     m_Acceptor.close();
     emit sigStop();
+    // Stop the relays before the workers, so the deleted owners of
+    // the sessions are processed by the event loops of the workers.
+    StopRelay();
+    StopWorkers();
+    m_Relay.clear();
     m_Status = STATUS::Stop;
     return nRet;
 }
 
+int CServer::SetListenSocket(qintptr socket)
+{
+    m_ListenSocket = socket;
+    return 0;
+}
+
+int CServer::StartWorkers(int nWorkers)
+{
+    for(int i = 0; i < nWorkers; i++)
+    {
+        qintptr fd = CreateListenSocket(m_pParameter->GetPort(), true,
+                                        m_pParameter->GetListenBacklog());
+        if(-1 == fd)
+        {
+            StopWorkers();
+            return -1;
+        }
+        CServerWorker* w = new CServerWorker(this, i, fd);
+        m_Workers.push_back(w);
+        // The worker isn't counted if it can't listen
+        if(w->Start())
+        {
+            StopWorkers();
+            return -1;
+        }
+    }
+    qInfo(logServer, "Server listen at port %d with %d workers",
+          m_pParameter->GetPort(), nWorkers);
+    return 0;
+}
+
+int CServer::StopWorkers()
+{
+    foreach(auto w, m_Workers)
+        w->Stop();
+    foreach(auto w, m_Workers)
+    {
+        w->wait();
+        delete w;
+    }
+    m_Workers.clear();
+    return 0;
+}
+
+int CServer::StartRelay(int nRelays)
+{
+    StopRelay();
+    m_Relay.clear();
+    CParameter::emRelay relay = m_pParameter->GetRelay();
+    if(CParameter::emRelay::Qt == relay)
+        return 0;
+    for(int i = 0; i < nRelays; i++)
+    {
+        QSharedPointer<CRelay> r = CRelay::Create(relay);
+        if(!r || r->Start())
+        {
+            StopRelay();
+            m_Relay.clear();
+            return -1;
+        }
+        m_Relay.push_back(r);
+    }
+    qInfo(logServer) << "Start" << nRelays << "relays:" << relay;
+    return 0;
+}
+
+int CServer::StopRelay()
+{
+    // The relays are cleared after the workers are stopped,
+    // because they may be used by the workers.
+    foreach(auto r, m_Relay)
+        r->Stop();
+    return 0;
+}
+
+CRelay* CServer::GetRelay()
+{
+    if(m_Relay.isEmpty())
+        return nullptr;
+    int n = m_nRelay.fetchAndAddRelaxed(1);
+    return m_Relay[(unsigned int)n % m_Relay.size()].data();
+}
+
+CRelay::strStatistics CServer::GetRelayStatistics()
+{
+    CRelay::strStatistics st;
+    foreach(auto r, m_Relay)
+    {
+        CRelay::strStatistics s = r->GetStatistics();
+        st.nSessions += s.nSessions;
+        st.nTotalSessions += s.nTotalSessions;
+        st.nBytes += s.nBytes;
+        st.nBuffers += s.nBuffers;
+    }
+    return st;
+}
+
+qintptr CServer::CreateListenSocket(quint16 nPort, bool bReusePort, int nBacklog)
+{
+#if defined(Q_OS_UNIX)
+    int nRet = 0;
+    int on = 1;
+    bool bIpv6 = true;
+    int fd = ::socket(AF_INET6, SOCK_STREAM, 0);
+    if(-1 == fd)
+    {
+        bIpv6 = false;
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    }
+    if(-1 == fd)
+    {
+        qCritical(logServer, "Create listen socket fail: %s", strerror(errno));
+        return -1;
+    }
+
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(bReusePort)
+    {
+#ifdef SO_REUSEPORT
+        nRet = ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#else
+        nRet = -1;
+        errno = ENOPROTOOPT;
+#endif
+        if(nRet)
+        {
+            qCritical(logServer, "Set SO_REUSEPORT fail: %s", strerror(errno));
+            ::close(fd);
+            return -1;
+        }
+    }
+
+    if(bIpv6)
+    {
+        // Dual stack, the same as QHostAddress::Any
+        int off = 0;
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(nPort);
+        nRet = ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(nPort);
+        nRet = ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    }
+    if(nRet || ::listen(fd, nBacklog > 0 ? nBacklog : SOMAXCONN))
+    {
+        qCritical(logServer, "Listen at port %d fail: %s",
+                  nPort, strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    Q_UNUSED(nPort)
+    Q_UNUSED(bReusePort)
+    Q_UNUSED(nBacklog)
+    qCritical(logServer) << "Create listen socket isn't supported on the platform";
+    return -1;
+#endif
+}
+
 void CServer::slotAccept()
 {
-    QTcpSocket* s = m_Acceptor.nextPendingConnection();
-    if(!s) return;
-    qInfo(logServer,
-                   tr("New connect from: %s:%d").toStdString().c_str(),
-                   s->peerAddress().toString().toStdString().c_str(),
-                   s->peerPort());
+    int nBudget = m_pParameter->GetAcceptBudget();
+    int nAccepted = 0;
+    while(!m_bPaused.loadAcquire() && m_Acceptor.hasPendingConnections())
+    {
+        if(nBudget > 0 && nAccepted >= nBudget)
+        {
+            // Let the other events run, then continue to accept
+            QTimer::singleShot(0, this, SLOT(slotAccept()));
+            return;
+        }
+        
+        QTcpSocket* s = m_Acceptor.nextPendingConnection();
+        if(!s) break;
+        nAccepted++;
+        m_nAccepted++;
+        qInfo(logServer,
+                       tr("New connect from: %s:%d").toStdString().c_str(),
+                       s->peerAddress().toString().toStdString().c_str(),
+                       s->peerPort());
+        
+        // The counter is the child of the socket, it is deleted with the socket
+        new CConnectionCounter(this, s);
+        onAccecpt(s);
+    }
+}
+
+CServer::strForwardStatistics CServer::GetForwardStatistics()
+{
+    strForwardStatistics st;
+    st.nPasses = m_nPasses.loadAcquire();
+    st.nDeferred = m_nDeferred.loadAcquire();
+    st.nBytes = m_nBytes.loadAcquire();
+    st.nMaxPassBytes = m_nMaxPassBytes.loadAcquire();
+    st.nWaiting = m_nWaiting.loadAcquire();
+    return st;
+}
+
+void CServer::OnForward(qint64 nBytes, bool bDeferred)
+{
+    m_nPasses.ref();
+    if(bDeferred)
+        m_nDeferred.ref();
+    m_nBytes.fetchAndAddRelaxed(nBytes);
+    quint64 nMax = m_nMaxPassBytes.loadAcquire();
+    while((quint64)nBytes > nMax
+           && !m_nMaxPassBytes.testAndSetOrdered(nMax, nBytes, nMax))
+        ;
+}
+
+void CServer::OnWaiting(int nDelta)
+{
+    m_nWaiting.fetchAndAddRelaxed(nDelta);
+}
+
+quint64 CServer::GetTimeouts(emState state)
+{
+    if(emState::Max == state) return 0;
+    return m_nTimeouts[(int)state].loadAcquire();
+}
+
+void CServer::OnTimeout(emState state)
+{
+    if(emState::Max == state) return;
+    m_nTimeouts[(int)state].ref();
+}
+
+CServer::strAcceptStatistics CServer::GetAcceptStatistics()
+{
+    strAcceptStatistics st;
+    QVector<qintptr> sockets;
+    st.nAccepted = m_nAccepted;
+    if(m_Acceptor.isListening())
+        sockets.push_back(m_Acceptor.socketDescriptor());
+    foreach(auto w, m_Workers)
+    {
+        st.nAccepted += w->GetAccepted();
+        sockets.push_back(w->GetListenSocket());
+    }
+    
+    qint64 nElapsed = m_RateTimer.restart();
+    if(nElapsed > 0)
+        st.dbRate = (st.nAccepted - m_nLastAccepted) * 1000.0 / nElapsed;
+    m_nLastAccepted = st.nAccepted;
     
-    int nRet = onAccecpt(s);
-    if(nRet) return;
-    bool check = connect(s, SIGNAL(disconnected()),
-                         this, SLOT(slotDisconnected()));
-    Q_ASSERT(check);
-#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
-    check = connect(s, SIGNAL(errorOccurred(QAbstractSocket::SocketError)),
-                    this, SLOT(slotError(QAbstractSocket::SocketError)));
-    Q_ASSERT(check);
+#if defined(Q_OS_LINUX)
+    foreach(auto fd, sockets)
+    {
+        // For a listening socket, tcpi_unacked is the length of
+        // the accept queue, and tcpi_sacked is the backlog.
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        if(::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len))
+            continue;
+        st.nQueue += info.tcpi_unacked;
+        st.nBacklog += info.tcpi_sacked;
+    }
+    
+    QFile f("/proc/net/netstat");
+    if(f.open(QIODevice::ReadOnly))
+    {
+        /* The format is pairs of header and value lines:
+           TcpExt: SyncookiesSent ... ListenOverflows ListenDrops ...
+           TcpExt: 0 ... 12 12 ...
+         */
+        QList<QByteArray> header;
+        while(!f.atEnd())
+        {
+            QByteArray line = f.readLine();
+            if(!line.startsWith("TcpExt:"))
+                continue;
+            if(header.isEmpty())
+            {
+                header = line.simplified().split(' ');
+                continue;
+            }
+            QList<QByteArray> value = line.simplified().split(' ');
+            for(int i = 1; i < header.size() && i < value.size(); i++)
+            {
+                if(header[i] == "ListenOverflows")
+                    st.nListenOverflows = value[i].toULongLong();
+                else if(header[i] == "ListenDrops")
+                    st.nListenDrops = value[i].toULongLong();
+            }
+            break;
+        }
+    }
+#else
+    Q_UNUSED(sockets)
 #endif
-    m_nConnectors++;
+    return st;
+}
+
+void CServer::ChangeState(emState from, emState to)
+{
+    if(emState::Max != to)
+        m_nState[(int)to].ref();
+    if(emState::Max != from)
+        m_nState[(int)from].deref();
+    CheckAdmission();
+}
+
+bool CServer::IsOverload()
+{
+    if(!m_pParameter) return false;
+    int nMax = m_pParameter->GetMaxConnections();
+    if(nMax > 0 && GetConnectors() >= nMax)
+        return true;
+    int nMaxHandshakes = m_pParameter->GetMaxHandshakes();
+    if(nMaxHandshakes > 0
+            && GetConnectors(emState::Handshake)
+                   + GetConnectors(emState::LookUp)
+                   + GetConnectors(emState::Connect) >= nMaxHandshakes)
+        return true;
+    return false;
+}
+
+void CServer::CheckAdmission()
+{
+    bool bOverload = IsOverload();
+    if(!m_bPaused.testAndSetOrdered(!bOverload, bOverload))
+        return;
+    
+    if(bOverload)
+        qWarning(logServer, "Pause accepting: connectors: %d; handshakes: %d",
+                 GetConnectors(), GetConnectors(emState::Handshake));
+    else
+        qInfo(logServer, "Resume accepting: connectors: %d; handshakes: %d",
+              GetConnectors(), GetConnectors(emState::Handshake));
+    
+    // The acceptors must be paused or resumed in their threads.
+    // Use the current value, because the queued calls may be reordered.
+    // It is always queued, because it may be called in slotAccept() or in
+    // the destructor of a counter, which can't accept again at once.
+    QMetaObject::invokeMethod(&m_Acceptor, [this](){
+            if(!m_Acceptor.isListening()) return;
+            if(m_bPaused.loadAcquire())
+                m_Acceptor.pauseAccepting();
+            else {
+                m_Acceptor.resumeAccepting();
+                // Accept the pending connections
+                slotAccept();
+            }
+        }, Qt::QueuedConnection);
+    foreach(auto w, m_Workers)
+        w->CheckAdmission();
+}
+
+bool CServer::IsPaused()
+{
+    return m_bPaused.loadAcquire();
+}
+
+CConnectionCounter::CConnectionCounter(CServer *pServer, QTcpSocket *pSocket,
+                                       QAtomicInt *pWorker)
+    : QObject(pSocket),
+    m_pServer(pServer),
+    m_pWorker(pWorker),
+    m_State(CServer::emState::Handshake),
+    m_nHandshakeTimeout(0),
+    m_Handshake([this]() { OnHandshakeTimeout(); })
+{
+    if(m_pWorker)
+        m_pWorker->ref();
+    if(m_pServer)
+    {
+        m_pServer->ChangeState(CServer::emState::Max, m_State);
+        // It is created in the thread of the socket
+        m_nHandshakeTimeout = m_pServer->Getparameter()->GetHandshakeTimeout();
+        m_Accept.start();
+        m_Handshake.Start(m_nHandshakeTimeout);
+    }
+}
+
+CConnectionCounter::~CConnectionCounter()
+{
+    if(m_pWorker)
+        m_pWorker->deref();
+    if(m_pServer)
+        m_pServer->ChangeState(m_State, CServer::emState::Max);
+}
+
+CConnectionCounter* CConnectionCounter::Get(QTcpSocket *pSocket)
+{
+    if(!pSocket) return nullptr;
+    return pSocket->findChild<CConnectionCounter*>(QString(),
+                                                   Qt::FindDirectChildrenOnly);
+}
+
+CServer::emState CConnectionCounter::GetState()
+{
+    return m_State;
+}
+
+int CConnectionCounter::SetState(CServer::emState state)
+{
+    if(m_State == state || CServer::emState::Max == state)
+        return 0;
+    if(m_pServer)
+        m_pServer->ChangeState(m_State, state);
+    m_State = state;
+    return 0;
 }
 
-void CServer::slotDisconnected()
+qint64 CConnectionCounter::StopHandshake()
 {
-    m_nConnectors--;
+    m_Handshake.Stop();
+    if(m_nHandshakeTimeout <= 0)
+        return 0;
+    // The deadline is from the accept. The timer has the resolution of the
+    // wheel, so the rest may be a little less than 0
+    return qMax<qint64>(1, m_nHandshakeTimeout - m_Accept.elapsed());
 }
 
-void CServer::slotError(QAbstractSocket::SocketError socketError)
+void CConnectionCounter::OnHandshakeTimeout()
 {
-    m_nConnectors--;
+    QTcpSocket* pSocket = qobject_cast<QTcpSocket*>(parent());
+    qInfo(logServer) << "The accepted connection is timeout in the handshake";
+    if(m_pServer)
+        m_pServer->OnTimeout(CServer::emState::Handshake);
+    if(!pSocket) return;
+    // The counter is deleted with the socket
+    pSocket->abort();
+    pSocket->deleteLater();
 }
 
 //void CProxyServer::onAccecpt(QTcpSocket* pSocket)
@@ -7,8 +7,17 @@
 
 #include <QObject>
 #include <QTcpServer>
+#include <QTcpSocket>
+#include <QAtomicInt>
+#include <QPointer>
+#include <QVector>
+#include <QElapsedTimer>
 #include <memory>
 #include "Parameter.h"
+#include "Relay.h"
+#include "TimingWheel.h"
+
+class CServerWorker;
 
 /*!
  * \brief The proxy server interface class
@@ -33,24 +42,226 @@ public:
         Error
     };
     STATUS GetStatus();
+    
+    //! The state of the connection
+    enum class emState {
+        Handshake, //!< Negotiate, authenticate and request
+        LookUp,    //!< Look up the host of the peer
+        Connect,   //!< Connect to the peer
+        Forward,   //!< Forward data
+        Max
+    };
+    //! The number of all connections. It is the sum of all states.
     int GetConnectors();
+    int GetConnectors(emState state);
+    //! Whether accepting is paused by the admission control
+    bool IsPaused();
+    /*!
+     * \brief The connectors of every worker thread in sharded mode.
+     *        The sum of them and the connectors accepted by the thread
+     *        of the server is GetConnectors().
+     * \see CParameter::GetWorkers()
+     */
+    QVector<int> GetWorkerConnectors();
+    
+    /*!
+     * \brief The statistics of accepting.
+     *        It is used to size CParameter::GetListenBacklog()
+     *        and CParameter::GetMaxPendingConnections()
+     */
+    struct strAcceptStatistics {
+        //! The total of accepted connections
+        quint64 nAccepted = 0;
+        //! The accepted connections per second since the last query
+        double dbRate = 0;
+        //! The length of the accept queues of the listening sockets (TCP_INFO)
+        int nQueue = 0;
+        //! The backlog of the listening sockets (TCP_INFO)
+        int nBacklog = 0;
+        //! The accept queue overflows of the system (/proc/net/netstat)
+        quint64 nListenOverflows = 0;
+        //! The dropped SYNs of the listening sockets of the system (/proc/net/netstat)
+        quint64 nListenDrops = 0;
+    };
+    /*!
+     * \note The queue and overflow counters are only supported on linux
+     */
+    strAcceptStatistics GetAcceptStatistics();
+
+    /*!
+     * \brief Create a listening socket at any address.
+     * \param nPort
+     * \param bReusePort: set SO_REUSEPORT, so that several sockets
+     *        can listen at the same port
+     * \param nBacklog: the backlog of listen. 0: SOMAXCONN
+     * \return the socket descriptor. -1 is fail
+     */
+    static qintptr CreateListenSocket(quint16 nPort, bool bReusePort = false,
+                                      int nBacklog = 0);
+    /*!
+     * \brief Accept from the listening socket instead of
+     *        listening at CParameter::GetPort() in Start().
+     *        eg: the listening socket is shared by the worker processes.
+     * \param socket: the listening socket descriptor.
+     *        -1: listen at CParameter::GetPort()
+     * \note The sharded mode isn't used with it
+     */
+    int SetListenSocket(qintptr socket);
+    
+    /*!
+     * \brief Get a relay for the forwarding after the handshake.
+     *        The relays are used in turn. It is thread safe.
+     * \return nullptr: the relay is Qt, or it isn't supported
+     * \see CParameter::GetRelay()
+     */
+    CRelay* GetRelay();
+    //! The sum of the statistics of all relays
+    CRelay::strStatistics GetRelayStatistics();
+
+    /*!
+     * \brief The statistics of the forwarding by Qt.
+     *        A pass is a wakeup of a direction of a connection.
+     *        When a pass uses up the read budget, the remaining data is
+     *        forwarded in a later pass of the event loop.
+     * \see CParameter::GetReadBudget()
+     */
+    struct strForwardStatistics {
+        //! The total of the passes
+        quint64 nPasses = 0;
+        //! The passes which use up the budget, and are deferred
+        quint64 nDeferred = 0;
+        //! The total of the forwarded bytes
+        quint64 nBytes = 0;
+        //! The most bytes forwarded in a pass
+        quint64 nMaxPassBytes = 0;
+        //! The directions which are waiting for a later pass now
+        int nWaiting = 0;
+    };
+    //! The sum of all event loops
+    strForwardStatistics GetForwardStatistics();
+
+    /*!
+     * \brief The total of the connections which are closed by the timeout
+     *        in the state. Forward is the idle timeout.
+     * \see CParameter::GetHandshakeTimeout() CParameter::GetConnectTimeout()
+     *      CParameter::GetIdleTimeout()
+     */
+    quint64 GetTimeouts(emState state);
     
 Q_SIGNALS:
     void sigStop();
 
 protected Q_SLOTS:
     virtual void slotAccept();
-    virtual void slotDisconnected();
-    virtual void slotError(QAbstractSocket::SocketError socketError);
 
 protected:
+    friend class CServerWorker;
+    /*!
+     * \note In sharded mode, it is called in the worker thread
+     */
     virtual int onAccecpt(QTcpSocket* pSocket) = 0;
+    /*!
+     * \brief The number of worker threads will be started
+     * \see CParameter::GetWorkers()
+     */
+    virtual int GetWorkers();
+
+private:
+    int StartWorkers(int nWorkers);
+    int StopWorkers();
+    int StartRelay(int nRelays);
+    int StopRelay();
+    
+    friend class CConnectionCounter;
+    void ChangeState(emState from, emState to);
+    friend class CProxy;
+    friend class CPeerConnectorIceServer;
+    /*!
+     * \brief Count a pass of the forwarding. It may be called in any thread.
+     * \param nBytes: the bytes forwarded in the pass
+     * \param bDeferred: the pass uses up the budget
+     */
+    void OnForward(qint64 nBytes, bool bDeferred);
+    //! A deferred pass is scheduled (nDelta is 1) or runs (nDelta is -1)
+    void OnWaiting(int nDelta);
+    //! A connection is closed by the timeout in the state
+    void OnTimeout(emState state);
+    /*!
+     * \brief Pause accepting when the connections reach the limits,
+     *        and resume when they drop below the limits.
+     *        It may be called in any thread.
+     * \see CParameter::GetMaxConnections()
+     *      CParameter::GetMaxHandshakes()
+     */
+    void CheckAdmission();
+    bool IsOverload();
 
 protected:
     QTcpServer m_Acceptor;
+    QVector<CServerWorker*> m_Workers;
     QSharedPointer<CParameter> m_pParameter;
     STATUS m_Status;
-    int m_nConnectors;
+    QAtomicInt m_nState[(int)emState::Max];
+    //! Whether pauses accepting by admission control
+    QAtomicInt m_bPaused;
+    qintptr m_ListenSocket;
+    quint64 m_nAccepted;
+    quint64 m_nLastAccepted;
+    QElapsedTimer m_RateTimer;
+    QVector<QSharedPointer<CRelay> > m_Relay;
+    QAtomicInt m_nRelay;
+    QAtomicInteger<quint64> m_nPasses;
+    QAtomicInteger<quint64> m_nDeferred;
+    QAtomicInteger<quint64> m_nBytes;
+    QAtomicInteger<quint64> m_nMaxPassBytes;
+    QAtomicInt m_nWaiting;
+    QAtomicInteger<quint64> m_nTimeouts[(int)emState::Max];
+};
+
+/*!
+ * \brief Count a connection in the states of the server.
+ *        It is the child of the accepted socket, so the connection
+ *        is counted exactly once until the socket is deleted.
+ *        The handshake timeout is started when the socket is accepted, so
+ *        the socket which doesn't send the protocol is closed. The proxy
+ *        takes over the rest of the timeout. \see CProxy::Attach()
+ */
+class RABBITPROXY_EXPORT CConnectionCounter : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+     * \param pServer
+     * \param pSocket: the accepted socket. It is the parent.
+     * \param pWorker: the connectors of the worker. It may be nullptr.
+     */
+    explicit CConnectionCounter(CServer* pServer, QTcpSocket* pSocket,
+                                QAtomicInt* pWorker = nullptr);
+    virtual ~CConnectionCounter();
+
+    //! Get the counter of the accepted socket
+    static CConnectionCounter* Get(QTcpSocket* pSocket);
+
+    CServer::emState GetState();
+    int SetState(CServer::emState state);
+
+    /*!
+     * \brief Stop the handshake timeout of the accepted socket
+     * \return the rest of the timeout (ms). 0: no limit
+     */
+    qint64 StopHandshake();
+
+private:
+    //! Close the socket which doesn't finish the handshake
+    void OnHandshakeTimeout();
+
+    QPointer<CServer> m_pServer;
+    QAtomicInt* m_pWorker;
+    CServer::emState m_State;
+    qint64 m_nHandshakeTimeout;
+    QElapsedTimer m_Accept;
+    CTimingWheel::CTimer m_Handshake;
 };
 
 #endif // CPROXYSERVER_H
@@ -2,7 +2,10 @@
 
 #include "ServerSocks.h"
 #include "ProxySocks5.h"
+#include "ProxyHttp.h"
 #include "ParameterSocks.h"
+#include "ObjectPool.h"
+#include "UpstreamPool.h"
 
 #ifdef HAVE_ICE
 #ifdef HAVE_WebSocket
@@ -31,6 +34,19 @@ CServerSocks::~CServerSocks()
     qDebug(logSocks) << "CServerSocks::~CServerSocks()";
 }
 
+int CServerSocks::Start()
+{
+    CParameterSocks* p = qobject_cast<CParameterSocks*>(Getparameter());
+    CUpstreamPool::SetLimits(p->GetHttpPoolMaxIdlePerHost(),
+                             p->GetHttpPoolMaxIdle(),
+                             p->GetHttpPoolIdleTimeout());
+#ifdef HAVE_ICE
+    return StartIce();
+#else
+    return CServer::Start();
+#endif
+}
+
 #ifdef HAVE_ICE
 QSharedPointer<CIceSignal> CServerSocks::GetSignal()
 {
@@ -42,7 +58,7 @@ QSharedPointer<CIceManager> CServerSocks::GetIceManager()
     return m_IceManager;
 }
 #endif
-int CServerSocks::Start()
+int CServerSocks::StartIce()
 {
     int nRet = 0;
     try {
@@ -249,59 +265,144 @@ void CServerSocks::CloseConnectServer(CPeerConnectorIceServer* pServer)
 
 int CServerSocks::onAccecpt(QTcpSocket* pSocket)
 {
-    bool check = connect(pSocket, SIGNAL(readyRead()),
-                         this, SLOT(slotRead()));
+    // In sharded mode, the socket lives in the worker thread,
+    // so read it in the thread of the socket.
+    bool check = connect(pSocket, &QTcpSocket::readyRead,
+                         pSocket, [this, pSocket](){ OnRead(pSocket); });
+    Q_ASSERT(check);
+    // The client closes before the protocol is detected.
+    // The handshake timeout is started in CConnectionCounter
+    check = connect(pSocket, &QTcpSocket::disconnected,
+                    pSocket, &QTcpSocket::deleteLater);
     Q_ASSERT(check);
     return 0;
 }
 
-void CServerSocks::slotRead()
+int CServerSocks::GetWorkers()
+{
+#ifdef HAVE_ICE
+    CParameterSocks* p = qobject_cast<CParameterSocks*>(Getparameter());
+    if(p && p->GetIce() && p->GetWorkers() > 0)
+    {
+        // The ICE signal and peer connectors live in the thread of the server
+        qWarning(logSocks) << "The workers isn't supported with ICE."
+                           << "Accept in the thread of the server";
+        return 0;
+    }
+#endif
+    return CServer::GetWorkers();
+}
+
+CServerSocks::emProtocol CServerSocks::Detect(const char *pData, int nLen)
+{
+    if(nLen <= 0)
+        return emProtocol::Incomplete;
+    switch (pData[0]) {
+    case 0x04:
+        return emProtocol::Socks4;
+    case 0x05:
+        return emProtocol::Socks5;
+    default:
+        break;
+    }
+    // The HTTP request starts with the method token and a space, eg: "CONNECT "
+    for(int i = 0; i < nLen; i++)
+    {
+        char c = pData[i];
+        if(' ' == c)
+            return i > 0 ? emProtocol::Http : emProtocol::Unknown;
+        if(c < 'A' || c > 'Z')
+            return emProtocol::Unknown;
+    }
+    return nLen < DETECT_SIZE ? emProtocol::Incomplete : emProtocol::Unknown;
+}
+
+int CServerSocks::OnRead(QTcpSocket* pSocket)
 {
-    QTcpSocket* pSocket = qobject_cast<QTcpSocket*>(sender());
     if(!pSocket)
     {
-        qCritical(logSocks) << "CProxyServerSocket::slotRead(): socket is null";
-        return;
+        qCritical(logSocks) << "CServerSocks::OnRead(): socket is null";
+        return -1;
     }
     
-    QByteArray d = pSocket->read(1);
-    pSocket->disconnect(this);
-    if(d.isEmpty())
+    // Peek, so the data is left to the proxy
+    char buf[DETECT_SIZE];
+    qint64 n = pSocket->peek(buf, DETECT_SIZE);
+    if(n <= 0)
     {
-        qDebug(logSocks) << "readAll fail";
+        qDebug(logSocks) << "peek fail";
+        disconnect(pSocket, &QTcpSocket::readyRead, pSocket, nullptr);
         pSocket->close();
         pSocket->deleteLater();
-        return;
+        return -1;
     }
+    emProtocol protocol = Detect(buf, n);
+    if(emProtocol::Incomplete == protocol)
+        return 0;
+    disconnect(pSocket, &QTcpSocket::readyRead, pSocket, nullptr);
+    // The proxy owns the socket from now on. \see CProxy::slotClose()
+    disconnect(pSocket, &QTcpSocket::disconnected,
+               pSocket, &QTcpSocket::deleteLater);
     
     CParameterSocks* pPara = qobject_cast<CParameterSocks*>(Getparameter());
     
-    qInfo(logSocks) << "Version is" << d.at(0);
-    switch (d.at(0)) {
-    case 0x05:
+    qInfo(logSocks) << "Protocol is" << (int)protocol;
+    switch (protocol) {
+    case emProtocol::Socks5:
     {
         if(pPara->GetV5())
         {
-            // The pointer is deleted by connect signal in CProxy::CProxy
-            CProxySocks5 *p = new CProxySocks5(pSocket, this);
+            // The version is removed. \see CProxySocks5::processNegotiate()
+            pSocket->read(1);
+            // The closed proxy is put into the pool. \see CProxy::slotClose()
+            CProxySocks5 *p = CObjectPool::Instance()->Get<CProxySocks5>();
+            if(p)
+                p->Reset(pSocket, this);
+            else
+                p = new CProxySocks5(pSocket, this);
             p->slotRead();
+            return 0;
         }
         break;
     }
-    case 0x04:
+    case emProtocol::Socks4:
     {
         if(pPara->GetV4())
         {
-            // The pointer is deleted by connect signal in CProxy::CProxy
-            CProxySocks4 *p = new CProxySocks4(pSocket, this);
+            // The version is removed. \see CProxySocks4::processClientRequest()
+            pSocket->read(1);
+            // The closed proxy is put into the pool. \see CProxy::slotClose()
+            CProxySocks4 *p = CObjectPool::Instance()->Get<CProxySocks4>();
+            if(p)
+                p->Reset(pSocket, this);
+            else
+                p = new CProxySocks4(pSocket, this);
             p->slotRead();
+            return 0;
+        }
+        break;
+    }
+    case emProtocol::Http:
+    {
+        if(pPara->GetHttp())
+        {
+            // The closed proxy is put into the pool. \see CProxy::slotClose()
+            CProxyHttp *p = CObjectPool::Instance()->Get<CProxyHttp>();
+            if(p)
+                p->Reset(pSocket, this);
+            else
+                p = new CProxyHttp(pSocket, this);
+            p->slotRead();
+            return 0;
         }
         break;
     }
     default:
-        qWarning(logSocks) << "Isn't support version:" << d.at(0);
-        pSocket->close();
-        pSocket->deleteLater();
         break;
     }
+    qWarning(logSocks) << "Isn't support protocol:" << (int)protocol
+                       << "first byte:" << buf[0];
+    pSocket->close();
+    pSocket->deleteLater();
+    return -1;
 }
@@ -27,18 +27,21 @@ public:
     CServerSocks(QObject *parent = nullptr);
     virtual ~CServerSocks() override;
 
-#ifdef HAVE_ICE
+public Q_SLOTS:
+    virtual int Start() override;
 
+#ifdef HAVE_ICE
+public:
     QSharedPointer<CIceSignal> GetSignal();
 #ifndef WITH_ONE_PEERCONNECTION_ONE_DATACHANNEL
     QSharedPointer<CIceManager> GetIceManager();
 #endif
 
 public Q_SLOTS:
-    virtual int Start() override;
     virtual int Stop() override;
 
 private:
+    int StartIce();
     void CloseConnectServer(CPeerConnectorIceServer *pServer);
 private Q_SLOTS:
     virtual void slotOffer(const QString& fromUser,
@@ -59,11 +62,32 @@ private:
     
 #endif //HAVE_ICE
 
-protected Q_SLOTS:
-    virtual void slotRead();
-
 protected:
+    enum class emProtocol {
+        Unknown,
+        //! Wait for more data
+        Incomplete,
+        Socks4,
+        Socks5,
+        Http
+    };
+    //! The most bytes which are peeked to detect the protocol
+    static const int DETECT_SIZE = 16;
+    /*!
+     * \brief Detect the protocol by the first bytes of the connection.
+     *        The socks requests start with the version, and the HTTP
+     *        request starts with the method.
+     */
+    static emProtocol Detect(const char* pData, int nLen);
+    /*!
+     * \brief Peek the first bytes without consuming them, detect the
+     *        protocol, and create the proxy of it.
+     * \note It is called in the thread of the socket
+     */
+    virtual int OnRead(QTcpSocket* pSocket);
+
     virtual int onAccecpt(QTcpSocket* pSocket) override;
+    virtual int GetWorkers() override;
 };
 
 #endif // CPROXYSERVERSOCKS_H
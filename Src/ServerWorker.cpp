@@ -0,0 +1,147 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "ServerWorker.h"
+#include "Server.h"
+
+#include <QTcpSocket>
+#include <QTimer>
+#include <QLoggingCategory>
+
+#if defined(Q_OS_UNIX)
+    #include <unistd.h>
+#endif
+
+Q_DECLARE_LOGGING_CATEGORY(logServer)
+
+CServerWorker::CServerWorker(CServer *pServer, int nId, qintptr listenSocket)
+    : QThread(),
+    m_pServer(pServer),
+    m_nId(nId),
+    m_ListenSocket(listenSocket),
+    m_nConnectors(0),
+    m_nAccepted(0),
+    m_nStarted(-1)
+{
+    setObjectName("ServerWorker" + QString::number(nId));
+    // The acceptor and the sockets accepted by it live in the worker thread
+    m_Acceptor.moveToThread(this);
+}
+
+CServerWorker::~CServerWorker()
+{
+    qDebug(logServer) << "CServerWorker::~CServerWorker()" << m_nId;
+    if(isRunning())
+    {
+        Stop();
+        wait();
+    }
+}
+
+int CServerWorker::Start()
+{
+    start();
+    m_Started.acquire();
+    return m_nStarted;
+}
+
+int CServerWorker::GetId()
+{
+    return m_nId;
+}
+
+int CServerWorker::GetConnectors()
+{
+    return m_nConnectors.loadAcquire();
+}
+
+quint64 CServerWorker::GetAccepted()
+{
+    return m_nAccepted.loadAcquire();
+}
+
+qintptr CServerWorker::GetListenSocket()
+{
+    return m_ListenSocket;
+}
+
+int CServerWorker::CheckAdmission()
+{
+    QMetaObject::invokeMethod(&m_Acceptor, [this](){
+            if(!m_Acceptor.isListening()) return;
+            if(m_pServer->IsPaused())
+                m_Acceptor.pauseAccepting();
+            else {
+                m_Acceptor.resumeAccepting();
+                Accept();
+            }
+        }, Qt::QueuedConnection);
+    return 0;
+}
+
+int CServerWorker::Stop()
+{
+    QMetaObject::invokeMethod(&m_Acceptor, [this](){
+            m_Acceptor.close();
+            quit();
+        }, Qt::QueuedConnection);
+    return 0;
+}
+
+void CServerWorker::run()
+{
+    if(!m_Acceptor.setSocketDescriptor(m_ListenSocket))
+    {
+        qCritical(logServer, "Worker %d set listen socket fail: %s",
+                  m_nId, m_Acceptor.errorString().toStdString().c_str());
+        // The acceptor doesn't own the socket if it fails
+#if defined(Q_OS_UNIX)
+        ::close(m_ListenSocket);
+#endif
+        m_ListenSocket = -1;
+        m_nStarted = -1;
+        m_Started.release();
+        return;
+    }
+    int nMaxPending = m_pServer->Getparameter()->GetMaxPendingConnections();
+    if(nMaxPending > 0)
+        m_Acceptor.setMaxPendingConnections(nMaxPending);
+    bool check = connect(&m_Acceptor, &QTcpServer::newConnection,
+                         &m_Acceptor, [this](){ Accept(); });
+    Q_ASSERT(check);
+
+    qInfo(logServer, "Worker %d is running", m_nId);
+    m_nStarted = 0;
+    m_Started.release();
+    exec();
+
+    m_Acceptor.close();
+    m_Acceptor.disconnect();
+    qInfo(logServer, "Worker %d is stopped", m_nId);
+}
+
+void CServerWorker::Accept()
+{
+    int nBudget = m_pServer->Getparameter()->GetAcceptBudget();
+    int nAccepted = 0;
+    while(!m_pServer->IsPaused() && m_Acceptor.hasPendingConnections())
+    {
+        if(nBudget > 0 && nAccepted >= nBudget)
+        {
+            // Let the other events run, then continue to accept
+            QTimer::singleShot(0, &m_Acceptor, [this](){ Accept(); });
+            return;
+        }
+        
+        QTcpSocket* s = m_Acceptor.nextPendingConnection();
+        if(!s) break;
+        nAccepted++;
+        m_nAccepted.ref();
+        qInfo(logServer, "Worker %d: New connect from: %s:%d",
+              m_nId,
+              s->peerAddress().toString().toStdString().c_str(),
+              s->peerPort());
+        
+        new CConnectionCounter(m_pServer, s, &m_nConnectors);
+        m_pServer->onAccecpt(s);
+    }
+}
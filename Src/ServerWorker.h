@@ -0,0 +1,78 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CSERVERWORKER_H
+#define CSERVERWORKER_H
+
+#pragma once
+
+#include <QThread>
+#include <QTcpServer>
+#include <QAtomicInt>
+#include <QSemaphore>
+
+class CServer;
+
+/*!
+ * \brief The worker thread of the server in sharded mode.
+ *        It has itself event loop and listening socket.
+ *        The accepted sockets and the proxies of them live in this thread.
+ * \see CServer::Start()
+ */
+class CServerWorker : public QThread
+{
+    Q_OBJECT
+
+public:
+    /*!
+     * \param pServer
+     * \param nId: the index of worker
+     * \param listenSocket: the listening socket descriptor.
+     *        The worker owns it.
+     */
+    explicit CServerWorker(CServer* pServer, int nId, qintptr listenSocket);
+    virtual ~CServerWorker();
+
+    /*!
+     * \brief Start the worker thread, and wait until it listens
+     * \return 0: success
+     *         -1: the listening socket can't be used. It is closed, and the
+     *             thread exits.
+     */
+    int Start();
+    /*!
+     * \brief Stop the worker.
+     * \note It is queued after CServer::sigStop, so the proxies in this thread
+     *       are closed before the event loop exits.
+     */
+    int Stop();
+    /*!
+     * \brief Pause or resume accepting in the worker thread
+     * \see CServer::IsPaused()
+     */
+    int CheckAdmission();
+
+    int GetId();
+    int GetConnectors();
+    //! The total of accepted connections
+    quint64 GetAccepted();
+    qintptr GetListenSocket();
+
+protected:
+    virtual void run() override;
+
+private:
+    void Accept();
+
+private:
+    CServer* m_pServer;
+    int m_nId;
+    qintptr m_ListenSocket;
+    QTcpServer m_Acceptor;
+    QAtomicInt m_nConnectors;
+    QAtomicInteger<quint64> m_nAccepted;
+    //! It is released when the thread listens or fails. \see Start()
+    QSemaphore m_Started;
+    int m_nStarted; // The result of listening in the thread
+};
+
+#endif // CSERVERWORKER_H
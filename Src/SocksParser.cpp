@@ -0,0 +1,301 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "SocksParser.h"
+
+#include <cstring>
+#include <QtEndian>
+
+CSocksParser::CSocksParser()
+{
+    Start(emMessage::None);
+}
+
+void CSocksParser::Start(emMessage message)
+{
+    m_Message = message;
+    m_Result = Incomplete;
+    m_Error = emError::None;
+    m_nLen = 0;
+    m_nStage = 0;
+    m_nScan = 0;
+    m_nUser = m_nUserLen = 0;
+    m_nPassword = m_nPasswordLen = 0;
+    m_nAddress = m_nDomainLen = 0;
+    m_nPort = 0;
+    m_cAddressType = 0;
+    switch(message) {
+    case emMessage::None:
+        m_nNeed = 0;
+        break;
+    case emMessage::Greeting:
+        m_nNeed = 1;
+        break;
+    case emMessage::Authentication:
+        m_nNeed = 2;
+        break;
+    case emMessage::Request5:
+        // The head and the first byte of the address
+        m_nNeed = 5;
+        break;
+    case emMessage::Request4:
+        // The fixed fields and the null of the user id
+        m_nNeed = 8;
+        break;
+    }
+}
+
+CSocksParser::emMessage CSocksParser::Message() const
+{
+    return m_Message;
+}
+
+int CSocksParser::Need() const
+{
+    if(emMessage::None == m_Message || Incomplete != m_Result)
+        return 0;
+    return m_nNeed - m_nLen;
+}
+
+char* CSocksParser::Tail()
+{
+    return m_Buffer + m_nLen;
+}
+
+CSocksParser::emResult CSocksParser::Commit(int n)
+{
+    Q_ASSERT(n >= 0 && n <= Need());
+    if(n <= 0 || n > Need())
+        return m_Result;
+    m_nLen += n;
+    return Step();
+}
+
+int CSocksParser::Feed(const char *pData, int nLen)
+{
+    int nUsed = 0;
+    while(nUsed < nLen && Need() > 0)
+    {
+        int n = qMin(Need(), nLen - nUsed);
+        memcpy(Tail(), pData + nUsed, n);
+        nUsed += n;
+        Commit(n);
+    }
+    return nUsed;
+}
+
+CSocksParser::emResult CSocksParser::Result() const
+{
+    return m_Result;
+}
+
+CSocksParser::emError CSocksParser::GetError() const
+{
+    return m_Error;
+}
+
+int CSocksParser::Length() const
+{
+    return m_nLen;
+}
+
+CSocksParser::emResult CSocksParser::Fail(emError e)
+{
+    m_Error = e;
+    m_Result = Error;
+    return m_Result;
+}
+
+bool CSocksParser::ScanString(int nBegin, int &nLen)
+{
+    // The bytes which are scanned aren't scanned again
+    int i = qMax(nBegin + m_nScan, nBegin);
+    for(; i < m_nLen; i++)
+    {
+        if(0 == m_Buffer[i])
+        {
+            nLen = i - nBegin;
+            m_nScan = 0;
+            return true;
+        }
+    }
+    m_nScan = i - nBegin;
+    return false;
+}
+
+CSocksParser::emResult CSocksParser::Step()
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(m_Buffer);
+    while(Incomplete == m_Result && m_nLen >= m_nNeed)
+    {
+        switch(m_Message) {
+        case emMessage::None:
+            return m_Result;
+        case emMessage::Greeting:
+            if(0 == m_nStage)
+            {
+                m_nNeed = 1 + p[0];
+                m_nStage = 1;
+            } else
+                m_Result = Complete;
+            break;
+        case emMessage::Authentication:
+            if(0 == m_nStage)
+            {
+                if(0x01 != p[0])
+                    return Fail(emError::Version);
+                m_nUser = 2;
+                m_nUserLen = p[1];
+                m_nNeed = m_nUser + m_nUserLen + 1;
+                m_nStage = 1;
+            } else if(1 == m_nStage) {
+                m_nPassword = m_nUser + m_nUserLen + 1;
+                m_nPasswordLen = p[m_nPassword - 1];
+                m_nNeed = m_nPassword + m_nPasswordLen;
+                m_nStage = 2;
+            } else
+                m_Result = Complete;
+            break;
+        case emMessage::Request5:
+            if(0 == m_nStage)
+            {
+                if(0x05 != p[0])
+                    return Fail(emError::Version);
+                m_cAddressType = p[3];
+                m_nAddress = 4;
+                switch(m_cAddressType) {
+                case AddressTypeIpv4:
+                    m_nNeed = m_nAddress + 4 + 2;
+                    break;
+                case AddressTypeIpv6:
+                    m_nNeed = m_nAddress + 16 + 2;
+                    break;
+                case AddressTypeDomain:
+                    m_nAddress = 5;
+                    m_nDomainLen = p[4];
+                    m_nNeed = m_nAddress + m_nDomainLen + 2;
+                    break;
+                default:
+                    return Fail(emError::AddressType);
+                }
+                m_nPort = m_nNeed - 2;
+                m_nStage = 1;
+            } else
+                m_Result = Complete;
+            break;
+        case emMessage::Request4:
+            if(0 == m_nStage)
+            {
+                m_nPort = 1;
+                m_nUser = 7;
+                m_cAddressType = AddressTypeIpv4;
+                m_nStage = 1;
+            }
+            if(1 == m_nStage)
+            {
+                if(!ScanString(m_nUser, m_nUserLen))
+                {
+                    m_nNeed = m_nLen + 1;
+                    break;
+                }
+                quint32 ip = Ipv4();
+                // socks4a: 0.0.0.x (x isn't 0), and the domain follows the user
+                if(0 == (ip & 0xFFFFFF00) && (ip & 0x000000FF))
+                {
+                    m_cAddressType = AddressTypeDomain;
+                    m_nAddress = m_nUser + m_nUserLen + 1;
+                    m_nNeed = m_nAddress + 1;
+                    m_nStage = 2;
+                } else
+                    m_Result = Complete;
+            } else {
+                if(!ScanString(m_nAddress, m_nDomainLen))
+                {
+                    m_nNeed = m_nLen + 1;
+                    break;
+                }
+                m_Result = Complete;
+            }
+            break;
+        }
+        if(m_nNeed > BUFFER_SIZE)
+            return Fail(emError::Overflow);
+    }
+    return m_Result;
+}
+
+const unsigned char* CSocksParser::Methods() const
+{
+    return reinterpret_cast<const unsigned char*>(m_Buffer + 1);
+}
+
+int CSocksParser::MethodCount() const
+{
+    if(emMessage::Greeting != m_Message || Complete != m_Result)
+        return 0;
+    return static_cast<unsigned char>(m_Buffer[0]);
+}
+
+const char* CSocksParser::User() const
+{
+    return m_Buffer + m_nUser;
+}
+
+int CSocksParser::UserLength() const
+{
+    return m_nUserLen;
+}
+
+const char* CSocksParser::Password() const
+{
+    return m_Buffer + m_nPassword;
+}
+
+int CSocksParser::PasswordLength() const
+{
+    return m_nPasswordLen;
+}
+
+int CSocksParser::CommandOffset() const
+{
+    return emMessage::Request4 == m_Message ? 0 : 1;
+}
+
+int CSocksParser::Ipv4Offset() const
+{
+    return emMessage::Request4 == m_Message ? 3 : m_nAddress;
+}
+
+char CSocksParser::Command() const
+{
+    return m_Buffer[CommandOffset()];
+}
+
+char CSocksParser::AddressType() const
+{
+    return m_cAddressType;
+}
+
+quint32 CSocksParser::Ipv4() const
+{
+    return qFromBigEndian<quint32>(m_Buffer + Ipv4Offset());
+}
+
+const quint8* CSocksParser::Ipv6() const
+{
+    return reinterpret_cast<const quint8*>(m_Buffer + m_nAddress);
+}
+
+const char* CSocksParser::Domain() const
+{
+    return m_Buffer + m_nAddress;
+}
+
+int CSocksParser::DomainLength() const
+{
+    return m_nDomainLen;
+}
+
+quint16 CSocksParser::Port() const
+{
+    return qFromBigEndian<quint16>(m_Buffer + m_nPort);
+}
@@ -0,0 +1,155 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CSOCKSPARSER_H
+#define CSOCKSPARSER_H
+
+#pragma once
+
+#include <QtGlobal>
+#include "rabbitproxy_export.h"
+
+/*!
+ * \brief The incremental parser of the messages of the socks handshake.
+ *        It parses the socks5 greeting (RFC 1928), the user/password
+ *        authentication (RFC 1929), the socks5 request and the socks4/4a
+ *        request. The version byte which is read by the server to choose
+ *        the protocol isn't in the greeting and the socks4 request.
+ *
+ *        A message is gathered in a fixed inline buffer, and the fields are
+ *        parsed by a cursor when the bytes arrive. Need() is the bytes which
+ *        the message needs at least, so the caller reads no more than the
+ *        message, and the data which follows it is left in the socket.
+ *        It doesn't allocate memory.
+ *
+ *        Example:
+ *        \code
+ *        parser.Start(CSocksParser::emMessage::Greeting);
+ *        while(parser.Need() > 0)
+ *        {
+ *            qint64 n = pSocket->read(parser.Tail(), parser.Need());
+ *            if(n <= 0) break;
+ *            parser.Commit(n);
+ *        }
+ *        if(CSocksParser::Complete == parser.Result())
+ *            // Use parser.Methods()
+ *        \endcode
+ * \note The pointers of the fields are valid until the next Start().
+ */
+class RABBITPROXY_EXPORT CSocksParser
+{
+public:
+    //! The size of the inline buffer. A longer message is an error.
+    static const int BUFFER_SIZE = 1024;
+
+    enum class emMessage {
+        None,
+        //! NMETHODS METHODS
+        Greeting,
+        //! VER ULEN UNAME PLEN PASSWD
+        Authentication,
+        //! VER CMD RSV ATYP DST.ADDR DST.PORT
+        Request5,
+        //! CD DSTPORT DSTIP USERID NULL [DOMAIN NULL]
+        Request4
+    };
+
+    enum emResult {
+        Error = -1,
+        Complete = 0,
+        Incomplete = 1
+    };
+
+    enum class emError {
+        None,
+        //! The version of the message is wrong
+        Version,
+        //! The address type of the socks5 request isn't supported
+        AddressType,
+        //! The message is longer than the buffer
+        Overflow
+    };
+
+    enum emAddressType {
+        AddressTypeIpv4 = 0x01,
+        AddressTypeDomain = 0x03,
+        AddressTypeIpv6 = 0x04
+    };
+
+    CSocksParser();
+
+    //! Start to parse a message. emMessage::None stops parsing.
+    void Start(emMessage message);
+    emMessage Message() const;
+    //! The bytes which the message needs at least. 0: complete or error
+    int Need() const;
+    //! The place where the next bytes are put. There is Need() bytes at least.
+    char* Tail();
+    //! Parse the n bytes which are put into Tail(). n is at most Need().
+    emResult Commit(int n);
+    /*!
+     * \brief Copy and parse the bytes. The bytes after the message aren't used.
+     * \return the bytes which are used
+     */
+    int Feed(const char* pData, int nLen);
+    emResult Result() const;
+    emError GetError() const;
+    //! The bytes of the message
+    int Length() const;
+
+    //! \name Greeting
+    //! @{
+    const unsigned char* Methods() const;
+    int MethodCount() const;
+    //! @}
+
+    //! \name Authentication
+    //! @{
+    const char* User() const;
+    int UserLength() const;
+    const char* Password() const;
+    int PasswordLength() const;
+    //! @}
+
+    //! \name Request5 and Request4
+    //! @{
+    char Command() const;
+    //! enum emAddressType. The socks4a request is AddressTypeDomain.
+    char AddressType() const;
+    //! The IPv4 address in the host byte order
+    quint32 Ipv4() const;
+    //! The 16 bytes of the IPv6 address
+    const quint8* Ipv6() const;
+    //! The domain name, it isn't null-terminated
+    const char* Domain() const;
+    int DomainLength() const;
+    quint16 Port() const;
+    //! @}
+
+private:
+    emResult Step();
+    //! Scan the null-terminated field which starts at nBegin
+    bool ScanString(int nBegin, int& nLen);
+    //! The offset of the command and the IPv4 address
+    int CommandOffset() const;
+    int Ipv4Offset() const;
+    emResult Fail(emError e);
+
+    char m_Buffer[BUFFER_SIZE];
+    emMessage m_Message;
+    emResult m_Result;
+    emError m_Error;
+    int m_nLen; // The bytes in the buffer
+    int m_nNeed; // The bytes which the parsed fields need
+    int m_nStage; // The field which is parsed
+
+    int m_nScan; // The bytes of the null-terminated field which are scanned
+
+    // The fields. The offsets are in m_Buffer.
+    int m_nUser, m_nUserLen;
+    int m_nPassword, m_nPasswordLen;
+    int m_nAddress, m_nDomainLen;
+    int m_nPort;
+    char m_cAddressType;
+};
+
+#endif // CSOCKSPARSER_H
@@ -0,0 +1,198 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "TimingWheel.h"
+
+#include <cstring>
+#include <QThreadStorage>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(logTimingWheel, "TimingWheel")
+
+static QThreadStorage<CTimingWheel*> g_Wheel;
+
+CTimingWheel::CTimingWheel(QObject *parent) : QObject(parent),
+    m_nNow(0),
+    m_nTimers(0),
+    m_nExpired(0)
+{
+    memset(m_Slots, 0, sizeof(m_Slots));
+    m_Clock.start();
+    m_Timer.setInterval(TICK);
+    bool check = connect(&m_Timer, SIGNAL(timeout()), this, SLOT(slotTick()));
+    Q_ASSERT(check);
+}
+
+CTimingWheel::~CTimingWheel()
+{
+    qDebug(logTimingWheel) << "CTimingWheel::~CTimingWheel(); timers:" << m_nTimers
+                           << "expired:" << m_nExpired;
+    // The timers which live longer than the wheel are stopped
+    for(int l = 0; l < LEVELS; l++)
+    {
+        for(int i = 0; i < SLOTS; i++)
+        {
+            CTimer* t = m_Slots[l][i];
+            while(t)
+            {
+                CTimer* pNext = t->m_pNext;
+                t->m_pWheel = nullptr;
+                t->m_pPrev = t->m_pNext = nullptr;
+                t->m_ppHead = nullptr;
+                t = pNext;
+            }
+        }
+    }
+}
+
+CTimingWheel* CTimingWheel::Instance()
+{
+    // It is deleted when the thread exits
+    if(!g_Wheel.hasLocalData())
+        g_Wheel.setLocalData(new CTimingWheel());
+    return g_Wheel.localData();
+}
+
+CTimingWheel::CTimer::CTimer(std::function<void ()> cb)
+    : m_cb(cb),
+    m_pWheel(nullptr),
+    m_pPrev(nullptr),
+    m_pNext(nullptr),
+    m_ppHead(nullptr),
+    m_nExpire(0)
+{
+}
+
+CTimingWheel::CTimer::~CTimer()
+{
+    Stop();
+}
+
+void CTimingWheel::CTimer::Start(qint64 nMs)
+{
+    if(nMs <= 0)
+    {
+        Stop();
+        return;
+    }
+    CTimingWheel* pWheel = CTimingWheel::Instance();
+    if(m_pWheel == pWheel)
+        pWheel->Remove(this);
+    else
+    {
+        Stop();
+        m_pWheel = pWheel;
+        if(0 == pWheel->m_nTimers++)
+        {
+            // The wheel is stopped when it is empty, so skip the idle ticks
+            pWheel->m_nNow = pWheel->m_Clock.elapsed() / TICK;
+            pWheel->m_Timer.start();
+        }
+    }
+    m_nExpire = pWheel->m_nNow + (nMs + TICK - 1) / TICK;
+    pWheel->Add(this);
+}
+
+void CTimingWheel::CTimer::Stop()
+{
+    if(!m_pWheel)
+        return;
+    m_pWheel->Remove(this);
+    if(0 == --m_pWheel->m_nTimers)
+        m_pWheel->m_Timer.stop();
+    m_pWheel = nullptr;
+}
+
+bool CTimingWheel::CTimer::IsActive()
+{
+    return m_pWheel;
+}
+
+void CTimingWheel::Add(CTimer *t)
+{
+    quint64 nMax = (1ull << (SLOT_BITS * LEVELS)) - 1;
+    if(t->m_nExpire < m_nNow)
+        t->m_nExpire = m_nNow;
+    if(t->m_nExpire - m_nNow > nMax)
+        t->m_nExpire = m_nNow + nMax;
+    quint64 nDelta = t->m_nExpire - m_nNow;
+    int nLevel = 0;
+    while(nLevel < LEVELS - 1 && nDelta >= (1ull << (SLOT_BITS * (nLevel + 1))))
+        nLevel++;
+    int nIndex = (t->m_nExpire >> (SLOT_BITS * nLevel)) & (SLOTS - 1);
+
+    CTimer** ppHead = &m_Slots[nLevel][nIndex];
+    t->m_pPrev = nullptr;
+    t->m_pNext = *ppHead;
+    if(*ppHead)
+        (*ppHead)->m_pPrev = t;
+    *ppHead = t;
+    t->m_ppHead = ppHead;
+}
+
+void CTimingWheel::Remove(CTimer *t)
+{
+    if(t->m_pPrev)
+        t->m_pPrev->m_pNext = t->m_pNext;
+    else if(t->m_ppHead)
+        *t->m_ppHead = t->m_pNext;
+    if(t->m_pNext)
+        t->m_pNext->m_pPrev = t->m_pPrev;
+    t->m_pPrev = t->m_pNext = nullptr;
+    t->m_ppHead = nullptr;
+}
+
+int CTimingWheel::Cascade(int nLevel)
+{
+    int nIndex = (m_nNow >> (SLOT_BITS * nLevel)) & (SLOTS - 1);
+    CTimer* t = m_Slots[nLevel][nIndex];
+    m_Slots[nLevel][nIndex] = nullptr;
+    while(t)
+    {
+        CTimer* pNext = t->m_pNext;
+        Add(t);
+        t = pNext;
+    }
+    return nIndex;
+}
+
+void CTimingWheel::Expire(CTimer **ppHead)
+{
+    // Detach the list, so a timer restarted by its callback isn't called
+    // again in this tick even if it is put into the same slot
+    CTimer* pList = *ppHead;
+    *ppHead = nullptr;
+    for(CTimer* t = pList; t; t = t->m_pNext)
+        t->m_ppHead = &pList;
+    while(pList)
+    {
+        CTimer* t = pList;
+        // The callback may delete the timer
+        t->Stop();
+        m_nExpired++;
+        std::function<void()> cb = t->m_cb;
+        if(cb)
+            cb();
+    }
+}
+
+void CTimingWheel::slotTick()
+{
+    quint64 nTarget = m_Clock.elapsed() / TICK;
+    while(m_nNow <= nTarget && m_nTimers > 0)
+    {
+        int nIndex = m_nNow & (SLOTS - 1);
+        int i = nIndex;
+        for(int l = 1; 0 == i && l < LEVELS; l++)
+            i = Cascade(l);
+        m_nNow++;
+        Expire(&m_Slots[0][nIndex]);
+    }
+}
+
+CTimingWheel::strStatistics CTimingWheel::GetStatistics()
+{
+    strStatistics st;
+    st.nTimers = m_nTimers;
+    st.nExpired = m_nExpired;
+    return st;
+}
@@ -0,0 +1,97 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CTIMINGWHEEL_H
+#define CTIMINGWHEEL_H
+
+#pragma once
+
+#include <functional>
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+/*!
+ * \brief The hierarchical timing wheel of an event loop.
+ *        It drives many timeouts by one QTimer. Starting, restarting and
+ *        stopping a timer are O(1). The resolution is TICK milliseconds.
+ *        There are LEVELS wheels of SLOTS slots. The timers which are
+ *        far away are put into an upper wheel, and are moved down when
+ *        the lower wheel turns a round.
+ *
+ *        Example:
+ *        \code
+ *        CTimingWheel::CTimer timer([this]() { slotClose(); });
+ *        timer.Start(30000);
+ *        \endcode
+ * \note It isn't thread safe. A timer is used in the thread which starts it.
+ */
+class CTimingWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    //! The resolution (ms)
+    static const int TICK = 100;
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    virtual ~CTimingWheel();
+
+    //! The wheel of the current thread. It is created at the first call.
+    static CTimingWheel* Instance();
+
+    class CTimer
+    {
+    public:
+        //! \param cb: It is called in the event loop when the timer expires
+        explicit CTimer(std::function<void()> cb);
+        ~CTimer();
+        /*!
+         * \brief Start or restart the timer in the wheel of the current thread
+         * \param nMs: the timeout. If it is less than or equal to 0, stop the timer.
+         *        The maximum is about 19 days.
+         */
+        void Start(qint64 nMs);
+        void Stop();
+        bool IsActive();
+
+    private:
+        Q_DISABLE_COPY(CTimer)
+        friend class CTimingWheel;
+        std::function<void()> m_cb;
+        CTimingWheel* m_pWheel;
+        CTimer* m_pPrev;
+        CTimer* m_pNext;
+        CTimer** m_ppHead; // The slot which the timer is in
+        quint64 m_nExpire; // The tick
+    };
+
+    struct strStatistics {
+        //! The active timers
+        int nTimers = 0;
+        //! The total of the expired timers
+        quint64 nExpired = 0;
+    };
+    strStatistics GetStatistics();
+
+private Q_SLOTS:
+    void slotTick();
+
+private:
+    explicit CTimingWheel(QObject *parent = nullptr);
+    void Add(CTimer* t);
+    void Remove(CTimer* t);
+    //! Move the timers of the slot of the level to the lower levels
+    int Cascade(int nLevel);
+    void Expire(CTimer** ppHead);
+
+    CTimer* m_Slots[LEVELS][SLOTS];
+    quint64 m_nNow; // The next tick to process
+    QElapsedTimer m_Clock;
+    QTimer m_Timer;
+    int m_nTimers;
+    quint64 m_nExpired;
+};
+
+#endif // CTIMINGWHEEL_H
@@ -0,0 +1,940 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "UdpRelay.h"
+#include "SocksParser.h"
+#include "Resolver.h"
+
+#include <QSocketNotifier>
+#include <QtEndian>
+#include <QLoggingCategory>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+
+#if defined(Q_OS_LINUX)
+    #ifndef SOL_UDP
+        #define SOL_UDP 17
+    #endif
+    #ifndef UDP_SEGMENT
+        #define UDP_SEGMENT 103
+    #endif
+    #ifndef UDP_GRO
+        #define UDP_GRO 104
+    #endif
+#endif
+
+Q_LOGGING_CATEGORY(logUdp, "Udp")
+
+namespace {
+
+// The datagrams which are received in a call
+const int BATCH = 16;
+// The calls of receiving in a pass, so the other connections are served in turn
+const int PASSES = 4;
+// A datagram, or the datagrams which are coalesced by GRO
+const int SLOT_SIZE = 65536;
+// The most segments of a datagram of GRO or GSO in the kernel
+const int MAX_SEGMENTS = 64;
+const int MAX_PACKETS = BATCH * MAX_SEGMENTS;
+// The most bytes of a datagram of GSO
+const int MAX_GSO_SIZE = 65000;
+// A segment of GSO isn't fragmented on the ethernet
+const int MAX_GSO_SEGMENT = 1452;
+// The most destinations of an association
+const size_t MAX_ENDPOINTS = 4096;
+// The most datagrams which wait for the lookup of a domain name
+const int MAX_PENDING = 8;
+
+std::atomic<int> g_nAssociations(0);
+std::atomic<quint64> g_nPackets(0);
+std::atomic<quint64> g_nBytes(0);
+std::atomic<quint64> g_nDropped(0);
+std::atomic<quint64> g_nCalls(0);
+std::atomic<quint64> g_nGro(0);
+std::atomic<quint64> g_nGso(0);
+
+CUdpRelay::strEndpoint FromSockaddr(const sockaddr_storage& addr)
+{
+    CUdpRelay::strEndpoint e;
+    memset(e.ip, 0, sizeof(e.ip));
+    e.nPort = 0;
+    if(AF_INET == addr.ss_family)
+    {
+        const sockaddr_in* p = reinterpret_cast<const sockaddr_in*>(&addr);
+        e.ip[10] = e.ip[11] = 0xff;
+        memcpy(e.ip + 12, &p->sin_addr, 4);
+        e.nPort = qFromBigEndian(p->sin_port);
+    } else if(AF_INET6 == addr.ss_family) {
+        const sockaddr_in6* p = reinterpret_cast<const sockaddr_in6*>(&addr);
+        memcpy(e.ip, &p->sin6_addr, 16);
+        e.nPort = qFromBigEndian(p->sin6_port);
+    }
+    return e;
+}
+
+//! \return the length of the address. 0: the family hasn't the address
+socklen_t ToSockaddr(const CUdpRelay::strEndpoint& e, int nFamily,
+                     sockaddr_storage& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    if(AF_INET6 == nFamily)
+    {
+        sockaddr_in6* p = reinterpret_cast<sockaddr_in6*>(&addr);
+        p->sin6_family = AF_INET6;
+        memcpy(&p->sin6_addr, e.ip, 16);
+        p->sin6_port = qToBigEndian(e.nPort);
+        return sizeof(sockaddr_in6);
+    }
+    if(!e.IsIpv4())
+        return 0;
+    sockaddr_in* p = reinterpret_cast<sockaddr_in*>(&addr);
+    p->sin_family = AF_INET;
+    memcpy(&p->sin_addr, e.ip + 12, 4);
+    p->sin_port = qToBigEndian(e.nPort);
+    return sizeof(sockaddr_in);
+}
+
+int OpenSocket(int nFamily)
+{
+    int fd = ::socket(nFamily, SOCK_DGRAM, 0);
+    if(-1 == fd)
+        return -1;
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    // The bursts of the datagrams are kept in the kernel
+    int nBuffer = 1 << 20;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &nBuffer, sizeof(nBuffer));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &nBuffer, sizeof(nBuffer));
+#if defined(Q_OS_LINUX)
+    // It fails on the kernel before 5.0, the datagrams aren't coalesced
+    int on = 1;
+    ::setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+} // namespace
+
+struct CUdpRelay::strBatch {
+    // The received datagrams
+    char data[BATCH][SLOT_SIZE];
+    sockaddr_storage from[BATCH];
+    int nLen[BATCH]; // -1: it is truncated
+    int nSegment[BATCH]; // The size of the segments of GRO. 0: it isn't GRO
+
+    // The datagrams to send. A message of GSO has several segments.
+    struct strMessage {
+        sockaddr_storage to;
+        socklen_t nTo;
+        int nIov; // The first iovec of the message
+        int nIovCount;
+        int nSegment; // The size of a segment
+        int nSegments;
+        int nBytes;
+        bool bLast; // The last segment is shorter, no more segment
+    };
+    strMessage msg[MAX_PACKETS];
+    int nMsg = 0;
+    iovec iov[MAX_PACKETS * 2];
+    int nIov = 0;
+    char header[MAX_PACKETS][CUdpRelay::MAX_HEADER];
+    int nHeader = 0;
+
+    void Clear()
+    {
+        nMsg = 0;
+        nIov = 0;
+        nHeader = 0;
+    }
+};
+
+bool CUdpRelay::strEndpoint::operator==(const strEndpoint &e) const
+{
+    return nPort == e.nPort && 0 == memcmp(ip, e.ip, sizeof(ip));
+}
+
+bool CUdpRelay::strEndpoint::IsIpv4() const
+{
+    static const quint8 prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    return 0 == memcmp(ip, prefix, sizeof(prefix));
+}
+
+size_t CUdpRelay::strEndpointHash::operator()(const strEndpoint &e) const
+{
+    quint64 a = 0, b = 0;
+    memcpy(&a, e.ip, 8);
+    memcpy(&b, e.ip + 8, 8);
+    quint64 h = (a * 0x9E3779B97F4A7C15ULL) ^ b ^ ((quint64)e.nPort << 32);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return static_cast<size_t>(h);
+}
+
+CUdpRelay::CUdpRelay(QObject *parent) : QObject(parent),
+    m_Client(-1),
+    m_Remote(-1),
+    m_nClientFamily(AF_INET),
+    m_nRemoteFamily(AF_INET6),
+    m_bGso(false),
+    m_pClientNotifier(nullptr),
+    m_pRemoteNotifier(nullptr),
+    m_bClientPort(false),
+    m_nTimeout(0),
+    m_nNow(0),
+    m_Timer([this]() { OnExpire(); })
+{
+    memset(&m_ClientEndpoint, 0, sizeof(m_ClientEndpoint));
+    m_Clock.start();
+}
+
+CUdpRelay::~CUdpRelay()
+{
+    qDebug(logUdp) << "CUdpRelay::~CUdpRelay()";
+    Close();
+}
+
+int CUdpRelay::Open(const QHostAddress &local, const QHostAddress &client,
+                    quint16 nClientPort, int nTimeout)
+{
+    Close();
+
+    // The socket of the client is bound to the address which it connects to
+    strEndpoint e = ToEndpoint(local, 0);
+    m_nClientFamily = e.IsIpv4() ? AF_INET : AF_INET6;
+    sockaddr_storage addr;
+    socklen_t nAddr = ToSockaddr(e, m_nClientFamily, addr);
+    m_Client = OpenSocket(m_nClientFamily);
+    if(-1 == m_Client
+        || ::bind(m_Client, reinterpret_cast<sockaddr*>(&addr), nAddr))
+    {
+        qCritical(logUdp, "Bind the socket of the client fail: %s",
+                  strerror(errno));
+        Close();
+        return -1;
+    }
+
+    // The socket of the destinations is dual stack if it is supported
+    m_nRemoteFamily = AF_INET6;
+    m_Remote = OpenSocket(AF_INET6);
+    if(-1 != m_Remote)
+    {
+        int off = 0;
+        ::setsockopt(m_Remote, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        sockaddr_in6 any;
+        memset(&any, 0, sizeof(any));
+        any.sin6_family = AF_INET6;
+        any.sin6_addr = in6addr_any;
+        if(::bind(m_Remote, reinterpret_cast<sockaddr*>(&any), sizeof(any)))
+        {
+            ::close(m_Remote);
+            m_Remote = -1;
+        }
+    }
+    if(-1 == m_Remote)
+    {
+        m_nRemoteFamily = AF_INET;
+        m_Remote = OpenSocket(AF_INET);
+        sockaddr_in any;
+        memset(&any, 0, sizeof(any));
+        any.sin_family = AF_INET;
+        any.sin_addr.s_addr = htonl(INADDR_ANY);
+        if(-1 == m_Remote
+            || ::bind(m_Remote, reinterpret_cast<sockaddr*>(&any), sizeof(any)))
+        {
+            qCritical(logUdp, "Bind the socket of the destinations fail: %s",
+                      strerror(errno));
+            Close();
+            return -1;
+        }
+    }
+
+#if defined(Q_OS_LINUX)
+    // UDP_SEGMENT is supported from the kernel 4.18
+    int nSegment = 0;
+    socklen_t nLen = sizeof(nSegment);
+    m_bGso = 0 == ::getsockopt(m_Client, SOL_UDP, UDP_SEGMENT, &nSegment, &nLen)
+             && 0 == ::getsockopt(m_Remote, SOL_UDP, UDP_SEGMENT, &nSegment, &nLen);
+#endif
+
+    m_ClientEndpoint = ToEndpoint(client, nClientPort);
+    m_bClientPort = 0 != nClientPort;
+    m_nTimeout = nTimeout;
+
+    m_pClientNotifier = new QSocketNotifier(m_Client, QSocketNotifier::Read, this);
+    m_pRemoteNotifier = new QSocketNotifier(m_Remote, QSocketNotifier::Read, this);
+    // The signal is overloaded in Qt 5.15
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    bool check = connect(m_pClientNotifier, &QSocketNotifier::activated,
+                         this, &CUdpRelay::slotClientRead);
+    Q_ASSERT(check);
+    check = connect(m_pRemoteNotifier, &QSocketNotifier::activated,
+                    this, &CUdpRelay::slotRemoteRead);
+#else
+    bool check = connect(m_pClientNotifier, SIGNAL(activated(int)),
+                         this, SLOT(slotClientRead()));
+    Q_ASSERT(check);
+    check = connect(m_pRemoteNotifier, SIGNAL(activated(int)),
+                    this, SLOT(slotRemoteRead()));
+#endif
+    Q_ASSERT(check);
+
+    if(m_nTimeout > 0)
+        m_Timer.Start(qMax(1000, m_nTimeout / 2));
+    g_nAssociations++;
+    qDebug(logUdp) << "Open the association:" << LocalAddress() << LocalPort()
+                   << "client:" << client << nClientPort << "gso:" << m_bGso;
+    return 0;
+}
+
+void CUdpRelay::Close()
+{
+    m_Timer.Stop();
+    if(m_pClientNotifier)
+    {
+        // It may be in the slot of the notifier
+        m_pClientNotifier->setEnabled(false);
+        m_pClientNotifier->deleteLater();
+        m_pClientNotifier = nullptr;
+        m_pRemoteNotifier->setEnabled(false);
+        m_pRemoteNotifier->deleteLater();
+        m_pRemoteNotifier = nullptr;
+        g_nAssociations--;
+    }
+    if(-1 != m_Client)
+    {
+        ::close(m_Client);
+        m_Client = -1;
+    }
+    if(-1 != m_Remote)
+    {
+        ::close(m_Remote);
+        m_Remote = -1;
+    }
+    m_Nat.clear();
+    // The datagrams which wait for the lookups are dropped
+    for(auto it = m_Lookup.begin(); it != m_Lookup.end(); ++it)
+    {
+        CResolver::Instance()->Cancel(it->nTicket);
+        g_nDropped += it->pending.size();
+    }
+    m_Lookup.clear();
+}
+
+QHostAddress CUdpRelay::LocalAddress()
+{
+    sockaddr_storage addr;
+    socklen_t nLen = sizeof(addr);
+    if(-1 == m_Client
+        || ::getsockname(m_Client, reinterpret_cast<sockaddr*>(&addr), &nLen))
+        return QHostAddress();
+    return QHostAddress(reinterpret_cast<sockaddr*>(&addr));
+}
+
+quint16 CUdpRelay::LocalPort()
+{
+    sockaddr_storage addr;
+    socklen_t nLen = sizeof(addr);
+    if(-1 == m_Client
+        || ::getsockname(m_Client, reinterpret_cast<sockaddr*>(&addr), &nLen))
+        return 0;
+    return FromSockaddr(addr).nPort;
+}
+
+CUdpRelay::strEndpoint CUdpRelay::ToEndpoint(const QHostAddress &address,
+                                             quint16 nPort)
+{
+    strEndpoint e;
+    memset(e.ip, 0, sizeof(e.ip));
+    e.nPort = nPort;
+    bool ok = false;
+    quint32 v4 = address.toIPv4Address(&ok);
+    if(ok)
+    {
+        e.ip[10] = e.ip[11] = 0xff;
+        v4 = qToBigEndian(v4);
+        memcpy(e.ip + 12, &v4, 4);
+    } else {
+        Q_IPV6ADDR v6 = address.toIPv6Address();
+        memcpy(e.ip, v6.c, 16);
+    }
+    return e;
+}
+
+int CUdpRelay::ParseHeader(const char *pData, int nLen, strEndpoint &endpoint,
+                           const char *&pDomain, int &nDomain)
+{
+    pDomain = nullptr;
+    nDomain = 0;
+    if(nLen < 4)
+        return -1;
+    const quint8* p = reinterpret_cast<const quint8*>(pData);
+    // The fragment isn't supported, it is dropped. See RFC 1928 7
+    if(0 != p[2])
+        return -1;
+    int nHead = 0;
+    switch(p[3]) {
+    case CSocksParser::AddressTypeIpv4:
+        nHead = 4 + 4 + 2;
+        if(nLen < nHead)
+            return -1;
+        memset(endpoint.ip, 0, 10);
+        endpoint.ip[10] = endpoint.ip[11] = 0xff;
+        memcpy(endpoint.ip + 12, p + 4, 4);
+        break;
+    case CSocksParser::AddressTypeIpv6:
+        nHead = 4 + 16 + 2;
+        if(nLen < nHead)
+            return -1;
+        memcpy(endpoint.ip, p + 4, 16);
+        break;
+    case CSocksParser::AddressTypeDomain:
+        if(nLen < 5)
+            return -1;
+        nDomain = p[4];
+        nHead = 5 + nDomain + 2;
+        if(0 == nDomain || nLen < nHead)
+            return -1;
+        pDomain = pData + 5;
+        memset(endpoint.ip, 0, sizeof(endpoint.ip));
+        break;
+    default:
+        return -1;
+    }
+    endpoint.nPort = qFromBigEndian<quint16>(p + nHead - 2);
+    if(0 == endpoint.nPort)
+        return -1;
+    return nHead;
+}
+
+int CUdpRelay::BuildHeader(char *pBuffer, const strEndpoint &endpoint)
+{
+    int n = 4;
+    pBuffer[0] = pBuffer[1] = pBuffer[2] = 0;
+    if(endpoint.IsIpv4())
+    {
+        pBuffer[3] = CSocksParser::AddressTypeIpv4;
+        memcpy(pBuffer + n, endpoint.ip + 12, 4);
+        n += 4;
+    } else {
+        pBuffer[3] = CSocksParser::AddressTypeIpv6;
+        memcpy(pBuffer + n, endpoint.ip, 16);
+        n += 16;
+    }
+    qToBigEndian<quint16>(endpoint.nPort, pBuffer + n);
+    return n + 2;
+}
+
+CUdpRelay::strBatch& CUdpRelay::GetBatch()
+{
+    // It is about 1M bytes, and is created at the first association of a thread
+    thread_local std::unique_ptr<strBatch> batch;
+    if(!batch)
+        batch.reset(new strBatch());
+    return *batch;
+}
+
+int CUdpRelay::Receive(int fd, strBatch &batch)
+{
+#if defined(Q_OS_LINUX)
+    mmsghdr msgs[BATCH];
+    iovec iov[BATCH];
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    } control[BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for(int i = 0; i < BATCH; i++)
+    {
+        iov[i].iov_base = batch.data[i];
+        iov[i].iov_len = SLOT_SIZE;
+        msghdr& h = msgs[i].msg_hdr;
+        h.msg_name = &batch.from[i];
+        h.msg_namelen = sizeof(sockaddr_storage);
+        h.msg_iov = &iov[i];
+        h.msg_iovlen = 1;
+        h.msg_control = control[i].buf;
+        h.msg_controllen = sizeof(control[i].buf);
+    }
+    int n = ::recvmmsg(fd, msgs, BATCH, MSG_DONTWAIT, nullptr);
+    if(n <= 0)
+        return n;
+    g_nCalls++;
+    for(int i = 0; i < n; i++)
+    {
+        msghdr& h = msgs[i].msg_hdr;
+        batch.nLen[i] = (h.msg_flags & MSG_TRUNC) ? -1 : (int)msgs[i].msg_len;
+        batch.nSegment[i] = 0;
+        for(cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c))
+        {
+            if(SOL_UDP == c->cmsg_level && UDP_GRO == c->cmsg_type)
+                memcpy(&batch.nSegment[i], CMSG_DATA(c), sizeof(int));
+        }
+    }
+    return n;
+#else
+    int n = 0;
+    for(; n < BATCH; n++)
+    {
+        socklen_t nFrom = sizeof(sockaddr_storage);
+        ssize_t nLen = ::recvfrom(fd, batch.data[n], SLOT_SIZE, MSG_DONTWAIT,
+                                  reinterpret_cast<sockaddr*>(&batch.from[n]),
+                                  &nFrom);
+        if(nLen < 0)
+            break;
+        g_nCalls++;
+        batch.nLen[n] = (int)nLen;
+        batch.nSegment[n] = 0;
+    }
+    return n;
+#endif
+}
+
+bool CUdpRelay::AddMessage(strBatch &batch, const void *pTo, int nTo,
+                           const char *pHead, int nHead,
+                           const char *pData, int nData)
+{
+    if(batch.nMsg >= MAX_PACKETS)
+        return false;
+    int nSize = nHead + nData;
+    if(m_bGso && batch.nMsg > 0 && nSize > 0)
+    {
+        // The segments of GSO have the same size except the last,
+        // it may be shorter
+        strBatch::strMessage& m = batch.msg[batch.nMsg - 1];
+        if(!m.bLast && nSize <= m.nSegment && m.nSegment <= MAX_GSO_SEGMENT
+            && m.nSegments < MAX_SEGMENTS && m.nBytes + nSize <= MAX_GSO_SIZE
+            && m.nIov + m.nIovCount == batch.nIov
+            && (int)m.nTo == nTo && 0 == memcmp(&m.to, pTo, nTo))
+        {
+            if(nHead > 0)
+            {
+                batch.iov[batch.nIov].iov_base = const_cast<char*>(pHead);
+                batch.iov[batch.nIov++].iov_len = nHead;
+                m.nIovCount++;
+            }
+            batch.iov[batch.nIov].iov_base = const_cast<char*>(pData);
+            batch.iov[batch.nIov++].iov_len = nData;
+            m.nIovCount++;
+            m.nSegments++;
+            m.nBytes += nSize;
+            m.bLast = nSize < m.nSegment;
+            return true;
+        }
+    }
+
+    strBatch::strMessage& m = batch.msg[batch.nMsg++];
+    memcpy(&m.to, pTo, nTo);
+    m.nTo = nTo;
+    m.nIov = batch.nIov;
+    m.nIovCount = 0;
+    m.nSegment = nSize;
+    m.nSegments = 1;
+    m.nBytes = nSize;
+    m.bLast = 0 == nSize;
+    if(nHead > 0)
+    {
+        batch.iov[batch.nIov].iov_base = const_cast<char*>(pHead);
+        batch.iov[batch.nIov++].iov_len = nHead;
+        m.nIovCount++;
+    }
+    batch.iov[batch.nIov].iov_base = const_cast<char*>(pData);
+    batch.iov[batch.nIov++].iov_len = nData;
+    m.nIovCount++;
+    return true;
+}
+
+int CUdpRelay::Send(int fd, strBatch &batch)
+{
+    int nSent = 0;
+    int nDropped = 0;
+    int i = 0;
+#if defined(Q_OS_LINUX)
+    const int nChunk = 64;
+    mmsghdr msgs[nChunk];
+    union {
+        char buf[CMSG_SPACE(sizeof(quint16))];
+        cmsghdr align;
+    } control[nChunk];
+    while(i < batch.nMsg)
+    {
+        int n = qMin(nChunk, batch.nMsg - i);
+        memset(msgs, 0, sizeof(mmsghdr) * n);
+        for(int k = 0; k < n; k++)
+        {
+            strBatch::strMessage& m = batch.msg[i + k];
+            msghdr& h = msgs[k].msg_hdr;
+            h.msg_name = &m.to;
+            h.msg_namelen = m.nTo;
+            h.msg_iov = &batch.iov[m.nIov];
+            h.msg_iovlen = m.nIovCount;
+            if(m.nSegments > 1)
+            {
+                h.msg_control = control[k].buf;
+                h.msg_controllen = sizeof(control[k].buf);
+                cmsghdr* c = CMSG_FIRSTHDR(&h);
+                c->cmsg_level = SOL_UDP;
+                c->cmsg_type = UDP_SEGMENT;
+                c->cmsg_len = CMSG_LEN(sizeof(quint16));
+                quint16 nSegment = m.nSegment;
+                memcpy(CMSG_DATA(c), &nSegment, sizeof(nSegment));
+            }
+        }
+        int nRet = ::sendmmsg(fd, msgs, n, MSG_DONTWAIT);
+        g_nCalls++;
+        if(nRet < 0)
+        {
+            // The buffer of the socket is full, the datagrams are dropped
+            if(EAGAIN == errno || EWOULDBLOCK == errno)
+                break;
+            // The first message fails, the rest are sent by the next call
+            strBatch::strMessage& m = batch.msg[i];
+            if(m.nSegments > 1 && (EIO == errno || EINVAL == errno))
+            {
+                // The device doesn't support the checksum offload of GSO
+                qWarning(logUdp, "Send with GSO fail: %s. GSO is disabled",
+                         strerror(errno));
+                m_bGso = false;
+            }
+            nDropped += m.nSegments;
+            i++;
+            continue;
+        }
+        for(int k = 0; k < nRet; k++)
+        {
+            strBatch::strMessage& m = batch.msg[i + k];
+            nSent += m.nSegments;
+            if(m.nSegments > 1)
+                g_nGso += m.nSegments;
+        }
+        i += nRet;
+    }
+#else
+    for(; i < batch.nMsg; i++)
+    {
+        strBatch::strMessage& m = batch.msg[i];
+        msghdr h;
+        memset(&h, 0, sizeof(h));
+        h.msg_name = &m.to;
+        h.msg_namelen = m.nTo;
+        h.msg_iov = &batch.iov[m.nIov];
+        h.msg_iovlen = m.nIovCount;
+        g_nCalls++;
+        if(::sendmsg(fd, &h, MSG_DONTWAIT) < 0)
+        {
+            if(EAGAIN == errno || EWOULDBLOCK == errno)
+                break;
+            nDropped += m.nSegments;
+            continue;
+        }
+        nSent += m.nSegments;
+    }
+#endif
+    for(; i < batch.nMsg; i++)
+        nDropped += batch.msg[i].nSegments;
+    g_nPackets += nSent;
+    g_nDropped += nDropped;
+    batch.Clear();
+    return nSent;
+}
+
+void CUdpRelay::slotClientRead()
+{
+    strBatch& batch = GetBatch();
+    qint64 nBytes = 0;
+    for(int i = 0; i < PASSES && -1 != m_Client; i++)
+    {
+        int n = Receive(m_Client, batch);
+        if(n <= 0)
+            break;
+        nBytes += RelayFromClient(batch, n);
+        if(n < BATCH)
+            break;
+    }
+    if(nBytes > 0)
+        emit sigForward(nBytes);
+}
+
+void CUdpRelay::slotRemoteRead()
+{
+    strBatch& batch = GetBatch();
+    qint64 nBytes = 0;
+    for(int i = 0; i < PASSES && -1 != m_Remote; i++)
+    {
+        int n = Receive(m_Remote, batch);
+        if(n <= 0)
+            break;
+        nBytes += RelayFromRemote(batch, n);
+        if(n < BATCH)
+            break;
+    }
+    if(nBytes > 0)
+        emit sigForward(nBytes);
+}
+
+qint64 CUdpRelay::RelayFromClient(strBatch &batch, int nCount)
+{
+    m_nNow = m_Clock.elapsed();
+    batch.Clear();
+    qint64 nBytes = 0;
+    for(int i = 0; i < nCount; i++)
+    {
+        if(batch.nLen[i] < 0)
+        {
+            g_nDropped++;
+            continue;
+        }
+        // Only the client sends to the socket. See RFC 1928 7
+        strEndpoint from = FromSockaddr(batch.from[i]);
+        if(memcmp(from.ip, m_ClientEndpoint.ip, sizeof(from.ip))
+            || (m_bClientPort && from.nPort != m_ClientEndpoint.nPort))
+        {
+            g_nDropped++;
+            continue;
+        }
+        if(!m_bClientPort)
+        {
+            m_ClientEndpoint.nPort = from.nPort;
+            m_bClientPort = true;
+        }
+
+        // Every segment of GRO has the header
+        int nSegment = batch.nLen[i];
+        if(batch.nSegment[i] > 0 && batch.nSegment[i] < batch.nLen[i])
+            nSegment = batch.nSegment[i];
+        for(int nOffset = 0; nOffset < batch.nLen[i] || 0 == nOffset;
+             nOffset += qMax(nSegment, 1))
+        {
+            const char* p = batch.data[i] + nOffset;
+            int nLen = qMin(nSegment, batch.nLen[i] - nOffset);
+            if(nSegment < batch.nLen[i])
+                g_nGro++;
+            strEndpoint to;
+            const char* pDomain = nullptr;
+            int nDomain = 0;
+            int nHead = ParseHeader(p, nLen, to, pDomain, nDomain);
+            if(nHead < 0)
+            {
+                g_nDropped++;
+                continue;
+            }
+            if(pDomain
+                && !Resolve(pDomain, nDomain, to.nPort,
+                            p + nHead, nLen - nHead, to))
+                continue;
+            sockaddr_storage addr;
+            socklen_t nAddr = ToSockaddr(to, m_nRemoteFamily, addr);
+            if(0 == nAddr || !Touch(to)
+                || !AddMessage(batch, &addr, nAddr, nullptr, 0,
+                               p + nHead, nLen - nHead))
+            {
+                g_nDropped++;
+                continue;
+            }
+            nBytes += nLen - nHead;
+        }
+    }
+    Send(m_Remote, batch);
+    g_nBytes += nBytes;
+    return nBytes;
+}
+
+qint64 CUdpRelay::RelayFromRemote(strBatch &batch, int nCount)
+{
+    m_nNow = m_Clock.elapsed();
+    batch.Clear();
+    sockaddr_storage client;
+    socklen_t nClient = ToSockaddr(m_ClientEndpoint, m_nClientFamily, client);
+    qint64 nBytes = 0;
+    for(int i = 0; i < nCount; i++)
+    {
+        if(batch.nLen[i] < 0)
+        {
+            g_nDropped++;
+            continue;
+        }
+        int nSegment = batch.nLen[i];
+        if(batch.nSegment[i] > 0 && batch.nSegment[i] < batch.nLen[i])
+            nSegment = batch.nSegment[i];
+        int nSegments = nSegment > 0 ? (batch.nLen[i] + nSegment - 1) / nSegment : 1;
+        // Only the destinations which the client sends to reply
+        strEndpoint from = FromSockaddr(batch.from[i]);
+        auto it = m_Nat.find(from);
+        if(m_Nat.end() == it || !m_bClientPort || 0 == nClient)
+        {
+            g_nDropped += nSegments;
+            continue;
+        }
+        it->second = m_nNow;
+        if(nSegments > 1)
+            g_nGro += nSegments;
+
+        for(int nOffset = 0; nOffset < batch.nLen[i] || 0 == nOffset;
+             nOffset += qMax(nSegment, 1))
+        {
+            int nLen = qMin(nSegment, batch.nLen[i] - nOffset);
+            char* pHead = batch.header[batch.nHeader];
+            int nHead = BuildHeader(pHead, from);
+            if(!AddMessage(batch, &client, nClient, pHead, nHead,
+                           batch.data[i] + nOffset, nLen))
+            {
+                g_nDropped++;
+                continue;
+            }
+            batch.nHeader++;
+            nBytes += nLen;
+        }
+    }
+    Send(m_Client, batch);
+    g_nBytes += nBytes;
+    return nBytes;
+}
+
+bool CUdpRelay::Resolve(const char *pDomain, int nDomain, quint16 nPort,
+                        const char *pData, int nLen, strEndpoint &endpoint)
+{
+    // The key isn't copied, so it doesn't allocate when the name waits
+    auto it = m_Lookup.find(QByteArray::fromRawData(pDomain, nDomain));
+    if(m_Lookup.end() != it)
+    {
+        if(it->pending.size() < MAX_PENDING)
+            it->pending.push_back({nPort, QByteArray(pData, nLen)});
+        else
+            g_nDropped++;
+        return false;
+    }
+    if(m_Lookup.size() >= (int)MAX_ENDPOINTS)
+    {
+        g_nDropped++;
+        return false;
+    }
+
+    QByteArray name(pDomain, nDomain);
+    QList<QHostAddress> addresses;
+    quint64 nTicket = 0;
+    if(CResolver::Instance()->Lookup(
+            QString::fromUtf8(name), addresses,
+            [this, name](const QList<QHostAddress>& addresses) {
+                OnLookup(name, addresses);
+            }, nTicket))
+    {
+        if(SelectAddress(addresses, endpoint))
+        {
+            endpoint.nPort = nPort;
+            return true;
+        }
+        g_nDropped++;
+        return false;
+    }
+    strLookup& l = m_Lookup[name];
+    l.nTicket = nTicket;
+    l.pending.push_back({nPort, QByteArray(pData, nLen)});
+    qDebug(logUdp) << "Look up:" << name;
+    return false;
+}
+
+bool CUdpRelay::SelectAddress(const QList<QHostAddress> &addresses,
+                              strEndpoint &endpoint)
+{
+    for(const QHostAddress& address : addresses)
+    {
+        strEndpoint e = ToEndpoint(address, 0);
+        // The socket of IPv4 can't send to IPv6
+        if(AF_INET == m_nRemoteFamily && !e.IsIpv4())
+            continue;
+        endpoint = e;
+        return true;
+    }
+    return false;
+}
+
+void CUdpRelay::OnLookup(const QByteArray &name,
+                         const QList<QHostAddress> &addresses)
+{
+    auto it = m_Lookup.find(name);
+    if(m_Lookup.end() == it)
+        return;
+    QVector<strPending> pending;
+    pending.swap(it->pending);
+    m_Lookup.erase(it);
+    if(-1 == m_Remote)
+        return;
+
+    strEndpoint address;
+    if(!SelectAddress(addresses, address))
+    {
+        // The failure is kept in the negative cache of the resolver
+        qWarning(logUdp) << "Look up fail:" << name;
+        g_nDropped += pending.size();
+        return;
+    }
+
+    m_nNow = m_Clock.elapsed();
+    qint64 nBytes = 0;
+    for(const strPending& p : pending)
+    {
+        strEndpoint to = address;
+        to.nPort = p.nPort;
+        sockaddr_storage addr;
+        socklen_t nAddr = ToSockaddr(to, m_nRemoteFamily, addr);
+        g_nCalls++;
+        if(!Touch(to)
+            || ::sendto(m_Remote, p.data.constData(), p.data.size(), MSG_DONTWAIT,
+                        reinterpret_cast<sockaddr*>(&addr), nAddr) < 0)
+        {
+            g_nDropped++;
+            continue;
+        }
+        g_nPackets++;
+        nBytes += p.data.size();
+    }
+    g_nBytes += nBytes;
+    if(nBytes > 0)
+        emit sigForward(nBytes);
+}
+
+bool CUdpRelay::Touch(const strEndpoint &endpoint)
+{
+    auto it = m_Nat.find(endpoint);
+    if(m_Nat.end() != it)
+    {
+        it->second = m_nNow;
+        return true;
+    }
+    if(m_Nat.size() >= MAX_ENDPOINTS)
+        return false;
+    m_Nat.emplace(endpoint, m_nNow);
+    return true;
+}
+
+void CUdpRelay::OnExpire()
+{
+    qint64 nNow = m_Clock.elapsed();
+    for(auto it = m_Nat.begin(); it != m_Nat.end();)
+    {
+        if(nNow - it->second >= m_nTimeout)
+            it = m_Nat.erase(it);
+        else
+            ++it;
+    }
+    m_Timer.Start(qMax(1000, m_nTimeout / 2));
+}
+
+CUdpRelay::strStatistics CUdpRelay::GetStatistics()
+{
+    strStatistics st;
+    st.nAssociations = g_nAssociations;
+    st.nPackets = g_nPackets;
+    st.nBytes = g_nBytes;
+    st.nDropped = g_nDropped;
+    st.nCalls = g_nCalls;
+    st.nGro = g_nGro;
+    st.nGso = g_nGso;
+    return st;
+}
@@ -0,0 +1,196 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CUDPRELAY_H
+#define CUDPRELAY_H
+
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QByteArray>
+#include <QHostAddress>
+#include <QList>
+#include <QElapsedTimer>
+#include <unordered_map>
+#include "rabbitproxy_export.h"
+#include "TimingWheel.h"
+
+class QSocketNotifier;
+
+/*!
+ * \brief The UDP relay of a socks5 UDP ASSOCIATE (RFC 1928 7).
+ *        It has two native UDP sockets. The client socket is bound to the
+ *        address which the client connects to, and only receives the
+ *        datagrams of the client. The remote socket sends the datagrams to
+ *        the destinations, and receives their replies.
+ *
+ *        The datagrams are received and sent in batches with recvmmsg() and
+ *        sendmmsg() on linux. The datagrams of a flow are received with UDP
+ *        GRO, and the datagrams to the same endpoint in a batch are sent
+ *        with UDP GSO when the kernel supports them.
+ *        The headers are parsed and built in the buffers of the thread, so
+ *        relaying a datagram doesn't allocate memory.
+ *
+ *        The NAT table has the destinations which the client sends to. The
+ *        datagrams from other hosts are dropped. An entry expires when it
+ *        isn't used in the timeout.
+ *        The domain names are looked up by the resolver of the thread, so
+ *        they share the cache with the TCP connections. \see CResolver
+ *
+ * \note It is used in the thread which creates it.
+ * \see CProxySocks5
+ */
+class RABBITPROXY_EXPORT CUdpRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CUdpRelay(QObject* parent = nullptr);
+    virtual ~CUdpRelay();
+
+    /*!
+     * \brief Open the sockets of the association
+     * \param local: the address of the server which the client connects to
+     * \param client: the address of the client
+     * \param nClientPort: the port which the client sends from.
+     *        0: it is the port of the first datagram from the client
+     * \param nTimeout: the time (ms) which an entry of the NAT table is kept
+     * \return 0: success
+     */
+    int Open(const QHostAddress& local, const QHostAddress& client,
+             quint16 nClientPort, int nTimeout);
+    void Close();
+    //! The address and port which the client sends the datagrams to
+    QHostAddress LocalAddress();
+    quint16 LocalPort();
+
+    //! The endpoint of a datagram. The IPv4 address is mapped to IPv6.
+    struct strEndpoint {
+        quint8 ip[16];
+        quint16 nPort; // The host byte order
+        bool operator==(const strEndpoint& e) const;
+        bool IsIpv4() const;
+    };
+    static strEndpoint ToEndpoint(const QHostAddress& address, quint16 nPort);
+
+    //! The longest header, it has the IPv6 address
+    static const int MAX_HEADER = 22;
+    /*!
+     * \brief Parse the header of the datagram from the client.
+     *        +----+------+------+----------+----------+----------+
+     *        |RSV | FRAG | ATYP | DST.ADDR | DST.PORT |   DATA   |
+     *        +----+------+------+----------+----------+----------+
+     *        | 2  |  1   |  1   | Variable |    2     | Variable |
+     *        +----+------+------+----------+----------+----------+
+     * \param pDomain: the domain name, it isn't null-terminated.
+     *        nullptr if the address is IPv4 or IPv6.
+     * \return the length of the header.
+     *         -1: the header is error, or it is a fragment
+     */
+    static int ParseHeader(const char* pData, int nLen, strEndpoint& endpoint,
+                           const char*& pDomain, int& nDomain);
+    /*!
+     * \brief Build the header of the datagram to the client
+     * \param pBuffer: it has MAX_HEADER bytes at least
+     * \return the length of the header
+     */
+    static int BuildHeader(char* pBuffer, const strEndpoint& endpoint);
+
+    struct strStatistics {
+        //! The active associations
+        int nAssociations = 0;
+        //! The relayed datagrams
+        quint64 nPackets = 0;
+        quint64 nBytes = 0;
+        //! The datagrams which are dropped
+        quint64 nDropped = 0;
+        //! The calls of receiving and sending
+        quint64 nCalls = 0;
+        //! The datagrams which are coalesced by GRO, or are sent by GSO
+        quint64 nGro = 0;
+        quint64 nGso = 0;
+    };
+    //! The statistics of all associations
+    static strStatistics GetStatistics();
+
+Q_SIGNALS:
+    //! The bytes of the datagrams which are relayed in a pass
+    void sigForward(qint64 nBytes);
+
+private Q_SLOTS:
+    void slotClientRead();
+    void slotRemoteRead();
+
+private:
+    struct strEndpointHash {
+        size_t operator()(const strEndpoint& e) const;
+    };
+    struct strPending {
+        quint16 nPort;
+        QByteArray data;
+    };
+    //! The lookup of a domain name
+    struct strLookup {
+        quint64 nTicket = 0; // \see CResolver::Lookup()
+        //! The datagrams which wait for the lookup
+        QVector<strPending> pending;
+    };
+
+    //! The datagrams of a pass. It is shared by the relays of a thread.
+    struct strBatch;
+    static strBatch& GetBatch();
+    /*!
+     * \brief Receive a batch of datagrams
+     * \return the number of the datagrams. <= 0: no datagram
+     */
+    static int Receive(int fd, strBatch& batch);
+    /*!
+     * \brief Add the datagram which is sent to the endpoint.
+     *        It is a segment of the previous one if they can be sent by GSO.
+     * \return false: the batch is full
+     */
+    bool AddMessage(strBatch& batch, const void* pTo, int nTo,
+                    const char* pHead, int nHead,
+                    const char* pData, int nData);
+    //! Send the batch. \return the number of the datagrams which are sent
+    int Send(int fd, strBatch& batch);
+    //! Relay the datagrams of a pass from the client to the destinations
+    qint64 RelayFromClient(strBatch& batch, int nCount);
+    //! Relay the datagrams of a pass from the destinations to the client
+    qint64 RelayFromRemote(strBatch& batch, int nCount);
+    /*!
+     * \brief Resolve the destination
+     * \return false: it waits for the lookup, or the datagram is dropped
+     */
+    bool Resolve(const char* pDomain, int nDomain, quint16 nPort,
+                 const char* pData, int nLen, strEndpoint& endpoint);
+    //! The lookup is complete. Send the datagrams which wait for it.
+    void OnLookup(const QByteArray& name, const QList<QHostAddress>& addresses);
+    //! Select the address which the remote socket can send to
+    bool SelectAddress(const QList<QHostAddress>& addresses,
+                       strEndpoint& endpoint);
+    //! Add the destination into the NAT table. \return false: it is full
+    bool Touch(const strEndpoint& endpoint);
+    void OnExpire();
+
+    int m_Client; // The socket of the client
+    int m_Remote; // The socket of the destinations
+    int m_nClientFamily;
+    int m_nRemoteFamily;
+    bool m_bGso;
+    QSocketNotifier* m_pClientNotifier;
+    QSocketNotifier* m_pRemoteNotifier;
+
+    strEndpoint m_ClientEndpoint;
+    bool m_bClientPort; // The port of the client is known
+
+    int m_nTimeout;
+    QElapsedTimer m_Clock;
+    qint64 m_nNow; // The time of the pass
+    std::unordered_map<strEndpoint, qint64, strEndpointHash> m_Nat;
+    QHash<QByteArray, strLookup> m_Lookup;
+    CTimingWheel::CTimer m_Timer;
+};
+
+#endif // CUDPRELAY_H
@@ -0,0 +1,189 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include "UpstreamPool.h"
+
+#include <atomic>
+#include <QThreadStorage>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(logUpstreamPool, "UpstreamPool")
+
+namespace {
+
+std::atomic<int> g_nMaxPerHost(8);
+std::atomic<int> g_nMax(256);
+std::atomic<int> g_nIdleTimeout(60000);
+std::atomic<quint64> g_nHit(0);
+std::atomic<quint64> g_nMiss(0);
+std::atomic<quint64> g_nExpired(0);
+std::atomic<quint64> g_nClosed(0);
+std::atomic<quint64> g_nDropped(0);
+std::atomic<int> g_nIdle(0);
+
+QThreadStorage<CUpstreamPool*> g_Pool;
+
+} // namespace
+
+CUpstreamPool::CUpstreamPool() : QObject(),
+    m_nIdle(0),
+    m_Timer([this]() { OnExpire(); })
+{
+    m_Clock.start();
+}
+
+CUpstreamPool::~CUpstreamPool()
+{
+    qDebug(logUpstreamPool) << "CUpstreamPool::~CUpstreamPool(); idle:" << m_nIdle;
+    for(QVector<strIdle>& idle : m_Idle)
+    {
+        for(strIdle& i : idle)
+            Close(i.peer);
+    }
+    g_nIdle -= m_nIdle;
+}
+
+CUpstreamPool* CUpstreamPool::Instance()
+{
+    // It is deleted when the thread exits
+    if(!g_Pool.hasLocalData())
+        g_Pool.setLocalData(new CUpstreamPool());
+    return g_Pool.localData();
+}
+
+QSharedPointer<CPeerConnector> CUpstreamPool::Get(const QString &szKey)
+{
+    auto it = m_Idle.find(szKey);
+    if(m_Idle.end() == it || it->isEmpty())
+    {
+        g_nMiss++;
+        return QSharedPointer<CPeerConnector>();
+    }
+    g_nHit++;
+    g_nIdle--;
+    m_nIdle--;
+    QSharedPointer<CPeerConnector> peer = it->back().peer;
+    it->pop_back();
+    if(it->isEmpty())
+        m_Idle.erase(it);
+    peer->disconnect(this);
+    return peer;
+}
+
+bool CUpstreamPool::Put(const QString &szKey,
+                        const QSharedPointer<CPeerConnector> &peer)
+{
+    if(!peer) return false;
+    QVector<strIdle>& idle = m_Idle[szKey];
+    if(m_nIdle >= g_nMax || idle.size() >= g_nMaxPerHost)
+    {
+        if(idle.isEmpty())
+            m_Idle.remove(szKey);
+        g_nDropped++;
+        Close(peer);
+        return false;
+    }
+
+    CPeerConnector* p = peer.data();
+    // The session which creates it may be deleted before it is reused
+    p->setParent(nullptr);
+    bool check = connect(p, &CPeerConnector::sigDisconnected, this,
+                         [this, szKey, p]() { OnClosed(szKey, p); });
+    Q_ASSERT(check);
+    check = connect(p, &CPeerConnector::sigError, this,
+                    [this, szKey, p]() { OnClosed(szKey, p); });
+    Q_ASSERT(check);
+    // The server doesn't send data to an idle connection
+    check = connect(p, &CPeerConnector::sigReadyRead, this,
+                    [this, szKey, p]() { OnClosed(szKey, p); });
+    Q_ASSERT(check);
+
+    strIdle i;
+    i.peer = peer;
+    i.nTime = m_Clock.elapsed();
+    idle.push_back(i);
+    m_nIdle++;
+    g_nIdle++;
+    if(g_nIdleTimeout > 0 && !m_Timer.IsActive())
+        m_Timer.Start(g_nIdleTimeout);
+    return true;
+}
+
+void CUpstreamPool::OnClosed(const QString &szKey, CPeerConnector *pPeer)
+{
+    auto it = m_Idle.find(szKey);
+    if(m_Idle.end() == it)
+        return;
+    for(int i = 0; i < it->size(); i++)
+    {
+        if(it->at(i).peer.data() != pPeer)
+            continue;
+        qDebug(logUpstreamPool) << "The idle connection is closed:" << szKey;
+        QSharedPointer<CPeerConnector> peer = it->at(i).peer;
+        it->remove(i);
+        if(it->isEmpty())
+            m_Idle.erase(it);
+        m_nIdle--;
+        g_nIdle--;
+        g_nClosed++;
+        Close(peer);
+        return;
+    }
+}
+
+void CUpstreamPool::OnExpire()
+{
+    int nTimeout = g_nIdleTimeout;
+    if(nTimeout <= 0)
+        return;
+    qint64 nNow = m_Clock.elapsed();
+    qint64 nOldest = nNow;
+    for(auto it = m_Idle.begin(); it != m_Idle.end();)
+    {
+        int n = 0;
+        while(n < it->size() && nNow - it->at(n).nTime >= nTimeout)
+            Close(it->at(n++).peer);
+        if(n > 0)
+        {
+            it->remove(0, n);
+            m_nIdle -= n;
+            g_nIdle -= n;
+            g_nExpired += n;
+        }
+        if(it->isEmpty())
+        {
+            it = m_Idle.erase(it);
+            continue;
+        }
+        nOldest = qMin(nOldest, it->front().nTime);
+        ++it;
+    }
+    // The next expiry is the oldest connection
+    if(m_nIdle > 0)
+        m_Timer.Start(nTimeout - (nNow - nOldest));
+}
+
+void CUpstreamPool::Close(const QSharedPointer<CPeerConnector> &peer)
+{
+    // The connector is given back by the deleter of the shared pointer
+    peer->disconnect();
+    peer->Close();
+}
+
+void CUpstreamPool::SetLimits(int nMaxPerHost, int nMax, int nIdleTimeout)
+{
+    g_nMaxPerHost = qMax(0, nMaxPerHost);
+    g_nMax = qMax(0, nMax);
+    g_nIdleTimeout = qMax(0, nIdleTimeout);
+}
+
+CUpstreamPool::strStatistics CUpstreamPool::GetStatistics()
+{
+    strStatistics st;
+    st.nHit = g_nHit;
+    st.nMiss = g_nMiss;
+    st.nExpired = g_nExpired;
+    st.nClosed = g_nClosed;
+    st.nDropped = g_nDropped;
+    st.nIdle = g_nIdle;
+    return st;
+}
@@ -0,0 +1,109 @@
+//! @author Kang Lin <kl222@126.com>
+
+#ifndef CUPSTREAMPOOL_H
+#define CUPSTREAMPOOL_H
+
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QSharedPointer>
+#include <QElapsedTimer>
+#include "PeerConnector.h"
+#include "TimingWheel.h"
+
+/*!
+ * \brief The pool of the idle upstream connections of a thread.
+ *        The HTTP forward proxy puts the connection into it when a response
+ *        is complete and the server keeps the connection alive. The next
+ *        request to the same host:port in the thread reuses it, so it skips
+ *        looking up, connecting and the ICE setup.
+ *        The connectors may be CPeerConnector or the ICE connectors.
+ *        A connection is closed when it is idle longer than the idle
+ *        timeout, or the server closes it or sends data when it is idle.
+ *
+ *        Example:
+ *        \code
+ *        QSharedPointer<CPeerConnector> peer
+ *                = CUpstreamPool::Instance()->Get("example.com:80");
+ *        if(!peer)
+ *            // Create and connect a peer
+ *        // ... When the response is complete
+ *        CUpstreamPool::Instance()->Put("example.com:80", peer);
+ *        \endcode
+ * \note It isn't thread safe. Use the pool of the current thread.
+ * \see CProxyHttp
+ */
+class RABBITPROXY_EXPORT CUpstreamPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    virtual ~CUpstreamPool();
+
+    //! The pool of the current thread. It is created at the first call.
+    static CUpstreamPool* Instance();
+
+    /*!
+     * \brief Get an idle connection of the key. The latest is got first.
+     * \param szKey: host:port
+     * \return nullptr if the pool hasn't it
+     */
+    QSharedPointer<CPeerConnector> Get(const QString& szKey);
+    /*!
+     * \brief Put the idle connection into the pool.
+     *        The signals of the peer must be disconnected from the session.
+     * \return true: the pool owns it
+     *         false: the pool is full or off, the connection is closed
+     */
+    bool Put(const QString& szKey, const QSharedPointer<CPeerConnector>& peer);
+
+    /*!
+     * \brief Set the limits of the pools of all threads
+     * \param nMaxPerHost: the most idle connections of a key in a pool
+     * \param nMax: the most idle connections in a pool. 0: off
+     * \param nIdleTimeout: the time (ms) which a connection is kept idle.
+     *        0: no limit
+     */
+    static void SetLimits(int nMaxPerHost, int nMax, int nIdleTimeout);
+
+    //! The reuse ratio is nHit / (nHit + nMiss)
+    struct strStatistics {
+        //! The requests which reuse an idle connection
+        quint64 nHit = 0;
+        //! The requests which connect because the pool hasn't a connection
+        quint64 nMiss = 0;
+        //! The connections which are closed by the idle timeout
+        quint64 nExpired = 0;
+        //! The idle connections which are closed by the server
+        quint64 nClosed = 0;
+        //! The connections which aren't kept because the pool is full
+        quint64 nDropped = 0;
+        //! The idle connections in the pools of all threads
+        int nIdle = 0;
+    };
+    static strStatistics GetStatistics();
+
+private:
+    CUpstreamPool();
+    Q_DISABLE_COPY(CUpstreamPool)
+
+    //! The server closes the idle connection
+    void OnClosed(const QString& szKey, CPeerConnector* pPeer);
+    //! Close the connections which are idle longer than the idle timeout
+    void OnExpire();
+    static void Close(const QSharedPointer<CPeerConnector>& peer);
+
+    struct strIdle {
+        QSharedPointer<CPeerConnector> peer;
+        qint64 nTime = 0; // The time when it is put
+    };
+    //! The oldest is at the front
+    QHash<QString, QVector<strIdle> > m_Idle;
+    int m_nIdle;
+    QElapsedTimer m_Clock;
+    CTimingWheel::CTimer m_Timer;
+};
+
+#endif // CUPSTREAMPOOL_H
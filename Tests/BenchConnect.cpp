@@ -0,0 +1,132 @@
+//! @author Kang Lin <kl222@126.com>
+
+/*!
+ * \brief The cost of the connections of the signals of a session.
+ *        The signals of a client socket are connected to a session like
+ *        CProxy does, by the string-based SIGNAL()/SLOT() (before) and by
+ *        the pointer-to-member connects (after). The time of creating and
+ *        deleting the socket without the connections is subtracted.
+ *
+ *        Usage: BenchConnect [sessions]
+ */
+
+#include <QCoreApplication>
+#include <QTcpSocket>
+#include <QElapsedTimer>
+#include <cstdio>
+#include <cstdlib>
+
+// The default sessions of a pass
+#define DEFAULT_SESSIONS 100000
+
+class CSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class emConnect {
+        None,
+        String,
+        Typed
+    };
+
+    CSession(QTcpSocket* pSocket, emConnect c) : QObject()
+    {
+        bool check = true;
+        switch(c) {
+        case emConnect::None:
+            break;
+        case emConnect::String:
+            check = connect(pSocket, SIGNAL(readyRead()),
+                            this, SLOT(slotRead()));
+            Q_ASSERT(check);
+            check = connect(pSocket, SIGNAL(disconnected()),
+                            this, SLOT(slotDisconnected()));
+            Q_ASSERT(check);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+            check = connect(pSocket,
+                            SIGNAL(errorOccurred(QAbstractSocket::SocketError)),
+                            this, SLOT(slotError(QAbstractSocket::SocketError)));
+#else
+            check = connect(pSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+                            this, SLOT(slotError(QAbstractSocket::SocketError)));
+#endif
+            Q_ASSERT(check);
+            check = connect(pSocket, SIGNAL(bytesWritten(qint64)),
+                            this, SLOT(slotBytesWritten(qint64)));
+            break;
+        case emConnect::Typed:
+            check = connect(pSocket, &QTcpSocket::readyRead,
+                            this, &CSession::slotRead);
+            Q_ASSERT(check);
+            check = connect(pSocket, &QTcpSocket::disconnected,
+                            this, &CSession::slotDisconnected);
+            Q_ASSERT(check);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+            check = connect(pSocket, &QTcpSocket::errorOccurred,
+                            this, &CSession::slotError);
+#else
+            check = connect(pSocket,
+                            QOverload<QAbstractSocket::SocketError>::of(
+                                &QTcpSocket::error),
+                            this, &CSession::slotError);
+#endif
+            Q_ASSERT(check);
+            check = connect(pSocket, &QTcpSocket::bytesWritten,
+                            this, &CSession::slotBytesWritten);
+            break;
+        }
+        Q_ASSERT(check);
+        Q_UNUSED(check)
+    }
+
+public Q_SLOTS:
+    void slotRead() {}
+    void slotDisconnected() {}
+    void slotError(QAbstractSocket::SocketError e) { Q_UNUSED(e) }
+    void slotBytesWritten(qint64 n) { Q_UNUSED(n) }
+};
+
+//! \return the nanoseconds of the pass
+static qint64 Pass(CSession::emConnect c, int nSessions)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0; i < nSessions; i++)
+    {
+        QTcpSocket* pSocket = new QTcpSocket();
+        CSession* pSession = new CSession(pSocket, c);
+        delete pSession;
+        delete pSocket;
+    }
+    return timer.nsecsElapsed();
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    int nSessions = argc > 1 ? atoi(argv[1]) : DEFAULT_SESSIONS;
+    if(nSessions <= 0)
+    {
+        fprintf(stderr, "Usage: %s [sessions]\n", argv[0]);
+        return -1;
+    }
+
+    // Warm up, so the meta objects and the allocator are ready
+    Pass(CSession::emConnect::String, nSessions / 10 + 1);
+    Pass(CSession::emConnect::Typed, nSessions / 10 + 1);
+
+    qint64 nNone = Pass(CSession::emConnect::None, nSessions);
+    qint64 nString = Pass(CSession::emConnect::String, nSessions);
+    qint64 nTyped = Pass(CSession::emConnect::Typed, nSessions);
+    printf("Sessions: %d; 4 connections per session\n", nSessions);
+    printf("Socket and session:  %.1f ns/session\n",
+           (double)nNone / nSessions);
+    printf("SIGNAL()/SLOT():     %.1f ns/session; %.0f sessions/s\n",
+           (double)(nString - nNone) / nSessions, nSessions * 1e9 / nString);
+    printf("Pointer-to-member:   %.1f ns/session; %.0f sessions/s\n",
+           (double)(nTyped - nNone) / nSessions, nSessions * 1e9 / nTyped);
+    return 0;
+}
+
+#include "BenchConnect.moc"
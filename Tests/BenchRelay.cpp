@@ -0,0 +1,211 @@
+//! @author Kang Lin <kl222@126.com>
+
+/*!
+ * \brief The throughput of the relays on the loopback.
+ *        A thread writes to the client connection, the relay forwards it to
+ *        the peer connection, and another thread reads from the peer.
+ *        The Qt relay is readAll() and write() of QTcpSocket in the event
+ *        loop, it is the base line of the native relays (epoll, io_uring,
+ *        splice). The CPU time of the process is the cost of the relay.
+ *
+ *        Usage: BenchRelay [Qt|Epoll|IoUring|Splice|Sockmap ...] [-m MiB]
+ */
+
+#include <QCoreApplication>
+#include <QTcpSocket>
+#include <QMetaEnum>
+#include <QElapsedTimer>
+#include <QStringList>
+#include "Relay.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// The default MiB which is forwarded
+#define DEFAULT_MIB 1024
+// The size of a write and a read of the threads
+#define CHUNK_SIZE 65536
+
+//! A connected TCP pair on the loopback. \return 0: success
+static int Connect(int& a, int& b)
+{
+    a = b = -1;
+    int l = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(-1 == l)
+        return -1;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t nLen = sizeof(addr);
+    if(::bind(l, (sockaddr*)&addr, sizeof(addr)) || ::listen(l, 1)
+        || ::getsockname(l, (sockaddr*)&addr, &nLen))
+    {
+        ::close(l);
+        return -1;
+    }
+    a = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(-1 != a && 0 == ::connect(a, (sockaddr*)&addr, sizeof(addr)))
+        b = ::accept(l, nullptr, nullptr);
+    ::close(l);
+    if(-1 == b)
+    {
+        if(-1 != a)
+            ::close(a);
+        return -1;
+    }
+    int on = 1;
+    ::setsockopt(a, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    ::setsockopt(b, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return 0;
+}
+
+static double CpuTime()
+{
+    rusage u;
+    ::getrusage(RUSAGE_SELF, &u);
+    return u.ru_utime.tv_sec + u.ru_stime.tv_sec
+           + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1e6;
+}
+
+//! Forward nBytes through the relay. \return 0: success
+static int Bench(CParameter::emRelay relay, qint64 nBytes)
+{
+    QSharedPointer<CRelay> r;
+    if(CParameter::emRelay::Qt != relay)
+    {
+        r = CRelay::Create(relay);
+        if(!r || r->Start())
+            return -1;
+    }
+
+    // writer -> client -> relay -> peer -> reader
+    int writer, client, peer, reader;
+    if(Connect(writer, client))
+        return -1;
+    if(Connect(peer, reader))
+    {
+        ::close(writer);
+        ::close(client);
+        return -1;
+    }
+
+    std::atomic<qint64> nRead(0);
+    std::thread write([writer, nBytes]() {
+        std::vector<char> buf(CHUNK_SIZE, 'a');
+        qint64 nSent = 0;
+        while(nSent < nBytes)
+        {
+            ssize_t n = ::send(writer, buf.data(),
+                               qMin<qint64>(CHUNK_SIZE, nBytes - nSent),
+                               MSG_NOSIGNAL);
+            if(n <= 0)
+                break;
+            nSent += n;
+        }
+    });
+    std::thread read([reader, nBytes, &nRead]() {
+        std::vector<char> buf(CHUNK_SIZE);
+        while(nRead < nBytes)
+        {
+            ssize_t n = ::recv(reader, buf.data(), buf.size(), 0);
+            if(n <= 0)
+                break;
+            nRead += n;
+        }
+        QMetaObject::invokeMethod(QCoreApplication::instance(), "quit",
+                                  Qt::QueuedConnection);
+    });
+
+    double dbCpu = CpuTime();
+    QElapsedTimer timer;
+    timer.start();
+    QTcpSocket* pClient = nullptr;
+    QTcpSocket* pPeer = nullptr;
+    if(r)
+    {
+        // The descriptors are duplicated by the relay
+        r->Add(client, peer, QByteArray(), QByteArray(), nullptr);
+        ::close(client);
+        ::close(peer);
+    } else {
+        pClient = new QTcpSocket();
+        pPeer = new QTcpSocket();
+        pClient->setSocketDescriptor(client);
+        pPeer->setSocketDescriptor(peer);
+        bool check = QObject::connect(pClient, &QTcpSocket::readyRead,
+                                      [pClient, pPeer]() {
+            pPeer->write(pClient->readAll());
+        });
+        Q_ASSERT(check);
+        Q_UNUSED(check)
+    }
+    QCoreApplication::exec();
+    write.join();
+    read.join();
+    qint64 nElapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+    dbCpu = CpuTime() - dbCpu;
+
+    QString szName = QMetaEnum::fromType<CParameter::emRelay>()
+                         .valueToKey((int)relay);
+    printf("%-8s %lld MiB; %.1f ms; %.1f MiB/s; CPU: %.1f ms, %.2f ms/MiB",
+           szName.toStdString().c_str(), nRead.load() >> 20, nElapsed / 1e6,
+           nRead.load() * 1e9 / nElapsed / (1 << 20), dbCpu * 1e3,
+           dbCpu * 1e3 * (1 << 20) / qMax<qint64>(nRead.load(), 1));
+    if(r)
+        printf("; sessions: %d", r->GetStatistics().nSessions);
+    printf("\n");
+
+    if(r)
+        r->Stop();
+    delete pClient;
+    delete pPeer;
+    ::close(writer);
+    ::close(reader);
+    return nRead < nBytes ? -1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    args.removeFirst();
+    qint64 nMiB = DEFAULT_MIB;
+    int nIndex = args.indexOf("-m");
+    if(nIndex >= 0 && nIndex + 1 < args.size())
+    {
+        nMiB = args[nIndex + 1].toLongLong();
+        args.erase(args.begin() + nIndex, args.begin() + nIndex + 2);
+    }
+    if(args.isEmpty())
+        args << "Qt" << "Epoll" << "IoUring" << "Splice";
+
+    int nRet = 0;
+    QMetaEnum e = QMetaEnum::fromType<CParameter::emRelay>();
+    foreach(auto a, args)
+    {
+        bool ok = false;
+        int relay = e.keyToValue(a.toStdString().c_str(), &ok);
+        if(!ok)
+        {
+            fprintf(stderr, "Usage: %s [Qt|Epoll|IoUring|Splice|Sockmap ...]"
+                            " [-m MiB]\n", argv[0]);
+            return -1;
+        }
+        if(Bench((CParameter::emRelay)relay, nMiB << 20))
+        {
+            fprintf(stderr, "%s fail\n", a.toStdString().c_str());
+            nRet = -1;
+        }
+    }
+    return nRet;
+}
@@ -0,0 +1,260 @@
+//! @author Kang Lin <kl222@126.com>
+
+/*!
+ * \brief The packet rate of CUdpRelay on the loopback.
+ *        The client sends the datagrams with the socks5 UDP header to the
+ *        relay, the relay sends them to the echo socket, and the echo socket
+ *        sends them back through the relay. A window limits the datagrams in
+ *        flight, so the rate isn't the drops of the socket buffers.
+ *
+ *        Usage: BenchUdpRelay [payload bytes] [seconds] [window]
+ */
+
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QtEndian>
+#include "UdpRelay.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+// The default bytes of the payload of a datagram
+#define DEFAULT_PAYLOAD 64
+// The default time of the benchmark (seconds)
+#define DEFAULT_SECONDS 5
+// The default datagrams in flight
+#define DEFAULT_WINDOW 256
+// The datagrams which are received in a call of the client and the echo
+#define BATCH 64
+
+static int OpenSocket(sockaddr_in& addr)
+{
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if(-1 == fd)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t nLen = sizeof(addr);
+    if(::bind(fd, (sockaddr*)&addr, sizeof(addr))
+        || ::getsockname(fd, (sockaddr*)&addr, &nLen))
+    {
+        ::close(fd);
+        return -1;
+    }
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int nBuffer = 1 << 20;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &nBuffer, sizeof(nBuffer));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &nBuffer, sizeof(nBuffer));
+    return fd;
+}
+
+class CBenchUdpRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    CBenchUdpRelay(int nPayload, int nWindow)
+        : m_nPayload(nPayload),
+          m_nWindow(nWindow),
+          m_Client(-1),
+          m_Echo(-1),
+          m_nSent(0),
+          m_nReceived(0),
+          m_nLast(0),
+          m_bStop(false)
+    {}
+    virtual ~CBenchUdpRelay()
+    {
+        m_Relay.Close();
+        if(-1 != m_Client)
+            ::close(m_Client);
+        if(-1 != m_Echo)
+            ::close(m_Echo);
+    }
+
+    int Start(int nTimeout)
+    {
+        sockaddr_in client, echo;
+        m_Client = OpenSocket(client);
+        m_Echo = OpenSocket(echo);
+        if(-1 == m_Client || -1 == m_Echo)
+        {
+            perror("Open the socket fail");
+            return -1;
+        }
+        if(m_Relay.Open(QHostAddress(QHostAddress::LocalHost),
+                        QHostAddress(QHostAddress::LocalHost),
+                        qFromBigEndian(client.sin_port), nTimeout))
+        {
+            fprintf(stderr, "Open the relay fail\n");
+            return -1;
+        }
+        memset(&m_To, 0, sizeof(m_To));
+        m_To.sin_family = AF_INET;
+        m_To.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        m_To.sin_port = qToBigEndian(m_Relay.LocalPort());
+
+        // The socks5 UDP header to the echo socket, and the payload
+        m_Datagram = QByteArray(CUdpRelay::MAX_HEADER + m_nPayload, 'a');
+        int nHeader = CUdpRelay::BuildHeader(
+            m_Datagram.data(),
+            CUdpRelay::ToEndpoint(QHostAddress(QHostAddress::LocalHost),
+                                  qFromBigEndian(echo.sin_port)));
+        m_Datagram.resize(nHeader + m_nPayload);
+
+        QSocketNotifier* pEcho = new QSocketNotifier(
+            m_Echo, QSocketNotifier::Read, this);
+        QSocketNotifier* pClient = new QSocketNotifier(
+            m_Client, QSocketNotifier::Read, this);
+        // The signal is overloaded in Qt 5.15
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+        bool check = connect(pEcho, &QSocketNotifier::activated,
+                             this, &CBenchUdpRelay::slotEcho);
+        Q_ASSERT(check);
+        check = connect(pClient, &QSocketNotifier::activated,
+                        this, &CBenchUdpRelay::slotClient);
+#else
+        bool check = connect(pEcho, SIGNAL(activated(int)),
+                             this, SLOT(slotEcho()));
+        Q_ASSERT(check);
+        check = connect(pClient, SIGNAL(activated(int)),
+                        this, SLOT(slotClient()));
+#endif
+        Q_ASSERT(check);
+        // The datagrams which are dropped are sent again after the window drains
+        check = connect(&m_Resend, &QTimer::timeout,
+                        this, &CBenchUdpRelay::slotResend);
+        Q_ASSERT(check);
+        m_Resend.start(100);
+
+        m_Timer.start();
+        Send();
+        return 0;
+    }
+
+    void Stop()
+    {
+        m_bStop = true;
+        m_nElapsed = qMax<qint64>(m_Timer.nsecsElapsed(), 1);
+    }
+
+    void Report()
+    {
+        // A round trip passes the relay twice
+        CUdpRelay::strStatistics st = CUdpRelay::GetStatistics();
+        printf("Payload: %d bytes; window: %d; time: %lld ms\n",
+               m_nPayload, m_nWindow, m_nElapsed / 1000000);
+        printf("Round trips: %llu; %.0f round trips/s;"
+               " %.0f relayed packets/s; %.2f Mbit/s\n",
+               (unsigned long long)m_nReceived,
+               m_nReceived * 1e9 / m_nElapsed,
+               st.nPackets * 1e9 / m_nElapsed,
+               st.nBytes * 8 * 1e3 / m_nElapsed);
+        printf("Relayed packets: %llu; calls: %llu; packets per call: %.2f;"
+               " dropped: %llu; GRO: %llu; GSO: %llu\n",
+               (unsigned long long)st.nPackets, (unsigned long long)st.nCalls,
+               st.nCalls ? (double)st.nPackets / st.nCalls : 0.0,
+               (unsigned long long)st.nDropped, (unsigned long long)st.nGro,
+               (unsigned long long)st.nGso);
+    }
+
+private Q_SLOTS:
+    //! Send the datagrams back to the relay
+    void slotEcho()
+    {
+        char buf[2048];
+        sockaddr_storage from;
+        for(int i = 0; i < BATCH; i++)
+        {
+            socklen_t nFrom = sizeof(from);
+            ssize_t n = ::recvfrom(m_Echo, buf, sizeof(buf), 0,
+                                   (sockaddr*)&from, &nFrom);
+            if(n < 0)
+                break;
+            ::sendto(m_Echo, buf, n, 0, (sockaddr*)&from, nFrom);
+        }
+    }
+
+    void slotClient()
+    {
+        char buf[2048];
+        for(int i = 0; i < BATCH; i++)
+        {
+            if(::recv(m_Client, buf, sizeof(buf), 0) < 0)
+                break;
+            m_nReceived++;
+        }
+        Send();
+    }
+
+    void slotResend()
+    {
+        if(m_nLast == m_nReceived)
+            m_nSent = m_nReceived;
+        m_nLast = m_nReceived;
+        Send();
+    }
+
+private:
+    void Send()
+    {
+        while(!m_bStop && m_nSent < m_nReceived + m_nWindow)
+        {
+            if(::sendto(m_Client, m_Datagram.constData(), m_Datagram.size(),
+                        0, (sockaddr*)&m_To, sizeof(m_To)) < 0)
+                break;
+            m_nSent++;
+        }
+    }
+
+    int m_nPayload;
+    int m_nWindow;
+    CUdpRelay m_Relay;
+    int m_Client;
+    int m_Echo;
+    sockaddr_in m_To;
+    QByteArray m_Datagram;
+    quint64 m_nSent;
+    quint64 m_nReceived;
+    quint64 m_nLast; // The received datagrams when it is checked last
+    bool m_bStop;
+    QTimer m_Resend;
+    QElapsedTimer m_Timer;
+    qint64 m_nElapsed = 1;
+};
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    int nPayload = argc > 1 ? atoi(argv[1]) : DEFAULT_PAYLOAD;
+    int nSeconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+    int nWindow = argc > 3 ? atoi(argv[3]) : DEFAULT_WINDOW;
+    if(nPayload <= 0 || nPayload > 1400 || nSeconds <= 0 || nWindow <= 0)
+    {
+        fprintf(stderr, "Usage: %s [payload bytes] [seconds] [window]\n",
+                argv[0]);
+        return -1;
+    }
+
+    CBenchUdpRelay bench(nPayload, nWindow);
+    if(bench.Start(nSeconds * 2000))
+        return -1;
+    QTimer::singleShot(nSeconds * 1000, &app, [&]() {
+        bench.Stop();
+        app.quit();
+    });
+    app.exec();
+    bench.Report();
+    return 0;
+}
+
+#include "BenchUdpRelay.moc"
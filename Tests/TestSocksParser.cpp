@@ -0,0 +1,339 @@
+//! @author Kang Lin <kl222@126.com>
+
+#include <cstring>
+#include <QtTest>
+#include <QRandomGenerator>
+#include <QElapsedTimer>
+#include "SocksParser.h"
+
+// The seed of the random data, so a failure can be repeated
+#define RANDOM_SEED 20211017
+// The times which every message is split randomly
+#define SPLIT_TIMES 1000
+// The times which the random bytes are parsed
+#define GARBAGE_TIMES 10000
+// The handshakes of the benchmark
+#define BENCH_HANDSHAKES 200000
+
+Q_DECLARE_METATYPE(CSocksParser::emMessage)
+
+/*!
+ * \brief The tests of CSocksParser.
+ *        The messages are split at random places and parsed, the result must
+ *        be the same as the whole message. The random bytes mustn't make the
+ *        parser read out of the buffer, and the bytes after the message
+ *        mustn't be used.
+ */
+class CTestSocksParser : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testWhole_data();
+    void testWhole();
+    void testRandomSplit_data();
+    void testRandomSplit();
+    void testTrailing_data();
+    void testTrailing();
+    void testErrors();
+    void testGarbage();
+    void benchHandshake();
+
+private:
+    void AddMessages();
+    //! The fields of the message which is parsed
+    QByteArray Fields(const CSocksParser& parser);
+};
+
+static QByteArray Bytes(std::initializer_list<int> bytes)
+{
+    QByteArray d;
+    for(int b : bytes)
+        d.append(static_cast<char>(b));
+    return d;
+}
+
+void CTestSocksParser::AddMessages()
+{
+    QTest::addColumn<CSocksParser::emMessage>("message");
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<QByteArray>("fields");
+
+    QTest::newRow("Greeting")
+        << CSocksParser::emMessage::Greeting
+        << Bytes({0x02, 0x00, 0x02})
+        << QByteArray("methods:0,2");
+    QTest::newRow("Authentication")
+        << CSocksParser::emMessage::Authentication
+        << Bytes({0x01, 0x04}) + "user" + Bytes({0x06}) + "passwd"
+        << QByteArray("user:user;password:passwd");
+    QTest::newRow("Request5 IPv4")
+        << CSocksParser::emMessage::Request5
+        << Bytes({0x05, 0x01, 0x00, 0x01, 0xC0, 0xA8, 0x01, 0x02, 0x1F, 0x90})
+        << QByteArray("command:1;type:1;ipv4:c0a80102;port:8080");
+    QTest::newRow("Request5 domain")
+        << CSocksParser::emMessage::Request5
+        << Bytes({0x05, 0x01, 0x00, 0x03, 0x0B}) + "example.com"
+               + Bytes({0x01, 0xBB})
+        << QByteArray("command:1;type:3;domain:example.com;port:443");
+    QTest::newRow("Request5 IPv6")
+        << CSocksParser::emMessage::Request5
+        << Bytes({0x05, 0x03, 0x00, 0x04,
+                  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                  0x00, 0x50})
+        << QByteArray("command:3;type:4;"
+                      "ipv6:000102030405060708090a0b0c0d0e0f;port:80");
+    QTest::newRow("Request4")
+        << CSocksParser::emMessage::Request4
+        << Bytes({0x01, 0x00, 0x50, 0x0A, 0x00, 0x00, 0x01}) + "id"
+               + Bytes({0x00})
+        << QByteArray("command:1;type:1;ipv4:0a000001;port:80;user:id");
+    QTest::newRow("Request4a")
+        << CSocksParser::emMessage::Request4
+        << Bytes({0x01, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01}) + "id"
+               + Bytes({0x00}) + "example.com" + Bytes({0x00})
+        << QByteArray("command:1;type:3;domain:example.com;port:80;user:id");
+}
+
+QByteArray CTestSocksParser::Fields(const CSocksParser &parser)
+{
+    QByteArray f;
+    switch(parser.Message()) {
+    case CSocksParser::emMessage::Greeting:
+    {
+        QStringList methods;
+        for(int i = 0; i < parser.MethodCount(); i++)
+            methods << QString::number(parser.Methods()[i]);
+        f = "methods:" + methods.join(",").toLatin1();
+        break;
+    }
+    case CSocksParser::emMessage::Authentication:
+        f = "user:" + QByteArray(parser.User(), parser.UserLength())
+            + ";password:"
+            + QByteArray(parser.Password(), parser.PasswordLength());
+        break;
+    case CSocksParser::emMessage::Request5:
+    case CSocksParser::emMessage::Request4:
+        f = "command:" + QByteArray::number(parser.Command())
+            + ";type:" + QByteArray::number(parser.AddressType());
+        switch(parser.AddressType()) {
+        case CSocksParser::AddressTypeIpv4:
+            f += ";ipv4:" + QByteArray::number(parser.Ipv4(), 16)
+                                .rightJustified(8, '0');
+            break;
+        case CSocksParser::AddressTypeIpv6:
+            f += ";ipv6:" + QByteArray(
+                     reinterpret_cast<const char*>(parser.Ipv6()), 16).toHex();
+            break;
+        case CSocksParser::AddressTypeDomain:
+            f += ";domain:"
+                 + QByteArray(parser.Domain(), parser.DomainLength());
+            break;
+        }
+        f += ";port:" + QByteArray::number(parser.Port());
+        if(CSocksParser::emMessage::Request4 == parser.Message())
+            f += ";user:" + QByteArray(parser.User(), parser.UserLength());
+        break;
+    default:
+        break;
+    }
+    return f;
+}
+
+void CTestSocksParser::testWhole_data()
+{
+    AddMessages();
+}
+
+void CTestSocksParser::testWhole()
+{
+    QFETCH(CSocksParser::emMessage, message);
+    QFETCH(QByteArray, data);
+    QFETCH(QByteArray, fields);
+
+    CSocksParser parser;
+    parser.Start(message);
+    QCOMPARE(parser.Feed(data.constData(), data.size()), int(data.size()));
+    QCOMPARE(parser.Result(), CSocksParser::Complete);
+    QCOMPARE(parser.Length(), int(data.size()));
+    QCOMPARE(parser.Need(), 0);
+    QCOMPARE(Fields(parser), fields);
+}
+
+void CTestSocksParser::testRandomSplit_data()
+{
+    AddMessages();
+}
+
+void CTestSocksParser::testRandomSplit()
+{
+    QFETCH(CSocksParser::emMessage, message);
+    QFETCH(QByteArray, data);
+    QFETCH(QByteArray, fields);
+
+    QRandomGenerator random(RANDOM_SEED);
+    CSocksParser parser;
+    for(int t = 0; t < SPLIT_TIMES; t++)
+    {
+        parser.Start(message);
+        int nPos = 0;
+        // Read as the server does: no more than Need() every time
+        while(parser.Need() > 0)
+        {
+            QVERIFY(nPos < data.size());
+            int n = random.bounded(1, parser.Need() + 1);
+            n = qMin(n, int(data.size()) - nPos);
+            memcpy(parser.Tail(), data.constData() + nPos, n);
+            nPos += n;
+            parser.Commit(n);
+        }
+        QCOMPARE(nPos, int(data.size()));
+        QCOMPARE(parser.Result(), CSocksParser::Complete);
+        QCOMPARE(Fields(parser), fields);
+    }
+}
+
+void CTestSocksParser::testTrailing_data()
+{
+    AddMessages();
+}
+
+void CTestSocksParser::testTrailing()
+{
+    QFETCH(CSocksParser::emMessage, message);
+    QFETCH(QByteArray, data);
+    QFETCH(QByteArray, fields);
+
+    // The bytes after the message are the data of the client,
+    // they mustn't be used by the parser
+    QByteArray trailing = data + Bytes({0x00, 0x05, 0xFF}) + "GET / HTTP/1.1";
+    QRandomGenerator random(RANDOM_SEED);
+    CSocksParser parser;
+    for(int t = 0; t < SPLIT_TIMES; t++)
+    {
+        parser.Start(message);
+        int nPos = 0;
+        while(nPos < trailing.size() && parser.Need() > 0)
+        {
+            int n = random.bounded(1, int(trailing.size()) - nPos + 1);
+            nPos += parser.Feed(trailing.constData() + nPos, n);
+        }
+        QCOMPARE(nPos, int(data.size()));
+        QCOMPARE(parser.Result(), CSocksParser::Complete);
+        QCOMPARE(parser.Length(), int(data.size()));
+        QCOMPARE(Fields(parser), fields);
+    }
+}
+
+void CTestSocksParser::testErrors()
+{
+    CSocksParser parser;
+
+    QByteArray auth = Bytes({0x02, 0x04}) + "user" + Bytes({0x00});
+    parser.Start(CSocksParser::emMessage::Authentication);
+    parser.Feed(auth.constData(), auth.size());
+    QCOMPARE(parser.Result(), CSocksParser::Error);
+    QCOMPARE(parser.GetError(), CSocksParser::emError::Version);
+    QCOMPARE(parser.Need(), 0);
+
+    QByteArray version = Bytes({0x04, 0x01, 0x00, 0x01, 0, 0, 0, 0, 0, 0});
+    parser.Start(CSocksParser::emMessage::Request5);
+    parser.Feed(version.constData(), version.size());
+    QCOMPARE(parser.Result(), CSocksParser::Error);
+    QCOMPARE(parser.GetError(), CSocksParser::emError::Version);
+
+    QByteArray type = Bytes({0x05, 0x01, 0x00, 0x02, 0, 0, 0, 0, 0, 0});
+    parser.Start(CSocksParser::emMessage::Request5);
+    QCOMPARE(parser.Feed(type.constData(), type.size()), 5);
+    QCOMPARE(parser.Result(), CSocksParser::Error);
+    QCOMPARE(parser.GetError(), CSocksParser::emError::AddressType);
+
+    // The user id which isn't terminated
+    QByteArray overflow = Bytes({0x01, 0x00, 0x50, 0x0A, 0x00, 0x00, 0x01})
+                          + QByteArray(2 * CSocksParser::BUFFER_SIZE, 'a');
+    parser.Start(CSocksParser::emMessage::Request4);
+    int nUsed = parser.Feed(overflow.constData(), overflow.size());
+    QVERIFY(nUsed <= CSocksParser::BUFFER_SIZE);
+    QCOMPARE(parser.Result(), CSocksParser::Error);
+    QCOMPARE(parser.GetError(), CSocksParser::emError::Overflow);
+    QCOMPARE(parser.Need(), 0);
+}
+
+void CTestSocksParser::testGarbage()
+{
+    const CSocksParser::emMessage messages[] = {
+        CSocksParser::emMessage::Greeting,
+        CSocksParser::emMessage::Authentication,
+        CSocksParser::emMessage::Request5,
+        CSocksParser::emMessage::Request4
+    };
+    QRandomGenerator random(RANDOM_SEED);
+    QByteArray data(2 * CSocksParser::BUFFER_SIZE, 0);
+    CSocksParser parser;
+    for(int t = 0; t < GARBAGE_TIMES; t++)
+    {
+        int nLen = random.bounded(1, int(data.size()) + 1);
+        for(int i = 0; i < nLen; i++)
+            data[i] = static_cast<char>(random.bounded(256));
+        parser.Start(messages[t % 4]);
+        int nPos = 0;
+        while(nPos < nLen && parser.Need() > 0)
+        {
+            int nNeed = parser.Need();
+            QVERIFY(parser.Length() + nNeed <= CSocksParser::BUFFER_SIZE);
+            int n = random.bounded(1, nLen - nPos + 1);
+            int nUsed = parser.Feed(data.constData() + nPos, n);
+            QVERIFY(nUsed > 0 && nUsed <= n);
+            nPos += nUsed;
+        }
+        QCOMPARE(parser.Length(), nPos);
+        switch(parser.Result()) {
+        case CSocksParser::Incomplete:
+            QCOMPARE(nPos, nLen);
+            QVERIFY(parser.Need() > 0);
+            break;
+        case CSocksParser::Complete:
+            QCOMPARE(parser.Need(), 0);
+            // The fields are in the bytes which are parsed
+            Fields(parser);
+            break;
+        case CSocksParser::Error:
+            QCOMPARE(parser.Need(), 0);
+            QVERIFY(CSocksParser::emError::None != parser.GetError());
+            break;
+        }
+    }
+}
+
+void CTestSocksParser::benchHandshake()
+{
+    // The messages which the socks5 server parses in a handshake
+    QByteArray greeting = Bytes({0x02, 0x00, 0x02});
+    QByteArray auth = Bytes({0x01, 0x04}) + "user" + Bytes({0x06}) + "passwd";
+    QByteArray request = Bytes({0x05, 0x01, 0x00, 0x03, 0x0B}) + "example.com"
+                         + Bytes({0x01, 0xBB});
+    CSocksParser parser;
+    int nComplete = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0; i < BENCH_HANDSHAKES; i++)
+    {
+        parser.Start(CSocksParser::emMessage::Greeting);
+        parser.Feed(greeting.constData(), greeting.size());
+        parser.Start(CSocksParser::emMessage::Authentication);
+        parser.Feed(auth.constData(), auth.size());
+        parser.Start(CSocksParser::emMessage::Request5);
+        parser.Feed(request.constData(), request.size());
+        if(CSocksParser::Complete == parser.Result())
+            nComplete++;
+    }
+    qint64 nElapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+    QCOMPARE(nComplete, BENCH_HANDSHAKES);
+    qInfo("Handshakes: %d; time: %lld us; %.0f handshakes/s",
+          BENCH_HANDSHAKES, nElapsed / 1000,
+          BENCH_HANDSHAKES * 1e9 / nElapsed);
+}
+
+QTEST_APPLESS_MAIN(CTestSocksParser)
+
+#include "TestSocksParser.moc"